@@ -21,6 +21,8 @@ enum action
 	ACTION_DIFF,
 	ACTION_DIFF_LONG,
 	ACTION_MONITOR,
+	ACTION_SCRUB,
+	ACTION_CHANGE_JOURNAL,
 };
 
 #endif
@@ -21,9 +21,15 @@
 #include <ncurses/ncurses.h>
 #endif
 
+// Large frame leads are the command with its top bit set, followed by the
+// length in four bytes, most significant first. Commands are plain ASCII,
+// so these cannot be mistaken for the usual '%c%04X' leads.
+#define LARGE_FRAME_BIT	0x80
+
 static void truncate_readbuf(struct asfd *asfd)
 {
 	asfd->readbuf[0]='\0';
+	asfd->readbufstart=0;
 	asfd->readbuflen=0;
 }
 
@@ -34,9 +40,36 @@ static int asfd_alloc_buf(struct asfd *asfd, char **buf)
 	return 0;
 }
 
+// Frames that have been parsed are not moved out of the way one at a time.
+// Whatever is left over is moved to the start of the read buffer once,
+// before reading more into it.
+static void make_space_in_readbuf(struct asfd *asfd)
+{
+	// A view into the read buffer is still in use.
+	if(asfd->rbuf_view_saved)
+		return;
+	if(!asfd->readbufstart)
+		return;
+	if(asfd->readbuflen)
+		memmove(asfd->readbuf, asfd->readbuf+asfd->readbufstart,
+			asfd->readbuflen);
+	asfd->readbufstart=0;
+}
+
+static void consume_readbuf(struct asfd *asfd, size_t len)
+{
+	asfd->readbuflen-=len;
+	if(asfd->readbuflen)
+		asfd->readbufstart+=len;
+	else if(!asfd->rbuf_view_saved)
+		asfd->readbufstart=0;
+}
+
 static int extract_buf(struct asfd *asfd,
 	size_t len, size_t offset)
 {
+	char *src=asfd->readbuf+asfd->readbufstart+offset;
+
 	if(offset+len>=asfd->bufmaxsize)
 	{
 		logp("%s: offset(%lu)+len(%lu)>=asfd->bufmaxsize(%lu) in %s!",
@@ -48,25 +81,43 @@ static int extract_buf(struct asfd *asfd,
 		return -1;
 	}
 
-	if(!(asfd->rbuf->buf=(char *)malloc_w(len+1, __func__)))
-		return -1;
-	if(!(memcpy(asfd->rbuf->buf, asfd->readbuf+offset, len)))
+	if(asfd->rbuf_views
+	  && asfd->rbuf->cmd==asfd->rbuf_view_cmd
+	  && asfd->readbufstart+offset+len<asfd->bufmaxsize)
 	{
-		logp("%s: memcpy failed in %s\n", asfd->desc, __func__);
-		return -1;
+		// Point straight into the read buffer. The byte after the
+		// frame, which might be the start of the next one, is kept
+		// so that the view can be terminated like a copy would be.
+		asfd->rbuf->buf=src;
+		asfd->rbuf_view_saved=1;
+		asfd->rbuf_view_byte=src[len];
 	}
-	asfd->rbuf->buf[len]='\0';
-	if(!(memmove(asfd->readbuf,
-		asfd->readbuf+len+offset, asfd->readbuflen-len-offset)))
+	else
 	{
-		logp("%s: memmove failed in %s\n", asfd->desc, __func__);
-		return -1;
+		if(!(asfd->rbuf->buf=(char *)malloc_w(len+1, __func__)))
+			return -1;
+		memcpy(asfd->rbuf->buf, src, len);
 	}
-	asfd->readbuflen-=len+offset;
+	asfd->rbuf->buf[len]='\0';
 	asfd->rbuf->len=len;
+	consume_readbuf(asfd, len+offset);
 	return 0;
 }
 
+void asfd_free_rbuf(struct asfd *asfd)
+{
+	if(!asfd->rbuf_view_saved)
+	{
+		iobuf_free_content(asfd->rbuf);
+		return;
+	}
+	asfd->rbuf->buf[asfd->rbuf->len]=asfd->rbuf_view_byte;
+	asfd->rbuf_view_saved=0;
+	iobuf_init(asfd->rbuf);
+	if(!asfd->readbuflen)
+		asfd->readbufstart=0;
+}
+
 #ifdef HAVE_NCURSES
 static int parse_readbuf_ncurses(struct asfd *asfd)
 {
@@ -80,17 +131,11 @@ static int parse_readbuf_ncurses(struct asfd *asfd)
 
 static int parse_readbuf_line_buf(struct asfd *asfd)
 {
-	static char *cp=NULL;
-	static char *dp=NULL;
-	static size_t len=0;
-	if(!cp)
-	{
-		// Only start from the beginning if we previously got something
-		// to extract.
-		cp=asfd->readbuf;
-		len=0;
-	}
-	for(; len<asfd->readbuflen; cp++, len++)
+	char *cp;
+	char *dp;
+	size_t len;
+	cp=asfd->readbuf+asfd->readbufstart;
+	for(len=0; len<asfd->readbuflen; cp++, len++)
 	{
 		if(*cp!='\n') continue;
 		len++;
@@ -102,31 +147,67 @@ static int parse_readbuf_line_buf(struct asfd *asfd)
 		asfd->rbuf->len=len;
 		break;
 	}
-	cp=NULL;
 	return 0;
 }
 
+static void parse_large_lead(const char *buf, enum cmd *cmd, size_t *len)
+{
+	const uint8_t *u=(const uint8_t *)buf;
+	*cmd=(enum cmd)(u[0]&~LARGE_FRAME_BIT);
+	*len=((size_t)u[1]<<24)
+		| ((size_t)u[2]<<16)
+		| ((size_t)u[3]<<8)
+		| (size_t)u[4];
+}
+
+static void make_large_lead(char *buf, enum cmd cmd, size_t len)
+{
+	uint8_t *u=(uint8_t *)buf;
+	u[0]=(uint8_t)cmd|LARGE_FRAME_BIT;
+	u[1]=(uint8_t)(len>>24);
+	u[2]=(uint8_t)(len>>16);
+	u[3]=(uint8_t)(len>>8);
+	u[4]=(uint8_t)len;
+}
+
 static int parse_readbuf_standard(struct asfd *asfd)
 {
-	unsigned int s=0;
-	char command;
+	size_t s=0;
+	enum cmd command;
+	const char *buf=asfd->readbuf+asfd->readbufstart;
 	if(asfd->readbuflen<5) return 0;
-	if((sscanf(asfd->readbuf, "%c%04X", &command, &s))!=2)
+	if((uint8_t)*buf & LARGE_FRAME_BIT)
+	{
+		if(!asfd->large_frames)
+		{
+			logp("%s: got a large frame without agreeing to them in %s\n",
+				asfd->desc, __func__);
+			return -1;
+		}
+		parse_large_lead(buf, &command, &s);
+	}
+	else if(iobuf_parse_lead(buf, &command, &s))
+	{
+		logp("%s: could not parse lead '%.5s' in %s\n",
+			asfd->desc, buf, __func__);
+		return -1;
+	}
+	if(!command)
 	{
-		logp("%s: sscanf of '%s' failed in %s\n",
-			asfd->desc, asfd->readbuf, __func__);
+		logp("%s: got a frame with no command in %s\n",
+			asfd->desc, __func__);
 		return -1;
 	}
 	if(s>=asfd->bufmaxsize)
 	{
-		logp("%s: given buffer length '%d', which is too big!\n",
-			asfd->desc, s);
+		logp("%s: given buffer length '%lu', which is too big!\n",
+			asfd->desc, (unsigned long)s);
 		return -1;
 	}
 	if(asfd->readbuflen>=s+5)
 	{
-		asfd->rbuf->cmd=(enum cmd)command;
-		if(extract_buf(asfd, (size_t)s, 5))
+		asfd->rbuf->cmd=command;
+		if(extract_buf(asfd, s, 5))
 			return -1;
 	}
 	return 0;
@@ -150,6 +231,7 @@ static int asfd_do_read_ncurses(struct asfd *asfd)
 {
 	static int i;
 	i=getch();
+	asfd->readbufstart=0;
 	asfd->readbuflen=sizeof(int);
 	memcpy(asfd->readbuf, &i, asfd->readbuflen);
 	return 0;
@@ -165,8 +247,10 @@ static int asfd_do_write_ncurses(__attribute__ ((unused)) struct asfd *asfd)
 static int asfd_do_read(struct asfd *asfd)
 {
 	ssize_t r;
-	r=read(asfd->fd,
-	  asfd->readbuf+asfd->readbuflen, asfd->bufmaxsize-asfd->readbuflen);
+	size_t end;
+	make_space_in_readbuf(asfd);
+	end=asfd->readbufstart+asfd->readbuflen;
+	r=read(asfd->fd, asfd->readbuf+end, asfd->bufmaxsize-end);
 	if(r<0)
 	{
 		if(errno==EAGAIN || errno==EINTR)
@@ -199,14 +283,17 @@ static int asfd_do_read_ssl(struct asfd *asfd)
 {
 	int e;
 	ssize_t r;
+	size_t end;
 
 	asfd->read_blocked_on_write=0;
 
+	make_space_in_readbuf(asfd);
+	end=asfd->readbufstart+asfd->readbuflen;
 	ERR_clear_error();
 	r=SSL_read(
 		asfd->ssl,
-		asfd->readbuf+asfd->readbuflen,
-		asfd->bufmaxsize-asfd->readbuflen
+		asfd->readbuf+end,
+		asfd->bufmaxsize-end
 	);
 
 	switch((e=SSL_get_error(asfd->ssl, r)))
@@ -305,6 +392,7 @@ static int asfd_do_write(struct asfd *asfd)
 	}
 	if(asfd->ratelimit) asfd->rlbytes+=w;
 	asfd->sent+=w;
+	asfd->writes++;
 /*
 {
 char buf[100000]="";
@@ -315,6 +403,8 @@ printf("wrote %d: %s\n", w, buf);
 
 	memmove(asfd->writebuf, asfd->writebuf+w, asfd->writebuflen-w);
 	asfd->writebuflen-=w;
+	if(!asfd->writebuflen)
+		asfd->write_batch_flush=0;
 	return 0;
 }
 
@@ -344,6 +434,9 @@ printf("wrote %d: %s\n", w, buf);
 				asfd->writebuf+w, asfd->writebuflen-w);
 			asfd->writebuflen-=w;
 			asfd->sent+=w;
+			asfd->writes++;
+			if(!asfd->writebuflen)
+				asfd->write_batch_flush=0;
 			break;
 		case SSL_ERROR_WANT_WRITE:
 			break;
@@ -377,7 +470,7 @@ static int append_to_write_buffer(struct asfd *asfd,
 	return 0;
 }
 
-static enum append_ret asfd_append_all_to_write_buffer(struct asfd *asfd,
+static enum append_ret append_frame(struct asfd *asfd,
 	struct iobuf *wbuf)
 {
 	switch(asfd->streamtype)
@@ -389,9 +482,20 @@ static enum append_ret asfd_append_all_to_write_buffer(struct asfd *asfd,
 			if(asfd->writebuflen+6+(wbuf->len)>=asfd->bufmaxsize-1)
 				return APPEND_BLOCKED;
 
-			snprintf(sbuf, sizeof(sbuf), "%c%04X",
-				wbuf->cmd, (unsigned int)wbuf->len);
-			sblen=strlen(sbuf);
+			// File data, and anything too long for four hex
+			// digits, gets a binary lead if the peer agreed.
+			if(asfd->large_frames
+			  && (wbuf->cmd==CMD_APPEND || wbuf->len>0xFFFF))
+			{
+				make_large_lead(sbuf, wbuf->cmd, wbuf->len);
+				sblen=5;
+			}
+			else
+			{
+				snprintf(sbuf, sizeof(sbuf), "%c%04X",
+					wbuf->cmd, (unsigned int)wbuf->len);
+				sblen=strlen(sbuf);
+			}
 			append_to_write_buffer(asfd, sbuf, sblen);
 			break;
 		}
@@ -411,6 +515,59 @@ static enum append_ret asfd_append_all_to_write_buffer(struct asfd *asfd,
 	return APPEND_OK;
 }
 
+static enum append_ret asfd_append_all_to_write_buffer(struct asfd *asfd,
+	struct iobuf *wbuf)
+{
+	enum append_ret ret;
+	size_t before=asfd->writebuflen;
+	if((ret=append_frame(asfd, wbuf))==APPEND_OK)
+	{
+		asfd->frames++;
+		if(!before && asfd->write_batch_bytes)
+			gettimeofday(&asfd->write_batch_start, NULL);
+	}
+	else if(ret==APPEND_BLOCKED)
+	{
+		// Holding on would never make room.
+		asfd->write_batch_flush=1;
+	}
+	return ret;
+}
+
+int asfd_write_held(struct asfd *asfd, struct timeval *tval)
+{
+	long waited;
+	long left;
+	struct timeval now;
+
+	if(!asfd->write_batch_bytes
+	  || asfd->write_batch_flush
+	  || !asfd->writebuflen
+	  || asfd->writebuflen>=asfd->write_batch_bytes)
+		return 0;
+	gettimeofday(&now, NULL);
+	waited=(now.tv_sec-asfd->write_batch_start.tv_sec)*1000000
+		+(now.tv_usec-asfd->write_batch_start.tv_usec);
+	if(waited<0 || waited>=asfd->write_batch_usec)
+		return 0;
+	left=asfd->write_batch_usec-waited;
+	if(tval->tv_sec*1000000+tval->tv_usec>left)
+	{
+		tval->tv_sec=left/1000000;
+		tval->tv_usec=left%1000000;
+	}
+	return 1;
+}
+
+void asfd_log_write_stats(struct asfd *asfd)
+{
+	if(!asfd || !asfd->writes)
+		return;
+	logp("%s: %" PRIu64 " frames in %" PRIu64 " writes (%.1f per write)\n",
+		asfd->desc, asfd->frames, asfd->writes,
+		(double)asfd->frames/asfd->writes);
+}
+
 #ifdef IPTOS_THROUGHPUT
 static int asfd_connection_af(struct asfd *asfd)
 {
@@ -454,6 +611,10 @@ static int asfd_set_bulk_packets(struct asfd *asfd)
 static int asfd_read(struct asfd *asfd)
 {
 	if(asfd->as->doing_estimate) return 0;
+	// Whatever was written might be what the peer is waiting for before
+	// it replies.
+	if(!asfd->rbuf->buf && asfd->writebuflen)
+		asfd->write_batch_flush=1;
 	while(!asfd->rbuf->buf)
 	{
 		if(asfd->errors)
@@ -464,6 +625,40 @@ static int asfd_read(struct asfd *asfd)
 	return 0;
 }
 
+int asfd_set_large_frames(struct asfd *asfd)
+{
+	char *readbuf;
+	char *writebuf;
+	size_t bufmaxsize=(ASYNC_LARGE_BUF_LEN*2)+32;
+
+	if(asfd->large_frames)
+		return 0;
+	if(asfd->streamtype!=ASFD_STREAM_STANDARD
+	  || asfd->rbuf_view_saved)
+	{
+		logp("%s: cannot switch to large frames in %s\n",
+			asfd->desc, __func__);
+		return -1;
+	}
+	// Anything already read or waiting to be written stays where it is.
+	if(!(readbuf=(char *)realloc_w(asfd->readbuf, bufmaxsize, __func__)))
+		return -1;
+	asfd->readbuf=readbuf;
+	if(!(writebuf=(char *)realloc_w(asfd->writebuf, bufmaxsize, __func__)))
+		return -1;
+	asfd->writebuf=writebuf;
+	asfd->bufmaxsize=bufmaxsize;
+	asfd->large_frames=1;
+	return 0;
+}
+
+size_t asfd_frame_len(struct asfd *asfd)
+{
+	if(asfd && asfd->large_frames)
+		return ASYNC_LARGE_BUF_LEN;
+	return ASYNC_BUF_LEN;
+}
+
 int asfd_read_expect(struct asfd *asfd, enum cmd cmd, const char *expect)
 {
 	int ret=0;
@@ -560,6 +755,12 @@ static void asfd_set_timeout(struct asfd *asfd, int max_network_timeout)
 	asfd->network_timeout=asfd->max_network_timeout;
 }
 
+static void asfd_set_write_batch(struct asfd *asfd, int bytes, int max_ms)
+{
+	asfd->write_batch_bytes=bytes>0?(size_t)bytes:0;
+	asfd->write_batch_usec=max_ms>0?(long)max_ms*1000:0;
+}
+
 static char *get_asfd_desc(const char *desc, int fd)
 {
 	char r[256]="";
@@ -590,6 +791,7 @@ static int asfd_init(struct asfd *asfd, const char *desc,
 	asfd->append_all_to_write_buffer=asfd_append_all_to_write_buffer;
 	asfd->set_bulk_packets=asfd_set_bulk_packets;
 	asfd->set_timeout=asfd_set_timeout;
+	asfd->set_write_batch=asfd_set_write_batch;
 	if(asfd->ssl)
 	{
 		asfd->do_read=asfd_do_read_ssl;
@@ -677,6 +879,8 @@ void asfd_close(struct asfd *asfd)
 static void asfd_free_content(struct asfd *asfd)
 {
 	asfd_close(asfd);
+	if(asfd->rbuf)
+		asfd_free_rbuf(asfd);
 	iobuf_free(&asfd->rbuf);
 	free_w(&asfd->readbuf);
 	free_w(&asfd->writebuf);
@@ -801,6 +1005,8 @@ static int read_and_write(struct asfd *asfd)
 
 int asfd_flush_asio(struct asfd *asfd)
 {
+	if(asfd)
+		asfd->write_batch_flush=1;
 	while(asfd && asfd->writebuflen>0)
 	{
 		if(asfd->errors)
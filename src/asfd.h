@@ -62,20 +62,40 @@ struct asfd
 	uint64_t rlbytes;
 
 	struct iobuf *rbuf;
+	// When rbuf_views is set, frames with rbuf_view_cmd are not copied.
+	// Instead, rbuf points into readbuf, and must be given back with
+	// asfd_free_rbuf() rather than freed or kept.
+	uint8_t rbuf_views;
+	enum cmd rbuf_view_cmd;
+	uint8_t rbuf_view_saved;
+	char rbuf_view_byte;
 
 	int attempt_reads;
 
 	int doread;
 	char *readbuf;
+	// Unparsed data starts this far into readbuf.
+	size_t readbufstart;
 	size_t readbuflen;
 	int read_blocked_on_write;
 	size_t bufmaxsize;
+	// Set once the peer has agreed to frames with binary headers and
+	// 32 bit lengths.
+	uint8_t large_frames;
 
 	int dowrite;
 	char *writebuf;
 	size_t writebuflen;
 	int write_blocked_on_read;
 
+	// While reading as well, frames are held in writebuf until there are
+	// write_batch_bytes of them, or the first has waited write_batch_usec.
+	size_t write_batch_bytes;
+	long write_batch_usec;
+	struct timeval write_batch_start;
+	// Set when something needs writebuf emptied now, rather than later.
+	uint8_t write_batch_flush;
+
 	int errors;
 
 	struct asfd *next;
@@ -100,6 +120,8 @@ struct asfd
 	// Counters
 	uint64_t sent;
 	uint64_t rcvd;
+	uint64_t frames;
+	uint64_t writes;
 
 	// Function pointers.
 	int (*parse_readbuf)(struct asfd *);
@@ -108,6 +130,7 @@ struct asfd
 		(*append_all_to_write_buffer)(struct asfd *, struct iobuf *);
 	int (*set_bulk_packets)(struct asfd *);
 	void (*set_timeout)(struct asfd *, int max_network_timeout);
+	void (*set_write_batch)(struct asfd *, int bytes, int max_ms);
 	int (*do_read)(struct asfd *);
 	int (*do_write)(struct asfd *);
 	int (*read)(struct asfd *);
@@ -145,6 +168,20 @@ extern int asfd_write_wrapper(struct asfd *asfd, struct iobuf *wbuf);
 extern int asfd_write_wrapper_str(struct asfd *asfd,
 	enum cmd wcmd, const char *wsrc);
 
+// Switches to large frames for file data, growing the buffers to suit.
+// Both ends must do this at the same point in the conversation.
+extern int asfd_set_large_frames(struct asfd *asfd);
+// The most file data that should be put in one frame on this asfd.
+extern size_t asfd_frame_len(struct asfd *asfd);
+
+// Whether the frames in writebuf should wait for more. If so, tval is
+// lowered to when they have waited long enough.
+extern int asfd_write_held(struct asfd *asfd, struct timeval *tval);
+extern void asfd_log_write_stats(struct asfd *asfd);
+
+// Frees rbuf, or gives it back to readbuf if it is a view into it.
+extern void asfd_free_rbuf(struct asfd *asfd);
+
 extern int asfd_read_expect(struct asfd *asfd,
 	enum cmd cmd, const char *expect);
 
@@ -4,6 +4,10 @@
 #define ASYNC_BUF_LEN	16000
 #define ZCHUNK		ASYNC_BUF_LEN
 
+// Frames of file data can be this big once both ends have agreed to large
+// frames in extra_comms.
+#define ASYNC_LARGE_BUF_LEN	(256*1024)
+
 struct async
 {
 	struct asfd *asfd;
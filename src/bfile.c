@@ -16,6 +16,8 @@ void bfile_free(struct BFILE **bfd)
 
 #ifdef HAVE_WIN32
 static ssize_t bfile_write_windows(struct BFILE *bfd, void *buf, size_t count);
+#else
+static ssize_t bfile_write_data(struct BFILE *bfd, void *buf, size_t count);
 #endif
 
 #define min(a,b) \
@@ -73,7 +75,7 @@ static ssize_t bfile_write_vss_strip(struct BFILE *bfd, void *buf, size_t count)
 					cp, got))<=0)
 						return -1;
 #else
-				if((wrote=write(bfd->fd,
+				if((wrote=bfile_write_data(bfd,
 					cp, got))<=0)
 						return -1;
 #endif
@@ -451,12 +453,146 @@ static ssize_t bfile_write(struct BFILE *bfd, void *buf, size_t count)
 	return bfile_write_windows(bfd, buf, count);
 }
 
+static int bfile_set_restore(struct BFILE *bfd, struct bfile_restore *br)
+{
+	return 0;
+}
+
 #else
 
+// Zeros are only skipped a whole block at a time, or up to the end.
+#define SPARSE_BLOCK	4096
+
+static int write_all(int fd, const char *buf, size_t count)
+{
+	ssize_t w;
+	while(count)
+	{
+		if((w=write(fd, buf, count))<0)
+		{
+			if(errno==EINTR)
+				continue;
+			return -1;
+		}
+		buf+=w;
+		count-=w;
+	}
+	return 0;
+}
+
+static int is_zero(const char *buf, size_t len)
+{
+	return !buf[0] && !memcmp(buf, buf+1, len-1);
+}
+
+// The file is new, so anything that is seeked over is a hole, and reads
+// back as zeros.
+static int write_out(struct BFILE *bfd, const char *buf, size_t count)
+{
+	while(count)
+	{
+		int zero;
+		size_t len;
+		size_t blk;
+
+		if(!bfd->sparse)
+		{
+			len=count;
+			zero=0;
+		}
+		else
+		{
+			len=min(count,
+				SPARSE_BLOCK-(size_t)(bfd->woffset%SPARSE_BLOCK));
+			zero=is_zero(buf, len);
+			// Carry on while the blocks are the same.
+			while(len<count)
+			{
+				blk=min(count-len, (size_t)SPARSE_BLOCK);
+				if(is_zero(buf+len, blk)!=zero)
+					break;
+				len+=blk;
+			}
+		}
+		if(zero)
+		{
+			if(lseek(bfd->fd, (off_t)len, SEEK_CUR)<0)
+				return -1;
+		}
+		else if(write_all(bfd->fd, buf, len))
+			return -1;
+		bfd->hole_at_end=zero;
+		bfd->woffset+=len;
+		buf+=len;
+		count-=len;
+	}
+	return 0;
+}
+
+static int bfile_flush(struct BFILE *bfd)
+{
+	int ret=0;
+	if(bfd->wbuflen)
+		ret=write_out(bfd, bfd->wbuf, bfd->wbuflen);
+	bfd->wbuflen=0;
+	return ret;
+}
+
+// Finishes off what set_restore() started.
+static int bfile_restore_end(struct BFILE *bfd)
+{
+	int ret=0;
+	if(bfile_flush(bfd))
+		ret=-1;
+	// Skipped zeros at the end still need to be part of the file.
+	if(!ret && bfd->hole_at_end
+	  && ftruncate(bfd->fd, (off_t)bfd->woffset))
+		ret=-1;
+	free_w(&bfd->wbuf);
+	bfd->wbufsize=0;
+	bfd->sparse=0;
+	bfd->hole_at_end=0;
+	bfd->woffset=0;
+	return ret;
+}
+
+static int bfile_set_restore(struct BFILE *bfd, struct bfile_restore *br)
+{
+	uint64_t size=(uint64_t)bfd->statp.st_size;
+	int was_sparse=(uint64_t)bfd->statp.st_blocks*512<size;
+
+	if(bfd->mode!=BF_WRITE)
+		return 0;
+	bfd->sparse=br->sparse && was_sparse;
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+	// Not every filesystem can do this, and it is only a hint, so
+	// failures do not matter.
+	if(br->preallocate && !bfd->sparse && size)
+		fallocate(bfd->fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)size);
+#endif
+	// Small files go straight out.
+	if(br->buffer && size>br->buffer)
+	{
+		if(!(bfd->wbuf=(char *)malloc_w(br->buffer, __func__)))
+			return -1;
+		bfd->wbufsize=br->buffer;
+	}
+	return 0;
+}
+
 static int bfile_close(struct BFILE *bfd, struct asfd *asfd)
 {
 	if(!bfd || bfd->mode==BF_CLOSED) return 0;
 
+	if(bfd->mode==BF_WRITE && bfile_restore_end(bfd))
+	{
+		close(bfd->fd);
+		bfd->mode=BF_CLOSED;
+		bfd->fd=-1;
+		free_w(&bfd->path);
+		return -1;
+	}
+
 	if(!close(bfd->fd))
 	{
 		if(bfd->mode==BF_WRITE && bfd->set_attribs_on_close)
@@ -471,6 +607,23 @@ static int bfile_close(struct BFILE *bfd, struct asfd *asfd)
 	return -1;
 }
 
+// Only files that have fewer blocks than their size have holes worth
+// looking for.
+static void setup_holes(struct BFILE *bfd)
+{
+	struct stat statp;
+	bfd->holes=0;
+	bfd->roffset=0;
+	bfd->data_end=0;
+	bfd->hole_end=0;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+	if(!fstat(bfd->fd, &statp)
+	  && S_ISREG(statp.st_mode)
+	  && (uint64_t)statp.st_blocks*512<(uint64_t)statp.st_size)
+		bfd->holes=1;
+#endif
+}
+
 static int bfile_open(struct BFILE *bfd,
 	struct asfd *asfd, const char *fname, int flags, mode_t mode)
 {
@@ -482,7 +635,10 @@ static int bfile_open(struct BFILE *bfd,
 	if(flags & O_CREAT || flags & O_WRONLY)
 		bfd->mode=BF_WRITE;
 	else
+	{
 		bfd->mode=BF_READ;
+		setup_holes(bfd);
+	}
 	free_w(&bfd->path);
 	if(!(bfd->path=strdup_w(fname, __func__)))
 		return -1;
@@ -491,17 +647,104 @@ static int bfile_open(struct BFILE *bfd,
 	return 0;
 }
 
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+// Works out whether the read offset is in data or in a hole.
+static int find_holes(struct BFILE *bfd)
+{
+	off_t next;
+	struct stat statp;
+	off_t off=(off_t)bfd->roffset;
+
+	if((next=lseek(bfd->fd, off, SEEK_DATA))<0)
+	{
+		if(errno!=ENXIO || fstat(bfd->fd, &statp))
+			return -1;
+		// No more data, so it is a hole up to the end.
+		bfd->data_end=bfd->roffset;
+		bfd->hole_end=statp.st_size>off?
+			(uint64_t)statp.st_size:bfd->roffset;
+		return 0;
+	}
+	if(next>off)
+	{
+		bfd->data_end=bfd->roffset;
+		bfd->hole_end=(uint64_t)next;
+		return 0;
+	}
+	if((next=lseek(bfd->fd, off, SEEK_HOLE))<0)
+		return -1;
+	bfd->data_end=(uint64_t)next;
+	bfd->hole_end=bfd->data_end;
+	return 0;
+}
+
+// Holes are filled in with zeros without reading them. The data is read
+// with pread(), because the seeking moves the file offset around.
+static ssize_t bfile_read_holes(struct BFILE *bfd, void *buf, size_t count)
+{
+	ssize_t r;
+	size_t len;
+
+	if(bfd->roffset>=bfd->data_end
+	  && bfd->roffset>=bfd->hole_end
+	  && find_holes(bfd))
+	{
+		// Give up on it, and carry on reading from where we were.
+		bfd->holes=0;
+		if(lseek(bfd->fd, (off_t)bfd->roffset, SEEK_SET)<0)
+			return -1;
+		return read(bfd->fd, buf, count);
+	}
+	if(bfd->roffset>=bfd->data_end)
+	{
+		if(!(len=(size_t)min((uint64_t)count,
+			bfd->hole_end-bfd->roffset)))
+			return 0; // End of file.
+		memset(buf, 0, len);
+		bfd->roffset+=len;
+		return (ssize_t)len;
+	}
+	len=(size_t)min((uint64_t)count, bfd->data_end-bfd->roffset);
+	if((r=pread(bfd->fd, buf, len, (off_t)bfd->roffset))>0)
+		bfd->roffset+=r;
+	return r;
+}
+#endif
+
 static ssize_t bfile_read(struct BFILE *bfd, void *buf, size_t count)
 {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+	if(bfd->holes)
+		return bfile_read_holes(bfd, buf, count);
+#endif
 	return read(bfd->fd, buf, count);
 }
 
+static ssize_t bfile_write_data(struct BFILE *bfd, void *buf, size_t count)
+{
+	if(!bfd->sparse && !bfd->wbuf)
+		return write(bfd->fd, buf, count);
+	if(bfd->wbuf)
+	{
+		if(bfd->wbuflen+count>bfd->wbufsize && bfile_flush(bfd))
+			return -1;
+		if(count<bfd->wbufsize)
+		{
+			memcpy(bfd->wbuf+bfd->wbuflen, buf, count);
+			bfd->wbuflen+=count;
+			return (ssize_t)count;
+		}
+	}
+	if(write_out(bfd, (const char *)buf, count))
+		return -1;
+	return (ssize_t)count;
+}
+
 static ssize_t bfile_write(struct BFILE *bfd, void *buf, size_t count)
 {
 	if(bfd->vss_strip)
 		return bfile_write_vss_strip(bfd, buf, count);
-
-	return write(bfd->fd, buf, count);
+	return bfile_write_data(bfd, buf, count);
 }
 
 #endif
@@ -571,6 +814,7 @@ void bfile_setup_funcs(struct BFILE *bfd)
 	bfd->set_win32_api=bfile_set_win32_api;
 #endif
 	bfd->set_vss_strip=bfile_set_vss_strip;
+	bfd->set_restore=bfile_set_restore;
 }
 
 void bfile_init(
@@ -20,6 +20,14 @@ struct mysid
         size_t needed_d;
 };
 
+// How to write a file that is being restored.
+struct bfile_restore
+{
+	int sparse; // Seek over zeros in files that were sparse.
+	int preallocate; // Preallocate the other files.
+	size_t buffer; // Gather small writes up to this many bytes.
+};
+
 struct BFILE
 {
 	enum bf_mode mode;   /* set if file is open */
@@ -40,6 +48,18 @@ struct BFILE
 	int berrno;          /* errno */
 #else
 	int fd;
+	// For restores set up with set_restore().
+	int sparse;
+	int hole_at_end;
+	uint64_t woffset;
+	char *wbuf;
+	size_t wbuflen;
+	size_t wbufsize;
+	// For reading sparse files. [data_end, hole_end) is a known hole.
+	int holes;
+	uint64_t roffset;
+	uint64_t data_end;
+	uint64_t hole_end;
 #endif
 	struct mysid mysid;
 	int vss_strip;
@@ -64,6 +84,8 @@ struct BFILE
 	void (*set_win32_api)(struct BFILE *bfd, int on);
 #endif
 	void (*set_vss_strip)(struct BFILE *bfd, int on);
+	// Call after opening a file for restore, with statp filled in.
+	int (*set_restore)(struct BFILE *bfd, struct bfile_restore *br);
 };
 
 extern struct BFILE *bfile_alloc(void);
@@ -241,11 +241,15 @@ int backup_phase1_client(struct asfd *asfd, struct conf **confs)
 #endif
 	}
 
-	if(!(ff=find_files_init(my_send_file))) goto end;
+	if(!(ff=find_files_init(my_send_file))
+	  || find_files_journal_begin(confs))
+		goto end;
 	for(l=get_strlist(confs[OPT_STARTDIR]); l; l=l->next) {
 		if(l->flag && find_files_begin(asfd, ff, confs, l->path))
 			goto end;
 	}
+	if(find_files_journal_end())
+		goto end;
 	ret=0;
 end:
 	cntr_print_end_phase1(get_cntr(confs));
@@ -12,6 +12,7 @@
 #include "../md5.h"
 #include "../transfer.h"
 #include "cvss.h"
+#include "delta_worker.h"
 #include "extrameta.h"
 #include "find.h"
 #include "backup_phase2.h"
@@ -26,7 +27,7 @@ static int rs_loadsig_network_run(struct asfd *asfd,
 	memset(&buf, 0, sizeof(buf));
 
 	if(!(in_fb=rs_filebuf_new(NULL,
-		NULL, asfd, ASYNC_BUF_LEN, -1)))
+		NULL, asfd, asfd_frame_len(asfd), -1)))
 		goto end;
 
 	while(1)
@@ -103,7 +104,7 @@ static int load_signature_and_send_delta(struct asfd *asfd,
 	if(!(infb=rs_filebuf_new(bfd,
 		NULL, NULL, ASYNC_BUF_LEN, bfd->datalen))
 	  || !(outfb=rs_filebuf_new(NULL,
-		NULL, asfd, ASYNC_BUF_LEN, -1)))
+		NULL, asfd, asfd_frame_len(asfd), -1)))
 	{
 		logp("could not rs_filebuf_new for delta\n");
 		goto end;
@@ -209,14 +210,12 @@ static int size_checks(struct asfd *asfd, struct sbuf *sb, struct conf **confs)
 	return 0;
 }
 
-static int deal_with_data(struct asfd *asfd, struct sbuf *sb,
-	struct BFILE *bfd, struct conf **confs)
+// Gets the file ready to send. Returns 1 if the server should be told to
+// forget about it.
+static int prepare_data(struct asfd *asfd, struct sbuf *sb,
+	struct BFILE *bfd, char **extrameta, size_t *elen,
+	struct conf **confs)
 {
-	int ret=-1;
-	int forget=0;
-	size_t elen=0;
-	char *extrameta=NULL;
-	uint64_t bytes=0;
 	int conf_compression=get_int(confs[OPT_COMPRESSION]);
 	struct cntr *cntr=get_cntr(confs);
 	const char *enc_password=get_string(confs[OPT_ENCRYPTION_PASSWORD]);
@@ -247,19 +246,16 @@ static int deal_with_data(struct asfd *asfd, struct sbuf *sb,
 	{
 		logw(asfd, cntr, "Path has vanished: %s\n",
 			iobuf_to_printable(&sb->path));
-		forget++;
-		goto end;
+		return 1;
 	}
 
 	if(size_checks(asfd, sb, confs))
-	{
-		forget++;
-		goto end;
-	}
+		return 1;
 
 	sb->compression=in_exclude_comp(get_strlist(confs[OPT_EXCOM]),
 		sb->path.buf, conf_compression);
-	if(attribs_encode(sb)) goto error;
+	if(attribs_encode(sb))
+		return -1;
 
 	if(sb->path.cmd!=CMD_METADATA
 	  && sb->path.cmd!=CMD_ENC_METADATA)
@@ -272,10 +268,8 @@ static int deal_with_data(struct asfd *asfd, struct sbuf *sb,
 			sb->winattr,
 			get_int(confs[OPT_ATIME]),
 			cntr
-		)) {
-			forget++;
-			goto end;
-		}
+		))
+			return 1;
 	}
 
 	if(sb->path.cmd==CMD_METADATA
@@ -293,21 +287,20 @@ static int deal_with_data(struct asfd *asfd, struct sbuf *sb,
 #endif
 			sb->path.buf,
 			S_ISDIR(sb->statp.st_mode),
-			&extrameta, &elen, cntr))
+			extrameta, elen, cntr))
 		{
 			logw(asfd, cntr,
 				"Meta data error for %s\n",
 				iobuf_to_printable(&sb->path));
-			forget++;
-			goto end;
+			return 1;
 		}
-		if(extrameta)
+		if(*extrameta)
 		{
 #ifdef HAVE_WIN32
 	  		if(get_int(confs[OPT_STRIP_VSS]))
 			{
-				free_w(&extrameta);
-				elen=0;
+				free_w(extrameta);
+				*elen=0;
 			}
 #endif
 		}
@@ -316,9 +309,32 @@ static int deal_with_data(struct asfd *asfd, struct sbuf *sb,
 			logw(asfd, cntr,
 				"No meta data after all: %s\n",
 				iobuf_to_printable(&sb->path));
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int deal_with_data(struct asfd *asfd, struct sbuf *sb,
+	struct BFILE *bfd, struct conf **confs)
+{
+	int ret=-1;
+	int forget=0;
+	size_t elen=0;
+	char *extrameta=NULL;
+	uint64_t bytes=0;
+	struct cntr *cntr=get_cntr(confs);
+	const char *enc_password=get_string(confs[OPT_ENCRYPTION_PASSWORD]);
+
+	switch(prepare_data(asfd, sb, bfd, &extrameta, &elen, confs))
+	{
+		case 0:
+			break;
+		case 1:
 			forget++;
 			goto end;
-		}
+		default:
+			goto error;
 	}
 
 	if(sb->path.cmd==CMD_FILE
@@ -423,6 +439,530 @@ static int parse_rbuf(struct asfd *asfd, struct sbuf *sb,
 	return 0;
 }
 
+// With phase2 streams, the server can have more than one file in flight at
+// once. Each stream has a slot here, and the slots that have data to send
+// take turns, so a large file or a slow delta does not hold up the others.
+enum slot_state
+{
+	SLOT_IDLE=0,
+	SLOT_WHOLE,	// Sending a whole file.
+	SLOT_SIG,	// Loading a signature from the server.
+	SLOT_DELTA,	// Sending a delta.
+	SLOT_WORKER,	// Sending a delta from a delta worker.
+	SLOT_DISCARD	// Munching a signature for a forgotten file.
+};
+
+struct slot
+{
+	enum slot_state state;
+	struct sbuf *sb;
+	struct BFILE *bfd;
+	char *extrameta;
+	size_t elen;
+	struct send_whole *sw;
+	rs_job_t *job;
+	rs_signature_t *sumset;
+	rs_buffers_t rsbuf;
+	rs_filebuf_t *infb;
+	rs_filebuf_t *outfb;
+	struct delta_worker *dw;
+};
+
+struct slots
+{
+	struct slot *s;
+	int count;
+	int in; // Stream that the server is sending on.
+	int out; // Stream that we are sending on, or -1.
+	int sending;
+	int workers;
+	int workers_max;
+};
+
+static int slot_sending(struct slot *slot)
+{
+	return slot->state==SLOT_WHOLE || slot->state==SLOT_DELTA;
+}
+
+static void slot_reset(struct asfd *asfd, struct slots *slots,
+	struct slot *slot)
+{
+	if(slot_sending(slot))
+		slots->sending--;
+	if(slot->bfd)
+		slot->bfd->close(slot->bfd, asfd);
+	send_whole_free(&slot->sw);
+	if(slot->job)
+	{
+		rs_job_free(slot->job);
+		slot->job=NULL;
+	}
+	if(slot->sumset)
+	{
+		rs_free_sumset(slot->sumset);
+		slot->sumset=NULL;
+	}
+	rs_filebuf_free(&slot->infb);
+	rs_filebuf_free(&slot->outfb);
+	memset(&slot->rsbuf, 0, sizeof(slot->rsbuf));
+	if(slot->dw)
+	{
+		delta_worker_free(&slot->dw);
+		slots->workers--;
+	}
+	free_w(&slot->extrameta);
+	slot->elen=0;
+	sbuf_free_content(slot->sb);
+	slot->state=SLOT_IDLE;
+}
+
+static void slots_free(struct asfd *asfd, struct slots **slots)
+{
+	int i;
+	if(!slots || !*slots) return;
+	for(i=0; (*slots)->s && i<(*slots)->count; i++)
+	{
+		struct slot *slot=&(*slots)->s[i];
+		if(slot->sb)
+			slot_reset(asfd, *slots, slot);
+		bfile_free(&slot->bfd);
+		sbuf_free(&slot->sb);
+	}
+	free_v((void **)&(*slots)->s);
+	free_v((void **)slots);
+}
+
+static struct slots *slots_alloc(struct asfd *asfd,
+	int count, int workers_max, struct cntr *cntr)
+{
+	int i;
+	struct slots *slots;
+	if(!(slots=(struct slots *)
+		calloc_w(1, sizeof(struct slots), __func__))
+	  || !(slots->s=(struct slot *)
+		calloc_w(count, sizeof(struct slot), __func__)))
+			goto error;
+	slots->count=count;
+	slots->out=-1;
+	slots->workers_max=workers_max;
+	for(i=0; i<count; i++)
+	{
+		if(!(slots->s[i].sb=sbuf_alloc())
+		  || !(slots->s[i].bfd=bfile_alloc()))
+			goto error;
+		bfile_init(slots->s[i].bfd, 0, 0, cntr);
+	}
+	return slots;
+error:
+	slots_free(asfd, &slots);
+	return NULL;
+}
+
+static int slots_idle(struct slots *slots)
+{
+	int i;
+	for(i=0; i<slots->count; i++)
+		if(slots->s[i].state!=SLOT_IDLE)
+			return 0;
+	return 1;
+}
+
+static int switch_stream(struct asfd *asfd, struct slots *slots,
+	struct slot *slot)
+{
+	char buf[16];
+	int i=slot-slots->s;
+	if(slots->out==i)
+		return 0;
+	snprintf(buf, sizeof(buf), "%d", i);
+	if(asfd->write_str(asfd, CMD_STREAM, buf))
+		return -1;
+	slots->out=i;
+	return 0;
+}
+
+// As forget_file(), but the rest of any signature still to come is munched
+// as it arrives.
+static int slot_forget(struct asfd *asfd, struct slots *slots,
+	struct slot *slot, int discard)
+{
+	if(switch_stream(asfd, slots, slot)
+	  || asfd->write_str(asfd, CMD_INTERRUPT, slot->sb->path.buf))
+		return -1;
+	slot_reset(asfd, slots, slot);
+	if(discard)
+		slot->state=SLOT_DISCARD;
+	return 0;
+}
+
+static int slot_start(struct asfd *asfd, struct slots *slots,
+	struct slot *slot, struct conf **confs)
+{
+	struct sbuf *sb=slot->sb;
+	int delta=asfd->rbuf->cmd==CMD_FILE && sb->datapth.buf;
+	const char *enc_password=get_string(confs[OPT_ENCRYPTION_PASSWORD]);
+
+	switch(prepare_data(asfd, sb, slot->bfd,
+		&slot->extrameta, &slot->elen, confs))
+	{
+		case 0:
+			break;
+		case 1:
+			return slot_forget(asfd, slots, slot, delta);
+		default:
+			return -1;
+	}
+
+	if(switch_stream(asfd, slots, slot))
+		return -1;
+
+	if(delta)
+	{
+		// Need to do sig/delta stuff.
+		if(asfd->write(asfd, &sb->datapth)
+		  || asfd->write(asfd, &sb->attr)
+		  || asfd->write(asfd, &sb->path))
+			return -1;
+		if(!(slot->job=rs_loadsig_begin(&slot->sumset))
+		  || !(slot->infb=rs_filebuf_new(NULL,
+			NULL, asfd, asfd_frame_len(asfd), -1)))
+		{
+			logp("could not start sig job.\n");
+			return -1;
+		}
+		slot->state=SLOT_SIG;
+		return 0;
+	}
+
+	if(asfd->write(asfd, &sb->attr)
+	  || asfd->write(asfd, &sb->path))
+		return -1;
+	if(!(slot->sw=send_whole_alloc())
+	  || send_whole_init(slot->sw, asfd, get_cntr(confs), slot->bfd,
+		slot->extrameta, slot->elen,
+		(sb->compression || enc_password)
+			&& sb->path.cmd!=CMD_EFS_FILE,
+		sb->compression, enc_password,
+		sb->encryption, sb->salt))
+			return -1;
+	slot->state=SLOT_WHOLE;
+	slots->sending++;
+	return 0;
+}
+
+static int slot_load_sig(struct asfd *asfd, struct slots *slots,
+	struct slot *slot)
+{
+	rs_result result;
+	switch((result=rs_async(slot->job, &slot->rsbuf, slot->infb, NULL)))
+	{
+		case RS_BLOCKED:
+		case RS_RUNNING:
+			return 0;
+		case RS_DONE:
+			break;
+		default:
+			logp("error in rs_async for sig: %d\n", result);
+			return slot_forget(asfd, slots, slot,
+				asfd->rbuf->cmd!=CMD_END_FILE);
+	}
+
+	rs_job_free(slot->job);
+	slot->job=NULL;
+	rs_filebuf_free(&slot->infb);
+	memset(&slot->rsbuf, 0, sizeof(slot->rsbuf));
+
+	if(slots->workers<slots->workers_max)
+	{
+		// The worker builds the hash table as well.
+		if((slot->dw=delta_worker_alloc())
+		  && !delta_worker_start(slot->dw,
+			asfd->as, slot->sumset, slot->bfd))
+		{
+			slot->state=SLOT_WORKER;
+			slots->workers++;
+			return 0;
+		}
+		logp("could not start delta worker, carrying on without\n");
+		delta_worker_free(&slot->dw);
+	}
+
+	if(rs_build_hash_table(slot->sumset))
+		return -1;
+	if(!(slot->job=rs_delta_begin(slot->sumset)))
+	{
+		logp("could not start delta job.\n");
+		return -1;
+	}
+	if(!(slot->infb=rs_filebuf_new(slot->bfd,
+		NULL, NULL, ASYNC_BUF_LEN, slot->bfd->datalen))
+	  || !(slot->outfb=rs_filebuf_new(NULL,
+		NULL, asfd, asfd_frame_len(asfd), -1)))
+	{
+		logp("could not rs_filebuf_new for delta\n");
+		return -1;
+	}
+	slot->state=SLOT_DELTA;
+	slots->sending++;
+	return 0;
+}
+
+static int slot_send_delta(struct asfd *asfd, struct slots *slots,
+	struct slot *slot, struct cntr *cntr)
+{
+	rs_result result;
+	uint8_t checksum[MD5_DIGEST_LENGTH];
+
+	switch((result=rs_async(slot->job,
+		&slot->rsbuf, slot->infb, slot->outfb)))
+	{
+		case RS_BLOCKED:
+		case RS_RUNNING:
+			return 0;
+		case RS_DONE:
+			break;
+		default:
+			logp("error in rs_async for delta: %d\n", result);
+			logp("error in sig/delta for %s (%s)\n",
+				iobuf_to_printable(&slot->sb->path),
+				iobuf_to_printable(&slot->sb->datapth));
+			return slot_forget(asfd, slots, slot, 0);
+	}
+	if(!md5_final(slot->infb->md5, checksum))
+	{
+		logp("md5_final() failed\n");
+		return -1;
+	}
+	if(write_endfile(asfd, slot->infb->bytes, checksum))
+		return -1;
+	cntr_add(cntr, CMD_FILE_CHANGED, 1);
+	cntr_add_bytes(cntr, slot->infb->bytes);
+	slot_reset(asfd, slots, slot);
+	return 0;
+}
+
+static int slot_send_worker(struct asfd *asfd, struct slots *slots,
+	struct slot *slot, struct cntr *cntr)
+{
+	switch(delta_worker_send(slot->dw, asfd))
+	{
+		case 0:
+			return 0;
+		case 1:
+			break;
+		default:
+			return -1;
+	}
+	cntr_add(cntr, CMD_FILE_CHANGED, 1);
+	cntr_add_bytes(cntr, slot->dw->bytes);
+	slot_reset(asfd, slots, slot);
+	return 0;
+}
+
+static int slot_send_whole(struct asfd *asfd, struct slots *slots,
+	struct slot *slot, struct cntr *cntr)
+{
+	int done=0;
+	enum send_e ret;
+
+	if((ret=send_whole_step(slot->sw, &done))==SEND_OK && !done)
+		return 0;
+	if((ret=send_whole_end(slot->sw, ret, 0))==SEND_FATAL)
+		return -1;
+	cntr_add(cntr, slot->sb->path.cmd, 1);
+	cntr_add_bytes(cntr, slot->sw->bytes);
+	// Without compression or encryption, the end of file has been sent
+	// with what was read, and the server keeps that.
+	if(ret==SEND_ERROR && slot->sw->gz)
+		return slot_forget(asfd, slots, slot, 0);
+	slot_reset(asfd, slots, slot);
+	return 0;
+}
+
+static int slots_send(struct asfd *asfd, struct slots *slots,
+	struct cntr *cntr)
+{
+	int i;
+	for(i=0; i<slots->count; i++)
+	{
+		struct slot *slot=&slots->s[i];
+		if(slot->state==SLOT_WORKER)
+		{
+			if(!delta_worker_ready(slot->dw))
+				continue;
+			if(switch_stream(asfd, slots, slot)
+			  || slot_send_worker(asfd, slots, slot, cntr))
+				return -1;
+			continue;
+		}
+		if(!slot_sending(slot))
+			continue;
+		if(switch_stream(asfd, slots, slot))
+			return -1;
+		if(slot->state==SLOT_WHOLE)
+		{
+			if(slot_send_whole(asfd, slots, slot, cntr))
+				return -1;
+		}
+		else if(slot_send_delta(asfd, slots, slot, cntr))
+			return -1;
+	}
+	return 0;
+}
+
+// A delta worker that went away before finishing shows up as a read error.
+// Tell the server to forget about its file, and carry on. Anything else is
+// fatal.
+static int slots_worker_failed(struct asfd *asfd, struct slots *slots)
+{
+	int i;
+	int failed=0;
+	if(asfd->want_to_remove)
+		return -1;
+	for(i=0; i<slots->count; i++)
+	{
+		struct slot *slot=&slots->s[i];
+		if(slot->state!=SLOT_WORKER
+		  || !delta_worker_failed(slot->dw))
+			continue;
+		logp("delta worker failed for %s (%s)\n",
+			iobuf_to_printable(&slot->sb->path),
+			iobuf_to_printable(&slot->sb->datapth));
+		if(slot_forget(asfd, slots, slot, 0))
+			return -1;
+		failed++;
+	}
+	return failed?0:-1;
+}
+
+static int slots_parse_rbuf(struct asfd *asfd, struct slots *slots,
+	struct conf **confs)
+{
+	struct slot *slot;
+	struct iobuf *rbuf=asfd->rbuf;
+
+	if(rbuf->cmd==CMD_MESSAGE
+	  || rbuf->cmd==CMD_WARNING)
+	{
+		log_recvd(rbuf, get_cntr(confs), 0);
+		return 0;
+	}
+	if(rbuf->cmd==CMD_STREAM)
+	{
+		int i=atoi(rbuf->buf);
+		if(i<0 || i>=slots->count)
+		{
+			logp("bad phase2 stream from server: %s\n",
+				iobuf_to_printable(rbuf));
+			return -1;
+		}
+		slots->in=i;
+		return 0;
+	}
+
+	slot=&slots->s[slots->in];
+	switch(slot->state)
+	{
+		case SLOT_IDLE:
+			if(rbuf->cmd==CMD_DATAPTH)
+			{
+				iobuf_move(&slot->sb->datapth, rbuf);
+				return 0;
+			}
+			// Ignore the stat data, as in parse_rbuf().
+			if(rbuf->cmd==CMD_ATTRIBS)
+				return 0;
+			if(iobuf_is_filedata(rbuf)
+			  || iobuf_is_vssdata(rbuf))
+				return slot_start(asfd, slots, slot, confs);
+			break;
+		case SLOT_SIG:
+			if(rbuf->cmd==CMD_APPEND
+			  || rbuf->cmd==CMD_END_FILE)
+				return slot_load_sig(asfd, slots, slot);
+			break;
+		case SLOT_DISCARD:
+			if(rbuf->cmd==CMD_APPEND)
+				return 0;
+			if(rbuf->cmd==CMD_END_FILE)
+			{
+				slot->state=SLOT_IDLE;
+				return 0;
+			}
+			break;
+		default:
+			break;
+	}
+	iobuf_log_unexpected(rbuf, __func__);
+	return -1;
+}
+
+static int do_backup_phase2_client_streams(struct asfd *asfd,
+	struct conf **confs)
+{
+	int r;
+	int ret=-1;
+	int ending=0;
+	struct slots *slots=NULL;
+	struct iobuf *rbuf=asfd->rbuf;
+	struct cntr *cntr=get_cntr(confs);
+
+	if(!(slots=slots_alloc(asfd,
+		get_int(confs[OPT_PHASE2_STREAMS]),
+		get_int(confs[OPT_DELTA_WORKERS]), cntr)))
+			goto end;
+	logp("Using %d phase2 streams\n", slots->count);
+	if(slots->workers_max>0)
+		logp("Using up to %d delta workers\n", slots->workers_max);
+
+	while(1)
+	{
+		if(slots_send(asfd, slots, cntr))
+			goto end;
+
+		if(ending && slots_idle(slots))
+		{
+			if(asfd->write_str(asfd, CMD_GEN, "okbackupphase2end"))
+				goto end;
+			ret=0;
+			break;
+		}
+
+		iobuf_free_content(rbuf);
+		if(slots->sending)
+		{
+			// Keep sending, but pick up anything from the server.
+			r=asfd->as->read_quick(asfd->as);
+		}
+		else if(slots->workers)
+		{
+			// Wait for the server or a delta worker.
+			r=asfd->as->read_write(asfd->as);
+		}
+		else
+			r=asfd->read(asfd);
+		if(r && slots_worker_failed(asfd, slots))
+			goto end;
+		if(!rbuf->buf)
+			continue;
+
+		if(rbuf->cmd==CMD_GEN && !strcmp(rbuf->buf, "backupphase2end"))
+		{
+			// Finish off whatever is still in flight first.
+			ending=1;
+			continue;
+		}
+
+		if(slots_parse_rbuf(asfd, slots, confs))
+			goto end;
+	}
+
+end:
+	iobuf_free_content(rbuf);
+	slots_free(asfd, &slots);
+	return ret;
+}
+
 static int do_backup_phase2_client(struct asfd *asfd,
 	struct conf **confs, int resume)
 {
@@ -462,6 +1002,12 @@ static int do_backup_phase2_client(struct asfd *asfd,
 			goto end;
 	}
 
+	if(confs && get_int(confs[OPT_PHASE2_STREAMS])>1)
+	{
+		ret=do_backup_phase2_client_streams(asfd, confs);
+		goto end;
+	}
+
 	while(1)
 	{
 		iobuf_free_content(rbuf);
@@ -0,0 +1,668 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../conf.h"
+#include "../fsops.h"
+#include "../fzp.h"
+#include "../log.h"
+#include "../prepend.h"
+#include "../strlist.h"
+#include "change_journal.h"
+
+#ifdef HAVE_FANOTIFY_DFID_NAME
+#include <poll.h>
+#include <sys/fanotify.h>
+#include <sys/statfs.h>
+#endif
+
+/*
+   The journal is a text file that the watcher appends to, one line each:
+     F <dev>        A file system that is being watched.
+     D <dev> <ino>  A directory whose entries, or whose files, changed.
+     I <dev> <ino>  A file that changed, which may not be in a directory
+                    that has a D line, because of hard links.
+     O              Events were lost.
+     A <token>      The token in the marker file, once everything that
+                    happened before it was written has been appended.
+   Each D or I line is only written once between two A lines.
+*/
+
+struct change_journal *change_journal_alloc(void)
+{
+	return (struct change_journal *)
+		calloc_w(1, sizeof(struct change_journal), __func__);
+}
+
+static void cj_ids_free(struct cj_id **set)
+{
+	struct cj_id *x;
+	struct cj_id *tmp;
+	HASH_ITER(hh, *set, x, tmp)
+	{
+		HASH_DEL(*set, x);
+		free_v((void **)&x);
+	}
+}
+
+static void cj_reset(struct change_journal *cj)
+{
+	cj_ids_free(&cj->dirs);
+	cj_ids_free(&cj->inodes);
+	cj_ids_free(&cj->filesystems);
+	cj->usable=0;
+}
+
+void change_journal_free(struct change_journal **cj)
+{
+	if(!cj || !*cj) return;
+	cj_reset(*cj);
+	free_w(&(*cj)->token);
+	free_v((void **)cj);
+}
+
+static struct cj_id *cj_find(struct cj_id *set, dev_t dev, ino_t ino)
+{
+	struct cj_id key;
+	struct cj_id *x;
+	memset(&key, 0, sizeof(key));
+	key.id.dev=dev;
+	key.id.ino=ino;
+	HASH_FIND(hh, set, &key.id, sizeof(key.id), x);
+	return x;
+}
+
+static int cj_add(struct cj_id **set, dev_t dev, ino_t ino)
+{
+	struct cj_id *x;
+	if(cj_find(*set, dev, ino))
+		return 0;
+	if(!(x=(struct cj_id *)calloc_w(1, sizeof(struct cj_id), __func__)))
+		return -1;
+	x->id.dev=dev;
+	x->id.ino=ino;
+	HASH_ADD(hh, *set, id, sizeof(x->id), x);
+	return 0;
+}
+
+int change_journal_fs_is_watched(struct change_journal *cj, dev_t dev)
+{
+	return cj_find(cj->filesystems, dev, 0)!=NULL;
+}
+
+int change_journal_dir_is_dirty(struct change_journal *cj, struct stat *statp)
+{
+	return cj_find(cj->dirs, statp->st_dev, statp->st_ino)!=NULL;
+}
+
+int change_journal_inode_is_dirty(struct change_journal *cj,
+	struct stat *statp)
+{
+	return cj_find(cj->inodes, statp->st_dev, statp->st_ino)!=NULL;
+}
+
+static int write_marker(const char *dir, const char *token)
+{
+	int ret=-1;
+	char *path=NULL;
+	char *tmp=NULL;
+	struct fzp *fzp=NULL;
+	if(!(path=prepend_s(dir, CHANGE_JOURNAL_MARKER))
+	  || !(tmp=prepend(path, ".tmp")))
+		goto end;
+	if(!(fzp=fzp_open(tmp, "wb")))
+		goto end;
+	fzp_printf(fzp, "%s\n", token);
+	if(fzp_close(&fzp))
+	{
+		logp("Could not write %s\n", tmp);
+		goto end;
+	}
+	if(do_rename(tmp, path))
+		goto end;
+	ret=0;
+end:
+	free_w(&path);
+	free_w(&tmp);
+	return ret;
+}
+
+// Returns 1 when the line is the acknowledgement of our token.
+static int parse_line(struct change_journal *cj, char *buf,
+	const char *prev_token, const char *token, int *found_prev)
+{
+	unsigned long long dev=0;
+	unsigned long long ino=0;
+
+	buf[strlen(buf)-1]='\0';
+	switch(*buf)
+	{
+		case 'F':
+			if(sscanf(buf, "F %llu", &dev)!=1)
+				break;
+			return cj_add(&cj->filesystems, (dev_t)dev, 0);
+		case 'D':
+		case 'I':
+			if(sscanf(buf+1, " %llu %llu", &dev, &ino)!=2)
+				break;
+			return cj_add(*buf=='D'?&cj->dirs:&cj->inodes,
+				(dev_t)dev, (ino_t)ino);
+		case 'O':
+			cj->usable=0;
+			return 0;
+		case 'A':
+			if(!strncmp(buf, "A ", 2))
+			{
+				if(!strcmp(buf+2, token))
+					return 1;
+				if(prev_token && !strcmp(buf+2, prev_token))
+				{
+					// Everything before this was seen
+					// by the previous scan.
+					cj_ids_free(&cj->dirs);
+					cj_ids_free(&cj->inodes);
+					cj->usable=1;
+					*found_prev=1;
+				}
+				return 0;
+			}
+			break;
+	}
+	// Something that this version does not understand.
+	cj->usable=0;
+	return 0;
+}
+
+static int journal_replaced(struct fzp *fzp, const char *path)
+{
+	struct stat a;
+	struct stat b;
+	if(fstat(fzp_fileno(fzp), &a) || stat(path, &b))
+		return 0;
+	return a.st_dev!=b.st_dev || a.st_ino!=b.st_ino;
+}
+
+// Writes a new token to the marker file, and waits for the watcher to
+// acknowledge it in the journal. Reads what changed between the
+// acknowledgement of prev_token and the acknowledgement of the new token.
+// Anything that changes after this returns will come after the new token.
+int change_journal_sync(struct change_journal *cj, const char *dir,
+	const char *prev_token, int timeout)
+{
+	int ret=-1;
+	int r=0;
+	int found_prev=0;
+	off_t pos=0;
+	time_t deadline;
+	char buf[256]="";
+	char token[64]="";
+	char *path=NULL;
+	struct fzp *fzp=NULL;
+	struct timeval tv;
+
+	cj_reset(cj);
+	free_w(&cj->token);
+	// Must not be the same as the previous one, even if that was from
+	// the same process in the same second.
+	gettimeofday(&tv, NULL);
+	snprintf(token, sizeof(token), "%lld.%06ld.%d",
+		(long long)tv.tv_sec, (long)tv.tv_usec, (int)getpid());
+	if(!(path=prepend_s(dir, CHANGE_JOURNAL_FILE)))
+		goto end;
+	if(write_marker(dir, token))
+	{
+		// Carry on, as if the watcher was not there.
+		ret=0;
+		goto end;
+	}
+
+	deadline=time(NULL)+timeout;
+	while(1)
+	{
+		if(!fzp && !(fzp=fzp_open(path, "rb")))
+			goto wait;
+		pos=fzp_tell(fzp);
+		if(!fzp_gets(fzp, buf, sizeof(buf)))
+			goto wait;
+		if(!*buf || buf[strlen(buf)-1]!='\n')
+		{
+			// The watcher has not finished writing it.
+			fzp_seek(fzp, pos, SEEK_SET);
+			goto wait;
+		}
+		if((r=parse_line(cj, buf, prev_token, token, &found_prev))<0)
+			goto end;
+		if(r)
+		{
+			if(!(cj->token=strdup_w(token, __func__)))
+				goto end;
+			if(!found_prev) cj->usable=0;
+			break;
+		}
+		continue;
+wait:
+		if(time(NULL)>=deadline)
+		{
+			logp("No acknowledgement in %s after %d seconds. Is '-a journal' running?\n", path, timeout);
+			cj_reset(cj);
+			break;
+		}
+		if(fzp && journal_replaced(fzp, path))
+		{
+			// The watcher restarted, or started a new journal.
+			fzp_close(&fzp);
+			cj_reset(cj);
+			found_prev=0;
+		}
+		else if(fzp)
+			fzp_seek(fzp, fzp_tell(fzp), SEEK_SET);
+		usleep(100000);
+	}
+	ret=0;
+end:
+	fzp_close(&fzp);
+	free_w(&path);
+	return ret;
+}
+
+#ifdef HAVE_FANOTIFY_DFID_NAME
+
+// A journal bigger than this gets started again, which means that the
+// next scan walks everything.
+#define JOURNAL_MAX_SIZE	(64*1024*1024)
+
+#define WATCH_MASK	(FAN_CREATE|FAN_DELETE|FAN_MOVED_FROM|FAN_MOVED_TO \
+			|FAN_ATTRIB|FAN_MODIFY|FAN_ONDIR)
+
+struct watched_fs
+{
+	fsid_t fsid;
+	dev_t dev;
+	int fd;
+	struct watched_fs *next;
+};
+
+// The file handles that already have a line since the last A line.
+struct seen
+{
+	char *id;
+	size_t len;
+	UT_hash_handle hh;
+};
+
+struct watcher
+{
+	int fan_fd;
+	char *path;
+	char *marker;
+	struct fzp *fzp;
+	off_t size;
+	char acked[64];
+	struct watched_fs *fs;
+	struct seen *seen;
+};
+
+static void seen_free(struct seen **seen)
+{
+	struct seen *x;
+	struct seen *tmp;
+	HASH_ITER(hh, *seen, x, tmp)
+	{
+		HASH_DEL(*seen, x);
+		free_w(&x->id);
+		free_v((void **)&x);
+	}
+}
+
+// Returns 1 if the key was already there.
+static int seen_add(struct seen **seen, const char *id, size_t len)
+{
+	struct seen *x;
+	HASH_FIND(hh, *seen, id, len, x);
+	if(x) return 1;
+	if(!(x=(struct seen *)calloc_w(1, sizeof(struct seen), __func__))
+	  || !(x->id=(char *)malloc_w(len, __func__)))
+	{
+		free_v((void **)&x);
+		return -1;
+	}
+	memcpy(x->id, id, len);
+	x->len=len;
+	HASH_ADD_KEYPTR(hh, *seen, x->id, x->len, x);
+	return 0;
+}
+
+static int journal_write(struct watcher *w, const char *line)
+{
+	int r;
+	if((r=fzp_printf(w->fzp, "%s", line))<0)
+	{
+		logp("Could not write to %s: %s\n", w->path, strerror(errno));
+		return -1;
+	}
+	w->size+=r;
+	return 0;
+}
+
+static int journal_id(struct watcher *w, char kind, struct stat *statp)
+{
+	char line[64];
+	snprintf(line, sizeof(line), "%c %llu %llu\n", kind,
+		(unsigned long long)statp->st_dev,
+		(unsigned long long)statp->st_ino);
+	return journal_write(w, line);
+}
+
+// Starts a new journal, listing the file systems that are being watched.
+static int journal_start(struct watcher *w)
+{
+	int ret=-1;
+	char *tmp=NULL;
+	struct watched_fs *f;
+
+	fzp_close(&w->fzp);
+	seen_free(&w->seen);
+	w->size=0;
+	if(!(tmp=prepend(w->path, ".tmp"))
+	  || !(w->fzp=fzp_open(tmp, "wb")))
+		goto end;
+	for(f=w->fs; f; f=f->next)
+	{
+		char line[32];
+		snprintf(line, sizeof(line), "F %llu\n",
+			(unsigned long long)f->dev);
+		if(journal_write(w, line))
+			goto end;
+	}
+	if(fzp_flush(w->fzp)
+	  || do_rename(tmp, w->path))
+		goto end;
+	ret=0;
+end:
+	free_w(&tmp);
+	return ret;
+}
+
+static int watch_fs(struct watcher *w, const char *path)
+{
+	int fd;
+	struct stat statp;
+	struct statfs sfs;
+	struct watched_fs *f;
+
+	if((fd=open(path, O_RDONLY|O_DIRECTORY))<0
+	  || fstat(fd, &statp)
+	  || fstatfs(fd, &sfs))
+	{
+		logp("Could not open %s to watch it: %s\n",
+			path, strerror(errno));
+		if(fd>=0) close(fd);
+		return -1;
+	}
+	for(f=w->fs; f; f=f->next)
+	{
+		if(f->dev!=statp.st_dev) continue;
+		close(fd);
+		return 0;
+	}
+	if(fanotify_mark(w->fan_fd, FAN_MARK_ADD|FAN_MARK_FILESYSTEM,
+		WATCH_MASK, AT_FDCWD, path))
+	{
+		logp("Could not watch the file system of %s: %s\n",
+			path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if(!(f=(struct watched_fs *)calloc_w(1,
+		sizeof(struct watched_fs), __func__)))
+	{
+		close(fd);
+		return -1;
+	}
+	f->fsid=sfs.f_fsid;
+	f->dev=statp.st_dev;
+	f->fd=fd;
+	f->next=w->fs;
+	w->fs=f;
+	logp("Watching the file system of %s\n", path);
+	return 0;
+}
+
+static void watcher_free(struct watcher *w)
+{
+	struct watched_fs *f;
+	while((f=w->fs))
+	{
+		w->fs=f->next;
+		close(f->fd);
+		free_v((void **)&f);
+	}
+	seen_free(&w->seen);
+	fzp_close(&w->fzp);
+	if(w->fan_fd>=0) close(w->fan_fd);
+	free_w(&w->path);
+	free_w(&w->marker);
+}
+
+// Turns a file handle from an event into a journal line.
+static int record_fid(struct watcher *w,
+	struct fanotify_event_info_fid *fid, char kind, int has_dir)
+{
+	int fd;
+	int r;
+	char key[sizeof(fsid_t)+MAX_HANDLE_SZ+16];
+	size_t len;
+	struct stat statp;
+	struct watched_fs *f;
+	struct file_handle *fh=(struct file_handle *)fid->handle;
+
+	len=sizeof(fh->handle_type)+fh->handle_bytes;
+	if(len+sizeof(fid->fsid)+1>sizeof(key))
+		return journal_write(w, "O\n");
+	key[0]=kind;
+	memcpy(key+1, &fid->fsid, sizeof(fid->fsid));
+	memcpy(key+1+sizeof(fid->fsid), &fh->handle_type, len);
+	len+=1+sizeof(fid->fsid);
+	if((r=seen_add(&w->seen, key, len)))
+		return r<0?-1:0;
+
+	for(f=w->fs; f; f=f->next)
+		if(!memcmp(&f->fsid, &fid->fsid, sizeof(f->fsid)))
+			break;
+	if(!f) return 0;
+
+	if((fd=open_by_handle_at(f->fd, fh, O_PATH))<0)
+	{
+		// It has gone, and its directory has an event of its own.
+		if(errno==ESTALE || errno==ENOENT)
+			return 0;
+		logp("Could not open file handle: %s\n", strerror(errno));
+		return journal_write(w, "O\n");
+	}
+	r=fstat(fd, &statp);
+	close(fd);
+	if(r) return journal_write(w, "O\n");
+
+	if(kind=='D')
+		return journal_id(w, 'D', &statp);
+	// The directory line covers files with only one name.
+	if(S_ISDIR(statp.st_mode)
+	  || (has_dir && statp.st_nlink<2))
+		return 0;
+	return journal_id(w, 'I', &statp);
+}
+
+static int record_event(struct watcher *w,
+	struct fanotify_event_metadata *m)
+{
+	int has_dir=0;
+	char *end=(char *)m+m->event_len;
+	struct fanotify_event_info_header *h;
+
+	if(m->mask & FAN_Q_OVERFLOW)
+		return journal_write(w, "O\n");
+
+	for(h=(struct fanotify_event_info_header *)(m+1);
+	  (char *)h<end; h=(struct fanotify_event_info_header *)
+		((char *)h+h->len))
+	{
+		if(!h->len) break;
+		if(h->info_type==FAN_EVENT_INFO_TYPE_DFID_NAME
+		  || h->info_type==FAN_EVENT_INFO_TYPE_DFID)
+			has_dir=1;
+	}
+	for(h=(struct fanotify_event_info_header *)(m+1);
+	  (char *)h<end; h=(struct fanotify_event_info_header *)
+		((char *)h+h->len))
+	{
+		if(!h->len) break;
+		switch(h->info_type)
+		{
+			case FAN_EVENT_INFO_TYPE_DFID_NAME:
+			case FAN_EVENT_INFO_TYPE_DFID:
+				if(record_fid(w, (struct
+				  fanotify_event_info_fid *)h, 'D', has_dir))
+					return -1;
+				break;
+			case FAN_EVENT_INFO_TYPE_FID:
+				if(record_fid(w, (struct
+				  fanotify_event_info_fid *)h, 'I', has_dir))
+					return -1;
+				break;
+		}
+	}
+	return 0;
+}
+
+// Reads and records the events that are queued, until there are none.
+static int read_events(struct watcher *w)
+{
+	ssize_t len;
+	struct fanotify_event_metadata *m;
+	char buf[65536] __attribute__((aligned(__alignof__(
+		struct fanotify_event_metadata))));
+
+	while(1)
+	{
+		if((len=read(w->fan_fd, buf, sizeof(buf)))<0)
+		{
+			if(errno==EAGAIN) break;
+			if(errno==EINTR) continue;
+			logp("read on fanotify: %s\n", strerror(errno));
+			return -1;
+		}
+		for(m=(struct fanotify_event_metadata *)buf;
+		  FAN_EVENT_OK(m, len); m=FAN_EVENT_NEXT(m, len))
+		{
+			if(m->vers!=FANOTIFY_METADATA_VERSION)
+			{
+				logp("Unexpected fanotify version: %d\n",
+					m->vers);
+				return -1;
+			}
+			if(m->fd>=0) close(m->fd);
+			if(record_event(w, m))
+				return -1;
+		}
+	}
+	return fzp_flush(w->fzp);
+}
+
+// A scan writes a new token to the marker file before it starts. The
+// events of everything that changed before then are already queued by the
+// time that the token is seen, so once they are read, the token is
+// acknowledged. Everything after that gets a line of its own again.
+static int check_marker(struct watcher *w)
+{
+	char buf[64]="";
+	char line[80]="";
+	struct fzp *fzp;
+
+	if(!(fzp=fzp_open(w->marker, "rb")))
+		return 0;
+	if(!fzp_gets(fzp, buf, sizeof(buf)))
+		*buf='\0';
+	fzp_close(&fzp);
+	if(!*buf || buf[strlen(buf)-1]!='\n')
+		return 0;
+	buf[strlen(buf)-1]='\0';
+	if(!strcmp(buf, w->acked))
+		return 0;
+	if(read_events(w))
+		return -1;
+	snprintf(w->acked, sizeof(w->acked), "%s", buf);
+	seen_free(&w->seen);
+	snprintf(line, sizeof(line), "A %s\n", buf);
+	if(journal_write(w, line))
+		return -1;
+	return fzp_flush(w->fzp);
+}
+
+int change_journal_watch(struct conf **confs)
+{
+	int ret=-1;
+	struct strlist *l;
+	struct watcher w;
+	struct pollfd pfd;
+	const char *dir=get_string(confs[OPT_CHANGE_JOURNAL]);
+
+	memset(&w, 0, sizeof(w));
+	w.fan_fd=-1;
+	if(!dir)
+	{
+		logp("%s is not set\n", confs[OPT_CHANGE_JOURNAL]->field);
+		goto end;
+	}
+	if((w.fan_fd=fanotify_init(FAN_CLASS_NOTIF|FAN_CLOEXEC|FAN_NONBLOCK
+		|FAN_REPORT_DFID_NAME|FAN_REPORT_FID, O_RDONLY|O_LARGEFILE))<0)
+	{
+		logp("Could not start fanotify: %s\n", strerror(errno));
+		goto end;
+	}
+	for(l=get_strlist(confs[OPT_STARTDIR]); l; l=l->next)
+		if(l->flag && watch_fs(&w, l->path))
+			goto end;
+	if(!w.fs)
+	{
+		logp("Nothing to watch\n");
+		goto end;
+	}
+	if(mkdir(dir, 0755) && errno!=EEXIST)
+	{
+		logp("Could not mkdir %s: %s\n", dir, strerror(errno));
+		goto end;
+	}
+	if(!(w.path=prepend_s(dir, CHANGE_JOURNAL_FILE))
+	  || !(w.marker=prepend_s(dir, CHANGE_JOURNAL_MARKER))
+	  || journal_start(&w))
+		goto end;
+
+	pfd.fd=w.fan_fd;
+	pfd.events=POLLIN;
+	while(1)
+	{
+		if(poll(&pfd, 1, 1000)<0 && errno!=EINTR)
+		{
+			logp("poll on fanotify: %s\n", strerror(errno));
+			goto end;
+		}
+		if(read_events(&w)
+		  || check_marker(&w))
+			goto end;
+		if(w.size>JOURNAL_MAX_SIZE
+		  && journal_start(&w))
+			goto end;
+	}
+end:
+	watcher_free(&w);
+	return ret;
+}
+
+#else
+
+int change_journal_watch(struct conf **confs)
+{
+	logp("The change journal needs fanotify from Linux 5.9 or later, "
+		"which this burp was not built with.\n");
+	return -1;
+}
+
+#endif
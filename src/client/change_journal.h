@@ -0,0 +1,49 @@
+#ifndef _CHANGE_JOURNAL_H
+#define _CHANGE_JOURNAL_H
+
+#include <uthash.h>
+
+// The files in the change_journal directory.
+#define CHANGE_JOURNAL_FILE	"journal"
+#define CHANGE_JOURNAL_MARKER	"marker"
+
+struct cj_id
+{
+	struct
+	{
+		dev_t dev;
+		ino_t ino;
+	} id;
+	UT_hash_handle hh;
+};
+
+// What the journal says has changed since the scan that got the previous
+// token acknowledged. 'usable' is only set if the previous token was
+// found and nothing was lost after it. 'token' is only set if the watcher
+// acknowledged this scan, and is what the next scan needs to give.
+struct change_journal
+{
+	int usable;
+	char *token;
+	struct cj_id *dirs;
+	struct cj_id *inodes;
+	struct cj_id *filesystems;
+};
+
+extern struct change_journal *change_journal_alloc(void);
+extern void change_journal_free(struct change_journal **cj);
+
+extern int change_journal_sync(struct change_journal *cj, const char *dir,
+	const char *prev_token, int timeout);
+
+extern int change_journal_fs_is_watched(struct change_journal *cj,
+	dev_t dev);
+extern int change_journal_dir_is_dirty(struct change_journal *cj,
+	struct stat *statp);
+extern int change_journal_inode_is_dirty(struct change_journal *cj,
+	struct stat *statp);
+
+// Runs the watcher for '-a journal', until it is killed.
+extern int change_journal_watch(struct conf **confs);
+
+#endif
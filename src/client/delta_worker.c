@@ -0,0 +1,207 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../asfd.h"
+#include "../async.h"
+#include "../cmd.h"
+#include "../fsops.h"
+#include "../handy_extra.h"
+#include "../iobuf.h"
+#include "../log.h"
+#include "delta_worker.h"
+
+struct delta_worker *delta_worker_alloc(void)
+{
+	return (struct delta_worker *)
+		calloc_w(1, sizeof(struct delta_worker), __func__);
+}
+
+void delta_worker_free(struct delta_worker **dw)
+{
+	if(!dw || !*dw) return;
+	if((*dw)->asfd)
+	{
+		struct async *as=(*dw)->asfd->as;
+		as->asfd_remove(as, (*dw)->asfd);
+		asfd_free(&(*dw)->asfd);
+	}
+#ifndef HAVE_WIN32
+	if((*dw)->pid>0)
+	{
+		// If the delta was not finished, nothing wants the rest of it.
+		if(!(*dw)->done)
+			kill((*dw)->pid, SIGTERM);
+		waitpid((*dw)->pid, NULL, 0);
+	}
+#endif
+	free_v((void **)dw);
+}
+
+#ifndef HAVE_WIN32
+// This runs in the child.
+static int worker_run(int fd, rs_signature_t *sumset, struct BFILE *bfd)
+{
+	int ret=-1;
+	rs_job_t *job=NULL;
+	struct async *as=NULL;
+	struct asfd *asfd=NULL;
+	rs_filebuf_t *infb=NULL;
+	rs_filebuf_t *outfb=NULL;
+	rs_buffers_t rsbuf;
+	uint8_t checksum[MD5_DIGEST_LENGTH];
+	memset(&rsbuf, 0, sizeof(rsbuf));
+
+	if(!(as=async_alloc())
+	  || as->init(as, 0)
+	  || !(asfd=setup_asfd(as, "delta worker", &fd, /*listen*/"")))
+		goto end;
+
+	if(rs_build_hash_table(sumset))
+	{
+		logp("could not build hash table for delta\n");
+		goto end;
+	}
+	if(!(job=rs_delta_begin(sumset)))
+	{
+		logp("could not start delta job.\n");
+		goto end;
+	}
+	if(!(infb=rs_filebuf_new(bfd,
+		NULL, NULL, ASYNC_BUF_LEN, bfd->datalen))
+	  || !(outfb=rs_filebuf_new(NULL,
+		NULL, asfd, ASYNC_BUF_LEN, -1)))
+	{
+		logp("could not rs_filebuf_new for delta\n");
+		goto end;
+	}
+
+	while(1)
+	{
+		rs_result result;
+		switch((result=rs_async(job, &rsbuf, infb, outfb)))
+		{
+			case RS_DONE:
+				break;
+			case RS_BLOCKED:
+			case RS_RUNNING:
+				if(as->write(as))
+					goto end;
+				continue;
+			default:
+				logp("error in rs_async for delta: %d\n",
+					result);
+				goto end;
+		}
+		break;
+	}
+
+	if(!md5_final(infb->md5, checksum))
+	{
+		logp("md5_final() failed\n");
+		goto end;
+	}
+	if(write_endfile(asfd, infb->bytes, checksum))
+		goto end;
+	while(asfd->writebuflen)
+		if(as->write(as))
+			goto end;
+	ret=0;
+end:
+	close_fd(&fd);
+	rs_filebuf_free(&infb);
+	rs_filebuf_free(&outfb);
+	if(job) rs_job_free(job);
+	async_asfd_free_all(&as);
+	return ret;
+}
+#endif
+
+int delta_worker_start(struct delta_worker *dw, struct async *as,
+	rs_signature_t *sumset, struct BFILE *bfd)
+{
+#ifdef HAVE_WIN32
+	logp("delta workers are not supported on Windows\n");
+	return -1;
+#else
+	int fds[2];
+
+	if(pipe(fds)<0)
+	{
+		logp("pipe failed in %s: %s\n", __func__, strerror(errno));
+		return -1;
+	}
+	switch((dw->pid=fork()))
+	{
+		case -1:
+			logp("fork failed in %s: %s\n",
+				__func__, strerror(errno));
+			close_fd(&fds[0]);
+			close_fd(&fds[1]);
+			return -1;
+		case 0:
+			// Child. Leave everything that belongs to the parent
+			// alone, and do not run any exit handlers.
+			close_fd(&fds[0]);
+			_exit(worker_run(fds[1], sumset, bfd)?1:0);
+		default:
+			// Parent.
+			close_fd(&fds[1]);
+			if(!(dw->asfd=setup_asfd(as,
+				"delta worker", &fds[0], /*listen*/"")))
+			{
+				close_fd(&fds[0]);
+				return -1;
+			}
+			return 0;
+	}
+#endif
+}
+
+int delta_worker_ready(struct delta_worker *dw)
+{
+	return dw->asfd && dw->asfd->rbuf->buf;
+}
+
+int delta_worker_send(struct delta_worker *dw, struct asfd *asfd)
+{
+	struct iobuf *rbuf=dw->asfd->rbuf;
+
+	while(rbuf->buf)
+	{
+		switch(rbuf->cmd)
+		{
+			case CMD_APPEND:
+				switch(asfd->append_all_to_write_buffer(asfd,
+					rbuf))
+				{
+					case APPEND_OK:
+						break;
+					case APPEND_BLOCKED:
+						return 0;
+					case APPEND_ERROR:
+					default:
+						return -1;
+				}
+				break;
+			case CMD_END_FILE:
+				dw->bytes=strtoull(rbuf->buf, NULL, 10);
+				if(asfd->write(asfd, rbuf))
+					return -1;
+				iobuf_free_content(rbuf);
+				dw->done=1;
+				return 1;
+			default:
+				iobuf_log_unexpected(rbuf, __func__);
+				return -1;
+		}
+		iobuf_free_content(rbuf);
+		// There may be more already read.
+		if(dw->asfd->parse_readbuf(dw->asfd))
+			return -1;
+	}
+	return 0;
+}
+
+int delta_worker_failed(struct delta_worker *dw)
+{
+	return dw->asfd && dw->asfd->want_to_remove;
+}
@@ -0,0 +1,38 @@
+#ifndef _DELTA_WORKER_H
+#define _DELTA_WORKER_H
+
+#include "../rs_buf.h"
+
+struct asfd;
+struct async;
+
+// A child process that builds the signature hash table and generates the
+// delta for one changed file, so that the main process can carry on with
+// the network while it works. The delta comes back over a pipe as the
+// CMD_APPEND frames and the end of file frame that go to the server.
+struct delta_worker
+{
+	pid_t pid;
+	struct asfd *asfd; // Our end of the pipe, added to the async.
+	uint64_t bytes; // Size of the file, once the end of file has gone.
+	int done;
+};
+
+extern struct delta_worker *delta_worker_alloc(void);
+extern void delta_worker_free(struct delta_worker **dw);
+
+extern int delta_worker_start(struct delta_worker *dw, struct async *as,
+	rs_signature_t *sumset, struct BFILE *bfd);
+
+// Returns 1 if there is something from the worker to send.
+extern int delta_worker_ready(struct delta_worker *dw);
+
+// Passes whatever the worker has generated on to asfd, in order. Returns 1
+// once the end of file has been sent, 0 if there is more to come, or -1 on
+// error.
+extern int delta_worker_send(struct delta_worker *dw, struct asfd *asfd);
+
+// Returns 1 if the worker went away before finishing the delta.
+extern int delta_worker_failed(struct delta_worker *dw);
+
+#endif
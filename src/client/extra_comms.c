@@ -29,12 +29,53 @@ static const char *server_supports_autoupgrade(const char *feat)
 	return server_supports(feat, ":autoupgrade:");
 }
 
+// Returns the number of phase2 streams that the server will allow, or 1.
+static int server_supports_streams(const char *feat)
+{
+	int s;
+	const char *cp;
+	if(!(cp=server_supports(feat, ":phase2_streams=")))
+		return 1;
+	s=atoi(cp+strlen(":phase2_streams="));
+	if(s<1) return 1;
+	if(s>PHASE2_STREAMS_MAX) return PHASE2_STREAMS_MAX;
+	return s;
+}
+
+static int set_streams(struct asfd *asfd, struct conf **confs,
+	enum action action, const char *feat)
+{
+	int want=1;
+#ifndef HAVE_WIN32
+	int allowed;
+	char msg[64]="";
+	want=get_int(confs[OPT_PHASE2_STREAMS]);
+	allowed=server_supports_streams(feat);
+	if(action!=ACTION_BACKUP
+	  && action!=ACTION_BACKUP_TIMED)
+		want=1;
+	if(want>allowed)
+		want=allowed;
+	if(want>1)
+	{
+		snprintf(msg, sizeof(msg), "phase2_streams=%d", want);
+		if(asfd->write_str(asfd, CMD_GEN, msg))
+			return -1;
+	}
+	else
+		want=1;
+#endif
+	set_int(confs[OPT_PHASE2_STREAMS], want);
+	return 0;
+}
+
 #include <librsync.h>
 
 int extra_comms_client(struct async *as, struct conf **confs,
 	enum action *action, struct strlist *failover, char **incexc)
 {
 	int ret=-1;
+	int large_frames=0;
 	char *feat=NULL;
 	char *seed_src=NULL;
 	char *seed_dst=NULL;
@@ -277,6 +318,20 @@ int extra_comms_client(struct async *as, struct conf **confs,
 		}
 	}
 
+	if(set_streams(asfd, confs, *action, feat))
+		goto end;
+
+#ifndef HAVE_WIN32
+	// Not on Windows, where restored EFS data is handed over a frame at
+	// a time to a buffer of its own choosing.
+	if(server_supports(feat, ":large_frames:"))
+	{
+		if(asfd->write_str(asfd, CMD_GEN, "large_frames"))
+			goto end;
+		large_frames=1;
+	}
+#endif
+
 	if(asfd->write_str(asfd, CMD_GEN, "extra_comms_end")
 	  || asfd_read_expect(asfd, CMD_GEN, "extra_comms_end ok"))
 	{
@@ -284,6 +339,10 @@ int extra_comms_client(struct async *as, struct conf **confs,
 		goto end;
 	}
 
+	// The server switched straight after saying ok.
+	if(large_frames && asfd_set_large_frames(asfd))
+		goto end;
+
 	ret=0;
 end:
 	free_w(&feat);
@@ -52,11 +52,12 @@
 #include "../log.h"
 #include "../pathcmp.h"
 #include "../prepend.h"
-#include "../regexp.h"
 #include "../strlist.h"
 #include "cvss.h"
 #include "find.h"
 #include "find_logic.h"
+#include "find_match.h"
+#include "scan_cache.h"
 
 #ifdef HAVE_LINUX_OS
 #include <sys/statfs.h>
@@ -66,6 +67,8 @@
 #endif
 
 static int (*my_send_file)(struct asfd *, struct FF_PKT *, struct conf **);
+static struct find_match *fm=NULL;
+static struct scan_cache *sc=NULL;
 
 // Initialize the find files "global" variables
 struct FF_PKT *find_files_init(
@@ -84,55 +87,11 @@ struct FF_PKT *find_files_init(
 void find_files_free(struct FF_PKT **ff)
 {
 	linkhash_free();
+	find_match_free(&fm);
+	scan_cache_free(&sc);
 	free_v((void **)ff);
 }
 
-// Return 1 to include the file, 0 to exclude it.
-static int in_include_ext(struct strlist *incext, const char *fname)
-{
-	int i=0;
-	struct strlist *l;
-	const char *cp=NULL;
-	// If not doing include_ext, let the file get backed up.
-	if(!incext) return 1;
-
-	// The flag of the first item contains the maximum number of characters
-	// that need to be checked.
-	// FIX THIS: The next two functions do things very similar to this.
-	for(cp=fname+strlen(fname)-1; i<incext->flag && cp>=fname; cp--, i++)
-	{
-		if(*cp!='.') continue;
-		for(l=incext; l; l=l->next)
-			if(!strcasecmp(l->path, cp+1))
-				return 1;
-		// If file has no extension, it cannot be included.
-		return 0;
-	}
-	return 0;
-}
-
-static int in_exclude_ext(struct strlist *excext, const char *fname)
-{
-	int i=0;
-	struct strlist *l;
-	const char *cp=NULL;
-	// If not doing exclude_ext, let the file get backed up.
-	if(!excext) return 0;
-
-	// The flag of the first item contains the maximum number of characters
-	// that need to be checked.
-	for(cp=fname+strlen(fname)-1; i<excext->flag && cp>=fname; cp--, i++)
-	{
-		if(*cp!='.') continue;
-		for(l=excext; l; l=l->next)
-			if(!strcasecmp(l->path, cp+1))
-				return 1;
-		// If file has no extension, it is included.
-		return 0;
-	}
-	return 0;
-}
-
 // Returns the level of compression.
 int in_exclude_comp(struct strlist *excom, const char *fname, int compression)
 {
@@ -156,61 +115,7 @@ int in_exclude_comp(struct strlist *excom, const char *fname, int compression)
 	return compression;
 }
 
-/* Return 1 to include the file, 0 to exclude it. */
-int in_include_regex(struct strlist *increg, const char *fname)
-{
-	// If not doing include_regex, let the file get backed up.
-	if(!increg) return 1;
-	for(; increg; increg=increg->next)
-		if(regex_check(increg->re, fname))
-			return 1;
-	return 0;
-}
-
-static int in_exclude_regex(struct strlist *excreg, const char *fname)
-{
-	// If not doing exclude_regex, let the file get backed up.
-	for(; excreg; excreg=excreg->next)
-		if(regex_check(excreg->re, fname))
-			return 1;
-	return 0;
-}
-
-// When recursing into directories, do not want to check the include_ext list.
-#ifndef UTEST
-static
-#endif
-int file_is_included_no_incext(struct conf **confs, const char *fname)
-{
-	int ret=0;
-	int longest=0;
-	int matching=0;
-	struct strlist *l=NULL;
-	struct strlist *best=NULL;
-
-	if(in_exclude_ext(get_strlist(confs[OPT_EXCEXT]), fname)
-	  || in_exclude_regex(get_strlist(confs[OPT_EXCREG]), fname)
-		|| !in_include_regex(get_strlist(confs[OPT_INCREG]), fname))
-		return 0;
-
-	// Check include/exclude directories.
-	for(l=get_strlist(confs[OPT_INCEXCDIR]); l; l=l->next)
-	{
-		matching=is_subdir(l->path, fname);
-		if(matching>=longest)
-		{
-			longest=matching;
-			best=l;
-		}
-	}
-	if(!best) ret=0;
-	else ret=best->flag;
-
-	return ret;
-}
-
-static int file_is_included(struct conf **confs,
-	const char *fname, bool top_level)
+static int file_is_included(const char *fname, bool top_level)
 {
 	// Always save the top level directory.
 	// This will help in the simulation of browsing backups because it
@@ -221,9 +126,9 @@ static int file_is_included(struct conf **confs,
 	// in this example) as the stats of the parent directories (/home,
 	// for example). Trust me on this.
 	if(!top_level
-	  && !in_include_ext(get_strlist(confs[OPT_INCEXT]), fname)) return 0;
+	  && !find_match_incext(fm, fname)) return 0;
 
-	return file_is_included_no_incext(confs, fname);
+	return find_match_no_incext(fm, fname);
 }
 
 static int fs_change_is_allowed(struct conf **confs, const char *fname)
@@ -288,7 +193,12 @@ static int file_size_match(struct FF_PKT *ff_pkt, struct conf **confs)
 // Last checks before actually processing the file system entry.
 static int my_send_file_w(struct asfd *asfd, struct FF_PKT *ff, bool top_level, struct conf **confs)
 {
-	if(!file_is_included(confs, ff->fname, top_level)
+	// Before any of the checks, so that the next scan makes the same
+	// decisions.
+	if(sc && scan_cache_add_entry(sc, ff))
+		return -1;
+
+	if(!file_is_included(ff->fname, top_level)
 		|| is_logic_excluded(confs, ff)) return 0;
 
 	// Doing the file size match here also catches hard links.
@@ -426,11 +336,12 @@ static void windows_reparse_point_fiddling(struct FF_PKT *ff_pkt)
 // Prototype because process_entries_in_directory() recurses using find_files().
 static int find_files(struct asfd *asfd,
 	struct FF_PKT *ff_pkt, struct conf **confs,
-	char *fname, dev_t parent_device, bool top_level);
+	char *fname, dev_t parent_device, bool top_level, bool cached);
 
 static int process_entries_in_directory(struct asfd *asfd, char **nl,
 	int count, char **link, size_t len, size_t *link_len,
-	struct conf **confs, struct FF_PKT *ff_pkt, dev_t our_device)
+	struct conf **confs, struct FF_PKT *ff_pkt, dev_t our_device,
+	bool cached)
 {
 	int m=0;
 	int ret=0;
@@ -457,10 +368,11 @@ static int process_entries_in_directory(struct asfd *asfd, char **nl,
 		*q=0;
 		ff_pkt->flen=i;
 
-		if(file_is_included_no_incext(confs, *link))
+		if(find_match_no_incext(fm, *link))
 		{
 			ret=find_files(asfd, ff_pkt,
-				confs, *link, our_device, false /*top_level*/);
+				confs, *link, our_device, false /*top_level*/,
+				cached);
 		}
 		else
 		{
@@ -475,7 +387,7 @@ static int process_entries_in_directory(struct asfd *asfd, char **nl,
 					struct strlist *y;
 					if((ret=find_files(asfd, ff_pkt,
 						confs, x->path,
-						our_device, false)))
+						our_device, false, false)))
 							break;
 					// Now need to skip subdirectories of
 					// the thing that we just stuck in
@@ -504,6 +416,7 @@ static int found_directory(struct asfd *asfd,
 	size_t len;
 	int nbret=0;
 	int count=0;
+	int cached=0;
 	dev_t our_device;
 	char **nl=NULL;
 
@@ -576,8 +489,14 @@ static int found_directory(struct asfd *asfd,
 
 	ff_pkt->link=ff_pkt->fname;
 
+	// If the change journal says that nothing in the directory has
+	// changed, its entries come from the previous scan.
+	if(sc && (cached=scan_cache_replay_dir(sc, fname,
+		&ff_pkt->statp, &nl, &count))<0)
+			goto end;
+
 	errno=0;
-	switch(entries_in_directory_alphasort(fname,
+	if(!cached) switch(entries_in_directory_alphasort(fname,
 		&nl, &count, get_int(confs[OPT_ATIME]),
 		/* follow_symlinks */ 0))
 	{
@@ -589,10 +508,14 @@ static int found_directory(struct asfd *asfd,
 			goto end;
 	}
 
+	if(sc && scan_cache_add_dir(sc, fname, &ff_pkt->statp, nl, count))
+		goto end;
+
 	if(nl)
 	{
 		if(process_entries_in_directory(asfd, nl, count,
-			&link, len, &link_len, confs, ff_pkt, our_device))
+			&link, len, &link_len, confs, ff_pkt, our_device,
+			cached))
 				goto end;
 	}
 	ret=0;
@@ -643,11 +566,17 @@ static int find_files(
 	struct conf **confs,
 	char *fname,
 	dev_t parent_device,
-	bool top_level
+	bool top_level,
+	bool cached
 ) {
 	ff_pkt->fname=fname;
 	ff_pkt->link=fname;
 
+	// Only entries that are not directories come from the previous scan.
+	// Directories are always looked at, to see whether they changed.
+	if(cached && scan_cache_replay_entry(sc, fname, ff_pkt))
+		return my_send_file_w(asfd, ff_pkt, top_level, confs);
+
 #ifdef HAVE_WIN32
 	ff_pkt->use_winapi=get_use_winapi(
 		get_string(confs[OPT_REMOTE_DRIVES]),
@@ -695,6 +624,39 @@ static int find_files(
 int find_files_begin(struct asfd *asfd,
 	struct FF_PKT *ff_pkt, struct conf **confs, char *fname)
 {
+	// The rules are compiled the first time that they are needed, and
+	// kept until find_files_free().
+	if(!fm)
+	{
+		if(!(fm=find_match_alloc()))
+			return -1;
+		if(find_match_init(fm, confs))
+		{
+			find_match_free(&fm);
+			return -1;
+		}
+	}
 	return find_files(asfd, ff_pkt,
-		confs, fname, (dev_t)-1, 1 /* top_level */);
+		confs, fname, (dev_t)-1, 1 /* top_level */, false);
+}
+
+int find_files_journal_begin(struct conf **confs)
+{
+	if(!get_string(confs[OPT_CHANGE_JOURNAL]))
+		return 0;
+	if(!(sc=scan_cache_alloc())
+	  || scan_cache_open(sc, confs, SCAN_CACHE_SYNC_TIMEOUT))
+	{
+		scan_cache_free(&sc);
+		return -1;
+	}
+	return 0;
+}
+
+int find_files_journal_end(void)
+{
+	int ret=0;
+	if(sc) ret=scan_cache_close(sc);
+	scan_cache_free(&sc);
+	return ret;
 }
@@ -85,13 +85,14 @@ extern struct FF_PKT *find_files_init(
 extern void find_files_free(struct FF_PKT **ff);
 extern int find_files_begin(struct asfd *asfd,
 	struct FF_PKT *ff_pkt, struct conf **confs, char *fname);
+// With change_journal set, the directories that have not changed since the
+// previous scan are not read again. The scan cache for the next time is
+// only kept if find_files_journal_end() is reached.
+extern int find_files_journal_begin(struct conf **confs);
+extern int find_files_journal_end(void);
 // Returns the level of compression.
 extern int in_exclude_comp(struct strlist *excom, const char *fname,
 	int compression);
 
-#ifdef UTEST
-extern int file_is_included_no_incext(struct conf **confs, const char *fname);
-#endif
-
 
 #endif
@@ -37,17 +37,49 @@ typedef int TOKENS;
 #define EQ           11 // =
 #define PLACEHOLDER  99 // placeholder value
 
+// the kinds of compiled node
+#define LN_AND          1
+#define LN_OR           2
+#define LN_NOT          3
+#define LN_FILE_EXT     4
+#define LN_FILE_MATCH   5
+#define LN_PATH_MATCH   6
+#define LN_FILE_SIZE    7
+
+// an expression is compiled once into a tree of these, which is then
+// evaluated for each file without allocating anything
+struct lnode
+{
+	int type;
+	TOKENS cmp;          // for file_size
+	uint64_t size;       // for file_size
+	char *ext;           // for file_ext
+	regex_t *regex;      // for file_match and path_match
+	struct lnode *left;
+	struct lnode *right;
+	struct lnode *next;  // every node of an expression, to free them
+};
+
+// while compiling, a value is either known already, in 'val', or depends
+// on the file, in which case 'ln' says how to work it out and 'val' is
+// EVAL_FALSE so that it never looks like one of the other tokens
+struct value
+{
+	TOKENS val;
+	struct lnode *ln;
+};
+
 // a node contains a TOKEN with a reference to its successor and ancestor
 struct _node
 {
-	TOKENS val;
+	struct value v;
 
 	node *next;
 	node *prev;
 };
 
 // our expression will be converted in a doubly-linked list of nodes to ease
-// its evaluation
+// its compilation
 struct _dllist
 {
 	node *head;
@@ -65,25 +97,26 @@ struct tokens
 	int valid;
 };
 
-// an expression is a hash record to retrieve already parsed records
-struct expression
+// the result of compiling an expression
+struct compiled
 {
-	char *id;
-	struct tokens *tokens;
-	UT_hash_handle hh;
+	TOKENS val;          // the answer, if it does not depend on the file
+	struct lnode *root;  // otherwise, how to work it out
+	struct lnode *nodes;
+	int error;
 };
 
-// a cregex is a pre-compiled regex
-struct cregex
+// an expression is a hash record to retrieve already compiled records,
+// one for each default answer
+struct expression
 {
 	char *id;
-	regex_t *compiled;
+	struct compiled *compiled[2];
 	UT_hash_handle hh;
 };
 
-// these are some caches
-struct expression *cache=NULL;
-struct cregex *regex_cache=NULL;
+// this is our cache
+static struct expression *cache=NULL;
 
 static void free_tokens(struct tokens *ptr)
 {
@@ -92,17 +125,26 @@ static void free_tokens(struct tokens *ptr)
 	free_v((void **)&ptr);
 }
 
-static void free_expression(struct expression *ptr)
+static void free_compiled(struct compiled **c)
 {
-	if(!ptr) return;
-	free_tokens(ptr->tokens);
-	free_v((void **)&ptr);
+	struct lnode *ln;
+	if(!c || !*c) return;
+	while((ln=(*c)->nodes))
+	{
+		(*c)->nodes=ln->next;
+		free_w(&ln->ext);
+		regex_free(&ln->regex);
+		free_v((void **)&ln);
+	}
+	free_v((void **)c);
 }
 
-static void free_cregex(struct cregex *ptr)
+static void free_expression(struct expression *ptr)
 {
 	if(!ptr) return;
-	regex_free(&(ptr->compiled));
+	free_compiled(&ptr->compiled[0]);
+	free_compiled(&ptr->compiled[1]);
+	free_w(&ptr->id);
 	free_v((void **)&ptr);
 }
 
@@ -112,6 +154,76 @@ static void free_node(node **ptr)
 	free_v((void **)ptr);
 }
 
+static struct value v_static(TOKENS val)
+{
+	struct value v;
+	v.val=val;
+	v.ln=NULL;
+	return v;
+}
+
+static struct lnode *new_lnode(struct compiled *c, int type)
+{
+	struct lnode *ln;
+	if(!(ln=(struct lnode *)calloc_w(1, sizeof(*ln), __func__)))
+	{
+		c->error=1;
+		return NULL;
+	}
+	ln->type=type;
+	ln->next=c->nodes;
+	c->nodes=ln;
+	return ln;
+}
+
+static struct value v_dynamic(struct lnode *ln)
+{
+	struct value v;
+	v.val=EVAL_FALSE;
+	v.ln=ln;
+	return v;
+}
+
+// the compiled equivalent of 'left && right' and 'left || right'
+static struct value v_and_or(struct compiled *c,
+	struct value left, struct value right, int type)
+{
+	struct lnode *ln;
+	if(!left.ln && !right.ln)
+	{
+		if(type==LN_AND)
+			return v_static(left.val && right.val);
+		return v_static(left.val || right.val);
+	}
+	if(!left.ln || !right.ln)
+	{
+		struct value known=left.ln?right:left;
+		struct value unknown=left.ln?left:right;
+		if(type==LN_AND)
+			return known.val?unknown:v_static(EVAL_FALSE);
+		return known.val?v_static(EVAL_TRUE):unknown;
+	}
+	if(!(ln=new_lnode(c, type)))
+		return v_static(EVAL_FALSE);
+	ln->left=left.ln;
+	ln->right=right.ln;
+	return v_dynamic(ln);
+}
+
+// the compiled equivalent of '!value'
+static struct value v_not(struct compiled *c, struct value value)
+{
+	struct lnode *ln;
+	if(!value.ln)
+		return v_static(!value.val);
+	if(value.ln->type==LN_NOT)
+		return v_dynamic(value.ln->left);
+	if(!(ln=new_lnode(c, LN_NOT)))
+		return v_static(EVAL_FALSE);
+	ln->left=value.ln;
+	return v_dynamic(ln);
+}
+
 // append a node to a given list
 static void list_append(dllist **list, node *data)
 {
@@ -164,6 +276,7 @@ static void list_reset(dllist **list)
 		free_node(&tmp);
 		tmp=buf;
 	}
+	l->head=NULL;
 }
 
 static dllist *new_list(void)
@@ -176,11 +289,15 @@ static dllist *new_list(void)
 	return ret;
 }
 
-static node *new_node(int value)
+static node *new_node(struct compiled *c, struct value v)
 {
 	node *ret;
-	if(!(ret=(node *)malloc_w(sizeof(*ret), __func__))) return NULL;
-	ret->val=value;
+	if(!(ret=(node *)malloc_w(sizeof(*ret), __func__)))
+	{
+		c->error=1;
+		return NULL;
+	}
+	ret->v=v;
 	ret->next=NULL;
 	ret->prev=NULL;
 	return ret;
@@ -210,30 +327,17 @@ end:
 	return ret;
 }
 
-// we create our "expression" record to be cached
-static struct expression *parse_expression(char *expr)
-{
-	struct expression *ret=NULL;
-	struct tokens *toks;
-	if(!(toks=create_token_list(expr))) return ret;
-	if(!(ret=(struct expression *)malloc_w(sizeof(*ret), __func__))) goto error;
-	ret->tokens=toks;
-	ret->id=expr;
-	return ret;
-error:
-	free_tokens(toks);
-	return ret;
-}
-
 // search for the positions of the 'what' token in our tokens list
-static void find(dllist *toks, TOKENS what, int start, dllist **positions)
+static void find(struct compiled *c,
+	dllist *toks, TOKENS what, int start, dllist **positions)
 {
 	int i;
 	node *tmp;
 	for(i=0, tmp=toks->head; i<(int)toks->len; i++, tmp=tmp->next)
 	{
 		if(i<start) continue;  // skip the unwanted positions
-		if(tmp && tmp->val==what) list_append(positions, new_node(i));
+		if(tmp && tmp->v.val==what)
+			list_append(positions, new_node(c, v_static(i)));
 	}
 }
 
@@ -243,34 +347,37 @@ static void find(dllist *toks, TOKENS what, int start, dllist **positions)
 //       false or ( false or ( true or false ) )
 // 1 =>                      ^               ^   (true, 5, 9)
 // 2 =>           ^                            ^ (true, 2, 10)
-static void parens(dllist *toks, int *has, int *left, int *right)
+static void parens(struct compiled *c,
+	dllist *toks, int *has, int *left, int *right)
 {
 	dllist *positions;
+	*has=0;
+	*left=-1;
+	*right=-1;
 	if(!(positions=new_list()))
 	{
-		*has=0;
-		*left=-1;
-		*right=-1;
+		c->error=1;
 		return;
 	}
-	find(toks, LEFT_PARENS, 0, &positions);
+	find(c, toks, LEFT_PARENS, 0, &positions);
 	if(positions->len==0)
-	{
-		*has=0;
-		*left=-1;
-		*right=-1;
 		goto end;
-	}
-	*left=positions->tail->val;
+	*left=positions->tail->v.val;
 	list_reset(&positions);
-	find(toks, RIGHT_PARENS, *left+4, &positions);
+	find(c, toks, RIGHT_PARENS, *left+4, &positions);
 	if(positions->len==0)
 	{
 		// special case (token) instead of ( token or/and token )
 		list_reset(&positions);
-		find(toks, RIGHT_PARENS, *left+1, &positions);
+		find(c, toks, RIGHT_PARENS, *left+1, &positions);
 	}
-	*right=positions->head->val;
+	if(positions->len==0)
+	{
+		// a ')' before the last '(', which cannot be evaluated
+		c->error=1;
+		goto end;
+	}
+	*right=positions->head->v.val;
 	*has=1;
 end:
 	list_reset(&positions);
@@ -294,75 +401,78 @@ end:
 }
 
 // function 'file_ext'
-static int eval_file_ext(char *tok, const char *fname)
+static struct value compile_file_ext(struct compiled *c, char *tok)
 {
-	const char *cp;
-	int len;
+	struct lnode *ln;
 	char *strip=NULL;
-	if(!(len=strlen(tok))) goto end;
+	if(!strlen(tok)) goto end;
 	for(; *tok=='='; ++tok);
-	if(!(len=strlen(tok))) goto end;  // test again after we trimmed the '='
-	strip=strip_quotes(tok);
+	if(!strlen(tok)) goto end;  // test again after we trimmed the '='
+	if(!(strip=strip_quotes(tok))
+	  && !(strip=strdup_w(tok, __func__)))
+		goto error;
+	if(!(ln=new_lnode(c, LN_FILE_EXT)))
+		goto error;
+	ln->ext=strip;
+	return v_dynamic(ln);
+error:
+	c->error=1;
+	free_w(&strip);
+end:
+	return v_static(EVAL_FALSE);
+}
+
+static int eval_file_ext(struct lnode *ln, const char *fname)
+{
+	const char *cp;
 	for(cp=fname+strlen(fname)-1; cp>=fname; cp--)
 	{
 		if(*cp!='.') continue;
-		if((strip && !strcasecmp(strip, cp+1))
-		   || (!strip && !strcasecmp(tok, cp+1)))
+		if(!strcasecmp(ln->ext, cp+1))
 			return EVAL_TRUE;
 	}
-end:
-	free_w(&strip);
 	return EVAL_FALSE;
 }
 
-// function 'path_match'
-static int eval_path_match(char *tok, const char *fname)
+// functions 'path_match' and 'file_match'
+static struct value compile_match(struct compiled *c, char *tok, int type)
 {
-	int ret=EVAL_FALSE;
-	struct cregex *reg;
+	struct lnode *ln;
+	regex_t *regex;
 	char *strip=NULL;
 	if(strlen(tok)==0) goto end;
 	for(; *tok=='='; ++tok);
 	if(strlen(tok)==0) goto end;  // test again after we trimmed the '='
-	if(regex_cache)
-		HASH_FIND_STR(regex_cache, tok, reg);
+	if((strip=strip_quotes(tok)))
+		regex=regex_compile_backup(strip);
 	else
-		reg=NULL;
-	if(!reg)
+		regex=regex_compile_backup(tok);
+	free_w(&strip);
+	// an expression that does not compile never matches
+	if(!regex) goto end;
+	if(!(ln=new_lnode(c, type)))
 	{
-		regex_t *tmp;
-		if((strip=strip_quotes(tok)))
-			tmp=regex_compile_backup(strip);
-		else
-			tmp=regex_compile_backup(tok);
-		if(!(reg=(struct cregex *)malloc_w(sizeof(*reg), __func__)))
-		{
-			regex_free(&tmp);
-			goto end;
-		}
-		reg->id=strdup_w(tok, __func__);
-		reg->compiled=tmp;
-		HASH_ADD_KEYPTR(hh, regex_cache, reg->id, strlen(reg->id), reg);
+		regex_free(&regex);
+		goto end;
 	}
-	if(regex_check(reg->compiled, fname))
-		ret=EVAL_TRUE;
+	ln->regex=regex;
+	return v_dynamic(ln);
 end:
-	free_w(&strip);
-	return ret;
+	return v_static(EVAL_FALSE);
 }
 
 // function 'file_match'
-static int eval_file_match(char *tok, const char *fname)
+static int eval_file_match(struct lnode *ln, const char *fname)
 {
 	int len=strlen(fname);
 	for(; len>0 && fname[len-1]!='/'; len--);
-	return eval_path_match(tok, fname+len);
+	return regex_check(ln->regex, fname+len);
 }
 
 // function 'file_size'
-static int eval_file_size(char *tok, uint64_t filesize)
+static struct value compile_file_size(struct compiled *c, char *tok)
 {
-	int ret=EVAL_FALSE;
+	struct lnode *ln;
 	char *strip=NULL;
 	TOKENS eval=PLACEHOLDER;
 	uint64_t s=0;
@@ -397,56 +507,68 @@ static int eval_file_size(char *tok, uint64_t filesize)
 				break;
 		}
 	}
+	switch(eval)
+	{
+		case LT:
+		case LTE:
+		case GT:
+		case GTE:
+		case EQ:
+			break;
+		default:
+			goto end;
+	}
 	if((strip=strip_quotes(tok)))
 		get_file_size(strip, &s, NULL, -1);
 	else
 		get_file_size(tok, &s, NULL, -1);
-	switch(eval)
+	free_w(&strip);
+	if(!(ln=new_lnode(c, LN_FILE_SIZE)))
+		goto end;
+	ln->cmp=eval;
+	ln->size=s;
+	return v_dynamic(ln);
+end:
+	return v_static(EVAL_FALSE);
+}
+
+static int eval_file_size(struct lnode *ln, uint64_t filesize)
+{
+	switch(ln->cmp)
 	{
 		case LT:
-			ret=filesize<s;
-			break;
+			return filesize<ln->size;
 		case LTE:
-			ret=filesize<=s;
-			break;
+			return filesize<=ln->size;
 		case GT:
-			ret=filesize>s;
-			break;
+			return filesize>ln->size;
 		case GTE:
-			ret=filesize>=s;
-			break;
+			return filesize>=ln->size;
 		case EQ:
-			ret=filesize==s;
-			break;
+			return filesize==ln->size;
 		default:
-			ret=EVAL_FALSE;
+			return EVAL_FALSE;
 	}
-end:
-	free_w(&strip);
-	return ret;
 }
 
 // search what function to use
-static int eval_func(char *tok, const char *filename, uint64_t filesize)
+static struct value compile_func(struct compiled *c, char *tok)
 {
-	int ret;
 	if(!strncmp(tok, "file_ext", 8))
-		ret=eval_file_ext(tok+8, filename);
+		return compile_file_ext(c, tok+8);
 	else if(!strncmp(tok, "file_match", 10))
-		ret=eval_file_match(tok+10, filename);
+		return compile_match(c, tok+10, LN_FILE_MATCH);
 	else if(!strncmp(tok, "path_match", 10))
-		ret=eval_path_match(tok+10, filename);
+		return compile_match(c, tok+10, LN_PATH_MATCH);
 	else if(!strncmp(tok, "file_size", 9))
-		ret=eval_file_size(tok+9, filesize);
-	else
-		ret=EVAL_FALSE;
-	return ret;
+		return compile_file_size(c, tok+9);
+	return v_static(EVAL_FALSE);
 }
 
 // convert a string token into a TOKENS
-static node *str_to_node(char *tok, const char *filename, uint64_t filesize)
+static node *str_to_node(struct compiled *c, char *tok)
 {
-	int ret;
+	TOKENS ret;
 	if(!strncmp(tok, "and", 3))
 		ret=AND_FUNC;
 	else if(!strncmp(tok, "or", 2))
@@ -458,42 +580,42 @@ static node *str_to_node(char *tok, const char *filename, uint64_t filesize)
 	else if(!strncmp(tok, "not", 3))
 		ret=NOT;
 	else
-		ret=eval_func(tok, filename, filesize);
-	return new_node(ret);
+		return new_node(c, compile_func(c, tok));
+	return new_node(c, v_static(ret));
 }
 
-// evaluate a trio of tokens like 'true or false'
-static int eval_triplet(node *head, int def)
+// compile a trio of tokens like 'true or false'
+static struct value eval_triplet(struct compiled *c, node *head, int def)
 {
-	TOKENS left, func, right;
-	left=head->val;
-	func=head->next->val;
-	right=head->next->next->val;
-	switch(func)
+	struct value left, func, right;
+	left=head->v;
+	func=head->next->v;
+	right=head->next->next->v;
+	switch(func.val)
 	{
 		case AND_FUNC:
-			return left && right;
+			return v_and_or(c, left, right, LN_AND);
 		case OR_FUNC:
-			return left || right;
+			return v_and_or(c, left, right, LN_OR);
 		default:
-			return def;
+			return v_static(def);
 	}
 }
 
-// factorise tokens by recursively evaluating them
-static int bool_eval(dllist **tokens, int def)
+// factorise tokens by recursively compiling them
+static struct value bool_eval(struct compiled *c, dllist **tokens, int def)
 {
 	dllist *toks=*tokens;
 	if(toks->len==1)
-		return toks->head->val;
+		return toks->head->v;
 	else if(toks->len==2)
 	{
-		switch(toks->head->val)
+		switch(toks->head->v.val)
 		{
 			case NOT:
-				return !toks->tail->val;
+				return v_not(c, toks->tail->v);
 			default:
-				return toks->tail->val;
+				return toks->tail->v;
 		}
 	}
 	/* here we search for 'not' tokens */
@@ -504,7 +626,7 @@ static int bool_eval(dllist **tokens, int def)
 		int negate=0, is_negation=0;
 		for(tmp=toks->head; tmp; tmp=tmp->next)
 		{
-			if(tmp->val==NOT)
+			if(tmp->v.val==NOT)
 			{
 				is_negation=1;
 				break;
@@ -512,21 +634,27 @@ static int bool_eval(dllist **tokens, int def)
 		}
 		if(is_negation)
 		{
-			if(!(new_tokens=new_list())) return 0;
+			if(!(new_tokens=new_list()))
+			{
+				c->error=1;
+				return v_static(EVAL_FALSE);
+			}
 			for(tmp=toks->head; tmp; tmp=tmp->next)
 			{
-				if(tmp->val==NOT)
+				if(tmp->v.val==NOT)
 					negate=!negate;
 				else
 				{
 					if(negate)
 					{
-						list_append(&new_tokens, new_node(!(tmp->val)));
+						list_append(&new_tokens,
+						  new_node(c, v_not(c, tmp->v)));
 						negate=0;
 					}
 					else
 					{
-						list_append(&new_tokens, new_node(tmp->val));
+						list_append(&new_tokens,
+						  new_node(c, tmp->v));
 					}
 				}
 			}
@@ -537,139 +665,205 @@ static int bool_eval(dllist **tokens, int def)
 		}
 	}
 	/* here we don't have any negations anymore, but we may have chains of
-	 * expressions to evaluate recursively */
+	 * expressions to compile recursively */
 	if(toks->len>3)
 	{
 		node *tmp;
 		dllist *new_tokens;
 		int i;
-		tmp=new_node(eval_triplet(toks->head, def));
+		tmp=new_node(c, eval_triplet(c, toks->head, def));
 		if(!(new_tokens=new_list()))
 		{
+			c->error=1;
 			free_node(&tmp);
-			return 0;
+			return v_static(EVAL_FALSE);
 		}
 		list_append(&new_tokens, tmp);
 		for(tmp=toks->head, i=0; tmp; tmp=tmp->next, i++)
 		{
 			if(i<3) continue;
-			list_append(&new_tokens, new_node(tmp->val));
+			list_append(&new_tokens, new_node(c, tmp->v));
 		}
 		list_reset(tokens);
 		free_v((void **)tokens);
 		*tokens=new_tokens;
 		toks=*tokens;
-		return bool_eval(tokens, def);
+		return bool_eval(c, tokens, def);
 	}
-	if(toks->len%3!=0) return def;
-	return eval_triplet(toks->head, def);
+	if(toks->len%3!=0) return v_static(def);
+	return eval_triplet(c, toks->head, def);
 }
 
-// evaluate our list of tokens
-static int eval_parsed_expression(dllist **tokens, int def)
+// compile our list of tokens
+static struct value eval_parsed_expression(struct compiled *c,
+	dllist **tokens, int def)
 {
 	dllist *toks=*tokens, *sub;
 	node *begin, *end, *tmp;
 	int has, left, right, count;
-	if(!toks || toks->len==0) return def;
-	if(toks->len==1) return toks->head->val;
-	parens(toks, &has, &left, &right);
-	// we don't have parentheses, we can evaluate the tokens
+	if(c->error) return v_static(def);
+	if(!toks || toks->len==0) return v_static(def);
+	if(toks->len==1) return toks->head->v;
+	parens(c, toks, &has, &left, &right);
+	if(c->error) return v_static(def);
+	// we don't have parentheses, we can compile the tokens
 	if(!has)
-		return bool_eval(tokens, def);
+		return bool_eval(c, tokens, def);
 	// we have parentheses
 	// we retrieve the two nodes '(' and ')'
 	begin=list_get_node_by_id(toks, left);
 	end=list_get_node_by_id(toks, right);
 	// then we capture only the tokens surrounded by the parentheses
-	if(!(sub=new_list())) return def;
+	if(!(sub=new_list()))
+	{
+		c->error=1;
+		return v_static(def);
+	}
 	tmp=begin->next;
 	count=0;
 	while(tmp && count<right-left-1)
 	{
-		list_append(&sub, new_node(tmp->val));
+		list_append(&sub, new_node(c, tmp->v));
 		tmp=tmp->next;
 		count++;
 	}
 	count++;
-	// evaluate the inner expression
-	tmp=new_node(bool_eval(&sub, def));
-	// we replace all the tokens parentheses included with the new computed node
-	// first element of the list
-	if(!begin->prev)
-		(*tokens)->head=tmp;
-	else if (!end->next)  // last element of the list
-		(*tokens)->tail=tmp;
+	// compile the inner expression
+	if(sub->len)
+		tmp=new_node(c, bool_eval(c, &sub, def));
+	else
+		tmp=NULL;
+	list_reset(&sub);
+	free_v((void **)&sub);
+	if(!tmp)
+	{
+		c->error=1;
+		return v_static(def);
+	}
+	// we replace all the tokens parentheses included with the new
+	// computed node
 	toks->len-=count;  // decrement our list size
 	tmp->prev=begin->prev;
 	tmp->next=end->next;
 	if(begin->prev)
 		begin->prev->next=tmp;
-	else if(end->next)
+	else
+		toks->head=tmp;
+	if(end->next)
 		end->next->prev=tmp;
+	else
+		toks->tail=tmp;
 	// cleanup "orphans" nodes
-	tmp=begin;
-	while(tmp && count>=0)
+	end->next=NULL;
+	while(begin)
 	{
-		if(tmp)
-		{
-			node *buf=tmp->next;
-			free_node(&tmp);
-			tmp=buf;
-			count--;
-		}
+		node *buf=begin->next;
+		free_node(&begin);
+		begin=buf;
 	}
-	list_reset(&sub);
-	free_v((void **)&sub);
-	return eval_parsed_expression(tokens, def);
+	return eval_parsed_expression(c, tokens, def);
 }
 
-static int eval_expression(char *expr, const char *filename, uint64_t filesize, int def)
+static struct compiled *compile_expression(char *expr, int def)
 {
-	int ret=def, i;
-	struct expression *parsed;
+	size_t i;
+	struct value v;
+	struct tokens *parsed=NULL;
+	struct compiled *c=NULL;
 	dllist *tokens=NULL;
-	if(cache)
-		HASH_FIND_STR(cache, expr, parsed);
-	else
-		parsed=NULL;
-	if(!parsed)
+	if(!(c=(struct compiled *)calloc_w(1, sizeof(*c), __func__)))
+		return NULL;
+	c->val=def;
+	// an expression without any spaces does not split into tokens, and
+	// gets the default
+	if(!(parsed=create_token_list(expr))
+	  || !parsed->valid)
+		goto end;
+	if(!(tokens=new_list())) goto error;
+	for(i=0; i<parsed->size; i++)
+		list_append(&tokens, str_to_node(c, parsed->list[i]));
+	if(c->error) goto error;
+	v=eval_parsed_expression(c, &tokens, def);
+	if(c->error)
 	{
-		if(!(parsed=parse_expression(expr))) return def;
-		HASH_ADD_KEYPTR(hh, cache, parsed->id, strlen(parsed->id), parsed);
+		// it cannot be evaluated, so it gets the default
+		c->error=0;
+		goto end;
 	}
-	if(!parsed || !parsed->tokens->valid) goto end;
-	if(!(tokens=new_list())) goto end;
-	for(i=0; i<(int)parsed->tokens->size; i++)
-		list_append(&tokens, str_to_node(parsed->tokens->list[i], filename, filesize));
-	ret=eval_parsed_expression(&tokens, def);
+	c->val=v.val;
+	c->root=v.ln;
 end:
 	list_reset(&tokens);
 	free_v((void **)&tokens);
-	return ret;
+	free_tokens(parsed);
+	return c;
+error:
+	list_reset(&tokens);
+	free_v((void **)&tokens);
+	free_tokens(parsed);
+	free_compiled(&c);
+	return NULL;
 }
 
-// cleanup our caches
-void free_logic_cache(void)
+static int eval_lnode(struct lnode *ln, const char *fname, uint64_t filesize)
 {
-	struct expression *parsed, *tmp;
-	struct cregex *reg, *tmp2;
-	if(cache)
+	switch(ln->type)
 	{
-		HASH_ITER(hh, cache, parsed, tmp)
-		{
-			HASH_DEL(cache, parsed);
-			free_expression(parsed);
-		}
+		case LN_AND:
+			return eval_lnode(ln->left, fname, filesize)
+			  && eval_lnode(ln->right, fname, filesize);
+		case LN_OR:
+			return eval_lnode(ln->left, fname, filesize)
+			  || eval_lnode(ln->right, fname, filesize);
+		case LN_NOT:
+			return !eval_lnode(ln->left, fname, filesize);
+		case LN_FILE_EXT:
+			return eval_file_ext(ln, fname);
+		case LN_FILE_MATCH:
+			return eval_file_match(ln, fname);
+		case LN_PATH_MATCH:
+			return regex_check(ln->regex, fname);
+		case LN_FILE_SIZE:
+			return eval_file_size(ln, filesize);
+		default:
+			return EVAL_FALSE;
 	}
-	if(regex_cache)
+}
+
+// expressions are compiled the first time that they are seen, and after
+// that evaluating them does not allocate anything
+static int eval_expression(char *expr, const char *filename, uint64_t filesize, int def)
+{
+	struct expression *e;
+	struct compiled **c;
+	HASH_FIND_STR(cache, expr, e);
+	if(!e)
 	{
-		HASH_ITER(hh, regex_cache, reg, tmp2)
+		if(!(e=(struct expression *)calloc_w(1, sizeof(*e), __func__)))
+			return def;
+		if(!(e->id=strdup_w(expr, __func__)))
 		{
-			HASH_DEL(regex_cache, reg);
-			free_w(&(reg->id));
-			free_cregex(reg);
+			free_expression(e);
+			return def;
 		}
+		HASH_ADD_KEYPTR(hh, cache, e->id, strlen(e->id), e);
+	}
+	c=&e->compiled[def?1:0];
+	if(!*c && !(*c=compile_expression(expr, def)))
+		return def;
+	if(!(*c)->root)
+		return (*c)->val;
+	return eval_lnode((*c)->root, filename, filesize);
+}
+
+// cleanup our cache
+void free_logic_cache(void)
+{
+	struct expression *e, *tmp;
+	HASH_ITER(hh, cache, e, tmp)
+	{
+		HASH_DEL(cache, e);
+		free_expression(e);
 	}
 }
 
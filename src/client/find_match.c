@@ -0,0 +1,338 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../conf.h"
+#include "../regexp.h"
+#include "../strlist.h"
+#include "find_match.h"
+
+#include <uthash.h>
+
+struct ext
+{
+	char *id;
+	UT_hash_handle hh;
+};
+
+struct ext_table
+{
+	// The flag of the first item of the list, which is the maximum number
+	// of characters that need to be checked.
+	long window;
+	size_t longest;
+	struct ext *hash;
+	char *buf;
+};
+
+struct dir_rule
+{
+	char *id;
+	int depth;
+	long index;
+	long flag;
+	UT_hash_handle hh;
+};
+
+struct regex_set
+{
+	struct strlist *list;
+	regex_t *combined;
+};
+
+struct find_match
+{
+	struct strlist *incext_list;
+	struct ext_table incext;
+	struct ext_table excext;
+	struct dir_rule *dirs;
+	// What a path under none of the directories gets.
+	long dirs_default;
+	struct regex_set increg;
+	struct regex_set excreg;
+};
+
+struct find_match *find_match_alloc(void)
+{
+	return (struct find_match *)
+		calloc_w(1, sizeof(struct find_match), __func__);
+}
+
+static void lower_copy(char *dst, const char *src)
+{
+	for(; *src; src++)
+		*dst++=tolower((unsigned char)*src);
+	*dst='\0';
+}
+
+static int ext_table_init(struct ext_table *e, struct strlist *list)
+{
+	struct ext *x;
+	struct strlist *l;
+
+	if(!list) return 0;
+	e->window=list->flag;
+	for(l=list; l; l=l->next)
+	{
+		size_t len=strlen(l->path);
+		if(len>e->longest) e->longest=len;
+	}
+	if(!(e->buf=(char *)malloc_w(e->longest+1, __func__)))
+		return -1;
+	for(l=list; l; l=l->next)
+	{
+		lower_copy(e->buf, l->path);
+		HASH_FIND_STR(e->hash, e->buf, x);
+		if(x) continue;
+		if(!(x=(struct ext *)calloc_w(1, sizeof(struct ext), __func__))
+		  || !(x->id=strdup_w(e->buf, __func__)))
+		{
+			free_v((void **)&x);
+			return -1;
+		}
+		HASH_ADD_KEYPTR(hh, e->hash, x->id, strlen(x->id), x);
+	}
+	return 0;
+}
+
+static void ext_table_free(struct ext_table *e)
+{
+	struct ext *x;
+	struct ext *tmp;
+	HASH_ITER(hh, e->hash, x, tmp)
+	{
+		HASH_DEL(e->hash, x);
+		free_w(&x->id);
+		free_v((void **)&x);
+	}
+	free_w(&e->buf);
+}
+
+// Return 1 if the extension of the file is in the table.
+static int ext_table_match(struct ext_table *e, const char *fname)
+{
+	long i=0;
+	struct ext *x;
+	const char *cp=NULL;
+
+	for(cp=fname+strlen(fname)-1; i<e->window && cp>=fname; cp--, i++)
+	{
+		if(*cp!='.') continue;
+		if(strlen(cp+1)>e->longest)
+			return 0;
+		lower_copy(e->buf, cp+1);
+		HASH_FIND_STR(e->hash, e->buf, x);
+		return x!=NULL;
+	}
+	return 0;
+}
+
+static int dirs_init(struct find_match *fm, struct strlist *list)
+{
+	long index=0;
+	const char *cp;
+	struct strlist *l;
+	struct dir_rule *d;
+
+	for(l=list; l; l=l->next, index++)
+	{
+		HASH_FIND(hh, fm->dirs, l->path, strlen(l->path), d);
+		if(!d)
+		{
+			if(!(d=(struct dir_rule *)calloc_w(1,
+				sizeof(struct dir_rule), __func__))
+			  || !(d->id=strdup_w(l->path, __func__)))
+			{
+				free_v((void **)&d);
+				return -1;
+			}
+			d->depth=1;
+			for(cp=d->id; *cp; cp++)
+				if(*cp=='/') d->depth++;
+			HASH_ADD_KEYPTR(hh, fm->dirs, d->id, strlen(d->id), d);
+		}
+		// When two rules are as deep as each other, the later one
+		// wins.
+		d->index=index;
+		d->flag=l->flag;
+		fm->dirs_default=l->flag;
+	}
+	return 0;
+}
+
+static void dirs_free(struct find_match *fm)
+{
+	struct dir_rule *d;
+	struct dir_rule *tmp;
+	HASH_ITER(hh, fm->dirs, d, tmp)
+	{
+		HASH_DEL(fm->dirs, d);
+		free_w(&d->id);
+		free_v((void **)&d);
+	}
+}
+
+// Gives the same answer as checking is_subdir() against every rule and
+// taking the deepest. The only rules that can be a parent of the path are
+// the ones that end where the path has a '/', or just after one, or at its
+// end, so they are the only ones looked up.
+static long dirs_match(struct find_match *fm, const char *fname)
+{
+	size_t i;
+	size_t len=strlen(fname);
+	struct dir_rule *d;
+	struct dir_rule *best=NULL;
+
+	for(i=0; i<=len; i++)
+	{
+		if(i<len && fname[i]!='/' && !(i && fname[i-1]=='/'))
+			continue;
+		HASH_FIND(hh, fm->dirs, fname, i, d);
+		if(!d) continue;
+		if(!best
+		  || d->depth>best->depth
+		  || (d->depth==best->depth && d->index>best->index))
+			best=d;
+	}
+	if(!best) return fm->dirs_default;
+	return best->flag;
+}
+
+static const char *skip_bracket(const char *cp)
+{
+	cp++;
+	if(*cp=='^') cp++;
+	if(*cp==']') cp++;
+	for(; *cp; cp++)
+	{
+		if(*cp=='['
+		  && (*(cp+1)==':' || *(cp+1)=='.' || *(cp+1)=='='))
+		{
+			char c=*(cp+1);
+			for(cp+=2; *cp && !(*cp==c && *(cp+1)==']'); cp++) { }
+			if(!*cp) return NULL;
+			cp++;
+			continue;
+		}
+		if(*cp==']') return cp;
+	}
+	return NULL;
+}
+
+// Back references and their like refer to groups by number, and the
+// numbers change when the expressions are put together. An expression
+// that only compiled because of an unmatched ')' would also change.
+static int can_combine(const char *str)
+{
+	int depth=0;
+	const char *cp;
+	for(cp=str; *cp; cp++)
+	{
+		switch(*cp)
+		{
+			case '\\':
+				cp++;
+				if(!*cp || isdigit((unsigned char)*cp)
+				  || *cp=='g' || *cp=='k' || *cp=='Q')
+					return 0;
+				break;
+			case '[':
+				if(!(cp=skip_bracket(cp)))
+					return 0;
+				break;
+			case '(':
+				if(*(cp+1)=='?')
+					return 0;
+				depth++;
+				break;
+			case ')':
+				if(--depth<0)
+					return 0;
+				break;
+		}
+	}
+	return !depth;
+}
+
+static int regex_set_init(struct regex_set *r, struct strlist *list)
+{
+	char *str;
+	size_t len=1;
+	struct strlist *l;
+
+	r->list=list;
+	for(l=list; l; l=l->next)
+	{
+		if(!l->re || !can_combine(l->path))
+			return 0;
+		len+=strlen(l->path)+3;
+	}
+	if(!list) return 0;
+
+	if(!(str=(char *)malloc_w(len, __func__)))
+		return -1;
+	*str='\0';
+	for(l=list; l; l=l->next)
+	{
+		if(l!=list) strcat(str, "|");
+		strcat(str, "(");
+		strcat(str, l->path);
+		strcat(str, ")");
+	}
+	// If it does not compile, each expression is tried in turn, as
+	// before.
+	r->combined=regex_compile_backup_nosub(str);
+	free_w(&str);
+	return 0;
+}
+
+static int regex_set_match(struct regex_set *r, const char *fname)
+{
+	struct strlist *l;
+	if(r->combined)
+		return regex_check(r->combined, fname);
+	for(l=r->list; l; l=l->next)
+		if(regex_check(l->re, fname))
+			return 1;
+	return 0;
+}
+
+int find_match_init(struct find_match *fm, struct conf **confs)
+{
+	fm->incext_list=get_strlist(confs[OPT_INCEXT]);
+	if(ext_table_init(&fm->incext, fm->incext_list)
+	  || ext_table_init(&fm->excext, get_strlist(confs[OPT_EXCEXT]))
+	  || dirs_init(fm, get_strlist(confs[OPT_INCEXCDIR]))
+	  || regex_set_init(&fm->increg, get_strlist(confs[OPT_INCREG]))
+	  || regex_set_init(&fm->excreg, get_strlist(confs[OPT_EXCREG])))
+		return -1;
+	return 0;
+}
+
+void find_match_free(struct find_match **fm)
+{
+	if(!fm || !*fm) return;
+	ext_table_free(&(*fm)->incext);
+	ext_table_free(&(*fm)->excext);
+	dirs_free(*fm);
+	regex_free(&(*fm)->increg.combined);
+	regex_free(&(*fm)->excreg.combined);
+	free_v((void **)fm);
+}
+
+int find_match_incext(struct find_match *fm, const char *fname)
+{
+	// If not doing include_ext, let the file get backed up.
+	if(!fm->incext_list) return 1;
+	return ext_table_match(&fm->incext, fname);
+}
+
+// When recursing into directories, do not want to check the include_ext list.
+int find_match_no_incext(struct find_match *fm, const char *fname)
+{
+	if(ext_table_match(&fm->excext, fname)
+	  || regex_set_match(&fm->excreg, fname)
+	  || (fm->increg.list && !regex_set_match(&fm->increg, fname)))
+		return 0;
+
+	// Check include/exclude directories.
+	return (int)dirs_match(fm, fname);
+}
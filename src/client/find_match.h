@@ -0,0 +1,20 @@
+#ifndef _FIND_MATCH_H
+#define _FIND_MATCH_H
+
+struct find_match;
+
+// The include and exclude rules, compiled once so that deciding about a
+// path does not mean walking every rule. The extensions go in hash tables,
+// the include and exclude directories go in a hash table that is looked up
+// at each '/' of the path, and each list of regular expressions becomes a
+// single regular expression where possible. The answers are the same as
+// walking the lists from the configuration.
+extern struct find_match *find_match_alloc(void);
+extern int find_match_init(struct find_match *fm, struct conf **confs);
+extern void find_match_free(struct find_match **fm);
+
+// Return 1 to include the file, 0 to exclude it.
+extern int find_match_incext(struct find_match *fm, const char *fname);
+extern int find_match_no_incext(struct find_match *fm, const char *fname);
+
+#endif
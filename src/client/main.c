@@ -290,6 +290,8 @@ static int ssl_setup(int *rfd, SSL **ssl, SSL_CTX **ctx,
 		}
 		case ACTION_CHAMP_CHOOSER:
 		case ACTION_ESTIMATE:
+		case ACTION_SCRUB:
+		case ACTION_CHANGE_JOURNAL:
 		case ACTION_STATUS:
 		case ACTION_STATUS_SNAPSHOT:
 		case ACTION_UNSET:
@@ -491,6 +493,9 @@ static enum cliret do_client(struct conf **confs,
 			goto end;
 		asfd->set_timeout(asfd, get_int(confs[OPT_NETWORK_TIMEOUT]));
 		asfd->ratelimit=get_float(confs[OPT_RATELIMIT]);
+		asfd->set_write_batch(asfd,
+			get_int(confs[OPT_WRITE_BATCH_BYTES]),
+			get_int(confs[OPT_WRITE_BATCH_MS]));
 
 		// Set quality of service bits on backup packets.
 		if(act==ACTION_BACKUP
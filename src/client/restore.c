@@ -12,6 +12,7 @@
 #include "../log.h"
 #include "../prepend.h"
 #include "cvss.h"
+#include "restore_finish.h"
 #include "restore_switch.h"
 #include "restore.h"
 
@@ -325,7 +326,8 @@ end:
 }
 
 int restore_dir(struct asfd *asfd, struct sbuf *sb,
-	const char *dname, enum action act, struct cntr *cntr)
+	const char *dname, enum action act, struct cntr *cntr,
+	struct restore_finish *rf)
 {
 	int ret=0;
 	char *rpath=NULL;
@@ -346,6 +348,13 @@ int restore_dir(struct asfd *asfd, struct sbuf *sb,
 				goto end;
 			}
 		}
+		// The attributes might stop the finishers getting at
+		// what is in the directory.
+		else if(rf && restore_finish_wait(rf, rpath))
+		{
+			ret=-1;
+			goto end;
+		}
 		attribs_set(asfd, rpath, &(sb->statp), sb->winattr, cntr);
 		if(!ret) cntr_add(cntr, sb->path.cmd, 1);
 	}
@@ -726,6 +735,8 @@ int do_restore_client(struct asfd *asfd,
 	char msg[512]="";
 	struct sbuf *sb=NULL;
 	struct BFILE *bfd=NULL;
+	struct restore_finish *rf=NULL;
+	struct bfile_restore br;
 	char *fullpath=NULL;
 	char *style=NULL;
 	char *restore_desired_dir=NULL;
@@ -769,6 +780,18 @@ int do_restore_client(struct asfd *asfd,
 	bfile_init(bfd, 0, 0, cntr);
 	bfd->set_attribs_on_close=1;
 
+	br.sparse=get_int(confs[OPT_RESTORE_SPARSE]);
+	br.preallocate=get_int(confs[OPT_RESTORE_PREALLOCATE]);
+	br.buffer=0;
+	if(get_int(confs[OPT_RESTORE_WRITE_BUFFER])>0)
+		br.buffer=(size_t)get_int(confs[OPT_RESTORE_WRITE_BUFFER]);
+
+	if(!(rf=restore_finish_alloc())
+	  || restore_finish_init(rf, asfd, cntr,
+		act==ACTION_RESTORE?get_int(confs[OPT_RESTORE_FINISHERS]):0,
+		get_int(confs[OPT_RESTORE_FSYNC])))
+			goto error;
+
 	snprintf(msg, sizeof(msg), "%s%s %s:%s",
 		act_str(act),
 		restore_list?" restore_list":"",
@@ -824,8 +847,9 @@ int do_restore_client(struct asfd *asfd,
 		switch(sbuf_fill_from_net(sb, asfd, cntr))
 		{
 			case 0: break;
-			case 1: if(asfd->write_str(asfd, CMD_GEN,
-				"restoreend ok")) goto error;
+			case 1: if(restore_finish_end(rf)
+				  || asfd->write_str(asfd, CMD_GEN,
+					"restoreend ok")) goto error;
 				goto end; // It was OK.
 			default:
 			case -1: goto error;
@@ -931,7 +955,8 @@ int do_restore_client(struct asfd *asfd,
 		switch(sb->path.cmd)
 		{
 			case CMD_DIRECTORY:
-				if(restore_dir(asfd, sb, fullpath, act, cntr))
+				if(restore_dir(asfd, sb, fullpath, act, cntr,
+					rf))
 					goto error;
 				continue;
 			case CMD_SOFT_LINK:
@@ -950,7 +975,7 @@ int do_restore_client(struct asfd *asfd,
 		}
 
 		if(restore_switch(asfd, sb, fullpath, act,
-			bfd, vss_restore, cntr, encryption_password))
+			bfd, vss_restore, cntr, encryption_password, rf, &br))
 				goto error;
 	}
 
@@ -963,6 +988,7 @@ error:
 		bfd->close(bfd, asfd);
 		bfile_free(&bfd);
 	}
+	restore_finish_free(&rf);
 
 	cntr_print_end(cntr);
 	cntr_set_bytes(cntr, asfd);
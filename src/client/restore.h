@@ -1,6 +1,7 @@
 #ifndef _RESTORE_CLIENT_H
 #define _RESTORE_CLIENT_H
 
+struct restore_finish;
 struct sbuf;
 
 enum ofr_e
@@ -18,7 +19,8 @@ extern int do_restore_client(struct asfd *asfd,
 	struct conf **confs, enum action act);
 
 extern int restore_dir(struct asfd *asfd,
-	struct sbuf *sb, const char *dname, enum action act, struct cntr *cntr);
+	struct sbuf *sb, const char *dname, enum action act, struct cntr *cntr,
+	struct restore_finish *rf);
 extern int restore_interrupt(struct asfd *asfd,
 	struct sbuf *sb, const char *msg, struct cntr *cntr);
 
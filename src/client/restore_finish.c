@@ -0,0 +1,518 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../asfd.h"
+#include "../async.h"
+#include "../attribs.h"
+#include "../bfile.h"
+#include "../cmd.h"
+#include "../cntr.h"
+#include "../fsops.h"
+#include "../iobuf.h"
+#include "../log.h"
+#include "../sbuf.h"
+#include "extrameta.h"
+#include "restore_finish.h"
+
+// Stop handing a worker more once it is this far behind.
+#define RF_MAX_PENDING	256
+
+struct rf_job
+{
+	char *path;
+	// What to count once the worker has done it, or 0 for nothing.
+	char cmd;
+	struct rf_job *next;
+};
+
+struct rf_worker
+{
+	pid_t pid;
+	struct asfd *asfd;
+	struct rf_job *head;
+	struct rf_job *tail;
+	int pending;
+};
+
+struct restore_finish
+{
+	struct asfd *asfd;
+	struct cntr *cntr;
+	struct async *as;
+	struct rf_worker *workers;
+	int count;
+	int do_fsync;
+	uint64_t queued;
+	uint64_t waits;
+};
+
+struct restore_finish *restore_finish_alloc(void)
+{
+	return (struct restore_finish *)
+		calloc_w(1, sizeof(struct restore_finish), __func__);
+}
+
+static void rf_jobs_free(struct rf_worker *w)
+{
+	struct rf_job *job;
+	while((job=w->head))
+	{
+		w->head=job->next;
+		free_w(&job->path);
+		free_v((void **)&job);
+	}
+	w->tail=NULL;
+	w->pending=0;
+}
+
+void restore_finish_free(struct restore_finish **rf)
+{
+	int i;
+	if(!rf || !*rf) return;
+	for(i=0; i<(*rf)->count; i++)
+		rf_jobs_free(&(*rf)->workers[i]);
+	// Closing our ends lets any workers that are still there go.
+	async_asfd_free_all(&(*rf)->as);
+#ifndef HAVE_WIN32
+	for(i=0; i<(*rf)->count; i++)
+	{
+		pid_t pid=(*rf)->workers[i].pid;
+		if(pid<=0)
+			continue;
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+#endif
+	free_v((void **)&(*rf)->workers);
+	free_v((void **)rf);
+}
+
+int restore_finish_workers(struct restore_finish *rf)
+{
+	return rf->count;
+}
+
+static int fsync_fd(struct asfd *asfd, struct cntr *cntr,
+	int fd, const char *path)
+{
+	if(!fsync(fd))
+		return 0;
+	logw(asfd, cntr, "Could not fsync %s: %s\n", path, strerror(errno));
+	return -1;
+}
+
+#ifndef HAVE_WIN32
+// These run in the child. Warnings go back to the parent over the asfd,
+// and are counted there.
+static int finish_file(struct asfd *asfd, struct sbuf *sb,
+	const char *path, int do_fsync)
+{
+	if(do_fsync)
+	{
+		int fd;
+		if((fd=open(path, O_RDONLY))<0)
+			logw(asfd, NULL, "Could not open %s for fsync: %s\n",
+				path, strerror(errno));
+		else
+		{
+			fsync_fd(asfd, NULL, fd, path);
+			close_fd(&fd);
+		}
+	}
+	return attribs_set(asfd, path, &sb->statp, sb->winattr, NULL);
+}
+
+static int finish_meta(struct asfd *asfd, struct sbuf *sb,
+	const char *path, const char *metadata, size_t metalen)
+{
+	if(set_extrameta(asfd, path, metadata, metalen, NULL))
+		return -1;
+	// Set file times again, since we just diddled with the file.
+	return attribs_set_file_times(asfd, path, &sb->statp, NULL);
+}
+
+static int worker_run(int fd, int do_fsync)
+{
+	int ret=-1;
+	char *metadata=NULL;
+	size_t metalen=0;
+	struct sbuf *sb=NULL;
+	struct async *as=NULL;
+	struct asfd *asfd=NULL;
+	struct iobuf *rbuf;
+
+	if(!(as=async_alloc())
+	  || as->init(as, 0)
+	  || !(asfd=setup_asfd(as, "restore finisher", &fd, /*listen*/""))
+	  || !(sb=sbuf_alloc()))
+		goto end;
+	rbuf=asfd->rbuf;
+
+	while(1)
+	{
+		int r;
+		if(asfd->read(asfd))
+			goto end;
+		switch(rbuf->cmd)
+		{
+			case CMD_ATTRIBS:
+				iobuf_free_content(&sb->attr);
+				iobuf_move(&sb->attr, rbuf);
+				attribs_decode(sb);
+				continue;
+			case CMD_APPEND:
+				if(!(metadata=(char *)realloc_w(metadata,
+					metalen+rbuf->len+1, __func__)))
+						goto end;
+				memcpy(metadata+metalen, rbuf->buf, rbuf->len);
+				metalen+=rbuf->len;
+				metadata[metalen]='\0';
+				break;
+			case CMD_FILE:
+			case CMD_METADATA:
+				if(rbuf->cmd==CMD_FILE)
+					r=finish_file(asfd, sb,
+						rbuf->buf, do_fsync);
+				else
+					r=finish_meta(asfd, sb,
+						rbuf->buf, metadata, metalen);
+				free_w(&metadata);
+				metalen=0;
+				if(asfd->write_str(asfd, CMD_GEN,
+					r?"failed":"done"))
+						goto end;
+				break;
+			case CMD_GEN:
+				if(!strcmp(rbuf->buf, "quit"))
+				{
+					ret=0;
+					goto end;
+				}
+				// Fall through.
+			default:
+				iobuf_log_unexpected(rbuf, __func__);
+				goto end;
+		}
+		iobuf_free_content(rbuf);
+	}
+end:
+	free_w(&metadata);
+	sbuf_free(&sb);
+	async_asfd_free_all(&as);
+	return ret;
+}
+
+static int worker_start(struct restore_finish *rf, struct rf_worker *w)
+{
+	int i;
+	int fds[2];
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+	{
+		logp("socketpair failed in %s: %s\n",
+			__func__, strerror(errno));
+		return -1;
+	}
+	switch((w->pid=fork()))
+	{
+		case -1:
+			logp("fork failed in %s: %s\n",
+				__func__, strerror(errno));
+			close_fd(&fds[0]);
+			close_fd(&fds[1]);
+			w->pid=0;
+			return -1;
+		case 0:
+			// Child. Let go of the connection to the server and
+			// of the other workers, so that they go away when
+			// the parent is done with them. Do not run any exit
+			// handlers.
+			close_fd(&fds[0]);
+			if(rf->asfd && rf->asfd->fd>=0)
+				close(rf->asfd->fd);
+			for(i=0; i<rf->count; i++)
+				close(rf->workers[i].asfd->fd);
+			_exit(worker_run(fds[1], rf->do_fsync)?1:0);
+		default:
+			// Parent.
+			close_fd(&fds[1]);
+			if(!(w->asfd=setup_asfd(rf->as,
+				"restore finisher", &fds[0], /*listen*/"")))
+			{
+				close_fd(&fds[0]);
+				kill(w->pid, SIGTERM);
+				waitpid(w->pid, NULL, 0);
+				w->pid=0;
+				return -1;
+			}
+			return 0;
+	}
+}
+#endif
+
+int restore_finish_init(struct restore_finish *rf,
+	struct asfd *asfd, struct cntr *cntr, int workers, int do_fsync)
+{
+	rf->asfd=asfd;
+	rf->cntr=cntr;
+	rf->do_fsync=do_fsync;
+	if(workers<=0)
+		return 0;
+#ifdef HAVE_WIN32
+	logp("restore finishers are not supported on Windows\n");
+	return 0;
+#else
+	if(!(rf->as=async_alloc())
+	  || rf->as->init(rf->as, 0)
+	  || !(rf->workers=(struct rf_worker *)calloc_w(workers,
+		sizeof(struct rf_worker), __func__)))
+			return -1;
+	while(rf->count<workers)
+	{
+		if(worker_start(rf, &rf->workers[rf->count]))
+			break;
+		rf->count++;
+	}
+	if(rf->count<workers)
+		logp("Started %d of %d restore finishers\n",
+			rf->count, workers);
+	return 0;
+#endif
+}
+
+static int handle_reply(struct restore_finish *rf, struct rf_worker *w)
+{
+	struct rf_job *job;
+	struct iobuf *rbuf=w->asfd->rbuf;
+
+	switch(rbuf->cmd)
+	{
+		case CMD_WARNING:
+			// The worker has logged it already.
+			cntr_add(rf->cntr, CMD_WARNING, 1);
+			if(rf->asfd && rf->asfd->write(rf->asfd, rbuf))
+				return -1;
+			return 0;
+		case CMD_GEN:
+			if(!(job=w->head))
+				break;
+			if(!strcmp(rbuf->buf, "done"))
+			{
+				if(job->cmd)
+					cntr_add(rf->cntr, job->cmd, 1);
+			}
+			else if(strcmp(rbuf->buf, "failed"))
+				break;
+			if(!(w->head=job->next))
+				w->tail=NULL;
+			w->pending--;
+			free_w(&job->path);
+			free_v((void **)&job);
+			return 0;
+		default:
+			break;
+	}
+	iobuf_log_unexpected(rbuf, __func__);
+	return -1;
+}
+
+// Gets the workers' replies, and sends them what is waiting to go.
+static int rf_poll(struct restore_finish *rf, int block)
+{
+	int i;
+	int r;
+
+	r=block?rf->as->read_write(rf->as):rf->as->read_quick(rf->as);
+	for(i=0; i<rf->count; i++)
+	{
+		struct rf_worker *w=&rf->workers[i];
+		struct iobuf *rbuf=w->asfd->rbuf;
+		while(rbuf->buf)
+		{
+			if(handle_reply(rf, w))
+				return -1;
+			iobuf_free_content(rbuf);
+			if(w->asfd->parse_readbuf(w->asfd))
+				return -1;
+		}
+		if(w->asfd->want_to_remove)
+		{
+			logp("restore finisher %d went away with %d pending\n",
+				i, w->pending);
+			return -1;
+		}
+	}
+	return r;
+}
+
+static int send_frame(struct restore_finish *rf, struct asfd *asfd,
+	enum cmd cmd, const char *buf, size_t len)
+{
+	struct iobuf wbuf;
+	iobuf_set(&wbuf, cmd, (char *)buf, len);
+	while(1)
+	{
+		switch(asfd->append_all_to_write_buffer(asfd, &wbuf))
+		{
+			case APPEND_OK:
+				return 0;
+			case APPEND_BLOCKED:
+				if(rf_poll(rf, 1))
+					return -1;
+				break;
+			default:
+				return -1;
+		}
+	}
+}
+
+static unsigned int path_hash(const char *path)
+{
+	unsigned int h=5381;
+	for(; *path; path++)
+		h=h*33+(unsigned char)*path;
+	return h;
+}
+
+static int queue_job(struct restore_finish *rf, struct sbuf *sb,
+	enum cmd jobcmd, const char *path,
+	const char *metadata, size_t metalen, char count)
+{
+	size_t off;
+	struct rf_job *job;
+	struct rf_worker *w=&rf->workers[path_hash(path)%rf->count];
+
+	while(w->pending>=RF_MAX_PENDING)
+		if(rf_poll(rf, 1))
+			return -1;
+
+	if(!(job=(struct rf_job *)calloc_w(1, sizeof(struct rf_job), __func__))
+	  || !(job->path=strdup_w(path, __func__)))
+	{
+		free_v((void **)&job);
+		return -1;
+	}
+	job->cmd=count;
+	if(w->tail)
+		w->tail->next=job;
+	else
+		w->head=job;
+	w->tail=job;
+	w->pending++;
+	rf->queued++;
+
+	if(send_frame(rf, w->asfd, CMD_ATTRIBS, sb->attr.buf, sb->attr.len))
+		return -1;
+	for(off=0; off<metalen; off+=ASYNC_BUF_LEN)
+	{
+		size_t len=metalen-off;
+		if(len>ASYNC_BUF_LEN)
+			len=ASYNC_BUF_LEN;
+		if(send_frame(rf, w->asfd, CMD_APPEND, metadata+off, len))
+			return -1;
+	}
+	if(send_frame(rf, w->asfd, jobcmd, path, strlen(path)))
+		return -1;
+	return rf_poll(rf, 0);
+}
+
+int restore_finish_file(struct restore_finish *rf,
+	struct BFILE *bfd, struct sbuf *sb, const char *path)
+{
+	int ret;
+	int set_attribs_on_close=bfd->set_attribs_on_close;
+
+	if(!rf->count)
+	{
+#ifndef HAVE_WIN32
+		if(rf->do_fsync)
+			fsync_fd(rf->asfd, rf->cntr, bfd->fd, path);
+#endif
+		if(bfd->close(bfd, rf->asfd))
+			return -1;
+		attribs_set(rf->asfd, path, &sb->statp, sb->winattr, rf->cntr);
+		return 0;
+	}
+
+	bfd->set_attribs_on_close=0;
+	ret=bfd->close(bfd, rf->asfd);
+	bfd->set_attribs_on_close=set_attribs_on_close;
+	if(ret)
+		return -1;
+	return queue_job(rf, sb, CMD_FILE, path, NULL, 0, 0);
+}
+
+int restore_finish_meta(struct restore_finish *rf,
+	struct sbuf *sb, const char *path,
+	const char *metadata, size_t metalen)
+{
+	return queue_job(rf, sb, CMD_METADATA, path,
+		metadata, metalen, sb->path.cmd);
+}
+
+static int pending_for(struct restore_finish *rf, const char *path)
+{
+	int i;
+	size_t len=strlen(path);
+	struct rf_job *job;
+
+	for(i=0; i<rf->count; i++)
+	{
+		for(job=rf->workers[i].head; job; job=job->next)
+		{
+			if(!strncmp(job->path, path, len)
+			  && (!job->path[len]
+				|| job->path[len]=='/'
+				|| (len && path[len-1]=='/')))
+					return 1;
+		}
+	}
+	return 0;
+}
+
+int restore_finish_wait(struct restore_finish *rf, const char *path)
+{
+	if(!rf->count || !pending_for(rf, path))
+		return 0;
+	rf->waits++;
+	while(pending_for(rf, path))
+		if(rf_poll(rf, 1))
+			return -1;
+	return 0;
+}
+
+int restore_finish_end(struct restore_finish *rf)
+{
+	int i;
+	int ret=0;
+
+	if(!rf->count)
+		return 0;
+	for(i=0; i<rf->count; i++)
+		while(rf->workers[i].pending)
+			if(rf_poll(rf, 1))
+				return -1;
+	for(i=0; i<rf->count; i++)
+		if(send_frame(rf, rf->workers[i].asfd, CMD_GEN, "quit", 4))
+			return -1;
+	for(i=0; i<rf->count; i++)
+		while(rf->workers[i].asfd->writebuflen)
+			if(rf->as->write(rf->as))
+				return -1;
+#ifndef HAVE_WIN32
+	for(i=0; i<rf->count; i++)
+	{
+		int status;
+		struct rf_worker *w=&rf->workers[i];
+		if(waitpid(w->pid, &status, 0)<0
+		  || !WIFEXITED(status) || WEXITSTATUS(status))
+		{
+			logp("restore finisher %d did not exit cleanly\n", i);
+			ret=-1;
+		}
+		w->pid=0;
+	}
+#endif
+	logp("Restore finishers: %" PRIu64 " jobs, %" PRIu64 " waits\n",
+		rf->queued, rf->waits);
+	return ret;
+}
@@ -0,0 +1,38 @@
+#ifndef _RESTORE_FINISH_H
+#define _RESTORE_FINISH_H
+
+struct asfd;
+struct BFILE;
+struct cntr;
+struct sbuf;
+struct restore_finish;
+
+// Finishes restored files once their data is written: the optional fsync,
+// the owner, modes and times, and the acls and xattrs. With no workers,
+// this all happens in process, as it always did. With workers, child
+// processes do it while the main process carries on with the stream.
+// Jobs for the same path always go to the same worker, so they happen in
+// the order that they were given.
+extern struct restore_finish *restore_finish_alloc(void);
+extern int restore_finish_init(struct restore_finish *rf,
+	struct asfd *asfd, struct cntr *cntr, int workers, int do_fsync);
+extern void restore_finish_free(struct restore_finish **rf);
+
+extern int restore_finish_workers(struct restore_finish *rf);
+
+// Closes the file that has just been written, and sets its attributes.
+extern int restore_finish_file(struct restore_finish *rf,
+	struct BFILE *bfd, struct sbuf *sb, const char *path);
+// Queues setting the acls and xattrs of a path. Only for use when there
+// are workers.
+extern int restore_finish_meta(struct restore_finish *rf,
+	struct sbuf *sb, const char *path,
+	const char *metadata, size_t metalen);
+// Waits for everything queued for the path, and for anything under it if
+// it is a directory. To be done before setting the attributes of a
+// directory, because they may stop the workers getting into it.
+extern int restore_finish_wait(struct restore_finish *rf, const char *path);
+// Waits for everything queued, and stops the workers.
+extern int restore_finish_end(struct restore_finish *rf);
+
+#endif
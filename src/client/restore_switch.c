@@ -13,13 +13,14 @@
 #include "../transfer.h"
 #include "extrameta.h"
 #include "restore.h"
+#include "restore_finish.h"
 #include "restore_switch.h"
 
 static int do_restore_file_or_get_meta(struct asfd *asfd, struct BFILE *bfd,
 	struct sbuf *sb, const char *fname,
 	char **metadata, size_t *metalen,
 	struct cntr *cntr, const char *rpath,
-	const char *encryption_password)
+	const char *encryption_password, struct restore_finish *rf)
 {
 	int ret=-1;
 	int enccompressed=0;
@@ -73,17 +74,16 @@ static int do_restore_file_or_get_meta(struct asfd *asfd, struct BFILE *bfd,
 			encpassword, enccompressed,
 			cntr, NULL, key_deriv, sb->salt);
 #ifndef HAVE_WIN32
-		if(bfd && bfd->close(bfd, asfd))
+		// For Windows, only set the attribs when it closes the file,
+		// so that trailing vss does not get blocked after having set
+		// a read-only attribute.
+		if(bfd && (ret?bfd->close(bfd, asfd):
+			restore_finish_file(rf, bfd, sb, rpath)))
 		{
 			logp("error closing %s in %s\n",
 				fname, __func__);
 			ret=-1;
 		}
-		// For Windows, only set the attribs when it closes the file,
-		// so that trailing vss does not get blocked after having set
-		// a read-only attribute.
-		if(!ret) attribs_set(asfd, rpath,
-			&sb->statp, sb->winattr, cntr);
 #endif
 	}
 	if(ret)
@@ -99,7 +99,8 @@ static int do_restore_file_or_get_meta(struct asfd *asfd, struct BFILE *bfd,
 static int restore_file_or_get_meta(struct asfd *asfd, struct BFILE *bfd,
 	struct sbuf *sb, const char *fname, enum action act,
 	char **metadata, size_t *metalen, enum vss_restore vss_restore,
-	struct cntr *cntr, const char *encyption_password)
+	struct cntr *cntr, const char *encyption_password,
+	struct restore_finish *rf, struct bfile_restore *br)
 {
 	int ret=0;
 	char *rpath=NULL;
@@ -133,12 +134,17 @@ static int restore_file_or_get_meta(struct asfd *asfd, struct BFILE *bfd,
 			case OFR_CONTINUE: goto end;
 			default: ret=-1; goto end;
 		}
+		if(!metadata && bfd->set_restore(bfd, br))
+		{
+			ret=-1;
+			goto end;
+		}
 #ifndef HAVE_WIN32
 	}
 #endif
 
 	if(!(ret=do_restore_file_or_get_meta(asfd, bfd, sb, fname,
-		metadata, metalen, cntr, rpath, encyption_password)))
+		metadata, metalen, cntr, rpath, encyption_password, rf)))
 	{
 		// Only add to counters if we are not doing metadata. The
 		// actual metadata restore comes a bit later.
@@ -155,7 +161,8 @@ static int restore_metadata(struct asfd *asfd,
 	struct BFILE *bfd, struct sbuf *sb,
 	const char *fname, enum action act,
 	enum vss_restore vss_restore,
-	struct cntr *cntr, const char *encryption_password)
+	struct cntr *cntr, const char *encryption_password,
+	struct restore_finish *rf, struct bfile_restore *br)
 {
 	int ret=-1;
 	size_t metalen=0;
@@ -176,14 +183,20 @@ static int restore_metadata(struct asfd *asfd,
 
 	// Create the directory, but do not add to the counts.
 	if(S_ISDIR(sb->statp.st_mode)
-	  && restore_dir(asfd, sb, fname, act, /*cntr*/NULL))
+	  && restore_dir(asfd, sb, fname, act, /*cntr*/NULL, rf))
 		goto end;
 
 	// Read in the metadata...
 	if(restore_file_or_get_meta(asfd, bfd, sb, fname, act,
-		&metadata, &metalen, vss_restore, cntr, encryption_password))
+		&metadata, &metalen, vss_restore, cntr, encryption_password,
+		rf, br))
 			goto end;
-	if(metadata)
+	if(metadata && restore_finish_workers(rf))
+	{
+		if(restore_finish_meta(rf, sb, fname, metadata, metalen))
+			goto end;
+	}
+	else if(metadata)
 	{
 		if(!set_extrameta(asfd,
 #ifdef HAVE_WIN32
@@ -213,7 +226,8 @@ end:
 int restore_switch(struct asfd *asfd, struct sbuf *sb,
 	const char *fullpath, enum action act,
 	struct BFILE *bfd, enum vss_restore vss_restore, struct cntr *cntr,
-	const char *encryption_password)
+	const char *encryption_password, struct restore_finish *rf,
+	struct bfile_restore *br)
 {
 	switch(sb->path.cmd)
 	{
@@ -235,14 +249,14 @@ int restore_switch(struct asfd *asfd, struct sbuf *sb,
 			return restore_file_or_get_meta(asfd, bfd, sb,
 				fullpath, act,
 				NULL, NULL, vss_restore, cntr,
-				encryption_password);
+				encryption_password, rf, br);
 		case CMD_METADATA:
 		case CMD_VSS:
 		case CMD_ENC_METADATA:
 		case CMD_ENC_VSS:
 			return restore_metadata(asfd, bfd, sb,
 				fullpath, act,
-				vss_restore, cntr, encryption_password);
+				vss_restore, cntr, encryption_password, rf, br);
 		default:
 			// Other cases (dir/links/etc) are handled in the
 			// calling function.
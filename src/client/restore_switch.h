@@ -4,6 +4,7 @@
 int restore_switch(struct asfd *asfd, struct sbuf *sb,
 	const char *fullpath, enum action act,
 	struct BFILE *bfd, enum vss_restore vss_restore, struct cntr *cntr,
-	const char *encryption_password);
+	const char *encryption_password, struct restore_finish *rf,
+	struct bfile_restore *br);
 
 #endif
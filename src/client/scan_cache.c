@@ -0,0 +1,434 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../conf.h"
+#include "../fsops.h"
+#include "../fzp.h"
+#include "../hexmap.h"
+#include "../log.h"
+#include "../md5.h"
+#include "../pathcmp.h"
+#include "../prepend.h"
+#include "../strlist.h"
+#include "change_journal.h"
+#include "find.h"
+#include "scan_cache.h"
+
+/*
+   The file starts with three lines: the version and the size of a struct
+   stat, a fingerprint of the options that decide what gets scanned, and
+   the change journal token that was acknowledged before the scan started.
+   Then there is a record for each directory that was read, with the names
+   that were in it, and for each entry that the directory had that is not
+   a directory, in the order that the scan went through them.
+*/
+#define SCAN_CACHE_VERSION	1
+
+#define REC_DIR		'D'
+#define REC_ENTRY	'F'
+
+struct record
+{
+	uint8_t kind;
+	uint8_t type;
+	uint32_t plen;
+	uint32_t dlen;
+	uint32_t count;
+	struct stat statp;
+};
+
+struct scan_cache
+{
+	char *path;
+	char *tmp;
+	char fingerprint[64];
+	struct change_journal *cj;
+	// The previous scan, if the journal says what has changed since.
+	struct fzp *in;
+	struct record rec;
+	char *rpath;
+	size_t rpath_len;
+	char *rdata;
+	size_t rdata_len;
+	int have_rec;
+	int rec_used;
+	// This scan.
+	struct fzp *out;
+	uint64_t dirs;
+	uint64_t dirs_replayed;
+	uint64_t entries_replayed;
+};
+
+struct scan_cache *scan_cache_alloc(void)
+{
+	return (struct scan_cache *)
+		calloc_w(1, sizeof(struct scan_cache), __func__);
+}
+
+void scan_cache_free(struct scan_cache **sc)
+{
+	if(!sc || !*sc) return;
+	fzp_close(&(*sc)->in);
+	if((*sc)->out)
+	{
+		// Not finished, so it cannot be used next time.
+		fzp_close(&(*sc)->out);
+		unlink((*sc)->tmp);
+	}
+	change_journal_free(&(*sc)->cj);
+	free_w(&(*sc)->path);
+	free_w(&(*sc)->tmp);
+	free_w(&(*sc)->rpath);
+	free_w(&(*sc)->rdata);
+	free_v((void **)sc);
+}
+
+static int fingerprint_str(struct md5 *md5, const char *str)
+{
+	if(!str) str="";
+	return !md5_update(md5, str, strlen(str)+1);
+}
+
+// If any of the options that are sent with the includes and excludes
+// change, the previous scan cannot be used.
+static int fingerprint(struct scan_cache *sc, struct conf **confs)
+{
+	int i;
+	int ret=-1;
+	char tmp[64];
+	uint8_t checksum[MD5_DIGEST_LENGTH];
+	struct strlist *l;
+	struct md5 *md5;
+
+	if(!(md5=md5_alloc(__func__)))
+		return -1;
+	if(!md5_init(md5))
+		goto end;
+	for(i=0; i<OPT_MAX; i++)
+	{
+		if(!(confs[i]->flags & CONF_FLAG_INCEXC))
+			continue;
+		if(fingerprint_str(md5, confs[i]->field))
+			goto end;
+		switch(confs[i]->conf_type)
+		{
+			case CT_STRING:
+				if(fingerprint_str(md5, get_string(confs[i])))
+					goto end;
+				break;
+			case CT_STRLIST:
+				for(l=get_strlist(confs[i]); l; l=l->next)
+				{
+					snprintf(tmp, sizeof(tmp),
+						"%ld", l->flag);
+					if(fingerprint_str(md5, l->path)
+					  || fingerprint_str(md5, tmp))
+						goto end;
+				}
+				break;
+			case CT_UINT:
+				snprintf(tmp, sizeof(tmp), "%d",
+					get_int(confs[i]));
+				if(fingerprint_str(md5, tmp))
+					goto end;
+				break;
+			case CT_SSIZE_T:
+				snprintf(tmp, sizeof(tmp), "%" PRIu64,
+					get_uint64_t(confs[i]));
+				if(fingerprint_str(md5, tmp))
+					goto end;
+				break;
+			default:
+				break;
+		}
+	}
+	if(!md5_final(md5, checksum))
+		goto end;
+	snprintf(sc->fingerprint, sizeof(sc->fingerprint),
+		"%s", bytes_to_md5str(checksum));
+	ret=0;
+end:
+	md5_free(&md5);
+	return ret;
+}
+
+static int get_line(struct fzp *fzp, char *buf, size_t len)
+{
+	if(!fzp_gets(fzp, buf, (int)len)
+	  || !*buf || buf[strlen(buf)-1]!='\n')
+		return -1;
+	buf[strlen(buf)-1]='\0';
+	return 0;
+}
+
+// Returns the token of the previous scan, if it can be used at all.
+static int read_header(struct scan_cache *sc, char *token, size_t len)
+{
+	char buf[128];
+	char expected[64];
+
+	if(!(sc->in=fzp_gzopen(sc->path, "rb")))
+		return 0;
+	snprintf(expected, sizeof(expected), "%d %d",
+		SCAN_CACHE_VERSION, (int)sizeof(struct stat));
+	if(get_line(sc->in, buf, sizeof(buf))
+	  || strcmp(buf, expected))
+	{
+		logp("%s is from a different version\n", sc->path);
+		goto unusable;
+	}
+	if(get_line(sc->in, buf, sizeof(buf))
+	  || strcmp(buf, sc->fingerprint))
+	{
+		logp("The includes or excludes have changed since the previous scan\n");
+		goto unusable;
+	}
+	if(get_line(sc->in, token, len))
+		goto unusable;
+	return 0;
+unusable:
+	*token='\0';
+	fzp_close(&sc->in);
+	return 0;
+}
+
+static int write_header(struct scan_cache *sc)
+{
+	if(!(sc->out=fzp_gzopen(sc->tmp, "wb1")))
+		return -1;
+	fzp_printf(sc->out, "%d %d\n%s\n%s\n",
+		SCAN_CACHE_VERSION, (int)sizeof(struct stat),
+		sc->fingerprint, sc->cj->token);
+	return 0;
+}
+
+int scan_cache_open(struct scan_cache *sc, struct conf **confs, int timeout)
+{
+	char token[64]="";
+	const char *dir=get_string(confs[OPT_CHANGE_JOURNAL]);
+
+	if(!(sc->path=prepend_s(dir, SCAN_CACHE_FILE))
+	  || !(sc->tmp=prepend(sc->path, ".tmp"))
+	  || !(sc->cj=change_journal_alloc())
+	  || fingerprint(sc, confs)
+	  || read_header(sc, token, sizeof(token))
+	  || change_journal_sync(sc->cj, dir, *token?token:NULL, timeout))
+		return -1;
+
+	if(!sc->cj->usable)
+		fzp_close(&sc->in);
+	if(!sc->in)
+		logp("Scanning everything, because the change journal does not cover the time since the previous scan\n");
+
+	// Without an acknowledgement, there is no way of knowing what will
+	// have changed after this scan, so it is not worth keeping.
+	if(sc->cj->token && write_header(sc))
+		return -1;
+	return 0;
+}
+
+int scan_cache_close(struct scan_cache *sc)
+{
+	if(!sc->out) return 0;
+	if(fzp_close(&sc->out))
+	{
+		logp("Could not write %s\n", sc->tmp);
+		unlink(sc->tmp);
+		return -1;
+	}
+	if(do_rename(sc->tmp, sc->path))
+		return -1;
+	logp("%" PRIu64 " of %" PRIu64 " directories and %" PRIu64
+		" other entries came from the previous scan\n",
+		sc->dirs_replayed, sc->dirs, sc->entries_replayed);
+	return 0;
+}
+
+static int read_data(struct scan_cache *sc, char **buf, size_t *buf_len,
+	size_t len)
+{
+	if(len+1>*buf_len)
+	{
+		if(!(*buf=(char *)realloc_w(*buf, len+1, __func__)))
+			return -1;
+		*buf_len=len+1;
+	}
+	if(len && fzp_read(sc->in, *buf, len)!=(int)len)
+		return -1;
+	(*buf)[len]='\0';
+	return 0;
+}
+
+// Moves on to the next record of the previous scan. If it cannot be read,
+// the rest of the previous scan is not used.
+static void next_record(struct scan_cache *sc)
+{
+	sc->have_rec=0;
+	sc->rec_used=0;
+	if(!sc->in) return;
+	if(fzp_read(sc->in, &sc->rec, sizeof(sc->rec))==sizeof(sc->rec)
+	  && !read_data(sc, &sc->rpath, &sc->rpath_len, sc->rec.plen)
+	  && !read_data(sc, &sc->rdata, &sc->rdata_len, sc->rec.dlen))
+	{
+		sc->have_rec=1;
+		return;
+	}
+	fzp_close(&sc->in);
+}
+
+// The scan goes through paths in the same order as the previous scan did,
+// so the records for paths that are not there any more are skipped.
+static int seek_record(struct scan_cache *sc, const char *path, uint8_t kind)
+{
+	if(!sc->in) return 0;
+	if(!sc->have_rec || sc->rec_used)
+		next_record(sc);
+	while(sc->have_rec && pathcmp(sc->rpath, path)<0)
+		next_record(sc);
+	if(!sc->have_rec
+	  || sc->rec.kind!=kind
+	  || strcmp(sc->rpath, path)
+	  || !change_journal_fs_is_watched(sc->cj, sc->rec.statp.st_dev))
+		return 0;
+	sc->rec_used=1;
+	return 1;
+}
+
+static int build_names(struct scan_cache *sc, char ***nl, int *count)
+{
+	uint32_t i;
+	const char *cp=sc->rdata;
+	const char *end=sc->rdata+sc->rec.dlen;
+
+	if(!sc->rec.count) return 0;
+	if(!(*nl=(char **)calloc_w(sc->rec.count, sizeof(char *), __func__)))
+		return -1;
+	for(i=0; i<sc->rec.count; i++)
+	{
+		if(cp>=end
+		  || !((*nl)[i]=strdup_w(cp, __func__)))
+		{
+			for(; i>0; i--) free_w(&(*nl)[i-1]);
+			free_v((void **)nl);
+			return -1;
+		}
+		cp+=strlen(cp)+1;
+	}
+	*count=(int)sc->rec.count;
+	return 0;
+}
+
+int scan_cache_replay_dir(struct scan_cache *sc, const char *path,
+	struct stat *statp, char ***nl, int *count)
+{
+	struct stat *cached=&sc->rec.statp;
+	sc->dirs++;
+	if(!seek_record(sc, path, REC_DIR)
+	  || cached->st_dev!=statp->st_dev
+	  || cached->st_ino!=statp->st_ino
+	  || cached->st_mtime!=statp->st_mtime
+	  || cached->st_ctime!=statp->st_ctime
+	  || change_journal_dir_is_dirty(sc->cj, statp))
+		return 0;
+	if(build_names(sc, nl, count))
+		return -1;
+	sc->dirs_replayed++;
+	return 1;
+}
+
+// The types that are decided only by the entry and the options.
+static int type_can_be_replayed(uint8_t type)
+{
+	switch(type)
+	{
+		case FT_REG:
+		case FT_LNK_S:
+		case FT_SPEC:
+		case FT_RAW:
+		case FT_FIFO:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+int scan_cache_replay_entry(struct scan_cache *sc, const char *path,
+	struct FF_PKT *ff)
+{
+	if(!seek_record(sc, path, REC_ENTRY)
+	  || !type_can_be_replayed(sc->rec.type)
+	  || change_journal_inode_is_dirty(sc->cj, &sc->rec.statp))
+		return 0;
+	ff->statp=sc->rec.statp;
+	ff->type=sc->rec.type;
+	if(ff->type==FT_LNK_S)
+		ff->link=sc->rdata;
+	sc->entries_replayed++;
+	return 1;
+}
+
+static int write_record(struct scan_cache *sc, struct record *rec,
+	const char *path, const char *data)
+{
+	if(fzp_write(sc->out, rec, sizeof(*rec))!=sizeof(*rec)
+	  || fzp_write(sc->out, path, rec->plen)!=rec->plen
+	  || (rec->dlen && fzp_write(sc->out, data, rec->dlen)!=rec->dlen))
+	{
+		logp("Could not write to %s\n", sc->tmp);
+		return -1;
+	}
+	return 0;
+}
+
+int scan_cache_add_dir(struct scan_cache *sc, const char *path,
+	struct stat *statp, char **nl, int count)
+{
+	int i;
+	int ret=-1;
+	char *data=NULL;
+	char *cp;
+	size_t len=0;
+	struct record rec;
+
+	if(!sc->out) return 0;
+	for(i=0; i<count; i++)
+		len+=strlen(nl[i])+1;
+	if(len && !(data=(char *)malloc_w(len, __func__)))
+		return -1;
+	for(i=0, cp=data; i<count; i++)
+	{
+		size_t l=strlen(nl[i])+1;
+		memcpy(cp, nl[i], l);
+		cp+=l;
+	}
+	memset(&rec, 0, sizeof(rec));
+	rec.kind=REC_DIR;
+	rec.type=FT_DIR;
+	rec.plen=strlen(path);
+	rec.dlen=len;
+	rec.count=count;
+	rec.statp=*statp;
+	ret=write_record(sc, &rec, path, data);
+	free_w(&data);
+	return ret;
+}
+
+int scan_cache_add_entry(struct scan_cache *sc, struct FF_PKT *ff)
+{
+	struct record rec;
+	const char *data=NULL;
+
+	if(!sc->out
+	  || !type_can_be_replayed(ff->type))
+		return 0;
+	memset(&rec, 0, sizeof(rec));
+	rec.kind=REC_ENTRY;
+	rec.type=ff->type;
+	rec.plen=strlen(ff->fname);
+	if(ff->type==FT_LNK_S)
+	{
+		data=ff->link;
+		rec.dlen=strlen(data);
+	}
+	rec.statp=ff->statp;
+	return write_record(sc, &rec, ff->fname, data);
+}
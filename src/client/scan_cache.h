@@ -0,0 +1,32 @@
+#ifndef _SCAN_CACHE_H
+#define _SCAN_CACHE_H
+
+#define SCAN_CACHE_FILE		"scan"
+
+// How long a scan waits for the watcher to acknowledge it.
+#define SCAN_CACHE_SYNC_TIMEOUT	10
+
+struct FF_PKT;
+struct scan_cache;
+
+// What the previous file system scan found, so that the directories that
+// the change journal says have not changed since then do not need to be
+// read again. Everything that this scan finds is written to a new one.
+extern struct scan_cache *scan_cache_alloc(void);
+extern int scan_cache_open(struct scan_cache *sc, struct conf **confs,
+	int timeout);
+extern int scan_cache_close(struct scan_cache *sc);
+extern void scan_cache_free(struct scan_cache **sc);
+
+// Return 1 if the entries, or the entry, can be taken from the previous
+// scan instead of from the file system.
+extern int scan_cache_replay_dir(struct scan_cache *sc, const char *path,
+	struct stat *statp, char ***nl, int *count);
+extern int scan_cache_replay_entry(struct scan_cache *sc, const char *path,
+	struct FF_PKT *ff);
+
+extern int scan_cache_add_dir(struct scan_cache *sc, const char *path,
+	struct stat *statp, char **nl, int count);
+extern int scan_cache_add_entry(struct scan_cache *sc, struct FF_PKT *ff);
+
+#endif
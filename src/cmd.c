@@ -38,6 +38,8 @@ char *cmd_to_text(enum cmd cmd)
 			snprintf(buf, len, "Warning"); break;
 		case CMD_END_FILE:
 			snprintf(buf, len, "End of file transmission"); break;
+		case CMD_STREAM:
+			snprintf(buf, len, "Switch phase2 stream"); break;
 		case CMD_ENC_METADATA:
 			snprintf(buf, len, "Encrypted meta data"); break;
 		case CMD_EFS_FILE:
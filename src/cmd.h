@@ -37,6 +37,8 @@ enum cmd
 	CMD_END_FILE	='x',	/* End of file transmission - also appears at
 				   the end of the manifest and contains
 				   size/checksum info. */
+	CMD_STREAM	='j',	/* Following data frames are for this
+				   phase2 stream */
 
 // CMD_FILE_UNCHANGED only used in counting stats on the client, for humans
 	CMD_FILE_CHANGED='z',
@@ -60,6 +62,8 @@ enum cmd
 	CMD_TIMESTAMP_END='E',
 };
 
+// Upper limit on the number of files in flight at once in backup phase2.
+#define PHASE2_STREAMS_MAX	64
 
 extern void cmd_print_all(void);
 extern char *cmd_to_text(enum cmd cmd);
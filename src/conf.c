@@ -380,10 +380,17 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	  return sc_flt(c[o], 0, 0, "ratelimit");
 	case OPT_NETWORK_TIMEOUT:
 	  return sc_int(c[o], 60*60*2, 0, "network_timeout");
+	case OPT_WRITE_BATCH_BYTES:
+	  return sc_int(c[o], 0, 0, "write_batch_bytes");
+	case OPT_WRITE_BATCH_MS:
+	  return sc_int(c[o], 5, 0, "write_batch_ms");
 	case OPT_CLIENT_IS_WINDOWS:
 	  return sc_int(c[o], 0, 0, "client_is_windows");
 	case OPT_PEER_VERSION:
 	  return sc_str(c[o], 0, 0, "peer_version");
+	case OPT_PHASE2_STREAMS:
+	  return sc_int(c[o], 1,
+		CONF_FLAG_CC_OVERRIDE, "phase2_streams");
 	case OPT_PORT:
 	  return sc_lst(c[o], 0, 0, "port");
 	case OPT_STATUS_PORT:
@@ -476,6 +483,20 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	  return sc_str(c[o], 0, 0, "ca_csr_dir");
 	case OPT_RANDOMISE:
 	  return sc_int(c[o], 0, 0, "randomise");
+	case OPT_DELTA_WORKERS:
+	  return sc_int(c[o], 0, 0, "delta_workers");
+	case OPT_RESTORE_FINISHERS:
+	  return sc_int(c[o], 0, 0, "restore_finishers");
+	case OPT_RESTORE_FSYNC:
+	  return sc_int(c[o], 0, 0, "restore_fsync");
+	case OPT_RESTORE_SPARSE:
+	  return sc_int(c[o], 0, 0, "restore_sparse");
+	case OPT_RESTORE_PREALLOCATE:
+	  return sc_int(c[o], 0, 0, "restore_preallocate");
+	case OPT_RESTORE_WRITE_BUFFER:
+	  return sc_int(c[o], 0, 0, "restore_write_buffer");
+	case OPT_CHANGE_JOURNAL:
+	  return sc_str(c[o], 0, 0, "change_journal");
 	case OPT_RESTORE_LIST:
 	  return sc_str(c[o], 0, 0, "restore_list");
 	case OPT_ENABLED:
@@ -621,6 +642,12 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	case OPT_HARDLINKED_ARCHIVE:
 	  return sc_int(c[o], 0,
 		CONF_FLAG_CC_OVERRIDE, "hardlinked_archive");
+	case OPT_SYNTHETIC_FULL_CHAIN_LENGTH:
+	  return sc_int(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "synthetic_full_chain_length");
+	case OPT_SYNTHETIC_FULL_CHAIN_PERCENT:
+	  return sc_int(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "synthetic_full_chain_percent");
 	case OPT_KEEP:
 	  return sc_lst(c[o], 0,
 		CONF_FLAG_CC_OVERRIDE|CONF_FLAG_STRLIST_REPLACE, "keep");
@@ -630,6 +657,30 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	case OPT_LIBRSYNC_MAX_SIZE:
 	  return sc_u64(c[o], 0,
 		CONF_FLAG_CC_OVERRIDE, "librsync_max_size");
+	case OPT_LIBRSYNC_SIGNATURE_CACHE:
+	  return sc_int(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "librsync_signature_cache");
+	case OPT_CHUNK_STORE:
+	  return sc_int(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "chunk_store");
+	case OPT_RESTORE_PREFETCH:
+	  return sc_int(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "restore_prefetch");
+	case OPT_RESTORE_CACHE_MAX_SIZE:
+	  return sc_u64(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "restore_cache_max_size");
+	case OPT_SCRUB_WORKERS:
+	  return sc_int(c[o], 1,
+		CONF_FLAG_CC_OVERRIDE, "scrub_workers");
+	case OPT_SCRUB_MAX_RATE:
+	  return sc_u64(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "scrub_max_rate");
+	case OPT_IO_URING_DEPTH:
+	  return sc_int(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "io_uring_depth");
+	case OPT_HARDLINKED_DIR_REFS:
+	  return sc_int(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "hardlinked_dir_refs");
 	case OPT_COMPRESSION:
 	  return sc_int(c[o], 9,
 		CONF_FLAG_CC_OVERRIDE, "compression");
@@ -690,6 +741,9 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	case OPT_DEDUP_GROUP:
 	  return sc_str(c[o], 0,
 		CONF_FLAG_CC_OVERRIDE, "dedup_group");
+	case OPT_INGEST_DEDUP:
+	  return sc_int(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "ingest_dedup");
 	case OPT_CLIENT_CAN_DELETE:
 	  return sc_int(c[o], 1,
 		CONF_FLAG_CC_OVERRIDE, "client_can_delete");
@@ -90,6 +90,8 @@ enum conf_opt
 	OPT_GROUP,
 	OPT_RATELIMIT,
 	OPT_NETWORK_TIMEOUT,
+	OPT_WRITE_BATCH_BYTES,
+	OPT_WRITE_BATCH_MS,
 	OPT_CLIENT_IS_WINDOWS,
 	OPT_PEER_VERSION,
 	OPT_RSHASH,
@@ -97,6 +99,7 @@ enum conf_opt
 	OPT_CNAME_LOWERCASE, // force lowercase cname, client or server option
 	OPT_CNAME_FQDN, // use fqdn cname, client or server option
 	OPT_VSS_RESTORE,
+	OPT_PHASE2_STREAMS,
 
 	// Server options.
 	OPT_LISTEN,
@@ -152,6 +155,13 @@ enum conf_opt
 	OPT_AUTOUPGRADE_DIR, // also a server option
 	OPT_CA_CSR_DIR,
 	OPT_RANDOMISE,
+	OPT_DELTA_WORKERS,
+	OPT_RESTORE_FINISHERS,
+	OPT_RESTORE_FSYNC,
+	OPT_RESTORE_SPARSE,
+	OPT_RESTORE_PREALLOCATE,
+	OPT_RESTORE_WRITE_BUFFER,
+	OPT_CHANGE_JOURNAL,
 	OPT_SERVER_CAN_OVERRIDE_INCLUDES,
 	OPT_RESTORE_LIST,
 
@@ -243,6 +253,8 @@ enum conf_opt
 	// Client options on the server.
 	// They can be set globally in the server config, or for each client.
 	OPT_HARDLINKED_ARCHIVE,
+	OPT_SYNTHETIC_FULL_CHAIN_LENGTH,
+	OPT_SYNTHETIC_FULL_CHAIN_PERCENT,
 
 	OPT_KEEP,
 
@@ -251,6 +263,14 @@ enum conf_opt
 	OPT_MAX_RESUME_ATTEMPTS,
 	OPT_LIBRSYNC,
 	OPT_LIBRSYNC_MAX_SIZE,
+	OPT_LIBRSYNC_SIGNATURE_CACHE,
+	OPT_CHUNK_STORE,
+	OPT_RESTORE_PREFETCH,
+	OPT_RESTORE_CACHE_MAX_SIZE,
+	OPT_SCRUB_WORKERS,
+	OPT_SCRUB_MAX_RATE,
+	OPT_IO_URING_DEPTH,
+	OPT_HARDLINKED_DIR_REFS,
 
 	OPT_COMPRESSION,
 	OPT_VERSION_WARN,
@@ -281,6 +301,7 @@ enum conf_opt
 	OPT_SUPER_CLIENTS,
 
 	OPT_DEDUP_GROUP,
+	OPT_INGEST_DEDUP,
 
 	OPT_CLIENT_CAN_DELETE,
 	OPT_CLIENT_CAN_DIFF,
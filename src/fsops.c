@@ -5,6 +5,7 @@
 #include "log.h"
 #include "pathcmp.h"
 #include "prepend.h"
+#include "uring.h"
 
 #ifndef HAVE_WIN32
 #include <sys/un.h>
@@ -174,6 +175,22 @@ static void get_max(int32_t *max, int32_t default_max)
 	(*max)++;
 }
 
+struct unlinks
+{
+	const char *directory;
+	int remaining;
+};
+
+static int unlink_done(const char *path, const char *newpath,
+	int err, void *arg)
+{
+	struct unlinks *u=(struct unlinks *)arg;
+	if(!err) return 0;
+	logp("unlink %s/%s: %s\n", u->directory, path, strerror(err));
+	u->remaining=1;
+	return 0;
+}
+
 static int do_recursive_delete(const char *d, const char *file,
 	uint8_t delfiles, int32_t name_max,
 	uint8_t ignore_not_empty_errors)
@@ -184,6 +201,7 @@ static int do_recursive_delete(const char *d, const char *file,
 	struct stat statp;
 	char *directory=NULL;
 	char *fullpath=NULL;
+	struct unlinks unlinks;
 
 	if(!file)
 	{
@@ -202,6 +220,8 @@ static int do_recursive_delete(const char *d, const char *file,
 		ret=RECDEL_OK;
 		goto end;
 	}
+	unlinks.directory=directory;
+	unlinks.remaining=0;
 
 	if(!(dirp=opendir(directory)))
 	{
@@ -245,12 +265,12 @@ static int do_recursive_delete(const char *d, const char *file,
 		}
 		else if(delfiles)
 		{
-			if(unlink(fullpath))
-			{
-				logp("unlink %s: %s\n",
-					fullpath, strerror(errno));
-				ret=RECDEL_ENTRIES_REMAINING;
-			}
+			// Queued, so that many can be in flight at once, and
+			// relative to the open directory, so that the kernel
+			// does not walk the whole path again for each entry.
+			if(uring_unlinkat(dirfd(dirp), entry->d_name,
+				unlink_done, &unlinks))
+					goto end;
 		}
 		else
 		{
@@ -258,6 +278,9 @@ static int do_recursive_delete(const char *d, const char *file,
 		}
 	}
 
+	uring_wait();
+	if(unlinks.remaining) ret=RECDEL_ENTRIES_REMAINING;
+
 	if(ret==RECDEL_OK && rmdir(directory))
 	{
 		if(errno!=ENOTEMPTY || !ignore_not_empty_errors)
@@ -267,6 +290,8 @@ static int do_recursive_delete(const char *d, const char *file,
 		}
 	}
 end:
+	// The callbacks point at 'unlinks', and use the directory.
+	uring_wait();
 	if(dirp) closedir(dirp);
 	free_w(&fullpath);
 	free_w(&directory);
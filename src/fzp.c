@@ -189,6 +189,27 @@ error:
 	return -1;
 }
 
+// Non-zero if a read went wrong. A gzipped file that is cut short can
+// otherwise look the same as one that has been read to the end.
+int fzp_error(struct fzp *fzp)
+{
+	int errnum=Z_OK;
+	if(fzp) switch(fzp->type)
+	{
+		case FZP_FILE:
+			return ferror(fzp->fp);
+		case FZP_COMPRESSED:
+			gzerror(fzp->zp, &errnum);
+			return errnum!=Z_OK && errnum!=Z_STREAM_END;
+		default:
+			unknown_type(fzp->type, __func__);
+			goto error;
+	}
+	not_open(__func__);
+error:
+	return -1;
+}
+
 int fzp_flush(struct fzp *fzp)
 {
 	if(fzp) switch(fzp->type)
@@ -28,6 +28,7 @@ extern int fzp_close(struct fzp **fzp);
 extern int fzp_read(struct fzp *fzp, void *ptr, size_t nmemb);
 extern size_t fzp_write(struct fzp *fzp, const void *ptr, size_t nmemb);
 extern int fzp_eof(struct fzp *fzp);
+extern int fzp_error(struct fzp *fzp);
 extern int fzp_flush(struct fzp *fzp);
 
 extern int fzp_seek(struct fzp *fzp, off_t offset, int whence);
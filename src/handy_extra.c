@@ -151,6 +151,82 @@ int write_endfile(struct asfd *asfd, uint64_t bytes, uint8_t *checksum)
 		CMD_END_FILE, get_endfile_str(bytes, checksum));
 }
 
+struct send_whole *send_whole_alloc(void)
+{
+	return (struct send_whole *)
+		calloc_w(1, sizeof(struct send_whole), __func__);
+}
+
+void send_whole_free(struct send_whole **sw)
+{
+	if(!sw || !*sw) return;
+	if((*sw)->strm_init)
+		deflateEnd(&(*sw)->strm);
+	if((*sw)->enc_ctx)
+	{
+		EVP_CIPHER_CTX_cleanup((*sw)->enc_ctx);
+		EVP_CIPHER_CTX_free((*sw)->enc_ctx);
+	}
+	md5_free(&(*sw)->md5);
+	free_v((void **)&(*sw)->in);
+	free_v((void **)&(*sw)->out);
+	free_v((void **)&(*sw)->eoutbuf);
+	free_v((void **)sw);
+}
+
+int send_whole_init(struct send_whole *sw, struct asfd *asfd,
+	struct cntr *cntr, struct BFILE *bfd,
+	const char *extrameta, size_t elen,
+	int gz, int compression, const char *encpassword,
+	int key_deriv, uint64_t salt)
+{
+	sw->asfd=asfd;
+	sw->cntr=cntr;
+	sw->bfd=bfd;
+	sw->metadata=extrameta;
+	sw->metalen=elen;
+	sw->gz=gz;
+	sw->compression=compression;
+	sw->chunk=asfd_frame_len(asfd);
+	// Plain files have always gone 4096 bytes at a time, but might as
+	// well fill a large frame.
+	sw->plain_len=sw->chunk>ZCHUNK?sw->chunk:4096;
+	if(!(sw->in=(uint8_t *)malloc_w(sw->chunk, __func__))
+	  || !(sw->out=(uint8_t *)malloc_w(sw->chunk, __func__))
+	  || !(sw->eoutbuf=(uint8_t *)malloc_w(
+		sw->chunk+EVP_MAX_BLOCK_LENGTH, __func__)))
+			return -1;
+#ifdef HAVE_WIN32
+	if(bfd && (sw->datalen=bfd->datalen)>0)
+		sw->do_known_byte_count=1;
+#endif
+
+	if(gz && encpassword
+	  && !(sw->enc_ctx=enc_setup(1, encpassword, key_deriv, salt)))
+		return -1;
+
+	if(!(sw->md5=md5_alloc(__func__)))
+		return -1;
+	if(!md5_init(sw->md5))
+	{
+		logp("md5_init() failed\n");
+		return -1;
+	}
+
+	if(!gz)
+		return 0;
+
+	/* allocate deflate state */
+	sw->strm.zalloc=Z_NULL;
+	sw->strm.zfree=Z_NULL;
+	sw->strm.opaque=Z_NULL;
+	if(deflateInit2(&sw->strm, compression, Z_DEFLATED, (15+16),
+		8, Z_DEFAULT_STRATEGY)!=Z_OK)
+			return -1;
+	sw->strm_init=1;
+	return 0;
+}
+
 /* OK, this function is getting a bit out of control.
    One problem is that, if you give deflateInit2 compression=0, it still
    writes gzip headers and footers, so I had to add extra
@@ -160,256 +236,314 @@ int write_endfile(struct asfd *asfd, uint64_t bytes, uint8_t *checksum)
    Encryption off and compression off uses send_whole_file().
    Perhaps a separate function is needed for encryption on compression off.
 */
-enum send_e send_whole_file_gzl(struct asfd *asfd, const char *datapth,
-	int quick_read, uint64_t *bytes, const char *encpassword,
-	struct cntr *cntr, int compression, struct BFILE *bfd,
-	const char *extrameta, size_t elen, int key_deriv, uint64_t salt)
+static enum send_e gz_step(struct send_whole *sw, int *done)
 {
-	enum send_e ret=SEND_OK;
-	int zret=0;
-	struct md5 *md5=NULL;
-	size_t metalen=0;
-	const char *metadata=NULL;
-	struct iobuf wbuf;
-
 	int have;
-	z_stream strm;
-	int flush=Z_NO_FLUSH;
-	uint8_t in[ZCHUNK];
-	uint8_t out[ZCHUNK];
-	ssize_t r;
-
 	int eoutlen;
-	uint8_t eoutbuf[ZCHUNK+EVP_MAX_BLOCK_LENGTH];
+	ssize_t r;
+	struct iobuf wbuf;
+	z_stream *strm=&sw->strm;
 
-	EVP_CIPHER_CTX *enc_ctx=NULL;
+	if(sw->metadata)
+	{
+		if(sw->metalen>sw->chunk)
+			strm->avail_in=sw->chunk;
+		else
+			strm->avail_in=sw->metalen;
+		memcpy(sw->in, sw->metadata, strm->avail_in);
+		sw->metadata+=strm->avail_in;
+		sw->metalen-=strm->avail_in;
+	}
+	else
+	{
+		// Windows VSS headers give us how much data to
+		// expect to read.
 #ifdef HAVE_WIN32
-	int do_known_byte_count=0;
-	size_t datalen=bfd->datalen;
-	if(datalen>0) do_known_byte_count=1;
+		if(sw->do_known_byte_count)
+		{
+			if(sw->datalen<=0)
+				r=0;
+			else
+			{
+				r=sw->bfd->read(sw->bfd, sw->in,
+					min(sw->chunk, sw->datalen));
+				if(r>0)
+					sw->datalen-=r;
+			}
+		}
+		else
 #endif
+			r=sw->bfd->read(sw->bfd, sw->in, sw->chunk);
 
-	if(encpassword
-	  && !(enc_ctx=enc_setup(1, encpassword, key_deriv, salt)))
-		return SEND_FATAL;
-
-	if(!(md5=md5_alloc(__func__)))
-		return SEND_FATAL;
-
-	if(!md5_init(md5))
+		if(r<0)
+		{
+			logw(sw->asfd, sw->cntr,
+				"Error when reading %s in %s: %s\n",
+				sw->bfd->path, __func__, strerror(errno));
+			return SEND_ERROR;
+		}
+		strm->avail_in=(uint32_t)r;
+	}
+	if(!sw->compression && !strm->avail_in)
 	{
-		logp("md5_init() failed\n");
-		md5_free(&md5);
-		return SEND_FATAL;
+		*done=1;
+		return SEND_OK;
 	}
 
-//logp("send_whole_file_gz: %s%s\n", fname, extrameta?" (meta)":"");
+	sw->bytes+=strm->avail_in;
 
-	if((metadata=extrameta))
+	// The checksum needs to be later if encryption is being used.
+	if(!sw->enc_ctx)
 	{
-		metalen=elen;
-	}
-
-	/* allocate deflate state */
-	strm.zalloc = Z_NULL;
-	strm.zfree = Z_NULL;
-	strm.opaque = Z_NULL;
-	if((zret=deflateInit2(&strm, compression, Z_DEFLATED, (15+16),
-		8, Z_DEFAULT_STRATEGY))!=Z_OK) {
-			md5_free(&md5);
+		if(!md5_update(sw->md5, sw->in, strm->avail_in))
+		{
+			logp("md5_update() failed\n");
 			return SEND_FATAL;
+		}
 	}
 
+#ifdef HAVE_WIN32
+	if(sw->do_known_byte_count && sw->datalen<=0)
+		sw->flush=Z_FINISH;
+	else
+#endif
+	if(strm->avail_in) sw->flush=Z_NO_FLUSH;
+	else sw->flush=Z_FINISH;
+
+	strm->next_in=sw->in;
+
+	/* run deflate() on input until output buffer not full, finish
+		compression if all of source has been read in */
 	do
 	{
-		if(metadata)
+		if(sw->compression)
 		{
-			if(metalen>ZCHUNK)
-				strm.avail_in=ZCHUNK;
-			else
-				strm.avail_in=metalen;
-			memcpy(in, metadata, strm.avail_in);
-			metadata+=strm.avail_in;
-			metalen-=strm.avail_in;
+			strm->avail_out=sw->chunk;
+			strm->next_out=sw->out;
+			/* no bad return value */
+			sw->zret=deflate(strm, sw->flush);
+			if(sw->zret==Z_STREAM_ERROR) /* state not clobbered */
+			{
+				logw(sw->asfd, sw->cntr, "z_stream_error when reading %s in %s\n", sw->bfd->path, __func__);
+				return SEND_ERROR;
+			}
+			have=sw->chunk-strm->avail_out;
 		}
 		else
 		{
-			// Windows VSS headers give us how much data to
-			// expect to read.
-#ifdef HAVE_WIN32
-			if(do_known_byte_count)
-			{
-				if(datalen<=0)
-					r=0;
-				else
-				{
-					r=bfd->read(bfd, in,
-						min((size_t)ZCHUNK, datalen));
-					if(r>0)
-						datalen-=r;
-				}
-			}
-			else
-#endif
-				r=bfd->read(bfd, in, ZCHUNK);
+			have=strm->avail_in;
+			memcpy(sw->out, sw->in, have);
+		}
 
-			if(r<0)
-			{
-				logw(asfd, cntr,
-					"Error when reading %s in %s: %s\n",
-					bfd->path, __func__, strerror(errno));
-				ret=SEND_ERROR;
-				break;
-			}
-			strm.avail_in=(uint32_t)r;
+		if(sw->enc_ctx)
+		{
+			if(do_encryption(sw->asfd, sw->enc_ctx, sw->out, have,
+				sw->eoutbuf, &eoutlen, sw->md5))
+					return SEND_FATAL;
 		}
-		if(!compression && !strm.avail_in)
-			break;
+		else
+		{
+			iobuf_set(&wbuf, CMD_APPEND, (char *)sw->out, have);
+			if(sw->asfd->write(sw->asfd, &wbuf))
+				return SEND_FATAL;
+		}
+		if(!sw->compression) break;
+	} while(!strm->avail_out);
+
+	if(sw->compression && strm->avail_in) /* all input will be used */
+	{
+		logp("strm.avail_in=%d\n", strm->avail_in);
+		return SEND_FATAL;
+	}
+	if(sw->flush==Z_FINISH)
+		*done=1;
+	return SEND_OK;
+}
+
+static enum send_e gz_finish(struct send_whole *sw)
+{
+	int eoutlen;
+	struct iobuf wbuf;
+
+	if(sw->compression && sw->zret!=Z_STREAM_END)
+	{
+		logp("ret OK, but zstream not finished: %d\n", sw->zret);
+		return SEND_FATAL;
+	}
+	if(!sw->enc_ctx)
+		return SEND_OK;
+	if(!EVP_CipherFinal_ex(sw->enc_ctx, sw->eoutbuf, &eoutlen))
+	{
+		logp("Encryption failure at the end\n");
+		return SEND_FATAL;
+	}
+	if(eoutlen<=0)
+		return SEND_OK;
+	iobuf_set(&wbuf, CMD_APPEND, (char *)sw->eoutbuf, (size_t)eoutlen);
+	if(sw->asfd->write(sw->asfd, &wbuf))
+		return SEND_FATAL;
+	if(!md5_update(sw->md5, sw->eoutbuf, eoutlen))
+	{
+		logp("md5_update() failed\n");
+		return SEND_FATAL;
+	}
+	return SEND_OK;
+}
 
-		*bytes+=strm.avail_in;
+static enum send_e plain_step(struct send_whole *sw, int *done)
+{
+	ssize_t s;
+	struct iobuf wbuf;
 
-		// The checksum needs to be later if encryption is being used.
-		if(!enc_ctx)
+	if(sw->metadata)
+	{
+		// Send metadata in chunks, rather than all at once.
+		if(sw->metalen>0)
 		{
-			if(!md5_update(md5, in, strm.avail_in))
+			if(sw->metalen>sw->chunk) s=sw->chunk;
+			else s=sw->metalen;
+
+			if(!md5_update(sw->md5, sw->metadata, s))
 			{
 				logp("md5_update() failed\n");
-				ret=SEND_FATAL;
-				break;
+				return SEND_FATAL;
 			}
+			iobuf_set(&wbuf, CMD_APPEND, (char *)sw->metadata, s);
+			if(sw->asfd->write(sw->asfd, &wbuf))
+				return SEND_FATAL;
+
+			sw->metadata+=s;
+			sw->metalen-=s;
+			sw->bytes+=s;
 		}
+		if(!sw->metalen)
+			*done=1;
+		return SEND_OK;
+	}
 
 #ifdef HAVE_WIN32
-		if(do_known_byte_count && datalen<=0)
-			flush=Z_FINISH;
-		else
+	if(sw->do_known_byte_count)
+	{
+		s=sw->bfd->read(sw->bfd,
+			sw->in, min(sw->plain_len, sw->datalen));
+		if(s>0)
+			sw->datalen-=s;
+	}
+	else
 #endif
-		if(strm.avail_in) flush=Z_NO_FLUSH;
-		else flush=Z_FINISH;
+		s=sw->bfd->read(sw->bfd, sw->in, sw->plain_len);
+	if(!s)
+	{
+		*done=1;
+		return SEND_OK;
+	}
+	else if(s<0)
+	{
+		logw(sw->asfd, sw->cntr,
+			"Error when reading %s in %s: %s\n",
+			sw->bfd->path, __func__, strerror(errno));
+		return SEND_ERROR;
+	}
 
-		strm.next_in=in;
+	sw->bytes+=s;
+	if(!md5_update(sw->md5, sw->in, s))
+	{
+		logp("md5_update() failed\n");
+		return SEND_FATAL;
+	}
+	iobuf_set(&wbuf, CMD_APPEND, (char *)sw->in, s);
+	if(sw->asfd->write(sw->asfd, &wbuf))
+		return SEND_FATAL;
+#ifdef HAVE_WIN32
+	// Windows VSS headers tell us how many bytes to
+	// expect.
+	if(sw->do_known_byte_count && sw->datalen<=0)
+		*done=1;
+#endif
+	return SEND_OK;
+}
 
-		/* run deflate() on input until output buffer not full, finish
-			compression if all of source has been read in */
-		do
-		{
-			if(compression)
-			{
-				strm.avail_out = ZCHUNK;
-				strm.next_out = out;
-				zret = deflate(&strm, flush); /* no bad return value */
-				if(zret==Z_STREAM_ERROR) /* state not clobbered */
-				{
-					logw(asfd, cntr, "z_stream_error when reading %s in %s\n", bfd->path, __func__);
-					ret=SEND_ERROR;
-					break;
-				}
-				have = ZCHUNK-strm.avail_out;
-			}
-			else
-			{
-				have=strm.avail_in;
-				memcpy(out, in, have);
-			}
+enum send_e send_whole_step(struct send_whole *sw, int *done)
+{
+	if(sw->gz)
+		return gz_step(sw, done);
+	return plain_step(sw, done);
+}
 
-			if(enc_ctx)
-			{
-				if(do_encryption(asfd, enc_ctx, out, have,
-					eoutbuf, &eoutlen, md5))
-				{
-					ret=SEND_FATAL;
-					break;
-				}
-			}
-			else
-			{
-				iobuf_set(&wbuf, CMD_APPEND, (char *)out, have);
-				if(asfd->write(asfd, &wbuf))
-				{
-					ret=SEND_FATAL;
-					break;
-				}
-			}
-			if(quick_read && datapth)
-			{
-				int qr;
-				if((qr=do_quick_read(asfd, datapth, cntr))<0)
-				{
-					ret=SEND_FATAL;
-					break;
-				}
-				if(qr) // client wants to interrupt
-				{
-					goto cleanup;
-				}
-			}
-			if(!compression) break;
-		} while (!strm.avail_out);
+enum send_e send_whole_end(struct send_whole *sw,
+	enum send_e ret, int interrupted)
+{
+	uint8_t checksum[MD5_DIGEST_LENGTH];
 
-		if(ret!=SEND_OK) break;
+	if(sw->gz)
+	{
+		if(ret==SEND_OK && !interrupted)
+			ret=gz_finish(sw);
+		// Compressed or encrypted data is no good without its end.
+		if(ret!=SEND_OK)
+			return ret;
+	}
+	else if(ret==SEND_FATAL)
+		return ret;
 
-		if(!compression) continue;
+	if(!md5_final(sw->md5, checksum))
+	{
+		logp("md5_final() failed\n");
+		return SEND_FATAL;
+	}
+	if(write_endfile(sw->asfd, sw->bytes, checksum))
+		return SEND_FATAL;
+	return ret;
+}
 
-		if(strm.avail_in) /* all input will be used */
-		{
-			ret=SEND_FATAL;
-			logp("strm.avail_in=%d\n", strm.avail_in);
-			break;
-		}
-	} while(flush!=Z_FINISH);
+static enum send_e send_whole_loop(struct send_whole *sw,
+	const char *datapth, int quick_read, uint64_t *bytes)
+{
+	int done=0;
+	int interrupted=0;
+	enum send_e ret=SEND_OK;
 
-	if(ret==SEND_OK)
+	sw->bytes=*bytes;
+	while(!done)
 	{
-		if(compression && zret!=Z_STREAM_END)
-		{
-			logp("ret OK, but zstream not finished: %d\n", zret);
-			ret=SEND_FATAL;
-		}
-		else if(enc_ctx)
+		if((ret=send_whole_step(sw, &done))!=SEND_OK)
+			break;
+		if(quick_read && !done)
 		{
-			if(!EVP_CipherFinal_ex(enc_ctx, eoutbuf, &eoutlen))
+			int qr;
+			if((qr=do_quick_read(sw->asfd, datapth, sw->cntr))<0)
 			{
-				logp("Encryption failure at the end\n");
 				ret=SEND_FATAL;
+				break;
 			}
-			else if(eoutlen>0)
+			if(qr) // client wants to interrupt
 			{
-				iobuf_set(&wbuf, CMD_APPEND,
-					(char *)eoutbuf, (size_t)eoutlen);
-				if(asfd->write(asfd, &wbuf))
-					ret=SEND_FATAL;
-				else if(!md5_update(md5, eoutbuf, eoutlen))
-				{
-					logp("md5_update() failed\n");
-					ret=SEND_FATAL;
-				}
+				interrupted=1;
+				break;
 			}
 		}
 	}
+	ret=send_whole_end(sw, ret, interrupted);
+	*bytes=sw->bytes;
+	return ret;
+}
 
-cleanup:
-	deflateEnd(&strm);
+enum send_e send_whole_file_gzl(struct asfd *asfd, const char *datapth,
+	int quick_read, uint64_t *bytes, const char *encpassword,
+	struct cntr *cntr, int compression, struct BFILE *bfd,
+	const char *extrameta, size_t elen, int key_deriv, uint64_t salt)
+{
+	enum send_e ret=SEND_FATAL;
+	struct send_whole *sw=NULL;
 
-	if(enc_ctx)
-	{
-		EVP_CIPHER_CTX_cleanup(enc_ctx);
-		EVP_CIPHER_CTX_free(enc_ctx);
-		enc_ctx=NULL;
-	}
+//logp("send_whole_file_gz: %s%s\n", fname, extrameta?" (meta)":"");
 
-	if(ret==SEND_OK)
-	{
-		uint8_t checksum[MD5_DIGEST_LENGTH];
-		if(!md5_final(md5, checksum))
-		{
-			logp("md5_final() failed\n");
-			md5_free(&md5);
-			return SEND_FATAL;
-		}
-		if(write_endfile(asfd, *bytes, checksum))
-			return SEND_FATAL;
-	}
-	md5_free(&md5);
+	if((sw=send_whole_alloc())
+	  && !send_whole_init(sw, asfd, cntr, bfd, extrameta, elen,
+		1 /* gz */, compression, encpassword, key_deriv, salt))
+			ret=send_whole_loop(sw, datapth,
+				quick_read && datapth, bytes);
+	send_whole_free(&sw);
 	return ret;
 }
 
@@ -451,6 +585,30 @@ static DWORD WINAPI write_efs(PBYTE pbData,
 	}
 	return ERROR_SUCCESS;
 }
+
+static enum send_e send_efs(struct send_whole *sw,
+	const char *datapth, int quick_read, uint64_t *bytes)
+{
+	struct winbuf mybuf;
+	mybuf.md5=sw->md5;
+	mybuf.quick_read=quick_read;
+	mybuf.datapth=datapth;
+	mybuf.cntr=sw->cntr;
+	mybuf.bytes=bytes;
+	mybuf.asfd=sw->asfd;
+	// The EFS read function, ReadEncryptedFileRaw(),
+	// works in an annoying way. You have to give it a
+	// function that it calls repeatedly every time the
+	// read buffer is called.
+	// So ReadEncryptedFileRaw() will not return until
+	// it has read the whole file. I have no idea why
+	// they do not have a plain 'read()' function for it.
+
+	ReadEncryptedFileRaw((PFE_EXPORT_FUNC)write_efs,
+		&mybuf, sw->bfd->pvContext);
+	sw->bytes=*bytes;
+	return send_whole_end(sw, SEND_OK, 0);
+}
 #endif
 
 enum send_e send_whole_filel(struct asfd *asfd,
@@ -461,11 +619,8 @@ enum send_e send_whole_filel(struct asfd *asfd,
 	int quick_read, uint64_t *bytes, struct cntr *cntr,
 	struct BFILE *bfd, const char *extrameta, size_t elen)
 {
-	enum send_e ret=SEND_OK;
-	ssize_t s=0;
-	struct md5 *md5=NULL;
-	char buf[4096]="";
-	struct iobuf wbuf;
+	enum send_e ret=SEND_FATAL;
+	struct send_whole *sw=NULL;
 
 	if(!bfd)
 	{
@@ -473,152 +628,17 @@ enum send_e send_whole_filel(struct asfd *asfd,
 		return SEND_FATAL;
 	}
 
-	if(!(md5=md5_alloc(__func__)))
-		return SEND_FATAL;
-	if(!md5_init(md5))
-	{
-		logp("md5_init() failed\n");
-		md5_free(&md5);
-		return SEND_FATAL;
-	}
-
-	if(extrameta)
-	{
-		size_t metalen=0;
-		const char *metadata=NULL;
-
-		metadata=extrameta;
-		metalen=elen;
-
-		// Send metadata in chunks, rather than all at once.
-		while(metalen>0)
-		{
-			if(metalen>ZCHUNK) s=ZCHUNK;
-			else s=metalen;
-
-			if(!md5_update(md5, metadata, s))
-			{
-				logp("md5_update() failed\n");
-				ret=SEND_FATAL;
-			}
-			iobuf_set(&wbuf, CMD_APPEND, (char *)metadata, s);
-			if(asfd->write(asfd, &wbuf))
-				ret=SEND_FATAL;
-
-			metadata+=s;
-			metalen-=s;
-
-			*bytes+=s;
-		}
-	}
-	else
-	{
-#ifdef HAVE_WIN32
-		if(ret==SEND_OK && cmd==CMD_EFS_FILE)
-		{
-			struct winbuf mybuf;
-			mybuf.md5=md5;
-			mybuf.quick_read=quick_read;
-			mybuf.datapth=datapth;
-			mybuf.cntr=cntr;
-			mybuf.bytes=bytes;
-			mybuf.asfd=asfd;
-			// The EFS read function, ReadEncryptedFileRaw(),
-			// works in an annoying way. You have to give it a
-			// function that it calls repeatedly every time the
-			// read buffer is called.
-			// So ReadEncryptedFileRaw() will not return until
-			// it has read the whole file. I have no idea why
-			// they do not have a plain 'read()' function for it.
-
-			ReadEncryptedFileRaw((PFE_EXPORT_FUNC)write_efs,
-				&mybuf, bfd->pvContext);
-		}
-		else
-#endif
-
-		if(ret==SEND_OK)
-		{
-#ifdef HAVE_WIN32
-		  int do_known_byte_count=0;
-		  size_t datalen=bfd->datalen;
-		  if(datalen>0) do_known_byte_count=1;
-#endif
-		  while(1)
-		  {
-#ifdef HAVE_WIN32
-			if(do_known_byte_count)
-			{
-				s=bfd->read(bfd,
-					buf, min((size_t)4096, datalen));
-				if(s>0)
-					datalen-=s;
-			}
-			else
-			{
-#endif
-				s=bfd->read(bfd, buf, 4096);
-#ifdef HAVE_WIN32
-			}
-#endif
-			if(!s)
-				break;
-			else if(s<0)
-			{
-				logw(asfd, cntr,
-					"Error when reading %s in %s: %s\n",
-					bfd->path, __func__, strerror(errno));
-				ret=SEND_ERROR;
-				break;
-			}
-
-			*bytes+=s;
-			if(!md5_update(md5, buf, s))
-			{
-				logp("md5_update() failed\n");
-				ret=SEND_FATAL;
-				break;
-			}
-			iobuf_set(&wbuf, CMD_APPEND, buf, s);
-			if(asfd->write(asfd, &wbuf))
-			{
-				ret=SEND_FATAL;
-				break;
-			}
-			if(quick_read)
-			{
-				int qr;
-				if((qr=do_quick_read(asfd, datapth, cntr))<0)
-				{
-					ret=SEND_FATAL;
-					break;
-				}
-				if(qr)
-				{
-					// client wants to interrupt
-					break;
-				}
-			}
+	if(!(sw=send_whole_alloc())
+	  || send_whole_init(sw, asfd, cntr, bfd, extrameta, elen,
+		0 /* not gz */, 0, NULL, 0, 0))
+			goto end;
 #ifdef HAVE_WIN32
-			// Windows VSS headers tell us how many bytes to
-			// expect.
-			if(do_known_byte_count && datalen<=0) break;
+	if(cmd==CMD_EFS_FILE && !extrameta)
+		ret=send_efs(sw, datapth, quick_read, bytes);
+	else
 #endif
-		  }
-		}
-	}
-	if(ret!=SEND_FATAL)
-	{
-		uint8_t checksum[MD5_DIGEST_LENGTH];
-		if(!md5_final(md5, checksum))
-		{
-			logp("md5_final() failed\n");
-			md5_free(&md5);
-			return SEND_FATAL;
-		}
-		if(write_endfile(asfd, *bytes, checksum))
-			return SEND_FATAL;
-	}
-	md5_free(&md5);
+		ret=send_whole_loop(sw, datapth, quick_read, bytes);
+end:
+	send_whole_free(&sw);
 	return ret;
 }
@@ -1,8 +1,10 @@
 #ifndef HANDY_EXTRA_H
 #define HANDY_EXTRA_H
 
+#include <openssl/evp.h>
 #include <openssl/md5.h>
 #include <zlib.h>
+#include "async.h"
 #include "bfile.h"
 #include "cmd.h"
 
@@ -18,6 +20,49 @@ enum send_e
 	SEND_ERROR=1
 };
 
+// State for sending a whole file a step at a time, so that the sending of
+// several files can be interleaved on one connection.
+struct send_whole
+{
+	struct asfd *asfd;
+	struct cntr *cntr;
+	struct BFILE *bfd;
+	struct md5 *md5;
+	const char *metadata;
+	size_t metalen;
+	uint64_t bytes;
+	int gz;
+	int compression;
+	EVP_CIPHER_CTX *enc_ctx;
+	z_stream strm;
+	int strm_init;
+	int flush;
+	int zret;
+#ifdef HAVE_WIN32
+	int do_known_byte_count;
+	size_t datalen;
+#endif
+	// Sized by the frames that the asfd takes.
+	size_t chunk;
+	size_t plain_len;
+	uint8_t *in;
+	uint8_t *out;
+	uint8_t *eoutbuf;
+};
+
+extern struct send_whole *send_whole_alloc(void);
+extern void send_whole_free(struct send_whole **sw);
+extern int send_whole_init(struct send_whole *sw, struct asfd *asfd,
+	struct cntr *cntr, struct BFILE *bfd,
+	const char *extrameta, size_t elen,
+	int gz, int compression, const char *encpassword,
+	int key_deriv, uint64_t salt);
+// Sends the next chunk. Sets done when there is nothing left to read.
+extern enum send_e send_whole_step(struct send_whole *sw, int *done);
+// Finishes off the stream and writes the end of file frame.
+extern enum send_e send_whole_end(struct send_whole *sw,
+	enum send_e ret, int interrupted);
+
 extern enum send_e send_whole_file_gzl(struct asfd *asfd, const char *datapth,
 	int quick_read, uint64_t *bytes, const char *encpassword,
 	struct cntr *cntr, int compression, struct BFILE *bfd,
@@ -126,12 +126,39 @@ int iobuf_is_estimatable(struct iobuf *iobuf)
 	return cmd_is_estimatable(iobuf->cmd);
 }
 
+static int hex_digit(char c)
+{
+	if(c>='0' && c<='9') return c-'0';
+	if(c>='A' && c<='F') return c-'A'+10;
+	if(c>='a' && c<='f') return c-'a'+10;
+	return -1;
+}
+
+// The five bytes before each piece of data on the network and in manifests
+// are the command, then the length as four hex digits. This is called for
+// every one of them, so it avoids sscanf().
+int iobuf_parse_lead(const char *lead, enum cmd *cmd, size_t *len)
+{
+	int i;
+	int d;
+	size_t s=0;
+	if(!lead[0])
+		return -1;
+	for(i=1; i<5; i++)
+	{
+		if((d=hex_digit(lead[i]))<0)
+			return -1;
+		s=(s<<4)|d;
+	}
+	*cmd=(enum cmd)lead[0];
+	*len=s;
+	return 0;
+}
+
 static int do_iobuf_fill_from_fzp(struct iobuf *iobuf, struct fzp *fzp,
 	int extra_bytes)
 {
-	unsigned int s;
 	char lead[6]="";
-	char command;
 	int r;
 
 	r=fzp_read_ensure(fzp, lead, sizeof(lead)-1, __func__);
@@ -146,13 +173,11 @@ static int do_iobuf_fill_from_fzp(struct iobuf *iobuf, struct fzp *fzp,
 			return -1; // Error.
 		}
 	}
-	if((sscanf(lead, "%c%04X", &command, &s))!=2)
+	if(iobuf_parse_lead(lead, &iobuf->cmd, &iobuf->len))
 	{
-		logp("sscanf failed reading manifest: %s\n", lead);
+		logp("could not parse lead reading manifest: %s\n", lead);
 		return -1;
 	}
-	iobuf->cmd=(enum cmd)command;
-	iobuf->len=(size_t)s;
 	if(!(iobuf->buf=(char *)malloc_w(
 		iobuf->len+extra_bytes+1, __func__)))
 			return -1;
@@ -162,7 +187,7 @@ static int do_iobuf_fill_from_fzp(struct iobuf *iobuf, struct fzp *fzp,
 		case 0: break; // OK.
 		case 1: return 1; // Finished OK.
 		default:
-			logp("Error attempting to read after %s in %s (%c:%u)\n", lead, __func__, iobuf->cmd, s);
+			logp("Error attempting to read after %s in %s (%c:%lu)\n", lead, __func__, iobuf->cmd, (unsigned long)iobuf->len);
 			return -1;
 	}
 	iobuf->buf[iobuf->len]='\0';
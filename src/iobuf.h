@@ -34,6 +34,7 @@ extern int iobuf_is_encrypted(struct iobuf *iobuf);
 extern int iobuf_is_metadata(struct iobuf *iobuf);
 extern int iobuf_is_estimatable(struct iobuf *iobuf);
 
+extern int iobuf_parse_lead(const char *lead, enum cmd *cmd, size_t *len);
 extern int iobuf_fill_from_fzp(struct iobuf *iobuf, struct fzp *fzp);
 extern int iobuf_fill_from_fzp_data(struct iobuf *iobuf, struct fzp *fzp);
 
@@ -47,8 +47,33 @@ int md5_final(
 	return MD5_Final(md, md5->ctx);
 }
 
+void md5_cleanup(void)
+{
+}
+
 #else
 
+// Looking up the digest by name on every md5_init() costs as much as
+// hashing a small file, so it is fetched once and kept until exit.
+static EVP_MD *md5_md=NULL;
+
+void md5_cleanup(void)
+{
+	EVP_MD_free(md5_md);
+	md5_md=NULL;
+}
+
+static const EVP_MD *get_md5_md(void)
+{
+	static int registered=0;
+	if(!md5_md && (md5_md=EVP_MD_fetch(NULL, "MD5", NULL))
+	  && !registered)
+		registered=!atexit(md5_cleanup);
+	if(md5_md)
+		return md5_md;
+	return EVP_md5();
+}
+
 struct md5 *md5_alloc(
         const char *func
 ) {
@@ -86,7 +111,7 @@ void md5_free(
 int md5_init(
 	struct md5 *md5
 ) {
-	return EVP_DigestInit_ex(md5->ctx, EVP_md5(), NULL);
+	return EVP_DigestInit_ex(md5->ctx, get_md5_md(), NULL);
 }
 
 int md5_update(
@@ -32,5 +32,8 @@ extern int md5_final(
 	struct md5 *md5,
 	unsigned char *md
 );
+// Releases what md5_init() keeps between calls. It is called at exit, and
+// md5_init() still works afterwards.
+extern void md5_cleanup(void);
 
 #endif
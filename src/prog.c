@@ -3,6 +3,7 @@
 #include "cmd.h"
 #include "conf.h"
 #include "conffile.h"
+#include "client/change_journal.h"
 #include "client/main.h"
 #include "handy.h"
 #include "hexmap.h"
@@ -11,6 +12,7 @@
 #include "strlist.h"
 #include "server/bedup.h"
 #include "server/main.h"
+#include "server/scrub.h"
 
 static void usage_server(void)
 {
@@ -34,6 +36,9 @@ static void usage_server(void)
 	printf("  -V            Print version and exit.\n");
 	printf("Options to use with '-a c':\n");
 	printf("  -C <client>   Run as if forked via a connection from this client.\n");
+	printf("Options to use with '-a scrub':\n");
+	printf("  -C <client>   Check the stored data of this client's backups.\n");
+	printf("  -b <number>   Only check this backup.\n");
 	printf("\n");
 #endif
 }
@@ -48,6 +53,9 @@ static void usage_client(void)
 	printf("                  delete: delete\n");
 	printf("                  d: diff\n");
 	printf("                  e: estimate\n");
+#ifndef HAVE_WIN32
+	printf("                  journal: watch for changes (see change_journal)\n");
+#endif
 	printf("                  l: list (this is the default when an action is not given)\n");
 	printf("                  L: long list\n");
 	printf("                  m: monitor interface\n");
@@ -169,6 +177,12 @@ static int parse_action(enum action *act, const char *optarg,
 		*act=ACTION_LIST_LONG;
 	else if(!strncmp(optarg, "parseablelist", 1))
 		*act=ACTION_LIST_PARSEABLE;
+	// Needs spelling out, because 's' is already taken.
+	else if(!strncmp_w(optarg, "scrub"))
+		*act=ACTION_SCRUB;
+	// Needs spelling out, so that it is not mistaken for anything else.
+	else if(!strncmp_w(optarg, "journal"))
+		*act=ACTION_CHANGE_JOURNAL;
 	else if(!strncmp(optarg, "status", 1))
 		*act=ACTION_STATUS;
 	else if(!strncmp(optarg, "Status", 1))
@@ -474,6 +488,9 @@ int real_main(int argc, char *argv[])
 			case ACTION_CHAMP_CHOOSER:
 				// Need to run without getting the lock.
 				break;
+			case ACTION_SCRUB:
+				// Gets the lock of the client instead.
+				break;
 			default:
 				if(!(lock=get_prog_lock(confs)))
 					goto end;
@@ -534,9 +551,16 @@ int real_main(int argc, char *argv[])
 #ifdef HAVE_WIN32
 		logp("Sorry, server mode is not implemented for Windows.\n");
 #else
-		return server(confs, conffile, lock, generate_ca_only);
+		if(act==ACTION_SCRUB)
+			ret=run_scrub(confs, orig_client, backup)?1:0;
+		else
+			return server(confs, conffile, lock, generate_ca_only);
 #endif
 	}
+	else if(act==ACTION_CHANGE_JOURNAL)
+	{
+		ret=change_journal_watch(confs)?1:0;
+	}
 	else
 	{
 		ret=client(confs, act);
@@ -35,6 +35,17 @@ regex_t *regex_compile_backup(const char *str)
 #endif
 }
 
+// The same as regex_compile_backup(), but it can only say whether or not
+// there is a match. That lets the matcher run without backtracking.
+regex_t *regex_compile_backup_nosub(const char *str)
+{
+#ifdef HAVE_WIN32
+	return do_regex_compile(str, REG_EXTENDED|REG_ICASE|REG_NOSUB);
+#else
+	return do_regex_compile(str, REG_EXTENDED|REG_NOSUB);
+#endif
+}
+
 regex_t *regex_compile_restore(const char *str, int insensitive)
 {
 	if(insensitive)
@@ -8,6 +8,7 @@
 #endif
 
 extern regex_t *regex_compile_backup(const char *str);
+extern regex_t *regex_compile_backup_nosub(const char *str);
 extern regex_t *regex_compile_restore(const char *str, int insensitive);
 extern int regex_check(regex_t *regex, const char *buf);
 extern void regex_free(regex_t **regex);
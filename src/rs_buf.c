@@ -399,19 +399,23 @@ rs_result rs_patch_gzfile(struct fzp *basis_file,
 	return r;
 }
 
+static rs_job_t *sig_begin(size_t new_block_len, size_t strong_len,
+	struct conf **confs)
+{
+	return rs_sig_begin(new_block_len, strong_len
+#ifndef RS_DEFAULT_STRONG_LEN
+		, rshash_to_magic_number(get_e_rshash(confs[OPT_RSHASH]))
+#endif
+	);
+}
+
 rs_result rs_sig_gzfile(struct fzp *old_file, struct fzp *sig_file,
 	size_t new_block_len, size_t strong_len,
 	struct conf **confs)
 {
 	rs_job_t *job;
 	rs_result r;
-	job=
-		rs_sig_begin(new_block_len, strong_len
-#ifndef RS_DEFAULT_STRONG_LEN
-                  	, rshash_to_magic_number(
-				get_e_rshash(confs[OPT_RSHASH]))
-#endif
-		);
+	job=sig_begin(new_block_len, strong_len, confs);
 
 	r=rs_whole_gzrun(job, old_file, sig_file);
 	rs_job_free(job);
@@ -419,6 +423,92 @@ rs_result rs_sig_gzfile(struct fzp *old_file, struct fzp *sig_file,
 	return r;
 }
 
+/*
+ * Generate the signature of OLD_FILE and load it into SIG, without
+ * writing the signature out to a file and reading it back in. The output
+ * of the signature job is fed straight into a loadsig job through an
+ * intermediate buffer. If SIG_FILE is given, the signature is also
+ * written to it as it goes past.
+ */
+rs_result rs_sig_gzfile_load(struct fzp *old_file, struct fzp *sig_file,
+	rs_signature_t **sig,
+	size_t new_block_len, size_t strong_len,
+	struct conf **confs)
+{
+	rs_result r=RS_MEM_ERROR;
+	rs_result sigr=RS_BLOCKED;
+	rs_job_t *sigjob=NULL;
+	rs_job_t *loadjob=NULL;
+	rs_buffers_t sigbuf;
+	rs_buffers_t loadbuf;
+	rs_filebuf_t *in_fb=NULL;
+	char *mid=NULL;
+	size_t pending=0;
+
+	memset(&sigbuf, 0, sizeof(sigbuf));
+	memset(&loadbuf, 0, sizeof(loadbuf));
+	if(!(in_fb=rs_filebuf_new(NULL, old_file, NULL, ASYNC_BUF_LEN, -1))
+	  || !(mid=(char *)malloc_w(ASYNC_BUF_LEN, __func__))
+	  || !(sigjob=sig_begin(new_block_len, strong_len, confs))
+	  || !(loadjob=rs_loadsig_begin(sig)))
+		goto end;
+
+	while(1)
+	{
+		if(sigr==RS_BLOCKED)
+		{
+			if((r=rs_infilebuf_fill(sigjob, &sigbuf, in_fb))
+				!=RS_DONE)
+					goto end;
+			sigbuf.next_out=mid+pending;
+			sigbuf.avail_out=ASYNC_BUF_LEN-pending;
+			sigr=rs_job_iter(sigjob, &sigbuf);
+			if(sigr!=RS_DONE && sigr!=RS_BLOCKED)
+			{
+				r=sigr;
+				goto end;
+			}
+			if(sig_file)
+			{
+				size_t wlen=sigbuf.next_out-(mid+pending);
+				if(fzp_write(sig_file, mid+pending, wlen)!=wlen)
+				{
+					logp("error writing signature in %s\n",
+						__func__);
+					r=RS_IO_ERROR;
+					goto end;
+				}
+			}
+			pending=sigbuf.next_out-mid;
+		}
+
+		loadbuf.next_in=mid;
+		loadbuf.avail_in=pending;
+		loadbuf.eof_in=(sigr==RS_DONE);
+		if((r=rs_job_iter(loadjob, &loadbuf))==RS_DONE)
+			break;
+		if(r!=RS_BLOCKED)
+			goto end;
+		if(sigr==RS_DONE && loadbuf.avail_in==pending)
+		{
+			logp("signature load made no progress in %s\n",
+				__func__);
+			r=RS_INPUT_ENDED;
+			goto end;
+		}
+
+		// Keep whatever the loadsig job did not use yet.
+		pending=loadbuf.avail_in;
+		memmove(mid, loadbuf.next_in, pending);
+	}
+end:
+	if(sigjob) rs_job_free(sigjob);
+	if(loadjob) rs_job_free(loadjob);
+	rs_filebuf_free(&in_fb);
+	free_w(&mid);
+	return r;
+}
+
 rs_result rs_delta_gzfile(rs_signature_t *sig, struct fzp *new_file,
 	struct fzp *delta_file)
 {
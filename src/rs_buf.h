@@ -74,6 +74,12 @@ rs_result rs_sig_gzfile(struct fzp *old_file,
 	size_t new_block_len,
 	size_t strong_len,
 	struct conf **confs);
+rs_result rs_sig_gzfile_load(struct fzp *old_file,
+	struct fzp *sig_file,
+	rs_signature_t **sig,
+	size_t new_block_len,
+	size_t strong_len,
+	struct conf **confs);
 rs_result rs_delta_gzfile(rs_signature_t *sig,
 	struct fzp *new_file,
 	struct fzp *delta_file);
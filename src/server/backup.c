@@ -254,6 +254,7 @@ static int do_backup_server(struct async *as, struct sdirs *sdirs,
 	// Write backup_stats before flipping the symlink, so that is there
 	// even if phase4 is interrupted.
 	cntr_set_bytes(cntr, asfd);
+	asfd_log_write_stats(asfd);
 	if(cntr_stats_to_file(cntr, sdirs->working, ACTION_BACKUP))
 		goto error;
 	unlink(sdirs->counters_d);
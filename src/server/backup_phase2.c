@@ -16,11 +16,15 @@
 #include "backup_phase2.h"
 #include "blocklen.h"
 #include "child.h"
+#include "chunks.h"
 #include "compress.h"
 #include "dpth.h"
+#include "ingest_dedup.h"
 #include "link.h"
 #include "manios.h"
 #include "resume.h"
+#include "sdirs.h"
+#include "sigcache.h"
 
 static size_t treepathlen=0;
 
@@ -125,6 +129,9 @@ static int start_to_receive_new_file(struct asfd *asfd,
 	if(!(rpath=set_new_datapth(sdirs, cconfs, sb, dpth, &istreedata)))
 		goto end;
 
+	// After an interrupted backup, the path might be a hard link to a
+	// file that other backups share. Never write through it.
+	unlink(rpath);
 	if(!(sb->fzp=fzp_open(rpath, "wb")))
 	{
 		log_and_send(asfd, "make file failed");
@@ -150,10 +157,42 @@ enum processed_e
 
 #include <librsync.h>
 
+// If phase4 of the previous backup kept the signature of the file, it can
+// be sent as it is, rather than reading the whole file to make it again.
+static int open_cached_sig(struct conf **cconfs,
+	struct sbuf *p1b, const char *current)
+{
+	char *sigpath=NULL;
+
+	if(!get_int(cconfs[OPT_LIBRSYNC_SIGNATURE_CACHE]))
+		return 0;
+	if(!(sigpath=sigcache_path(current, cconfs, p1b->datapth.buf)))
+		return -1;
+	if(is_reg_lstat(sigpath)>0)
+		p1b->sigfzp=fzp_open(sigpath, "rb");
+	free_w(&sigpath);
+	return 0;
+}
+
+// The old file is in the chunk store, so put it back together to make the
+// signature from. It comes back uncompressed, and is only needed while it
+// is open.
+static struct fzp *open_from_chunks(struct sdirs *sdirs, const char *recipe)
+{
+	char *tmp=NULL;
+	struct fzp *fzp=NULL;
+	if(!(tmp=prepend_s(sdirs->working, "chunks_rebuild")))
+		return NULL;
+	if(!chunks_rebuild(sdirs->chunks, recipe, tmp))
+		fzp=fzp_open(tmp, "rb");
+	unlink(tmp);
+	free_w(&tmp);
+	return fzp;
+}
+
 static enum processed_e process_changed_file(struct asfd *asfd,
-	struct conf **cconfs,
-	struct sbuf *cb, struct sbuf *p1b,
-	const char *adir)
+	struct sdirs *sdirs, struct conf **cconfs,
+	struct sbuf *cb, struct sbuf *p1b)
 {
 	int ret=P_ERROR;
 	size_t blocklen=0;
@@ -164,15 +203,39 @@ static enum processed_e process_changed_file(struct asfd *asfd,
 	// Move datapth onto p1b.
 	iobuf_move(&p1b->datapth, &cb->datapth);
 
-	if(!(curpath=prepend_s(adir, p1b->datapth.buf)))
+	if(open_cached_sig(cconfs, p1b, sdirs->current))
+		goto end;
+	if(p1b->sigfzp)
+	{
+		// Only the output buffer is needed for sending it.
+		if(!(p1b->outfb=rs_filebuf_new(NULL, NULL,
+			asfd, asfd_frame_len(asfd), -1)))
+		{
+			logp("could not rs_filebuf_new for in_outfb.\n");
+			goto end;
+		}
+		goto flag;
+	}
+
+	if(!(curpath=prepend_s(sdirs->currentdata, p1b->datapth.buf)))
 	{
 		log_out_of_memory(__func__);
 		goto end;
 	}
-	if(dpth_is_compressed(cb->compression, curpath))
-		p1b->sigfzp=fzp_gzopen(curpath, "rb");
-	else
-		p1b->sigfzp=fzp_open(curpath, "rb");
+	switch(chunks_is_recipe(sdirs_get_chunks(sdirs), curpath))
+	{
+		case 0:
+			if(dpth_is_compressed(cb->compression, curpath))
+				p1b->sigfzp=fzp_gzopen(curpath, "rb");
+			else
+				p1b->sigfzp=fzp_open(curpath, "rb");
+			break;
+		case 1:
+			p1b->sigfzp=open_from_chunks(sdirs, curpath);
+			break;
+		default:
+			break;
+	}
 	if(!p1b->sigfzp)
 	{
 		logp("could not open %s: %s\n", curpath, strerror(errno));
@@ -200,12 +263,13 @@ static enum processed_e process_changed_file(struct asfd *asfd,
 		goto end;
 	}
 	if(!(p1b->outfb=rs_filebuf_new(NULL, NULL,
-		asfd, ASYNC_BUF_LEN, -1)))
+		asfd, asfd_frame_len(asfd), -1)))
 	{
 		logp("could not rs_filebuf_new for in_outfb.\n");
 		goto end;
 	}
 
+flag:
 	// Flag the things that need to be sent (to the client)
 	p1b->flags |= SBUF_SEND_DATAPTH;
 	p1b->flags |= SBUF_SEND_STAT;
@@ -568,8 +632,7 @@ static enum processed_e maybe_do_delta_stuff(struct asfd *asfd,
 		return process_new(cconfs, p1b, manios);
 
 	// Otherwise, do the delta stuff (if possible).
-	return process_changed_file(asfd, cconfs, cb, p1b,
-		sdirs->currentdata);
+	return process_changed_file(asfd, sdirs, cconfs, cb, p1b);
 }
 
 static enum processed_e deleted_file(struct sbuf *cb,
@@ -618,12 +681,190 @@ enum sts_e
 	STS_BLOCKED=1
 };
 
+// With phase2 streams, the client can have more than one file in flight at
+// once. Each stream has its own receive sbuf and delta tmp file. Files can
+// finish in any order, so finished ones are held until those requested
+// before them are done, to keep the changed manifest in phase1 order.
+struct stream
+{
+	struct sbuf *rb; // Receiving file from client.
+	char *deltmppath;
+	uint64_t seq;
+	int busy;
+};
+
+struct finished
+{
+	uint64_t seq;
+	struct sbuf *sb; // NULL if the client interrupted the file.
+	struct finished *next;
+};
+
+struct streams
+{
+	struct stream *s;
+	int count;
+	int in; // Stream that the client is sending on.
+	int out; // Stream that the server is sending on, or -1.
+	int out_sent;
+	int busy;
+	uint64_t next_seq;
+	uint64_t flush_seq;
+	struct finished *head;
+	struct finished *tail;
+	size_t held;
+};
+
+// Stop requesting files if this many are waiting on an earlier one.
+#define STREAMS_HELD_MAX	4096
+
+static void streams_free(struct streams **streams)
+{
+	int i;
+	struct finished *f;
+	if(!streams || !*streams) return;
+	for(i=0; (*streams)->s && i<(*streams)->count; i++)
+	{
+		struct stream *s=&(*streams)->s[i];
+		if(s->rb) fzp_close(&s->rb->fzp);
+		sbuf_free(&s->rb);
+		if(s->deltmppath) unlink(s->deltmppath);
+		free_w(&s->deltmppath);
+	}
+	while((f=(*streams)->head))
+	{
+		(*streams)->head=f->next;
+		sbuf_free(&f->sb);
+		free_v((void **)&f);
+	}
+	free_v((void **)&(*streams)->s);
+	free_v((void **)streams);
+}
+
+static struct streams *streams_alloc(struct sdirs *sdirs, int count)
+{
+	int i;
+	char suffix[16];
+	struct streams *streams;
+	if(!(streams=(struct streams *)
+		calloc_w(1, sizeof(struct streams), __func__))
+	  || !(streams->s=(struct stream *)
+		calloc_w(count, sizeof(struct stream), __func__)))
+			goto error;
+	streams->count=count;
+	streams->out=-1;
+	for(i=0; i<count; i++)
+	{
+		snprintf(suffix, sizeof(suffix), ".%d", i);
+		if(!(streams->s[i].rb=sbuf_alloc())
+		  || !(streams->s[i].deltmppath=
+			prepend(sdirs->deltmppath, suffix)))
+				goto error;
+	}
+	return streams;
+error:
+	streams_free(&streams);
+	return NULL;
+}
+
+// Picks a free stream for the next file to request, and tells the client.
+static enum sts_e stream_select_out(struct asfd *asfd,
+	struct streams *streams)
+{
+	char buf[16];
+	struct iobuf wbuf;
+	if(streams->out<0)
+	{
+		int i;
+		if(streams->held>=STREAMS_HELD_MAX)
+			return STS_BLOCKED;
+		for(i=0; i<streams->count; i++)
+			if(!streams->s[i].busy)
+				break;
+		if(i==streams->count)
+			return STS_BLOCKED;
+		streams->s[i].busy=1;
+		streams->s[i].seq=streams->next_seq++;
+		streams->busy++;
+		streams->out=i;
+		streams->out_sent=0;
+	}
+	if(streams->out_sent)
+		return STS_OK;
+	snprintf(buf, sizeof(buf), "%d", streams->out);
+	iobuf_from_str(&wbuf, CMD_STREAM, buf);
+	switch(asfd->append_all_to_write_buffer(asfd, &wbuf))
+	{
+		case APPEND_OK:
+			streams->out_sent=1;
+			return STS_OK;
+		case APPEND_BLOCKED:
+			return STS_BLOCKED;
+		default:
+			return STS_ERROR;
+	}
+}
+
+// Whether there is something to send without waiting for the client.
+static int streams_can_send(struct asfd *asfd, struct streams *streams,
+	struct manios *manios)
+{
+	if(asfd->writebuflen || !manios->phase1)
+		return 0;
+	if(streams->out>=0)
+		return 1;
+	return streams->busy<streams->count
+	  && streams->held<STREAMS_HELD_MAX;
+}
+
+// Sends the next chunk of a signature kept by phase4. The rsbuf is not
+// otherwise used for this file, so avail_in remembers a chunk that could
+// not be sent yet.
+static enum sts_e send_cached_sig(struct asfd *asfd, struct sbuf *p1b)
+{
+	struct iobuf wbuf;
+	rs_filebuf_t *fb=p1b->outfb;
+
+	if(!p1b->rsbuf.avail_in)
+	{
+		int len;
+		if((len=fzp_read(p1b->sigfzp, fb->buf, fb->buf_len))<0)
+		{
+			logp("error reading cached signature for %s\n",
+				iobuf_to_printable(&p1b->datapth));
+			return STS_ERROR;
+		}
+		if(!len)
+			return STS_OK;
+		p1b->rsbuf.avail_in=(size_t)len;
+	}
+	iobuf_set(&wbuf, CMD_APPEND, fb->buf, p1b->rsbuf.avail_in);
+	switch(asfd->append_all_to_write_buffer(asfd, &wbuf))
+	{
+		case APPEND_OK:
+			p1b->rsbuf.avail_in=0;
+			// Keep going round the loop.
+			return STS_BLOCKED;
+		case APPEND_BLOCKED:
+			return STS_BLOCKED;
+		default:
+			return STS_ERROR;
+	}
+}
+
 // Return 1 if there is still stuff needing to be sent.
 // FIX THIS: lots of repeated code.
 static enum sts_e do_stuff_to_send(struct asfd *asfd,
-	struct sbuf *p1b, char **last_requested)
+	struct sbuf *p1b, char **last_requested, struct streams *streams)
 {
 	static struct iobuf wbuf;
+	if(streams
+	  && (p1b->flags & (SBUF_SEND_DATAPTH|SBUF_SEND_STAT|SBUF_SEND_PATH)))
+	{
+		enum sts_e sts;
+		if((sts=stream_select_out(asfd, streams))!=STS_OK)
+			return sts;
+	}
 	if(p1b->flags & SBUF_SEND_DATAPTH)
 	{
 		iobuf_copy(&wbuf, &p1b->datapth);
@@ -656,9 +897,14 @@ static enum sts_e do_stuff_to_send(struct asfd *asfd,
 			default: return STS_ERROR;
 		}
 		p1b->flags &= ~SBUF_SEND_PATH;
-		free_w(last_requested);
-		if(!(*last_requested=strdup_w(p1b->path.buf, __func__)))
-			return STS_ERROR;
+		// The streams keep track of what is outstanding instead.
+		if(!streams)
+		{
+			free_w(last_requested);
+			if(!(*last_requested=strdup_w(p1b->path.buf,
+				__func__)))
+					return STS_ERROR;
+		}
 	}
 	if(p1b->sigjob && !(p1b->flags & SBUF_SEND_ENDOFSIG))
 	{
@@ -681,6 +927,19 @@ static enum sts_e do_stuff_to_send(struct asfd *asfd,
 				return STS_ERROR;
 		}
 	}
+	else if(p1b->sigfzp && !(p1b->flags & SBUF_SEND_ENDOFSIG))
+	{
+		switch(send_cached_sig(asfd, p1b))
+		{
+			case STS_OK:
+				p1b->flags |= SBUF_SEND_ENDOFSIG;
+				break;
+			case STS_BLOCKED:
+				return STS_BLOCKED;
+			default:
+				return STS_ERROR;
+		}
+	}
 	if(p1b->flags & SBUF_SEND_ENDOFSIG)
 	{
 		iobuf_from_str(&wbuf, CMD_END_FILE, (char *)"endfile");
@@ -692,20 +951,22 @@ static enum sts_e do_stuff_to_send(struct asfd *asfd,
 		}
 		p1b->flags &= ~SBUF_SEND_ENDOFSIG;
 	}
+	if(streams)
+		streams->out=-1;
 	return STS_OK;
 }
 
-static int start_to_receive_delta(struct sdirs *sdirs, struct sbuf *rb)
+static int start_to_receive_delta(struct sbuf *rb, const char *deltmppath)
 {
 	if(rb->compression)
 	{
-		if(!(rb->fzp=fzp_gzopen(sdirs->deltmppath,
+		if(!(rb->fzp=fzp_gzopen(deltmppath,
 			comp_level(rb->compression))))
 				return -1;
 	}
 	else
 	{
-		if(!(rb->fzp=fzp_open(sdirs->deltmppath, "wb")))
+		if(!(rb->fzp=fzp_open(deltmppath, "wb")))
 			return -1;
 	}
 	rb->flags |= SBUF_RECV_DELTA;
@@ -713,7 +974,8 @@ static int start_to_receive_delta(struct sdirs *sdirs, struct sbuf *rb)
 	return 0;
 }
 
-static int finish_delta(struct sdirs *sdirs, struct sbuf *rb)
+static int finish_delta(struct sdirs *sdirs, struct sbuf *rb,
+	const char *deltmppath)
 {
 	int ret=0;
 	char *deltmp=NULL;
@@ -723,44 +985,29 @@ static int finish_delta(struct sdirs *sdirs, struct sbuf *rb)
 	  || mkpath(&delpath, sdirs->working)
 	// Rename race condition is of no consequence here, as delpath will
 	// just get recreated.
-	  || do_rename(sdirs->deltmppath, delpath))
+	  || do_rename(deltmppath, delpath))
 		ret=-1;
 	free_w(&delpath);
 	free_w(&deltmp);
 	return ret;
 }
 
-static int deal_with_receive_end_file(struct asfd *asfd, struct sdirs *sdirs,
-	struct sbuf *rb, struct manios *manios,
-	struct conf **cconfs, char **last_requested)
+// Write a received file to the phase2 file.
+static int write_received(struct sbuf *rb, struct manios *manios,
+	struct conf **cconfs)
 {
-	int ret=-1;
 	static char *cp=NULL;
-	static struct iobuf *rbuf;
 	struct cntr *cntr=get_cntr(cconfs);
-	rbuf=asfd->rbuf;
-	// Finished the file.
-	// Write it to the phase2 file, and free the buffers.
-
-	if(fzp_close(&rb->fzp))
-	{
-		logp("error closing delta for %s in receive\n",
-			iobuf_to_printable(&rb->path));
-		goto end;
-	}
-	iobuf_move(&rb->endfile, rbuf);
-	if(rb->flags & SBUF_RECV_DELTA && finish_delta(sdirs, rb))
-		goto end;
 
 	if(manio_write_sbuf(manios->changed, rb))
-		goto end;
+		return -1;
 
 	if(rb->flags & SBUF_RECV_DELTA)
 	{
 		// Data has been saved - goes in counters_d, or the counters
 		// will be out of sequence.
 		if(manio_write_cntr(manios->counters_d, rb, CNTR_MANIO_CHANGED))
-			return P_ERROR;
+			return -1;
 		cntr_add_changed(cntr, rb->path.cmd);
 	}
 	else
@@ -768,13 +1015,10 @@ static int deal_with_receive_end_file(struct asfd *asfd, struct sdirs *sdirs,
 		// Data has been saved - goes in counters_d, or the counters
 		// will be out of sequence.
 		if(manio_write_cntr(manios->counters_d, rb, CNTR_MANIO_NEW))
-			return P_ERROR;
+			return -1;
 		cntr_add(cntr, rb->path.cmd, 0);
 	}
 
-	if(*last_requested && !strcmp(rb->path.buf, *last_requested))
-		free_w(last_requested);
-
 	cp=strchr(rb->endfile.buf, ':');
 	if(rb->endfile.buf)
 		cntr_add_bytes(cntr, strtoull(rb->endfile.buf, NULL, 10));
@@ -782,6 +1026,139 @@ static int deal_with_receive_end_file(struct asfd *asfd, struct sdirs *sdirs,
 	{
 		// checksum stuff goes here
 	}
+	return 0;
+}
+
+// Write out the finished files that are next in phase1 order.
+static int streams_flush(struct streams *streams, struct manios *manios,
+	struct conf **cconfs)
+{
+	struct finished *f;
+	while((f=streams->head) && f->seq==streams->flush_seq)
+	{
+		if(f->sb && write_received(f->sb, manios, cconfs))
+			return -1;
+		if(!(streams->head=f->next))
+			streams->tail=NULL;
+		sbuf_free(&f->sb);
+		free_v((void **)&f);
+		streams->flush_seq++;
+		streams->held--;
+	}
+	return 0;
+}
+
+// The client has finished with the current incoming stream. If keep is set,
+// the file is held to be written to the phase2 file in order.
+static int stream_finish(struct streams *streams, int keep,
+	struct manios *manios, struct conf **cconfs)
+{
+	struct sbuf *sb=NULL;
+	struct finished *f=NULL;
+	struct stream *s=&streams->s[streams->in];
+
+	if((keep && !(sb=sbuf_alloc()))
+	  || !(f=(struct finished *)
+		calloc_w(1, sizeof(struct finished), __func__)))
+	{
+		sbuf_free(&sb);
+		return -1;
+	}
+	f->seq=s->seq;
+	if(keep)
+	{
+		f->sb=s->rb;
+		s->rb=sb;
+	}
+	else
+		sbuf_free_content(s->rb);
+
+	// Usually finishes after the ones already held.
+	if(!streams->tail || streams->tail->seq<f->seq)
+	{
+		if(streams->tail)
+			streams->tail->next=f;
+		else
+			streams->head=f;
+		streams->tail=f;
+	}
+	else
+	{
+		struct finished **p;
+		for(p=&streams->head; (*p)->seq<f->seq; p=&(*p)->next) { }
+		f->next=*p;
+		*p=f;
+	}
+	streams->held++;
+	s->busy=0;
+	streams->busy--;
+	return streams_flush(streams, manios, cconfs);
+}
+
+// The whole of the new file is in place now, and probably still in the page
+// cache. If another client in the dedup group already sent the same file,
+// link to that. Otherwise, it might go into the chunk store. If neither
+// works out, it is kept as it is.
+static void finish_new_file(struct sdirs *sdirs, struct sbuf *rb,
+	struct conf **cconfs)
+{
+	char *path=NULL;
+	int chunk_store=get_int(cconfs[OPT_CHUNK_STORE]);
+	if(!(path=prepend_s(sdirs->datadirtmp, rb->datapth.buf)))
+		return;
+	// A file that is about to become a recipe is no use to the others.
+	if(get_int(cconfs[OPT_INGEST_DEDUP])
+	  && ingest_dedup(sdirs->ingest_dedup, path, rb->endfile.buf,
+		get_int(cconfs[OPT_MAX_HARDLINKS]), !chunk_store)>0)
+			goto end;
+	if(chunk_store
+	  && chunks_store(sdirs->chunks, path, rb->compression))
+		logp("could not chunk %s, keeping it whole\n", path);
+end:
+	free_w(&path);
+}
+
+static const char *get_deltmppath(struct sdirs *sdirs,
+	struct streams *streams)
+{
+	if(streams)
+		return streams->s[streams->in].deltmppath;
+	return sdirs->deltmppath;
+}
+
+static int deal_with_receive_end_file(struct asfd *asfd, struct sdirs *sdirs,
+	struct sbuf *rb, struct manios *manios,
+	struct conf **cconfs, char **last_requested, struct streams *streams)
+{
+	int ret=-1;
+	static struct iobuf *rbuf;
+	rbuf=asfd->rbuf;
+	// Finished the file.
+	// Write it to the phase2 file, and free the buffers.
+
+	if(fzp_close(&rb->fzp))
+	{
+		logp("error closing delta for %s in receive\n",
+			iobuf_to_printable(&rb->path));
+		goto end;
+	}
+	iobuf_move(&rb->endfile, rbuf);
+	if(rb->flags & SBUF_RECV_DELTA)
+	{
+		if(finish_delta(sdirs, rb, get_deltmppath(sdirs, streams)))
+			goto end;
+	}
+	else if(rb->path.cmd==CMD_FILE)
+		finish_new_file(sdirs, rb, cconfs);
+
+	if(streams)
+		return stream_finish(streams, 1, manios, cconfs);
+
+	if(write_received(rb, manios, cconfs))
+		goto end;
+
+	if(*last_requested && !strcmp(rb->path.buf, *last_requested))
+		free_w(last_requested);
 
 	ret=0;
 end:
@@ -807,14 +1184,15 @@ static int deal_with_receive_append(struct asfd *asfd, struct sbuf *rb)
 
 static int deal_with_filedata(struct asfd *asfd,
 	struct sdirs *sdirs, struct sbuf *rb,
-	struct iobuf *rbuf, struct dpth *dpth, struct conf **cconfs)
+	struct iobuf *rbuf, struct dpth *dpth, struct conf **cconfs,
+	const char *deltmppath)
 {
 	iobuf_move(&rb->path, rbuf);
 
 	if(rb->datapth.buf)
 	{
 		// Receiving a delta.
-		if(start_to_receive_delta(sdirs, rb))
+		if(start_to_receive_delta(rb, deltmppath))
 		{
 			logp("error in start_to_receive_delta\n");
 			return -1;
@@ -842,7 +1220,7 @@ enum str_e
 static enum str_e do_stuff_to_receive(struct asfd *asfd,
 	struct sdirs *sdirs, struct conf **cconfs,
 	struct sbuf *rb, struct manios *manios,
-	struct dpth *dpth, char **last_requested)
+	struct dpth *dpth, char **last_requested, struct streams *streams)
 {
 	struct iobuf *rbuf=asfd->rbuf;
 
@@ -855,6 +1233,29 @@ static enum str_e do_stuff_to_receive(struct asfd *asfd,
 		return STR_OK;
 	}
 
+	if(streams)
+	{
+		if(rbuf->cmd==CMD_STREAM)
+		{
+			int i=atoi(rbuf->buf);
+			if(i<0 || i>=streams->count || !streams->s[i].busy)
+			{
+				logp("bad phase2 stream from client: %s\n",
+					iobuf_to_printable(rbuf));
+				goto error;
+			}
+			streams->in=i;
+			return STR_OK;
+		}
+		if(rbuf->cmd!=CMD_GEN
+		  && !streams->s[streams->in].busy)
+		{
+			iobuf_log_unexpected(rbuf, __func__);
+			goto error;
+		}
+		rb=streams->s[streams->in].rb;
+	}
+
 	if(rb->fzp)
 	{
 		// Currently writing a file (or meta data)
@@ -866,7 +1267,8 @@ static enum str_e do_stuff_to_receive(struct asfd *asfd,
 				return STR_OK;
 			case CMD_END_FILE:
 				if(deal_with_receive_end_file(asfd, sdirs, rb,
-					manios, cconfs, last_requested))
+					manios, cconfs, last_requested,
+					streams))
 						goto error;
 				return STR_OK;
 			case CMD_INTERRUPT:
@@ -875,6 +1277,9 @@ static enum str_e do_stuff_to_receive(struct asfd *asfd,
 					free_w(last_requested);
 				fzp_close(&(rb->fzp));
 				sbuf_free_content(rb);
+				if(streams && stream_finish(streams,
+					0, manios, cconfs))
+						goto error;
 				return STR_OK;
 			default:
 				iobuf_log_unexpected(rbuf, __func__);
@@ -907,6 +1312,9 @@ static enum str_e do_stuff_to_receive(struct asfd *asfd,
 			if(*last_requested
 			  && !strcmp(rbuf->buf, *last_requested))
 				free_w(last_requested);
+			if(streams && stream_finish(streams,
+				0, manios, cconfs))
+					goto error;
 			return STR_OK;
 		default:
 			break;
@@ -914,8 +1322,9 @@ static enum str_e do_stuff_to_receive(struct asfd *asfd,
 	if(iobuf_is_filedata(rbuf)
 	  || iobuf_is_vssdata(rbuf))
 	{
-		if(deal_with_filedata(asfd, sdirs, rb, rbuf, dpth, cconfs))
-			goto error;
+		if(deal_with_filedata(asfd, sdirs, rb, rbuf, dpth, cconfs,
+			get_deltmppath(sdirs, streams)))
+				goto error;
 		return STR_OK;
 	}
 	iobuf_log_unexpected(rbuf, __func__);
@@ -1158,7 +1567,9 @@ int backup_phase2_server_all(struct async *as, struct sdirs *sdirs,
 	struct sbuf *cb=NULL; // file list in current manifest
 	struct sbuf *p1b=NULL; // file list from client
 	struct sbuf *rb=NULL; // receiving file from client
+	struct streams *streams=NULL;
 	struct asfd *asfd=NULL;
+	struct sbuf *tb=NULL;
 	int breaking=0;
 	int breakcount=0;
 	struct cntr *cntr=NULL;
@@ -1247,6 +1658,19 @@ int backup_phase2_server_all(struct async *as, struct sdirs *sdirs,
 	  || !(rb=sbuf_alloc()))
 		goto error;
 
+	if(get_int(cconfs[OPT_PHASE2_STREAMS])>1)
+	{
+		if(!(streams=streams_alloc(sdirs,
+			get_int(cconfs[OPT_PHASE2_STREAMS]))))
+				goto error;
+		logp("Using %d phase2 streams\n", streams->count);
+	}
+
+	// File data is written out straight away, so there is no need for a
+	// copy of each piece of it.
+	asfd->rbuf_views=1;
+	asfd->rbuf_view_cmd=CMD_APPEND;
+
 	while(1)
 	{
 		if(check_fail_on_warning(fail_on_warning, warn_ent))
@@ -1255,15 +1679,23 @@ int backup_phase2_server_all(struct async *as, struct sdirs *sdirs,
 		if(breaking && breakcount--==0)
 			return breakpoint(breaking, __func__);
 
+		tb=streams?streams->s[streams->in].rb:rb;
 		if(timed_operation(CNTR_STATUS_BACKUP,
-			rb->path.buf?rb->path.buf:"", asfd, sdirs, cconfs))
+			tb->path.buf?tb->path.buf:"", asfd, sdirs, cconfs))
 				goto error;
 		if(last_requested
 		  || !manios->phase1
-		  || asfd->writebuflen)
+		  || asfd->writebuflen
+		  || (streams && streams->busy))
 		{
-			iobuf_free_content(asfd->rbuf);
-			if(asfd->as->read_write(asfd->as))
+			int r;
+			asfd_free_rbuf(asfd);
+			// Do not wait on the client if there is more to send.
+			if(streams && streams_can_send(asfd, streams, manios))
+				r=asfd->as->read_quick(asfd->as);
+			else
+				r=asfd->as->read_write(asfd->as);
+			if(r)
 			{
 				logp("error in %s\n", __func__);
 				goto error;
@@ -1272,11 +1704,17 @@ int backup_phase2_server_all(struct async *as, struct sdirs *sdirs,
 			if(asfd->rbuf->buf)
 			  switch(do_stuff_to_receive(asfd, sdirs,
 				cconfs, rb, manios,
-				dpth, &last_requested))
+				dpth, &last_requested, streams))
 			{
 				case STR_OK:
 					break;
 				case STR_FINISHED:
+					if(streams
+					  && (streams->busy || streams->head))
+					{
+						logp("client finished phase2 with files still outstanding\n");
+						goto error;
+					}
 					if(check_fail_on_warning(
 						fail_on_warning, warn_ent))
 							goto error;
@@ -1286,7 +1724,8 @@ int backup_phase2_server_all(struct async *as, struct sdirs *sdirs,
 			}
 		}
 
-		if(p1b) switch(do_stuff_to_send(asfd, p1b, &last_requested))
+		if(p1b) switch(do_stuff_to_send(asfd, p1b, &last_requested,
+			streams))
 		{
 			case STS_OK:
 				sbuf_free(&p1b);
@@ -1309,6 +1748,12 @@ error:
 		logp("  last tried file:    %s\n",
 			iobuf_to_printable(&p1b->path));
 end:
+	if(asfd)
+	{
+		if(asfd->rbuf_view_saved)
+			asfd_free_rbuf(asfd);
+		asfd->rbuf_views=0;
+	}
 	if(manios_close(&manios))
 	{
 		logp("error closing manios in %s\n", __func__);
@@ -1323,6 +1768,7 @@ end:
 	sbuf_free(&cb);
 	sbuf_free(&p1b);
 	sbuf_free(&rb);
+	streams_free(&streams);
 	manio_close(&hmanio);
 	dpth_free(&dpth);
 	man_off_t_free(&pos_phase1);
@@ -1330,6 +1776,7 @@ end:
 	if(!ret && sdirs)
 		unlink(sdirs->phase1data);
 
+	ingest_dedup_log_stats();
 	logp("End phase2 (receive file data)\n");
 
 	return ret;
@@ -4,6 +4,7 @@
 #include "../conf.h"
 #include "../cstat.h"
 #include "../fsops.h"
+#include "../fzp.h"
 #include "../handy.h"
 #include "../log.h"
 #include "../sbuf.h"
@@ -13,6 +14,14 @@
 #include "child.h"
 #include "backup_phase3.h"
 
+// Phase4 can just hard link the data of files that came from the unchanged
+// manifest, instead of looking for where it is.
+static int list_unchanged(struct fzp *fzp, struct sbuf *sb)
+{
+	if(!fzp || !sb->datapth.buf) return 0;
+	return fzp_printf(fzp, "%s\n", sb->datapth.buf)<0?-1:0;
+}
+
 // Combine the phase1 and phase2 files into a new manifest.
 int backup_phase3_server_all(struct sdirs *sdirs, struct conf **confs)
 {
@@ -21,6 +30,8 @@ int backup_phase3_server_all(struct sdirs *sdirs, struct conf **confs)
 	struct sbuf *usb=NULL;
 	struct sbuf *csb=NULL;
 	char *manifesttmp=NULL;
+	char *listtmp=NULL;
+	struct fzp *listfzp=NULL;
 	struct manio *newmanio=NULL;
 	struct manio *chmanio=NULL;
 	struct manio *unmanio=NULL;
@@ -30,6 +41,17 @@ int backup_phase3_server_all(struct sdirs *sdirs, struct conf **confs)
 
 	logp("Begin phase3 (merge manifests)\n");
 
+	// When seeding, the data paths get rewritten, so the data is not
+	// where phase4 would look for it.
+	unlink(sdirs->unchangedlist);
+	if(!seed_src || !seed_dst)
+	{
+		if(!(listtmp=get_tmp_filename(sdirs->unchangedlist))
+		  || !(listfzp=fzp_gzopen(listtmp,
+			comp_level(get_int(confs[OPT_COMPRESSION])))))
+				goto end;
+	}
+
 	if(!(manifesttmp=get_tmp_filename(sdirs->manifest))
 	  || !(newmanio=manio_open_phase3(manifesttmp,
 		comp_level(get_int(confs[OPT_COMPRESSION])),
@@ -71,7 +93,8 @@ int backup_phase3_server_all(struct sdirs *sdirs, struct conf **confs)
 		if(usb->path.buf && !csb->path.buf)
 		{
 			if(timed_operation_status_only(CNTR_STATUS_MERGING,
-				usb->path.buf, confs)) goto end;
+				usb->path.buf, confs)
+			  || list_unchanged(listfzp, usb)) goto end;
 			switch(manio_copy_entry(usb, usb, unmanio, newmanio,
 				seed_src, seed_dst))
 			{
@@ -109,7 +132,8 @@ int backup_phase3_server_all(struct sdirs *sdirs, struct conf **confs)
 		else if(pcmp<0)
 		{
 			if(timed_operation_status_only(CNTR_STATUS_MERGING,
-				usb->path.buf, confs)) goto end;
+				usb->path.buf, confs)
+			  || list_unchanged(listfzp, usb)) goto end;
 			switch(manio_copy_entry(usb, usb, unmanio, newmanio,
 				seed_src, seed_dst))
 			{
@@ -138,6 +162,17 @@ int backup_phase3_server_all(struct sdirs *sdirs, struct conf **confs)
 		goto end;
 	}
 
+	if(listfzp)
+	{
+		if(fzp_close(&listfzp))
+		{
+			logp("error closing %s in %s\n", listtmp, __func__);
+			goto end;
+		}
+		if(do_rename(listtmp, sdirs->unchangedlist))
+			goto end;
+	}
+
 	// Rename race condition should be of no consequence here, as the
 	// manifest should just get recreated automatically.
 	if(do_rename(manifesttmp, sdirs->manifest))
@@ -154,8 +189,10 @@ end:
 	manio_close(&newmanio);
 	manio_close(&chmanio);
 	manio_close(&unmanio);
+	fzp_close(&listfzp);
 	sbuf_free(&csb);
 	sbuf_free(&usb);
 	free_w(&manifesttmp);
+	free_w(&listtmp);
 	return ret;
 }
@@ -13,12 +13,18 @@
 #include "../prepend.h"
 #include "../sbuf.h"
 #include "../strlist.h"
+#include "../uring.h"
 #include "blocklen.h"
 #include "deleteme.h"
+#include "delta_chain.h"
+#include "dirrefs.h"
 #include "fdirs.h"
 #include "child.h"
+#include "chunks.h"
 #include "compress.h"
 #include "link.h"
+#include "sdirs.h"
+#include "sigcache.h"
 #include "timestamp.h"
 #include "zlibio.h"
 #include "backup_phase4.h"
@@ -64,63 +70,70 @@ end:
 	return result;
 }
 
-static int make_rev_sig(const char *dst, const char *sig, const char *endfile,
-	int compression, struct conf **confs)
+static struct fzp *open_maybe_compressed(const char *path, int compression)
 {
-	int ret=-1;
-	rs_result result;
-	struct fzp *dstfzp=NULL;
-	struct fzp *sigp=NULL;
-//logp("make rev sig: %s %s\n", dst, sig);
+	if(dpth_is_compressed(compression, path))
+		return fzp_gzopen(path, "rb");
+	return fzp_open(path, "rb");
+}
 
-	if(dpth_is_compressed(compression, dst))
-		dstfzp=fzp_gzopen(dst, "rb");
-	else
-		dstfzp=fzp_open(dst, "rb");
+// Keeps the signature of a stored file for the next backup. Failure just
+// means that phase2 will have to make the signature from the file again.
+static void make_sig(const char *path, const char *sig, const char *endfile,
+	int compression, struct conf **cconfs)
+{
+	rs_result result=RS_IO_ERROR;
+	struct fzp *fzp=NULL;
+	struct fzp *sigfzp=NULL;
 
-	if(!dstfzp
-	  || !(sigp=fzp_open(sig, "wb")))
-		goto end;
-	
-	if((result=rs_sig_gzfile(dstfzp, sigp,
+	if((fzp=open_maybe_compressed(path, compression))
+	  && (sigfzp=fzp_open(sig, "wb"))
+	  && (result=rs_sig_gzfile(fzp, sigfzp,
 		get_librsync_block_len(endfile),
-		PROTO1_RS_STRONG_LEN, confs)!=RS_DONE))
-	{
-		logp("rs_sig_gzfile returned %d %s\n",
-			result, rs_strerror(result));
-		goto end;
-	}
-	ret=0;
-end:
-//logp("end of make rev sig\n");
-	fzp_close(&dstfzp);
-	if(fzp_close(&sigp))
-	{
-		logp("error closing %s in %s\n", sig, __func__);
-		return -1;
-	}
-	return ret;
+		PROTO1_RS_STRONG_LEN, cconfs))!=RS_DONE)
+			logp("rs_sig_gzfile returned %d %s\n",
+				result, rs_strerror(result));
+	fzp_close(&fzp);
+	if(fzp_close(&sigfzp) || result!=RS_DONE)
+		unlink(sig);
 }
 
-static int make_rev_delta(const char *src, const char *sig, const char *del,
-	int compression, struct conf **cconfs)
+// Make a reverse delta that turns dst (the new file) back into src (the old
+// file). The signature of dst is built in memory, and is also written to
+// sig if that is given.
+static int make_rev_delta(const char *src, const char *dst, const char *del,
+	const char *sig, const char *endfile, int compression,
+	struct conf **cconfs)
 {
 	int ret=-1;
 	rs_result result;
 	struct fzp *srcfzp=NULL;
+	struct fzp *dstfzp=NULL;
 	struct fzp *delfzp=NULL;
-	struct fzp *sigp=NULL;
+	struct fzp *sigfzp=NULL;
 	rs_signature_t *sumset=NULL;
 
-//logp("make rev delta: %s %s %s\n", src, sig, del);
-	if(!(sigp=fzp_open(sig, "rb"))) goto end;
+//logp("make rev delta: %s %s %s\n", src, dst, del);
+	if(!(dstfzp=open_maybe_compressed(dst, compression)))
+		goto end;
+	if(sig && !(sigfzp=fzp_open(sig, "wb")))
+		sig=NULL;
 
-	if((result=rs_loadsig_fzp(sigp, &sumset))!=RS_DONE)
+	if((result=rs_sig_gzfile_load(dstfzp, sigfzp, &sumset,
+		get_librsync_block_len(endfile),
+		PROTO1_RS_STRONG_LEN, cconfs))!=RS_DONE)
 	{
-		logp("rs_loadsig_fzp returned %d %s\n",
+		logp("rs_sig_gzfile_load returned %d %s\n",
 			result, rs_strerror(result));
 		goto end;
 	}
+	fzp_close(&dstfzp);
+	if(fzp_close(&sigfzp))
+	{
+		logp("error closing %s in %s\n", sig, __func__);
+		unlink(sig);
+		sig=NULL;
+	}
 	if((result=rs_build_hash_table(sumset))!=RS_DONE)
 	{
 		logp("rs_build_hash_table returned %d %s\n",
@@ -128,14 +141,8 @@ static int make_rev_delta(const char *src, const char *sig, const char *del,
 		goto end;
 	}
 
-//logp("make rev deltb: %s %s %s\n", src, sig, del);
-
-	if(dpth_is_compressed(compression, src))
-		srcfzp=fzp_gzopen(src, "rb");
-	else
-		srcfzp=fzp_open(src, "rb");
-
-	if(!srcfzp) goto end;
+	if(!(srcfzp=open_maybe_compressed(src, compression)))
+		goto end;
 
 	if(get_int(cconfs[OPT_COMPRESSION]))
 		delfzp=fzp_gzopen(del,
@@ -154,7 +161,12 @@ static int make_rev_delta(const char *src, const char *sig, const char *del,
 end:
 	if(sumset) rs_free_sumset(sumset);
 	fzp_close(&srcfzp);
-	fzp_close(&sigp);
+	fzp_close(&dstfzp);
+	if(sigfzp)
+	{
+		fzp_close(&sigfzp);
+		unlink(sig);
+	}
 	if(fzp_close(&delfzp))
 	{
 		logp("error closing delfzp %s in %s\n", del, __func__);
@@ -163,9 +175,9 @@ end:
 	return ret;
 }
 
-static int gen_rev_delta(const char *sigpath, const char *deltadir,
+static int gen_rev_delta(const char *deltadir,
 	const char *oldpath, const char *finpath, const char *path,
-	struct sbuf *sb, struct conf **cconfs)
+	const char *sigpath, struct sbuf *sb, struct conf **cconfs)
 {
 	int ret=-1;
 	char *delpath=NULL;
@@ -178,7 +190,6 @@ static int gen_rev_delta(const char *sigpath, const char *deltadir,
 /*
 	logp("delpath: %s\n", delpath);
 	logp("finpath: %s\n", finpath);
-	logp("sigpath: %s\n", sigpath);
 	logp("oldpath: %s\n", oldpath);
 */
 	if(mkpath(&delpath, deltadir))
@@ -186,19 +197,12 @@ static int gen_rev_delta(const char *sigpath, const char *deltadir,
 		logp("could not mkpaths for: %s\n", delpath);
 		goto end;
 	}
-	else if(make_rev_sig(finpath, sigpath,
+	else if(make_rev_delta(oldpath, finpath, delpath, sigpath,
 		sb->endfile.buf, sb->compression, cconfs))
-	{
-		logp("could not make signature from: %s\n", finpath);
-		goto end;
-	}
-	else if(make_rev_delta(oldpath, sigpath,
-		delpath, sb->compression, cconfs))
 	{
 		logp("could not make delta from: %s\n", oldpath);
 		goto end;
 	}
-	else unlink(sigpath);	
 
 	ret=0;
 end:
@@ -254,24 +258,31 @@ static int inflate_or_link_oldfile(const char *oldpath, const char *infpath,
 }
 
 static int forward_patch_and_reverse_diff(
+	struct sdirs *sdirs,
 	struct fdirs *fdirs,
 	struct fzp **delfp,
 	const char *deltabdir,
 	const char *deltafdir,
 	const char *deltafpath,
-	const char *sigpath,
 	const char *oldpath,
 	const char *newpath,
 	const char *datapth,
 	const char *finpath,
 	int hardlinked_current,
+	struct delta_chain *dc,
+	struct sigcache *sc,
 	struct sbuf *sb,
 	struct conf **cconfs
 )
 {
 	int lrs;
 	int ret=-1;
+	int keep_old=0;
+	int sig_done=0;
+	int old_recipe=0;
 	char *infpath=NULL;
+	char *delpath=NULL;
+	char *sigpath=NULL;
 
 	// Got a forward patch to do.
 	// First, need to gunzip the old file, otherwise the librsync patch
@@ -284,7 +295,20 @@ static int forward_patch_and_reverse_diff(
 	}
 
 	//logp("Fixing up: %s\n", datapth);
-	if(inflate_or_link_oldfile(oldpath, infpath, sb->compression, cconfs))
+	if((old_recipe=chunks_is_recipe(sdirs_get_chunks(sdirs), oldpath))<0)
+		goto end;
+	if(old_recipe)
+	{
+		// The chunks come back uncompressed.
+		if(chunks_rebuild(sdirs->chunks, oldpath, infpath))
+		{
+			logp("error when rebuilding old file: %s\n",
+				oldpath);
+			goto end;
+		}
+	}
+	else if(inflate_or_link_oldfile(oldpath, infpath,
+		sb->compression, cconfs))
 	{
 		logp("error when inflating old file: %s\n", oldpath);
 		goto end;
@@ -320,14 +344,46 @@ static int forward_patch_and_reverse_diff(
 		goto end;
 	}
 
+	// The signature of the new file gets kept for the next backup, if
+	// wanted. It comes for free when making the reverse delta.
+	if(sc)
+		sigpath=sigcache_new_path(sc, datapth);
+
 	// Need to generate a reverse diff, unless we are keeping a hardlinked
-	// archive.
-	if(!hardlinked_current)
+	// archive. If the chain of reverse deltas for this file has got too
+	// long, keep the old file as a full copy instead.
+	// An old recipe is always kept, because it costs next to nothing and
+	// shares its chunks with the new file.
+	if(!hardlinked_current && old_recipe)
+		keep_old=1;
+	else if(!hardlinked_current)
 	{
-		if(gen_rev_delta(sigpath, deltabdir,
-			oldpath, newpath, datapth, sb, cconfs))
+		if(dc && delta_chain_too_long(dc, datapth))
+			keep_old=1;
+		else if(gen_rev_delta(deltabdir,
+			oldpath, newpath, datapth, sigpath, sb, cconfs))
 				goto end;
+		else
+			sig_done=1;
+
+		if(!keep_old && dc && delta_chain_too_big(dc,
+			deltabdir, datapth, oldpath))
+		{
+			if(!(delpath=prepend_s(deltabdir, datapth)))
+				goto end;
+			unlink(delpath);
+			keep_old=1;
+		}
+		if(dc) delta_chain_add(dc, keep_old);
 	}
+	if(sigpath && !sig_done)
+		make_sig(newpath, sigpath, sb->endfile.buf,
+			sb->compression, cconfs);
+
+	if(get_int(cconfs[OPT_CHUNK_STORE])
+	  && sb->path.cmd==CMD_FILE
+	  && chunks_store(sdirs->chunks, newpath, sb->compression))
+		logp("could not chunk %s, keeping it whole\n", newpath);
 
 	// Power interruptions should be recoverable. If it happens before this
 	// point, the data jiggle for this file has to be done again.
@@ -348,7 +404,7 @@ static int forward_patch_and_reverse_diff(
 	// old file will hang around forever.
 	// FIX THIS: maybe put in something to detect this.
 	// ie, both a reverse delta and the old file exist.
-	if(!hardlinked_current)
+	if(!hardlinked_current && !keep_old)
 	{
 		//logp("Deleting oldpath...\n");
 		unlink(oldpath);
@@ -361,12 +417,15 @@ end:
 		unlink(infpath);
 		free_w(&infpath);
 	}
+	free_w(&delpath);
+	free_w(&sigpath);
 	return ret;
 }
 
 static int jiggle(struct sdirs *sdirs, struct fdirs *fdirs, struct sbuf *sb,
-	int hardlinked_current, const char *deltabdir, const char *deltafdir,
-	const char *sigpath, struct fzp **delfp, struct conf **cconfs)
+	int hardlinked_current, struct delta_chain *dc, struct sigcache *sc,
+	const char *deltabdir, const char *deltafdir,
+	struct fzp **delfp, struct conf **cconfs)
 {
 	int ret=-1;
 	struct stat statp;
@@ -418,17 +477,19 @@ static int jiggle(struct sdirs *sdirs, struct fdirs *fdirs, struct sbuf *sb,
 			goto end;
 		}
 		ret=forward_patch_and_reverse_diff(
+			sdirs,
 			fdirs,
 			delfp,
 			deltabdir,
 			deltafdir,
 			deltafpath,
-			sigpath,
 			oldpath,
 			newpath,
 			datapth,
 			finpath,
 			hardlinked_current,
+			dc,
+			sc,
 			sb,
 			cconfs
 		);
@@ -460,6 +521,8 @@ static int jiggle(struct sdirs *sdirs, struct fdirs *fdirs, struct sbuf *sb,
 			goto end;
 		else
 		{
+			if(sc) sigcache_move(sc, datapth);
+
 			// If we are not keeping a hardlinked
 			// archive, delete the old link.
 			if(!hardlinked_current)
@@ -493,6 +556,291 @@ end:
 	return ret;
 }
 
+// Most files in a backup are usually unchanged, and phase3 lists their data
+// paths. For those, there is no need to look for where the data is. It is
+// hard linked straight from the previous backup, relative to directory file
+// descriptors, with many links in flight at once if io_uring is on. Anything
+// unexpected, such as the link already being there after an interrupted
+// jiggle, falls back to jiggle() for that file.
+struct shuffle
+{
+	struct sdirs *sdirs;
+	struct fdirs *fdirs;
+	int hardlinked_current;
+	struct delta_chain *dc;
+	struct sigcache *sc;
+	const char *deltabdir;
+	const char *deltafdir;
+	struct fzp **delfp;
+	struct conf **cconfs;
+
+	struct fzp *listfzp;
+	char *next; // The next unchanged data path.
+	int olddirfd;
+	int newdirfd;
+	char *lastdir; // The last directory made in the new data directory.
+	unsigned int max_hardlinks;
+	// Unchanged directories that are symlinks to an older backup.
+	struct dirrefs_plan *plan;
+
+	uint64_t linked;
+	uint64_t looked_up;
+	uint64_t referred;
+};
+
+struct shuffle_op
+{
+	struct shuffle *s;
+	struct sbuf *sb;
+};
+
+static int shuffle_jiggle(struct shuffle *s, struct sbuf *sb)
+{
+	s->looked_up++;
+	return jiggle(s->sdirs, s->fdirs, sb, s->hardlinked_current,
+		s->dc, s->sc, s->deltabdir, s->deltafdir, s->delfp,
+		s->cconfs);
+}
+
+static void shuffle_next(struct shuffle *s)
+{
+	size_t len;
+	char buf[4096];
+
+	free_w(&s->next);
+	if(!s->listfzp) return;
+	while(fzp_gets(s->listfzp, buf, sizeof(buf)))
+	{
+		len=strlen(buf);
+		if(astrcat(&s->next, buf, __func__))
+			break;
+		if(len && buf[len-1]=='\n')
+		{
+			s->next[strlen(s->next)-1]='\0';
+			return;
+		}
+	}
+	free_w(&s->next);
+	fzp_close(&s->listfzp);
+}
+
+static int shuffle_is_unchanged(struct shuffle *s, const char *datapth)
+{
+	// The list is in manifest order, so it is enough to look at the next
+	// one.
+	if(!s->next || strcmp(s->next, datapth))
+		return 0;
+	shuffle_next(s);
+	return 1;
+}
+
+static void shuffle_free(struct shuffle *s)
+{
+	fzp_close(&s->listfzp);
+	free_w(&s->next);
+	free_w(&s->lastdir);
+	close_fd(&s->olddirfd);
+	close_fd(&s->newdirfd);
+	dirrefs_plan_free(&s->plan);
+}
+
+static int shuffle_init(struct shuffle *s, struct sdirs *sdirs,
+	struct fdirs *fdirs, int hardlinked_current, struct delta_chain *dc,
+	struct sigcache *sc, const char *deltabdir, const char *deltafdir,
+	struct fzp **delfp, struct conf **cconfs)
+{
+	const char *olddir;
+
+	memset(s, 0, sizeof(struct shuffle));
+	s->sdirs=sdirs;
+	s->fdirs=fdirs;
+	s->hardlinked_current=hardlinked_current;
+	s->dc=dc;
+	s->sc=sc;
+	s->deltabdir=deltabdir;
+	s->deltafdir=deltafdir;
+	s->delfp=delfp;
+	s->cconfs=cconfs;
+	s->olddirfd=-1;
+	s->newdirfd=-1;
+	s->max_hardlinks=(unsigned int)get_int(cconfs[OPT_MAX_HARDLINKS]);
+
+	olddir=hardlinked_current?sdirs->currentdata:fdirs->currentdupdata;
+	if(is_reg_lstat(fdirs->unchangedlist)<=0
+	  || is_dir_lstat(olddir)<=0)
+		return 0;
+	if((s->olddirfd=open(olddir, O_RDONLY|O_DIRECTORY))<0
+	  || (s->newdirfd=open(fdirs->datadir, O_RDONLY|O_DIRECTORY))<0)
+	{
+		logp("could not open %s: %s\n",
+			s->olddirfd<0?olddir:fdirs->datadir, strerror(errno));
+		return -1;
+	}
+	if(!(s->listfzp=fzp_gzopen(fdirs->unchangedlist, "rb")))
+		return -1;
+	shuffle_next(s);
+	return 0;
+}
+
+// Makes the parent directories of the data path, once for each run of data
+// paths in the same directory.
+static int shuffle_mkpath(struct shuffle *s, const char *datapth)
+{
+	int ret=-1;
+	size_t len;
+	char *finpath=NULL;
+	const char *cp;
+
+	if(!(cp=strrchr(datapth, '/')))
+		return 0;
+	len=cp-datapth;
+	if(s->lastdir && strlen(s->lastdir)==len
+	  && !strncmp(s->lastdir, datapth, len))
+		return 0;
+
+	free_w(&s->lastdir);
+	if(!(finpath=prepend_s(s->fdirs->datadir, datapth)))
+		goto end;
+	if(mkpath(&finpath, s->fdirs->datadir))
+	{
+		logp("could not create path for: %s\n", finpath);
+		goto end;
+	}
+	if(!(s->lastdir=strdup_w(datapth, __func__)))
+		goto end;
+	s->lastdir[len]='\0';
+	ret=0;
+end:
+	free_w(&finpath);
+	return ret;
+}
+
+static int unlinked_old(const char *path, const char *newpath,
+	int err, void *arg)
+{
+	// As in jiggle(), it does not matter if this fails.
+	return 0;
+}
+
+static int linked_unchanged(const char *path, const char *newpath,
+	int err, void *arg)
+{
+	int ret=0;
+	struct shuffle_op *op=(struct shuffle_op *)arg;
+	struct shuffle *s=op->s;
+	const char *datapth=op->sb->datapth.buf;
+
+	if(err)
+	{
+		ret=shuffle_jiggle(s, op->sb);
+		goto end;
+	}
+
+	s->linked++;
+	if(s->sc) sigcache_move(s->sc, datapth);
+	// If we are not keeping a hardlinked archive, delete the old link.
+	if(!s->hardlinked_current
+	  && uring_unlinkat(s->olddirfd, datapth, unlinked_old, NULL))
+		ret=-1;
+end:
+	sbuf_free(&op->sb);
+	free_v((void **)&op);
+	return ret;
+}
+
+static int shuffle_unchanged(struct shuffle *s, struct sbuf **sb)
+{
+	struct stat statp;
+	struct shuffle_op *op;
+	const char *datapth=(*sb)->datapth.buf;
+
+	// When the previous backup is a hardlinked archive, each backup adds
+	// a link, so keep to max_hardlinks like do_link(). Otherwise, the
+	// link from the duplicate of the previous backup is removed again
+	// straight afterwards.
+	if(s->hardlinked_current
+	  && (fstatat(s->olddirfd, datapth, &statp, AT_SYMLINK_NOFOLLOW)
+		|| !S_ISREG(statp.st_mode)
+		|| statp.st_nlink>=s->max_hardlinks))
+			return shuffle_jiggle(s, *sb);
+
+	if(shuffle_mkpath(s, datapth)
+	  || !(op=(struct shuffle_op *)calloc_w(1,
+		sizeof(struct shuffle_op), __func__)))
+			return -1;
+	op->s=s;
+	op->sb=*sb;
+	if(!(*sb=sbuf_alloc()))
+	{
+		*sb=op->sb;
+		free_v((void **)&op);
+		return -1;
+	}
+	return uring_linkat(s->olddirfd, datapth, s->newdirfd, datapth,
+		linked_unchanged, op);
+}
+
+static int shuffle(struct shuffle *s, struct sbuf **sb)
+{
+	const char *datapth=(*sb)->datapth.buf;
+	if(s->olddirfd<0
+	  || !shuffle_is_unchanged(s, datapth))
+		return shuffle_jiggle(s, *sb);
+	if(s->plan && dirrefs_plan_covers(s->plan, datapth))
+	{
+		s->referred++;
+		if(s->sc) sigcache_move(s->sc, datapth);
+		return 0;
+	}
+	return shuffle_unchanged(s, sb);
+}
+
+// Goes through the manifest and the unchanged list once beforehand, to find
+// the directories that can be referred to as a whole.
+static int shuffle_plan_dir_refs(struct shuffle *s, const char *realcurrent)
+{
+	int ret=-1;
+	struct sbuf *sb=NULL;
+	struct fzp *zp=NULL;
+	struct shuffle l;
+
+	memset(&l, 0, sizeof(l));
+	l.olddirfd=-1;
+	l.newdirfd=-1;
+	if(s->olddirfd<0)
+		return 0;
+	if(!(s->plan=dirrefs_plan_alloc())
+	  || !(sb=sbuf_alloc())
+	  || !(zp=fzp_gzopen(s->fdirs->manifest, "rb"))
+	  || !(l.listfzp=fzp_gzopen(s->fdirs->unchangedlist, "rb")))
+		goto end;
+	shuffle_next(&l);
+	while(1)
+	{
+		switch(sbuf_fill_from_file(sb, zp))
+		{
+			case 0: break;
+			case 1: goto done;
+			default: goto end;
+		}
+		if(sb->datapth.buf
+		  && dirrefs_plan_add(s->plan, sb->datapth.buf,
+			shuffle_is_unchanged(&l, sb->datapth.buf)))
+				goto end;
+		sbuf_free_content(sb);
+	}
+done:
+	if(dirrefs_plan_finish(s->plan, s->sdirs->current, realcurrent)
+	  || dirrefs_plan_link(s->plan, s->sdirs->finishing))
+		goto end;
+	ret=0;
+end:
+	shuffle_free(&l);
+	fzp_close(&zp);
+	sbuf_free(&sb);
+	return ret;
+}
+
 /* If OPT_HARDLINKED_ARCHIVE set, hardlink everything.
    If unset and there is more than one 'keep' value, periodically hardlink,
    based on the first 'keep' value. This is so that we have more choice
@@ -633,7 +981,8 @@ end:
 /* Need to make all the stuff that this does atomic so that existing backups
    never get broken, even if somebody turns the power off on the server. */
 static int atomic_data_jiggle(struct sdirs *sdirs, struct fdirs *fdirs,
-	int hardlinked_current, struct conf **cconfs)
+	int hardlinked_current, const char *dir_refs_from,
+	struct delta_chain *dc, struct sigcache *sc, struct conf **cconfs)
 {
 	int ret=-1;
 	char *datapth=NULL;
@@ -642,11 +991,15 @@ static int atomic_data_jiggle(struct sdirs *sdirs, struct fdirs *fdirs,
 
 	char *deltabdir=NULL;
 	char *deltafdir=NULL;
-	char *sigpath=NULL;
 	struct fzp *zp=NULL;
 	struct sbuf *sb=NULL;
 
 	struct fzp *delfp=NULL;
+	struct shuffle s;
+
+	memset(&s, 0, sizeof(s));
+	s.olddirfd=-1;
+	s.newdirfd=-1;
 
 	logp("Doing the atomic data jiggle...\n");
 
@@ -666,7 +1019,6 @@ static int atomic_data_jiggle(struct sdirs *sdirs, struct fdirs *fdirs,
 
 	if(!(deltabdir=prepend_s(fdirs->currentdup, "deltas.reverse"))
 	  || !(deltafdir=prepend_s(sdirs->finishing, "deltas.forward"))
-	  || !(sigpath=prepend_s(fdirs->currentdup, "sig.tmp"))
 	  || !(sb=sbuf_alloc()))
 	{
 		log_out_of_memory(__func__);
@@ -675,6 +1027,12 @@ static int atomic_data_jiggle(struct sdirs *sdirs, struct fdirs *fdirs,
 
 	mkdir(fdirs->datadir, 0777);
 
+	if(shuffle_init(&s, sdirs, fdirs, hardlinked_current, dc, sc,
+		deltabdir, deltafdir, &delfp, cconfs))
+			goto error;
+	if(dir_refs_from && shuffle_plan_dir_refs(&s, dir_refs_from))
+		goto error;
+
 	while(1)
 	{
 		switch(sbuf_fill_from_file(sb, zp))
@@ -687,15 +1045,21 @@ static int atomic_data_jiggle(struct sdirs *sdirs, struct fdirs *fdirs,
 		{
 			if(timed_operation_status_only(CNTR_STATUS_SHUFFLING,
 				sb->datapth.buf, cconfs)
-			  || jiggle(sdirs, fdirs, sb, hardlinked_current,
-				deltabdir, deltafdir,
-				sigpath, &delfp, cconfs))
+			  || shuffle(&s, &sb))
 					goto error;
 		}
 		sbuf_free_content(sb);
 	}
 
 end:
+	if(uring_wait())
+		goto error;
+	logp("Linked %" PRIu64 " unchanged files directly, looked up %"
+		PRIu64 " others\n", s.linked, s.looked_up);
+	if(s.referred)
+		logp("Left %" PRIu64 " unchanged files in %s\n",
+			s.referred, dir_refs_from);
+
 	if(fzp_close(&delfp))
 	{
 		logp("error closing %s in atomic_data_jiggle\n",
@@ -709,15 +1073,18 @@ end:
 	// Remove the temporary data directory, we have probably removed
 	// useful files from it.
 	recursive_delete_dirs_only(deltafdir);
+	unlink(fdirs->unchangedlist);
 
 	ret=0;
 error:
+	// Queued links refer to things that are about to be freed.
+	uring_wait();
+	shuffle_free(&s);
 	fzp_close(&zp);
 	fzp_close(&delfp);
 	sbuf_free(&sb);
 	free_w(&deltabdir);
 	free_w(&deltafdir);
-	free_w(&sigpath);
 	free_w(&datapth);
 	free_w(&tmpman);
 	return ret;
@@ -732,7 +1099,12 @@ int backup_phase4_server_all(struct sdirs *sdirs, struct conf **cconfs)
 	int hardlinked_current=0;
 	char tstmp[64]="";
 	int previous_backup=0;
+	int dir_refs=0;
 	struct fdirs *fdirs=NULL;
+	struct delta_chain *dc=NULL;
+	struct sigcache *sc=NULL;
+	int max_chain_length=get_int(cconfs[OPT_SYNTHETIC_FULL_CHAIN_LENGTH]);
+	int max_chain_percent=get_int(cconfs[OPT_SYNTHETIC_FULL_CHAIN_PERCENT]);
 
 	readlink_w(sdirs->current, realcurrent, sizeof(realcurrent));
 
@@ -804,6 +1176,11 @@ int backup_phase4_server_all(struct sdirs *sdirs, struct conf **cconfs)
 	// archive or not, from the confs and the backup number...
 	if(need_hardlinked_archive(cconfs, bno))
 	{
+		// Only when neither backup will have its files changed
+		// under it can directories be shared between them.
+		dir_refs=previous_backup && hardlinked_current
+		  && get_int(cconfs[OPT_HARDLINKED_DIR_REFS]);
+
 		// Create a file to indicate that the previous backup
 		// does not have others depending on it.
 		struct fzp *hfp=NULL;
@@ -822,11 +1199,34 @@ int backup_phase4_server_all(struct sdirs *sdirs, struct conf **cconfs)
 	else
 		unlink(fdirs->hlinked);
 
-	if(atomic_data_jiggle(sdirs, fdirs, hardlinked_current, cconfs))
+	if(previous_backup && !hardlinked_current
+	  && (max_chain_length || max_chain_percent))
+	{
+		if(!(dc=delta_chain_alloc())
+		  || delta_chain_init(dc, sdirs,
+			max_chain_length, max_chain_percent))
+				goto end;
+	}
+
+	if(previous_backup && get_int(cconfs[OPT_LIBRSYNC_SIGNATURE_CACHE]))
+	{
+		if(!(sc=sigcache_alloc())
+		  || sigcache_init(sc, hardlinked_current?
+			sdirs->current:fdirs->currentdup,
+			sdirs->finishing, cconfs))
+				goto end;
+	}
+
+	if(atomic_data_jiggle(sdirs, fdirs, hardlinked_current,
+		dir_refs?realcurrent:NULL, dc, sc, cconfs))
 	{
 		logp("could not finish up backup.\n");
 		goto end;
 	}
+	if(dc) delta_chain_log(dc);
+	chunks_log_stats();
+	link_log_stats();
+	if(sc) sigcache_tidy(sc);
 
 	if(timed_operation_status_only(CNTR_STATUS_SHUFFLING,
 		"deleting temporary files", cconfs))
@@ -864,5 +1264,7 @@ int backup_phase4_server_all(struct sdirs *sdirs, struct conf **cconfs)
 	ret=0;
 end:
 	fdirs_free(&fdirs);
+	delta_chain_free(&dc);
+	sigcache_free(&sc);
 	return ret;
 }
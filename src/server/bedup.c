@@ -11,6 +11,7 @@
 #include "../prepend.h"
 #include "../strlist.h"
 #include "bedup.h"
+#include "rcache.h"
 
 #include <uthash.h>
 
@@ -516,6 +517,10 @@ static int level_exclusion(int level, const char *fname,
 
 		if(!strcmp(fname, "deleteme"))
 			return 1;
+
+		// Restore cache files get removed as they age.
+		if(!strcmp(fname, RCACHE_DIR))
+			return 1;
 	}
 	else if(level==1)
 	{
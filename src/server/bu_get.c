@@ -2,6 +2,7 @@
 #include "../alloc.h"
 #include "../bu.h"
 #include "../fsops.h"
+#include "../fzp.h"
 #include "../log.h"
 #include "../prepend.h"
 #include "sdirs.h"
@@ -32,72 +33,361 @@ static void have_backup_file_name_w(struct bu *bu,
 	have_backup_file_name(bu, compressed, bit);
 }
 
-static int maybe_add_ent(const char *dir, const char *d_name,
-	struct bu **bu_list, uint16_t flags,
-	int include_working)
+// Flags that depend only on the contents of a storage directory, so can be
+// remembered in the backup catalog.
+#define BU_CATALOG_FLAGS	(BU_HARDLINKED|BU_MANIFEST \
+				|BU_LOG_BACKUP|BU_LOG_RESTORE|BU_LOG_VERIFY \
+				|BU_STATS_BACKUP|BU_STATS_RESTORE|BU_STATS_VERIFY)
+
+#define BU_CATALOG_DIR		".bu_catalog"
+#define BU_CATALOG_FILE		"catalog"
+
+// An entry in the backup catalog, which is a summary of the storage
+// directories of a client. It is validated by the modification time of the
+// client directory, which changes whenever a storage directory or one of the
+// working/finishing/current symlinks is added, removed or renamed.
+struct catent
+{
+	char *basename;
+	char *timestamp;
+	time_t mtime; // Of the storage directory.
+	uint16_t flags; // Only BU_CATALOG_FLAGS.
+};
+
+struct catalog
+{
+	struct catent *ents;
+	int len;
+	int dirty;
+};
+
+// Timestamps with a granularity of a second cannot be trusted if they are
+// this recent, because another change could happen in the same second
+// without altering the timestamp.
+static int mtime_is_racy(time_t mtime)
+{
+	return mtime>=time(NULL)-1;
+}
+
+static void catalog_free_content(struct catalog *cat)
+{
+	int i;
+	for(i=0; i<cat->len; i++)
+	{
+		free_w(&cat->ents[i].basename);
+		free_w(&cat->ents[i].timestamp);
+	}
+	free_v((void **)&cat->ents);
+	cat->len=0;
+}
+
+static struct catent *catalog_add(struct catalog *cat)
+{
+	struct catent *ents;
+	if(!(ents=(struct catent *)realloc_w(cat->ents,
+		(cat->len+1)*sizeof(struct catent), __func__)))
+			return NULL;
+	cat->ents=ents;
+	memset(&cat->ents[cat->len], 0, sizeof(struct catent));
+	return &cat->ents[cat->len++];
+}
+
+static uint16_t get_content_flags(const char *fullpath)
+{
+	struct bu bu;
+	memset(&bu, 0, sizeof(bu));
+	bu.path=(char *)fullpath;
+	have_backup_file_name(&bu, "hardlinked", BU_HARDLINKED);
+	have_backup_file_name_w(&bu, "manifest", BU_MANIFEST);
+	have_backup_file_name_w(&bu, "log", BU_LOG_BACKUP);
+	have_backup_file_name_w(&bu, "restorelog", BU_LOG_RESTORE);
+	have_backup_file_name_w(&bu, "verifylog", BU_LOG_VERIFY);
+	have_backup_file_name(&bu, "backup_stats", BU_STATS_BACKUP);
+	have_backup_file_name(&bu, "restore_stats", BU_STATS_RESTORE);
+	have_backup_file_name(&bu, "verify_stats", BU_STATS_VERIFY);
+	return bu.flags;
+}
+
+// Returns 1 if the directory is not a valid storage directory.
+static int scan_ent(const char *dir, const char *d_name, struct catent *ce)
 {
 	int ret=-1;
 	char buf[38]="";
 	struct stat statp;
 	char *fullpath=NULL;
 	char *timestamp=NULL;
-	char *timestampstr=NULL;
-	char *hlinkedpath=NULL;
-	char *basename=NULL;
-	struct bu *bu=NULL;
 
-	if(!(basename=prepend("", d_name))
-	 || !(fullpath=prepend_s(dir, basename))
-	 || !(timestamp=prepend_s(fullpath, "timestamp"))
-	 || !(hlinkedpath=prepend_s(fullpath, "hardlinked")))
-		goto error;
+	if(!(fullpath=prepend_s(dir, d_name))
+	 || !(timestamp=prepend_s(fullpath, "timestamp")))
+		goto end;
+
+	if(lstat(fullpath, &statp) || !S_ISDIR(statp.st_mode))
+	{
+		ret=1;
+		goto end;
+	}
+	ce->mtime=statp.st_mtime;
 
-	if((!lstat(fullpath, &statp) && !S_ISDIR(statp.st_mode))
-	  || lstat(timestamp, &statp) || !S_ISREG(statp.st_mode)
+	if(lstat(timestamp, &statp) || !S_ISREG(statp.st_mode)
 	  || timestamp_read(timestamp, buf, sizeof(buf))
 	// A bit of paranoia to protect against loading directories moved
 	// aside as if they were real storage directories.
 	  || strncmp(buf, d_name, 8))
 	{
-		ret=0; // For resilience.
-		goto error;
+		ret=1; // For resilience.
+		goto end;
 	}
-
+	ce->flags=get_content_flags(fullpath);
+	if(!(ce->basename=strdup_w(d_name, __func__))
+	  || !(ce->timestamp=strdup_w(buf, __func__)))
+		goto end;
+	ret=0;
+end:
+	if(ret)
+	{
+		free_w(&ce->basename);
+		free_w(&ce->timestamp);
+	}
+	free_w(&fullpath);
 	free_w(&timestamp);
+	return ret;
+}
 
-	if(!(timestampstr=strdup_w(buf, __func__)))
-		goto error;
+static int catalog_scan(const char *dir, struct catalog *cat)
+{
+	int i=0;
+	int n=0;
+	int ret=-1;
+	struct dirent **dp=NULL;
+	struct catent *ce=NULL;
+
+	if((n=scandir(dir, &dp, filter_dot, alphasort))<0)
+	{
+		logp("scandir failed in %s: %s\n", __func__, strerror(errno));
+		goto end;
+	}
+	for(i=0; i<n; i++)
+	{
+		// Each storage directory starts with a digit. The 'deleteme'
+		// directory does not. This check avoids loading 'deleteme'
+		// as a storage directory.
+		if(!isdigit(dp[i]->d_name[0]))
+			continue;
+		if(!(ce=catalog_add(cat)))
+			goto end;
+		switch(scan_ent(dir, dp[i]->d_name, ce))
+		{
+			case 0:
+				break;
+			case 1:
+				// Cannot remember invalid directories, they
+				// might become valid without the client
+				// directory changing.
+				cat->len--;
+				cat->dirty=0;
+				continue;
+			default:
+				cat->len--;
+				goto end;
+		}
+	}
+	ret=0;
+end:
+	if(dp)
+	{
+		for(i=0; i<n; i++)
+			free(dp[i]);
+		free(dp);
+	}
+	return ret;
+}
+
+static char *get_catalog_path(const char *dir)
+{
+	return prepend_s(dir, BU_CATALOG_DIR "/" BU_CATALOG_FILE);
+}
+
+// Returns 0 if the catalog was loaded, non-zero if it was missing, invalid
+// or stale.
+static int catalog_load(const char *dir, time_t dirmtime,
+	struct catalog *cat)
+{
+	int ret=-1;
+	char buf[512]="";
+	char *path=NULL;
+	char *cp=NULL;
+	char *tok[4];
+	char *saveptr=NULL;
+	struct stat statp;
+	struct fzp *fzp=NULL;
+	struct catent *ce=NULL;
+	int t;
+
+	if(!(path=get_catalog_path(dir))
+	  || lstat(path, &statp)
+	  || !(fzp=fzp_open(path, "rb"))
+	  || !fzp_gets(fzp, buf, sizeof(buf))
+	  || (time_t)strtoll(buf, NULL, 10)!=dirmtime)
+		goto end;
+	while(fzp_gets(fzp, buf, sizeof(buf)))
+	{
+		if(!(cp=strrchr(buf, '\n')))
+			goto end;
+		*cp='\0';
+		for(t=0, cp=buf; t<4; t++, cp=NULL)
+			if(!(tok[t]=strtok_r(cp, "\t", &saveptr)))
+				goto end;
+		if(!(ce=catalog_add(cat)))
+			goto end;
+		ce->mtime=(time_t)strtoll(tok[0], NULL, 10);
+		ce->flags=strtoul(tok[1], NULL, 16) & BU_CATALOG_FLAGS;
+		if(!(ce->basename=strdup_w(tok[2], __func__))
+		  || !(ce->timestamp=strdup_w(tok[3], __func__)))
+			goto end;
+	}
+	ret=0;
+end:
+	if(ret)
+		catalog_free_content(cat);
+	fzp_close(&fzp);
+	free_w(&path);
+	return ret;
+}
+
+// Failing to write the catalog is not an error, the next listing will just
+// have to scan the storage directories again.
+static void catalog_write(const char *dir, time_t dirmtime,
+	struct catalog *cat)
+{
+	int i;
+	char suffix[32]="";
+	char *catdir=NULL;
+	char *path=NULL;
+	char *tmp=NULL;
+	struct fzp *fzp=NULL;
+	struct catent *ce=NULL;
+
+	if(mtime_is_racy(dirmtime))
+		return;
+	for(i=0; i<cat->len; i++)
+		if(strpbrk(cat->ents[i].basename, "\t\n")
+		  || strpbrk(cat->ents[i].timestamp, "\t\n"))
+			return;
+
+	snprintf(suffix, sizeof(suffix), ".%d", (int)getpid());
+	if(!(catdir=prepend_s(dir, BU_CATALOG_DIR))
+	  || !(path=get_catalog_path(dir))
+	  || !(tmp=prepend(path, suffix)))
+		goto end;
+	if(!mkdir(catdir, 0777))
+	{
+		// Creating the catalog directory changed the client
+		// directory, so what we have is already stale.
+		goto end;
+	}
+	if(errno!=EEXIST
+	  || !(fzp=fzp_open(tmp, "wb")))
+		goto end;
+	fzp_printf(fzp, "%lld\n", (long long)dirmtime);
+	for(i=0; i<cat->len; i++)
+	{
+		ce=&cat->ents[i];
+		fzp_printf(fzp, "%lld\t%04X\t%s\t%s\n",
+			// Make sure racy directories get checked again.
+			mtime_is_racy(ce->mtime)?0:(long long)ce->mtime,
+			ce->flags, ce->basename, ce->timestamp);
+	}
+	if(fzp_close(&fzp)
+	  || do_rename(tmp, path))
+		unlink(tmp);
+end:
+	fzp_close(&fzp);
+	free_w(&catdir);
+	free_w(&path);
+	free_w(&tmp);
+}
+
+// Make sure that the content flags of a catalog entry are still good. Only
+// needed for the flags of logs and stats, which can be added to finished
+// backups without changing the client directory.
+static int catent_refresh(const char *dir, struct catent *ce,
+	struct catalog *cat)
+{
+	int ret=-1;
+	struct stat statp;
+	char *fullpath=NULL;
+
+	if(!(fullpath=prepend_s(dir, ce->basename)))
+		goto end;
+	if(lstat(fullpath, &statp) || !S_ISDIR(statp.st_mode))
+	{
+		// Gone from under us.
+		ce->flags=0;
+		ret=1;
+		goto end;
+	}
+	if(statp.st_mtime!=ce->mtime || mtime_is_racy(statp.st_mtime))
+	{
+		ce->mtime=statp.st_mtime;
+		ce->flags=get_content_flags(fullpath);
+		cat->dirty=1;
+	}
+	ret=0;
+end:
+	free_w(&fullpath);
+	return ret;
+}
+
+static int add_ent(const char *dir, struct catent *ce,
+	struct bu **bu_list, uint16_t flags, int include_working)
+{
+	char *fullpath=NULL;
+	char *basename=NULL;
+	char *timestampstr=NULL;
+	struct bu *bu=NULL;
 
-	if(!lstat(hlinkedpath, &statp)) flags|=BU_HARDLINKED;
+	if(include_working)
+		flags|=ce->flags;
+	else
+		flags|=(ce->flags & (BU_HARDLINKED|BU_MANIFEST));
 
-	if(!(bu=bu_alloc())
+	if(!(basename=strdup_w(ce->basename, __func__))
+	  || !(fullpath=prepend_s(dir, basename))
+	  || !(timestampstr=strdup_w(ce->timestamp, __func__))
+	  || !(bu=bu_alloc())
 	  || bu_init(bu, fullpath, basename, timestampstr, flags))
 		goto error;
 
 	if(*bu_list) bu->next=*bu_list;
 	*bu_list=bu;
-	have_backup_file_name_w(bu, "manifest", BU_MANIFEST);
-	if(include_working)
-	{
-		have_backup_file_name_w(bu, "log", BU_LOG_BACKUP);
-		have_backup_file_name_w(bu, "restorelog", BU_LOG_RESTORE);
-		have_backup_file_name_w(bu, "verifylog", BU_LOG_VERIFY);
-		if(!(bu->flags & BU_STATS_BACKUP))
-		  have_backup_file_name(bu, "backup_stats", BU_STATS_BACKUP);
-		if(!(bu->flags & BU_STATS_RESTORE))
-		  have_backup_file_name(bu, "restore_stats", BU_STATS_RESTORE);
-		if(!(bu->flags & BU_STATS_VERIFY))
-		  have_backup_file_name(bu, "verify_stats", BU_STATS_VERIFY);
-	}
-
-	free_w(&hlinkedpath);
 	return 0;
 error:
 	free_w(&basename);
 	free_w(&fullpath);
-	free_w(&timestamp);
 	free_w(&timestampstr);
-	free_w(&hlinkedpath);
+	bu_free(&bu);
+	return -1;
+}
+
+static int maybe_add_ent(const char *dir, const char *d_name,
+	struct bu **bu_list, uint16_t flags,
+	int include_working)
+{
+	int ret=-1;
+	struct catent ce;
+
+	memset(&ce, 0, sizeof(ce));
+	switch(scan_ent(dir, d_name, &ce))
+	{
+		case 0:
+			ret=add_ent(dir, &ce, bu_list, flags, include_working);
+			break;
+		case 1:
+			ret=0; // For resilience.
+			break;
+	}
+	free_w(&ce.basename);
+	free_w(&ce.timestamp);
 	return ret;
 }
 
@@ -143,15 +433,18 @@ static int do_bu_get_list(struct sdirs *sdirs,
 	struct bu **bu_list, int include_working)
 {
 	int i=0;
-	int n=0;
 	int ret=-1;
+	int loaded=0;
 	char realwork[38]="";
 	char realfinishing[38]="";
 	char realcurrent[38]="";
-	struct dirent **dp=NULL;
 	const char *dir=NULL;
 	uint16_t flags=0;
 	struct stat statp;
+	struct catalog cat;
+	struct catent *ce=NULL;
+
+	memset(&cat, 0, sizeof(cat));
 
 	if(!sdirs)
 	{
@@ -166,49 +459,61 @@ static int do_bu_get_list(struct sdirs *sdirs,
 	  || get_link(dir, "current", realcurrent, sizeof(realcurrent)))
 		goto end;
 
-	if(!stat(dir, &statp)
-	  && (n=scandir(dir, &dp, filter_dot, alphasort))<0)
+	if(stat(dir, &statp))
 	{
-		logp("scandir failed in %s: %s\n", __func__, strerror(errno));
+		ret=0;
 		goto end;
 	}
-	i=n;
+
+	if(!catalog_load(dir, statp.st_mtime, &cat))
+		loaded=1;
+	else
+	{
+		cat.dirty=1;
+		if(catalog_scan(dir, &cat))
+			goto end;
+	}
+
+	i=cat.len;
 	while(i--)
 	{
-		// Each storage directory starts with a digit. The 'deleteme'
-		// directory does not. This check avoids loading 'deleteme'
-		// as a storage directory.
-		if(!isdigit(dp[i]->d_name[0]))
-			continue;
+		ce=&cat.ents[i];
 		flags=0;
-		if(!strcmp(dp[i]->d_name, realcurrent))
+		if(!strcmp(ce->basename, realcurrent))
 		{
 			flags|=BU_CURRENT;
 		}
-		else if(!strcmp(dp[i]->d_name, realwork))
+		else if(!strcmp(ce->basename, realwork))
 		{
 			if(!include_working) continue;
 			flags|=BU_WORKING;
 		}
-		else if(!strcmp(dp[i]->d_name, realfinishing))
+		else if(!strcmp(ce->basename, realfinishing))
 		{
 			if(!include_working) continue;
 			flags|=BU_FINISHING;
 		}
-		if(maybe_add_ent(dir, dp[i]->d_name, bu_list, flags,
-			include_working)) goto end;
+		if(loaded && include_working)
+		{
+			switch(catent_refresh(dir, ce, &cat))
+			{
+				case 0: break;
+				case 1: continue;
+				default: goto end;
+			}
+		}
+		if(add_ent(dir, ce, bu_list, flags, include_working))
+			goto end;
 	}
 
 	setup_indices(*bu_list);
 
+	if(cat.dirty)
+		catalog_write(dir, statp.st_mtime, &cat);
+
 	ret=0;
 end:
-	if(dp)
-	{
-		for(i=0; i<n; i++)
-			free(dp[i]);
-		free(dp);
-	}
+	catalog_free_content(&cat);
 	return ret;
 }
 
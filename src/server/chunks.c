@@ -0,0 +1,800 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../async.h"
+#include "../fsops.h"
+#include "../fzp.h"
+#include "../handy.h"
+#include "../log.h"
+#include "../prepend.h"
+#include "chunks.h"
+#include "compress.h"
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#define HASH_LEN	32
+#define HEX_LEN		(HASH_LEN*2)
+#define ID_LEN		16
+#define RECIPE_MAGIC	"burp chunk recipe "
+#define HEADER_LEN	(sizeof(RECIPE_MAGIC)-1+ID_LEN*2+1)
+
+// The masks use the high bits of the fingerprint, because those depend on
+// the most bytes. There are more bits before the average size is reached,
+// and fewer after, so that the sizes bunch up around the average.
+#define MASK_S		(((1ULL<<18)-1)<<46)
+#define MASK_L		(((1ULL<<14)-1)<<50)
+
+static uint64_t gear[256];
+static int gear_done=0;
+
+static struct chunks_stats stats;
+
+// The table has to be the same every time, or nothing would match the
+// chunks from earlier backups.
+static void gear_init(void)
+{
+	int i;
+	uint64_t x=0x6275727063686e6bULL;
+	if(gear_done) return;
+	for(i=0; i<256; i++)
+	{
+		uint64_t z=(x+=0x9e3779b97f4a7c15ULL);
+		z=(z^(z>>30))*0xbf58476d1ce4e5b9ULL;
+		z=(z^(z>>27))*0x94d049bb133111ebULL;
+		gear[i]=z^(z>>31);
+	}
+	gear_done=1;
+}
+
+size_t chunks_cut(const uint8_t *buf, size_t len)
+{
+	size_t i;
+	uint64_t fp=0;
+	size_t normal=CHUNK_AVG;
+
+	if(len<=CHUNK_MIN) return len;
+	if(len>CHUNK_MAX) len=CHUNK_MAX;
+	if(normal>len) normal=len;
+	gear_init();
+
+	for(i=CHUNK_MIN; i<normal; i++)
+	{
+		fp=(fp<<1)+gear[buf[i]];
+		if(!(fp&MASK_S)) return i+1;
+	}
+	for(; i<len; i++)
+	{
+		fp=(fp<<1)+gear[buf[i]];
+		if(!(fp&MASK_L)) return i+1;
+	}
+	return len;
+}
+
+static void to_hex(const uint8_t *bytes, size_t len, char *hex)
+{
+	size_t i;
+	static const char digits[]="0123456789abcdef";
+	for(i=0; i<len; i++)
+	{
+		hex[i*2]=digits[bytes[i]>>4];
+		hex[i*2+1]=digits[bytes[i]&0x0f];
+	}
+	hex[len*2]='\0';
+}
+
+static int from_hex(const char *hex, uint8_t *bytes, size_t len)
+{
+	size_t i;
+	for(i=0; i<len*2; i++)
+	{
+		int v;
+		char c=hex[i];
+		if(c>='0' && c<='9') v=c-'0';
+		else if(c>='a' && c<='f') v=c-'a'+10;
+		else return -1;
+		if(i%2) bytes[i/2]|=v;
+		else bytes[i/2]=v<<4;
+	}
+	return 0;
+}
+
+static char *chunk_path(const char *store, const char *hex)
+{
+	char sub[HEX_LEN+8];
+	snprintf(sub, sizeof(sub), "%.2s/%.2s/%s", hex, hex+2, hex);
+	return prepend_s(store, sub);
+}
+
+// Returns 0 with the id of the store filled in, 1 if there is no store
+// yet and create is not set, or -1 on error.
+static int get_store_id(const char *store, int create, char id[ID_LEN*2+1])
+{
+	int ret=-1;
+	char *path=NULL;
+	char *tmppath=NULL;
+	struct fzp *fzp=NULL;
+	uint8_t bytes[ID_LEN];
+
+	if(!(path=prepend_s(store, "id")))
+		goto end;
+	if((fzp=fzp_open(path, "rb")))
+	{
+		if(fzp_read(fzp, id, ID_LEN*2)!=ID_LEN*2)
+		{
+			logp("could not read chunk store id from %s\n", path);
+			goto end;
+		}
+		id[ID_LEN*2]='\0';
+		ret=0;
+		goto end;
+	}
+	if(!create)
+	{
+		ret=1;
+		goto end;
+	}
+
+	if(!RAND_bytes(bytes, ID_LEN))
+	{
+		logp("RAND_bytes failed in %s\n", __func__);
+		goto end;
+	}
+	to_hex(bytes, ID_LEN, id);
+	if(!(tmppath=prepend_s(store, "id.tmp"))
+	  || build_path_w(tmppath)
+	  || !(fzp=fzp_open(tmppath, "wb"))
+	  || fzp_printf(fzp, "%s\n", id)<0
+	  || fzp_close(&fzp)
+	  || do_rename(tmppath, path))
+		goto end;
+	ret=0;
+end:
+	fzp_close(&fzp);
+	free_w(&path);
+	free_w(&tmppath);
+	return ret;
+}
+
+// Reads the next chunk reference from a recipe. Returns 0 on success, 1
+// at the end, or -1 on error.
+static int recipe_next(struct fzp *fzp,
+	char hex[HEX_LEN+1], uint8_t hash[HASH_LEN], uint64_t *len)
+{
+	char *cp=NULL;
+	char line[HEX_LEN+32];
+
+	if(!fzp_gets(fzp, line, sizeof(line)))
+		return fzp_eof(fzp)?1:-1;
+	if(strlen(line)<HEX_LEN+2
+	  || line[HEX_LEN]!=' '
+	  || from_hex(line, hash, HASH_LEN))
+		return -1;
+	memcpy(hex, line, HEX_LEN);
+	hex[HEX_LEN]='\0';
+	*len=strtoull(line+HEX_LEN+1, &cp, 10);
+	if(*cp!='\n')
+		return -1;
+	return 0;
+}
+
+static struct fzp *recipe_open(const char *path, const char *id)
+{
+	struct fzp *fzp=NULL;
+	char header[HEADER_LEN];
+
+	if(!(fzp=fzp_open(path, "rb")))
+		return NULL;
+	if(fzp_read(fzp, header, HEADER_LEN)==(int)HEADER_LEN
+	  && !strncmp(header, RECIPE_MAGIC, sizeof(RECIPE_MAGIC)-1)
+	  && !strncmp(header+sizeof(RECIPE_MAGIC)-1, id, ID_LEN*2)
+	  && header[HEADER_LEN-1]=='\n')
+		return fzp;
+	fzp_close(&fzp);
+	return NULL;
+}
+
+/*
+   References to chunks are counted, so that deleting a backup does not
+   mean looking at every file that is left to find out what is still used.
+   Each chunk has a count of the references to it from recipes, in a
+   '<sha256>.refs' file next to it. Each recipe that holds references is
+   hard linked into '<store>/recipes/<ab>/<cd>/<random>'. When that is the
+   only link left, every backup that had the recipe has gone, or replaced
+   it, so its references are released. Moving or hard linking recipes
+   needs nothing else doing, but copies have to be added with
+   chunks_recipe_copied().
+   Anything that goes wrong part way through leaves a count too high, so a
+   chunk can be kept for longer than it needs to be, but never removed too
+   early.
+*/
+
+// Returns the count after adding 'by' to it.
+static int refs_adjust(const char *store, const char *hex, int by,
+	uint64_t *count)
+{
+	int fd=-1;
+	int ret=-1;
+	ssize_t got;
+	uint64_t n;
+	char *path=NULL;
+	char buf[32]="";
+
+	if(!(path=chunk_path(store, hex))
+	  || astrcat(&path, ".refs", __func__))
+		goto end;
+	if((fd=open(path, O_RDWR|O_CREAT, 0644))<0
+	  || (got=pread(fd, buf, sizeof(buf)-1, 0))<0)
+	{
+		logp("could not open %s in %s: %s\n",
+			path, __func__, strerror(errno));
+		goto end;
+	}
+	buf[got]='\0';
+	n=strtoull(buf, NULL, 10);
+	if(by<0 && n<(uint64_t)-by)
+		n=0;
+	else
+		n+=by;
+	// Always the same length, so that it can be written over.
+	snprintf(buf, sizeof(buf), "%020" PRIu64 "\n", n);
+	if(pwrite(fd, buf, 21, 0)!=21)
+	{
+		logp("could not write %s in %s: %s\n",
+			path, __func__, strerror(errno));
+		goto end;
+	}
+	*count=n;
+	ret=0;
+end:
+	if(fd>=0 && close(fd))
+		ret=-1;
+	free_w(&path);
+	return ret;
+}
+
+// Removes the directory, if it is empty, and the one above it.
+static void tidy_dirs(const char *path)
+{
+	int i;
+	char *copy;
+	char *cp;
+	if(!(copy=strdup_w(path, __func__)))
+		return;
+	for(i=0; i<2 && (cp=strrchr(copy, '/')); i++)
+	{
+		*cp='\0';
+		if(rmdir(copy))
+			break;
+	}
+	free_w(&copy);
+}
+
+static int remove_chunk(const char *store, const char *hex)
+{
+	int ret=-1;
+	char *path=NULL;
+	char *refs=NULL;
+	if(!(path=chunk_path(store, hex))
+	  || !(refs=prepend(path, ".refs")))
+		goto end;
+	unlink(path);
+	unlink(refs);
+	tidy_dirs(path);
+	ret=0;
+end:
+	free_w(&path);
+	free_w(&refs);
+	return ret;
+}
+
+// Takes the references of the recipe away from its chunks, removing the
+// chunks that are left with none.
+static int release_recipe(const char *store, struct fzp *fzp,
+	const char *path, uint64_t *removed)
+{
+	int r;
+	uint64_t len;
+	uint64_t count;
+	char hex[HEX_LEN+1];
+	uint8_t hash[HASH_LEN];
+
+	while(!(r=recipe_next(fzp, hex, hash, &len)))
+	{
+		if(refs_adjust(store, hex, -1, &count))
+			return -1;
+		if(count)
+			continue;
+		if(remove_chunk(store, hex))
+			return -1;
+		(*removed)++;
+	}
+	if(r<0)
+	{
+		logp("bad line in chunk recipe %s\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+// Gives back the references of a recipe that could not be finished.
+static void release_unfinished(const char *store, const char *id,
+	const char *path)
+{
+	uint64_t removed=0;
+	struct fzp *fzp=NULL;
+	if(!(fzp=recipe_open(path, id)))
+		return;
+	release_recipe(store, fzp, path, &removed);
+	fzp_close(&fzp);
+}
+
+static int index_recipe(const char *store, const char *path)
+{
+	int ret=-1;
+	char *ipath=NULL;
+	char sub[ID_LEN*2+16];
+	char hex[ID_LEN*2+1];
+	uint8_t bytes[ID_LEN];
+
+	if(!RAND_bytes(bytes, ID_LEN))
+	{
+		logp("RAND_bytes failed in %s\n", __func__);
+		return -1;
+	}
+	to_hex(bytes, ID_LEN, hex);
+	snprintf(sub, sizeof(sub), "recipes/%.2s/%.2s/%s", hex, hex+2, hex);
+	if(!(ipath=prepend_s(store, sub))
+	  || build_path_w(ipath))
+		goto end;
+	if(link(path, ipath))
+	{
+		logp("could not hard link %s to %s: %s\n",
+			ipath, path, strerror(errno));
+		goto end;
+	}
+	ret=0;
+end:
+	free_w(&ipath);
+	return ret;
+}
+
+static int store_chunk(const char *store, const uint8_t *buf, size_t len,
+	int compression, const char *tmppath, struct fzp *recipe)
+{
+	int ret=-1;
+	char *path=NULL;
+	struct fzp *fzp=NULL;
+	char hex[HEX_LEN+1];
+	uint8_t md[EVP_MAX_MD_SIZE];
+	unsigned int mdlen=0;
+	uint64_t count;
+
+	if(!EVP_Digest(buf, len, md, &mdlen, EVP_sha256(), NULL)
+	  || mdlen!=HASH_LEN)
+	{
+		logp("could not hash chunk in %s\n", __func__);
+		return -1;
+	}
+	to_hex(md, HASH_LEN, hex);
+	if(!(path=chunk_path(store, hex)))
+		goto end;
+
+	stats.chunks++;
+	if(is_reg_lstat(path)<=0)
+	{
+		// Written to one side first, so that a chunk is either all
+		// there, or not there at all.
+		if(!(fzp=fzp_gzopen(tmppath, comp_level(compression)))
+		  || fzp_write(fzp, buf, len)!=len
+		  || fzp_close(&fzp)
+		  || build_path_w(path)
+		  || do_rename(tmppath, path))
+		{
+			logp("could not store chunk %s\n", path);
+			goto end;
+		}
+		stats.new_chunks++;
+		stats.new_bytes+=len;
+	}
+	// Counted before it is in the recipe, so that giving back the
+	// references of an unfinished recipe cannot take too many.
+	if(refs_adjust(store, hex, 1, &count)
+	  || fzp_printf(recipe, "%s %lu\n", hex, (unsigned long)len)<0)
+		goto end;
+	ret=0;
+end:
+	fzp_close(&fzp);
+	free_w(&path);
+	return ret;
+}
+
+int chunks_store(const char *store, const char *path, int compression)
+{
+	int ret=-1;
+	int got=0;
+	int indexed=0;
+	size_t have=0;
+	uint8_t *buf=NULL;
+	char *tmppath=NULL;
+	char *recipepath=NULL;
+	struct fzp *in=NULL;
+	struct fzp *recipe=NULL;
+	struct stat statp;
+	char id[ID_LEN*2+1];
+	int level=1;
+	size_t buflen=CHUNK_MAX*4;
+
+	if(lstat(path, &statp) || !S_ISREG(statp.st_mode))
+	{
+		logp("could not lstat %s in %s\n", path, __func__);
+		return -1;
+	}
+	// Small files would end up as one chunk anyway.
+	if(statp.st_size<CHUNK_MAX)
+		return 0;
+
+	// The chunks are always gzipped, so that reading them back never
+	// depends on guessing.
+	if(compression>0) level=compression;
+
+	if(get_store_id(store, 1, id)
+	  || !(tmppath=prepend_s(store, "chunk.tmp"))
+	  || astrcat(&recipepath, path, __func__)
+	  || astrcat(&recipepath, ".recipe", __func__))
+		goto end;
+
+	if(dpth_is_compressed(compression, path))
+		in=fzp_gzopen(path, "rb");
+	else
+		in=fzp_open(path, "rb");
+	if(!in)
+	{
+		logp("could not open %s in %s\n", path, __func__);
+		goto end;
+	}
+	if(!(buf=(uint8_t *)malloc_w(buflen, __func__))
+	  || !(recipe=fzp_open(recipepath, "wb"))
+	  || fzp_printf(recipe, RECIPE_MAGIC "%s\n", id)<0)
+		goto end;
+
+	while(1)
+	{
+		size_t len;
+		size_t off=0;
+		if(have<buflen && (got=fzp_read(in, buf+have, buflen-have))>0)
+			have+=got;
+		else if(!fzp_eof(in) && have<buflen)
+		{
+			logp("error reading %s in %s\n", path, __func__);
+			goto end;
+		}
+		if(!have)
+			break;
+		// Keep the end of the buffer for the next read, unless
+		// there is no more to come.
+		while(have-off>=CHUNK_MAX || (fzp_eof(in) && off<have))
+		{
+			len=chunks_cut(buf+off, have-off);
+			if(store_chunk(store, buf+off, len, level,
+				tmppath, recipe))
+					goto end;
+			stats.bytes+=len;
+			off+=len;
+		}
+		memmove(buf, buf+off, have-off);
+		have-=off;
+	}
+
+	if(fzp_close(&recipe)
+	  || index_recipe(store, recipepath))
+		goto end;
+	indexed=1;
+	if(do_rename(recipepath, path))
+		goto end;
+	stats.files++;
+	ret=0;
+end:
+	fzp_close(&in);
+	fzp_close(&recipe);
+	if(ret && recipepath)
+	{
+		// Once it is in the index, the next chunks_gc() sees to it.
+		if(!indexed)
+			release_unfinished(store, id, recipepath);
+		unlink(recipepath);
+	}
+	free_v((void **)&buf);
+	free_w(&tmppath);
+	free_w(&recipepath);
+	return ret;
+}
+
+int chunks_store_exists(const char *store)
+{
+	char id[ID_LEN*2+1];
+	switch(get_store_id(store, 0, id))
+	{
+		case 0: return 1;
+		case 1: return 0;
+		default: return -1;
+	}
+}
+
+int chunks_is_recipe(const char *store, const char *path)
+{
+	int ret=0;
+	struct fzp *fzp=NULL;
+	char id[ID_LEN*2+1];
+	char header[HEADER_LEN];
+
+	if(!store) return 0;
+	if(!(fzp=fzp_open(path, "rb")))
+		return -1;
+	if(fzp_read(fzp, header, HEADER_LEN)==(int)HEADER_LEN
+	  && !strncmp(header, RECIPE_MAGIC, sizeof(RECIPE_MAGIC)-1)
+	  && header[HEADER_LEN-1]=='\n')
+	{
+		// Only count recipes that this store wrote, in case a file
+		// that was backed up happens to look like one.
+		switch(get_store_id(store, 0, id))
+		{
+			case 0:
+				ret=!strncmp(header+sizeof(RECIPE_MAGIC)-1,
+					id, ID_LEN*2);
+				break;
+			case 1:
+				break;
+			default:
+				ret=-1;
+				break;
+		}
+	}
+	fzp_close(&fzp);
+	return ret;
+}
+
+int chunks_read(const char *store, const char *recipe,
+	int (*fn)(void *arg, const uint8_t *buf, size_t len), void *arg)
+{
+	int r;
+	int ret=-1;
+	char *path=NULL;
+	struct fzp *in=NULL;
+	struct fzp *chunk=NULL;
+	uint64_t len=0;
+	char hex[HEX_LEN+1];
+	char id[ID_LEN*2+1];
+	uint8_t hash[HASH_LEN];
+	uint8_t buf[ZCHUNK];
+
+	if(get_store_id(store, 0, id)
+	  || !(in=recipe_open(recipe, id)))
+	{
+		logp("could not open chunk recipe %s\n", recipe);
+		goto end;
+	}
+	while(!(r=recipe_next(in, hex, hash, &len)))
+	{
+		int got;
+		uint64_t bytes=0;
+		free_w(&path);
+		if(!(path=chunk_path(store, hex)))
+			goto end;
+		if(!(chunk=fzp_gzopen(path, "rb")))
+		{
+			logp("missing chunk %s for %s\n", hex, recipe);
+			goto end;
+		}
+		while((got=fzp_read(chunk, buf, sizeof(buf)))>0)
+		{
+			if(fn(arg, buf, (size_t)got))
+				goto end;
+			bytes+=got;
+		}
+		if(!fzp_eof(chunk) || bytes!=len)
+		{
+			logp("chunk %s for %s is corrupt\n", hex, recipe);
+			goto end;
+		}
+		fzp_close(&chunk);
+	}
+	if(r<0)
+	{
+		logp("bad line in chunk recipe %s\n", recipe);
+		goto end;
+	}
+	ret=0;
+end:
+	fzp_close(&in);
+	fzp_close(&chunk);
+	free_w(&path);
+	return ret;
+}
+
+static int write_out(void *arg, const uint8_t *buf, size_t len)
+{
+	if(fzp_write((struct fzp *)arg, buf, len)==len)
+		return 0;
+	logp("error writing in %s\n", __func__);
+	return -1;
+}
+
+int chunks_rebuild(const char *store, const char *recipe, const char *dest)
+{
+	struct fzp *out=NULL;
+
+	if(!(out=fzp_open(dest, "wb")))
+		return -1;
+	if(chunks_read(store, recipe, write_out, out))
+	{
+		fzp_close(&out);
+		return -1;
+	}
+	return fzp_close(&out);
+}
+
+// Looks for the store that the recipe belongs to in the directories above
+// it, which is where the backups keep them.
+static char *find_store(const char *path, const char *id)
+{
+	char *cp;
+	char *dir=NULL;
+	char *store=NULL;
+	char got[ID_LEN*2+1];
+
+	if(!(dir=strdup_w(path, __func__)))
+		return NULL;
+	while((cp=strrchr(dir, '/')))
+	{
+		*cp='\0';
+		free_w(&store);
+		if(!(store=prepend_s(*dir?dir:"/", CHUNKS_DIR)))
+			break;
+		if(!get_store_id(store, 0, got)
+		  && !strncmp(got, id, ID_LEN*2))
+			break;
+		free_w(&store);
+	}
+	free_w(&dir);
+	return store;
+}
+
+int chunks_recipe_copied(const char *oldpath, const char *newpath)
+{
+	int r;
+	int ret=-1;
+	uint64_t len;
+	uint64_t count;
+	char *store=NULL;
+	struct fzp *fzp=NULL;
+	char hex[HEX_LEN+1];
+	char id[ID_LEN*2+1];
+	uint8_t hash[HASH_LEN];
+	char header[HEADER_LEN];
+
+	if(!(fzp=fzp_open(newpath, "rb")))
+		return -1;
+	if(fzp_read(fzp, header, HEADER_LEN)!=(int)HEADER_LEN
+	  || strncmp(header, RECIPE_MAGIC, sizeof(RECIPE_MAGIC)-1)
+	  || header[HEADER_LEN-1]!='\n')
+	{
+		// Not a recipe.
+		ret=0;
+		goto end;
+	}
+	memcpy(id, header+sizeof(RECIPE_MAGIC)-1, ID_LEN*2);
+	id[ID_LEN*2]='\0';
+	if(!(store=find_store(oldpath, id)))
+	{
+		// Something that was backed up happens to look like one.
+		ret=0;
+		goto end;
+	}
+	while(!(r=recipe_next(fzp, hex, hash, &len)))
+		if(refs_adjust(store, hex, 1, &count))
+			goto end;
+	if(r<0)
+	{
+		logp("bad line in chunk recipe %s\n", newpath);
+		goto end;
+	}
+	if(index_recipe(store, newpath))
+		goto end;
+	ret=0;
+end:
+	fzp_close(&fzp);
+	free_w(&store);
+	return ret;
+}
+
+static int gc_recipes(const char *store, const char *id, const char *dir,
+	int depth, uint64_t *released, uint64_t *removed)
+{
+	int ret=-1;
+	DIR *dirp=NULL;
+	char *path=NULL;
+	struct dirent *d;
+	struct stat statp;
+	struct fzp *fzp=NULL;
+
+	if(!(dirp=opendir(dir)))
+		return 0;
+	while((d=readdir(dirp)))
+	{
+		if(strlen(d->d_name)!=(depth<2?2:ID_LEN*2))
+			continue;
+		free_w(&path);
+		if(!(path=prepend_s(dir, d->d_name)))
+			goto end;
+		if(lstat(path, &statp))
+			continue;
+		if(depth<2)
+		{
+			if(S_ISDIR(statp.st_mode)
+			  && gc_recipes(store, id, path, depth+1,
+				released, removed))
+					goto end;
+			continue;
+		}
+		if(!S_ISREG(statp.st_mode)
+		  || statp.st_nlink>1)
+			continue;
+		// Gone from the index before the counts go down, so that
+		// being interrupted cannot release it twice.
+		fzp=recipe_open(path, id);
+		if(unlink_w(path, __func__))
+			goto end;
+		tidy_dirs(path);
+		(*released)++;
+		if(fzp && release_recipe(store, fzp, path, removed))
+			goto end;
+		fzp_close(&fzp);
+	}
+	ret=0;
+end:
+	fzp_close(&fzp);
+	closedir(dirp);
+	free_w(&path);
+	return ret;
+}
+
+int chunks_gc(const char *store)
+{
+	int ret=-1;
+	uint64_t removed=0;
+	uint64_t released=0;
+	char *index=NULL;
+	char id[ID_LEN*2+1];
+
+	switch(get_store_id(store, 0, id))
+	{
+		case 0: break;
+		case 1: return 0; // No store.
+		default: return -1;
+	}
+
+	if(!(index=prepend_s(store, "recipes"))
+	  || gc_recipes(store, id, index, 0, &released, &removed))
+		goto end;
+	if(released)
+		logp("Chunk store: released %" PRIu64 " recipes, removed %"
+			PRIu64 " chunks\n", released, removed);
+	ret=0;
+end:
+	free_w(&index);
+	return ret;
+}
+
+void chunks_get_stats(struct chunks_stats *s)
+{
+	*s=stats;
+}
+
+void chunks_log_stats(void)
+{
+	if(!stats.files) return;
+	logp("Chunk store: %" PRIu64 " files, %" PRIu64 " bytes in %" PRIu64
+		" chunks, %" PRIu64 " new chunks with %" PRIu64 " bytes\n",
+		stats.files, stats.bytes, stats.chunks,
+		stats.new_chunks, stats.new_bytes);
+}
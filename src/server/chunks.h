@@ -0,0 +1,61 @@
+#ifndef _CHUNKS_H
+#define _CHUNKS_H
+
+#define CHUNKS_DIR	"chunks"
+
+// Content defined chunking, FastCDC style. Chunks are cut between the
+// minimum and maximum sizes, aiming for the average.
+#define CHUNK_MIN	16384
+#define CHUNK_AVG	65536
+#define CHUNK_MAX	262144
+
+struct chunks_stats
+{
+	uint64_t files;
+	uint64_t bytes;
+	uint64_t chunks;
+	uint64_t new_chunks;
+	uint64_t new_bytes;
+};
+
+// Per client store of the chunks of protocol1 file data, kept under
+// <client>/chunks/<ab>/<cd>/<sha256>. Each chunk is stored once, gzipped.
+// A data file that has been chunked is replaced by a recipe, which is a
+// text file listing the chunks that make up the uncompressed content.
+// Each chunk has a count of the recipes that refer to it.
+
+// Returns the length of the next chunk in buf.
+extern size_t chunks_cut(const uint8_t *buf, size_t len);
+
+// Replaces the data file at path with a recipe. Files that are too small
+// to be worth it are left alone.
+extern int chunks_store(const char *store, const char *path, int compression);
+
+// Returns 1 if the store has been created, 0 if not, or -1 on error.
+extern int chunks_store_exists(const char *store);
+
+// Returns 1 if path is a recipe for this store, 0 if it is not, or -1 on
+// error. A NULL store has no recipes.
+extern int chunks_is_recipe(const char *store, const char *path);
+
+// Passes the uncompressed content of the recipe to fn, a piece at a time,
+// stopping if fn returns non-zero.
+extern int chunks_read(const char *store, const char *recipe,
+	int (*fn)(void *arg, const uint8_t *buf, size_t len), void *arg);
+
+// Writes the uncompressed content of the recipe to dest.
+extern int chunks_rebuild(const char *store, const char *recipe,
+	const char *dest);
+
+// Copies of recipes need their own references to the chunks. Links and
+// renames do not. Does nothing if newpath is not a recipe.
+extern int chunks_recipe_copied(const char *oldpath, const char *newpath);
+
+// Removes the chunks that are no longer referred to by any recipe that is
+// still in a backup.
+extern int chunks_gc(const char *store);
+
+extern void chunks_get_stats(struct chunks_stats *stats);
+extern void chunks_log_stats(void);
+
+#endif
@@ -11,8 +11,12 @@
 #include "../strlist.h"
 #include "bu_get.h"
 #include "child.h"
+#include "chunks.h"
 #include "sdirs.h"
 #include "delete.h"
+#include "dirrefs.h"
+#include "ingest_dedup.h"
+#include "rcache.h"
 
 static int do_rename_w(const char *a, const char *b,
 	const char *cname, struct bu *bu)
@@ -53,6 +57,14 @@ static int delete_backup(struct sdirs *sdirs, const char *cname, struct bu *bu,
 {
 	logp("deleting %s backup %" PRId64 "\n", cname, bu->bno);
 
+	// Anything rebuilt for this backup in the restore cache is no longer
+	// needed.
+	rcache_delete_backup(sdirs->rcache, bu);
+
+	// Directories that newer backups refer to have to go to them first.
+	if(dirrefs_hand_over(bu))
+		return -1;
+
 	if(!bu->next && !bu->prev)
 	{
 		// The current, and only, backup.
@@ -186,27 +198,39 @@ end:
 	return ret;
 }
 
+// Chunks and ingest dedup entries that only the deleted backups used can go
+// now.
+static void tidy_shared(struct sdirs *sdirs)
+{
+	if(chunks_gc(sdirs->chunks))
+		logp("could not tidy chunk store %s\n", sdirs->chunks);
+	ingest_dedup_prune(sdirs->ingest_dedup);
+}
+
 int delete_backups(struct sdirs *sdirs,
 	const char *cname, struct strlist *keep, const char *manual_delete)
 {
+	int r;
 	int ret=-1;
+	int deleted=0;
 	struct bu *bu_list=NULL;
 	// Deleting a backup might mean that more become available to delete.
 	// Keep trying to delete until we cannot delete any more.
 	while(1)
 	{
 		if(bu_get_list(sdirs, &bu_list)) goto end;
-		switch(do_delete_backups(sdirs, cname, keep, bu_list,
-			manual_delete))
+		switch((r=do_delete_backups(sdirs, cname, keep, bu_list,
+			manual_delete)))
 		{
 			case 0: ret=0; goto end;
 			case -1: ret=-1; goto end;
-			default: break;
+			default: deleted+=r; break;
 		}
 		bu_list_free(&bu_list);
 	}
 end:
 	bu_list_free(&bu_list);
+	if(deleted) tidy_shared(sdirs);
 	return ret;
 }
 
@@ -265,6 +289,8 @@ int do_delete_server(struct asfd *asfd,
 		asfd->write_str(asfd, CMD_ERROR, "backup not found");
 		goto end;
 	}
+	if(found)
+		tidy_shared(sdirs);
 
 	ret=0;
 end:
@@ -0,0 +1,116 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../bu.h"
+#include "../log.h"
+#include "../prepend.h"
+#include "bu_get.h"
+#include "sdirs.h"
+#include "delta_chain.h"
+
+struct delta_chain *delta_chain_alloc(void)
+{
+	return (struct delta_chain *)
+		calloc_w(1, sizeof(struct delta_chain), __func__);
+}
+
+int delta_chain_init(struct delta_chain *dc, struct sdirs *sdirs,
+	int max_length, int max_percent)
+{
+	struct bu *current;
+	if(bu_get_list(sdirs, &dc->bu_list))
+		return -1;
+	if((current=bu_find_current(dc->bu_list)))
+		dc->older=current->prev;
+	dc->max_length=max_length;
+	dc->max_percent=max_percent;
+	return 0;
+}
+
+void delta_chain_free(struct delta_chain **dc)
+{
+	if(!dc || !*dc) return;
+	bu_list_free(&(*dc)->bu_list);
+	free_v((void **)dc);
+}
+
+static int is_reg(const char *dir, const char *datapth, struct stat *statp)
+{
+	int ret;
+	char *path;
+	if(!(path=prepend_s(dir, datapth)))
+		return -1;
+	ret=!lstat(path, statp) && S_ISREG(statp->st_mode);
+	free_w(&path);
+	return ret;
+}
+
+// Counts the reverse deltas that would be applied after the new one to
+// restore the oldest version of the file, stopping at the first older
+// backup that has a full copy. Returns 1 if the new reverse delta would
+// make the chain longer than allowed.
+int delta_chain_too_long(struct delta_chain *dc, const char *datapth)
+{
+	struct bu *b;
+	struct stat statp;
+
+	dc->length=0;
+	dc->bytes=0;
+	for(b=dc->older; b; b=b->prev)
+	{
+		if(is_reg(b->data, datapth, &statp)>0)
+			break;
+		if(is_reg(b->delta, datapth, &statp)<=0)
+			continue;
+		dc->length++;
+		dc->bytes+=(uint64_t)statp.st_size;
+		if(dc->max_length && dc->length+1>dc->max_length)
+			return 1;
+	}
+	return 0;
+}
+
+// Returns 1 if the deltas in the chain, including the new one in deltadir,
+// add up to more than the allowed percentage of the full copy at oldpath.
+int delta_chain_too_big(struct delta_chain *dc,
+	const char *deltadir, const char *datapth, const char *oldpath)
+{
+	struct stat dstatp;
+	struct stat ostatp;
+	if(!dc->max_percent
+	  || is_reg(deltadir, datapth, &dstatp)<=0
+	  || lstat(oldpath, &ostatp))
+		return 0;
+	return (dc->bytes+(uint64_t)dstatp.st_size)*100
+		> (uint64_t)dc->max_percent*(uint64_t)ostatp.st_size;
+}
+
+void delta_chain_add(struct delta_chain *dc, int full_copy)
+{
+	int i;
+	if(full_copy)
+	{
+		dc->full_copies++;
+		return;
+	}
+	i=dc->length;
+	if(i>=DELTA_CHAIN_BUCKETS)
+		i=DELTA_CHAIN_BUCKETS-1;
+	dc->lengths[i]++;
+}
+
+void delta_chain_log(struct delta_chain *dc)
+{
+	int i;
+	size_t len=0;
+	char buf[512]="";
+	for(i=0; i<DELTA_CHAIN_BUCKETS; i++)
+	{
+		if(!dc->lengths[i])
+			continue;
+		len+=snprintf(buf+len, sizeof(buf)-len, " %d%s:%" PRIu64,
+			i+1, i==DELTA_CHAIN_BUCKETS-1?"+":"", dc->lengths[i]);
+	}
+	logp("Reverse delta chain lengths:%s\n", *buf?buf:" none");
+	logp("Full copies kept to limit chains: %" PRIu64 "\n",
+		dc->full_copies);
+}
@@ -0,0 +1,39 @@
+#ifndef _DELTA_CHAIN_H
+#define _DELTA_CHAIN_H
+
+#define DELTA_CHAIN_BUCKETS	16
+
+struct bu;
+struct sdirs;
+
+// Used by phase4 to decide when to keep a full copy of an old file in the
+// previous backup instead of a reverse delta, so that restores of older
+// backups do not need to apply an unlimited number of patches.
+struct delta_chain
+{
+	struct bu *bu_list;
+	struct bu *older; // The backup before the one getting new deltas.
+	int max_length;
+	int max_percent;
+
+	// Set by delta_chain_too_long() for the last file checked.
+	int length;
+	uint64_t bytes;
+
+	// Histogram of chain lengths, the last bucket includes longer ones.
+	uint64_t lengths[DELTA_CHAIN_BUCKETS];
+	uint64_t full_copies;
+};
+
+extern struct delta_chain *delta_chain_alloc(void);
+extern int delta_chain_init(struct delta_chain *dc, struct sdirs *sdirs,
+	int max_length, int max_percent);
+extern void delta_chain_free(struct delta_chain **dc);
+
+extern int delta_chain_too_long(struct delta_chain *dc, const char *datapth);
+extern int delta_chain_too_big(struct delta_chain *dc,
+	const char *deltadir, const char *datapth, const char *oldpath);
+extern void delta_chain_add(struct delta_chain *dc, int full_copy);
+extern void delta_chain_log(struct delta_chain *dc);
+
+#endif
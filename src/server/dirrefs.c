@@ -0,0 +1,691 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../bu.h"
+#include "../fsops.h"
+#include "../fzp.h"
+#include "../handy.h"
+#include "../log.h"
+#include "../prepend.h"
+#include "sdirs.h"
+#include "dirrefs.h"
+
+#include <uthash.h>
+
+// Suffix for a symlink that is being replaced.
+#define DIRREF_TMP	".dirref"
+
+struct dirref
+{
+	char *owner;
+	char *dir;
+	uint8_t gone;
+};
+
+struct reflist
+{
+	struct dirref *refs;
+	size_t len;
+	size_t alloc;
+};
+
+struct dirnode
+{
+	char *path;
+	// Unchanged files in the new backup under this directory, and the
+	// sum of the hashes of their data paths.
+	uint64_t want;
+	uint64_t want_sum;
+	// The same for the files in the previous backup.
+	uint64_t have;
+	uint64_t have_sum;
+	// Something new or changed is under this directory.
+	uint8_t dirty;
+	uint8_t ref;
+	// Set if this directory is a symlink in the previous backup.
+	char *owner;
+	UT_hash_handle hh;
+};
+
+struct dirrefs_plan
+{
+	struct dirnode *nodes;
+	struct dirnode **refs;
+	size_t nrefs;
+	char *oldbasename;
+};
+
+static uint64_t path_hash(const char *path)
+{
+	uint64_t h=14695981039346656037ULL;
+	for(; *path; path++)
+	{
+		h^=(uint8_t)*path;
+		h*=1099511628211ULL;
+	}
+	return h;
+}
+
+static void reflist_free_content(struct reflist *l)
+{
+	size_t i;
+	for(i=0; i<l->len; i++)
+	{
+		free_w(&l->refs[i].owner);
+		free_w(&l->refs[i].dir);
+	}
+	free_v((void **)&l->refs);
+	l->len=0;
+	l->alloc=0;
+}
+
+static int reflist_add(struct reflist *l, const char *owner, const char *dir)
+{
+	struct dirref *r;
+	if(l->len==l->alloc)
+	{
+		struct dirref *tmp;
+		size_t n=l->alloc?l->alloc*2:16;
+		if(!(tmp=(struct dirref *)realloc_w(l->refs,
+			n*sizeof(struct dirref), __func__)))
+				return -1;
+		l->refs=tmp;
+		l->alloc=n;
+	}
+	r=&l->refs[l->len];
+	memset(r, 0, sizeof(struct dirref));
+	if(!(r->owner=strdup_w(owner, __func__))
+	  || !(r->dir=strdup_w(dir, __func__)))
+	{
+		free_w(&r->owner);
+		return -1;
+	}
+	l->len++;
+	return 0;
+}
+
+static int reflist_load(struct reflist *l, const char *backup)
+{
+	int ret=-1;
+	char *path=NULL;
+	char *line=NULL;
+	char *cp;
+	size_t len;
+	char buf[4096];
+	struct fzp *fzp=NULL;
+
+	if(!(path=prepend_s(backup, DIRREFS)))
+		goto end;
+	if(is_reg_lstat(path)<=0)
+	{
+		ret=0;
+		goto end;
+	}
+	if(!(fzp=fzp_open(path, "rb")))
+		goto end;
+	while(fzp_gets(fzp, buf, sizeof(buf)))
+	{
+		len=strlen(buf);
+		if(astrcat(&line, buf, __func__))
+			goto end;
+		if(!len || buf[len-1]!='\n')
+			continue;
+		line[strlen(line)-1]='\0';
+		if(!(cp=strchr(line, '\t')))
+		{
+			logp("bad line in %s: %s\n", path, line);
+			goto end;
+		}
+		*cp++='\0';
+		if(reflist_add(l, line, cp))
+			goto end;
+		free_w(&line);
+	}
+	ret=0;
+end:
+	fzp_close(&fzp);
+	free_w(&line);
+	free_w(&path);
+	return ret;
+}
+
+static int reflist_save(struct reflist *l, const char *backup)
+{
+	int ret=-1;
+	size_t i;
+	size_t n=0;
+	char *path=NULL;
+	char *tmp=NULL;
+	struct fzp *fzp=NULL;
+
+	if(!(path=prepend_s(backup, DIRREFS)))
+		goto end;
+	for(i=0; i<l->len; i++)
+		if(!l->refs[i].gone) n++;
+	if(!n)
+	{
+		unlink(path);
+		ret=0;
+		goto end;
+	}
+	if(!(tmp=get_tmp_filename(path))
+	  || !(fzp=fzp_open(tmp, "wb")))
+		goto end;
+	for(i=0; i<l->len; i++)
+	{
+		if(l->refs[i].gone) continue;
+		if(fzp_printf(fzp, "%s\t%s\n",
+			l->refs[i].owner, l->refs[i].dir)<0)
+				goto end;
+	}
+	if(fzp_close(&fzp))
+	{
+		logp("error closing %s in %s\n", tmp, __func__);
+		goto end;
+	}
+	ret=do_rename(tmp, path);
+end:
+	fzp_close(&fzp);
+	free_w(&path);
+	free_w(&tmp);
+	return ret;
+}
+
+// The target of the symlink for dir, relative to where the symlink is.
+static char *ref_target(const char *owner, const char *dir)
+{
+	char *target=NULL;
+	const char *cp;
+
+	// Up out of each component of dir, and then the data directory.
+	if(astrcat(&target, "../", __func__))
+		return NULL;
+	for(cp=dir; (cp=strchr(cp, '/')); cp++)
+		if(astrcat(&target, "../", __func__))
+			goto error;
+	if(astrcat(&target, "../", __func__)
+	  || astrcat(&target, owner, __func__)
+	  || astrcat(&target, "/" DATA_DIR "/", __func__)
+	  || astrcat(&target, dir, __func__))
+		goto error;
+	return target;
+error:
+	free_w(&target);
+	return NULL;
+}
+
+static int under(const char *path, const char *dir)
+{
+	size_t len=strlen(dir);
+	return !strncmp(path, dir, len) && (!path[len] || path[len]=='/');
+}
+
+static struct dirnode *node_find(struct dirrefs_plan *plan,
+	const char *path, size_t len)
+{
+	struct dirnode *n=NULL;
+	HASH_FIND(hh, plan->nodes, path, len, n);
+	return n;
+}
+
+static struct dirnode *node_get(struct dirrefs_plan *plan,
+	const char *path, size_t len)
+{
+	struct dirnode *n;
+	if((n=node_find(plan, path, len)))
+		return n;
+	if(!(n=(struct dirnode *)calloc_w(1, sizeof(struct dirnode), __func__))
+	  || !(n->path=(char *)malloc_w(len+1, __func__)))
+	{
+		free_v((void **)&n);
+		return NULL;
+	}
+	memcpy(n->path, path, len);
+	n->path[len]='\0';
+	HASH_ADD_KEYPTR(hh, plan->nodes, n->path, len, n);
+	return n;
+}
+
+struct dirrefs_plan *dirrefs_plan_alloc(void)
+{
+	return (struct dirrefs_plan *)calloc_w(1,
+		sizeof(struct dirrefs_plan), __func__);
+}
+
+void dirrefs_plan_free(struct dirrefs_plan **plan)
+{
+	struct dirnode *n;
+	struct dirnode *tmp;
+	if(!plan || !*plan) return;
+	HASH_ITER(hh, (*plan)->nodes, n, tmp)
+	{
+		HASH_DEL((*plan)->nodes, n);
+		free_w(&n->path);
+		free_w(&n->owner);
+		free_v((void **)&n);
+	}
+	free_v((void **)&(*plan)->refs);
+	free_w(&(*plan)->oldbasename);
+	free_v((void **)plan);
+}
+
+int dirrefs_plan_add(struct dirrefs_plan *plan,
+	const char *datapth, int unchanged)
+{
+	const char *cp;
+	struct dirnode *n;
+	uint64_t h=unchanged?path_hash(datapth):0;
+
+	for(cp=datapth; (cp=strchr(cp, '/')); cp++)
+	{
+		if(!(n=node_get(plan, datapth, cp-datapth)))
+			return -1;
+		if(unchanged)
+		{
+			n->want++;
+			n->want_sum+=h;
+		}
+		else
+			n->dirty=1;
+	}
+	return 0;
+}
+
+// Adds a file in the previous backup to every directory above it, or marks
+// them as not the same if it is a directory that the new backup does not
+// have.
+static void count_old(struct dirrefs_plan *plan, const char *rel, int isdir)
+{
+	const char *cp;
+	struct dirnode *n;
+	uint64_t h=isdir?0:path_hash(rel);
+
+	for(cp=rel; (cp=strchr(cp, '/')); cp++)
+	{
+		if(!(n=node_find(plan, rel, cp-rel)))
+			continue;
+		if(isdir)
+			n->dirty=1;
+		else
+		{
+			n->have++;
+			n->have_sum+=h;
+		}
+	}
+}
+
+static int walk_old(struct dirrefs_plan *plan,
+	const char *datadir, const char *rel)
+{
+	int ret=-1;
+	DIR *dirp=NULL;
+	char *dir=NULL;
+	char *path=NULL;
+	char *full=NULL;
+	struct dirent *entry;
+	struct stat statp;
+
+	if(!(dir=prepend_s(datadir, rel)))
+		goto end;
+	if(!(dirp=opendir(dir)))
+	{
+		logp("opendir %s in %s: %s\n", dir, __func__, strerror(errno));
+		goto end;
+	}
+	while(1)
+	{
+		int isdir;
+		errno=0;
+		if(!(entry=readdir(dirp)))
+		{
+			if(errno)
+			{
+				logp("error in readdir in %s: %s\n",
+					__func__, strerror(errno));
+				goto end;
+			}
+			break;
+		}
+		if(!filter_dot(entry))
+			continue;
+		free_w(&path);
+		free_w(&full);
+		if(!(path=prepend_s(rel, entry->d_name))
+		  || !(full=prepend_s(dir, entry->d_name)))
+			goto end;
+		// Directories that are symlinks from older backups count
+		// the same as real ones.
+		isdir=is_dir(full, entry)>0;
+#ifdef _DIRENT_HAVE_D_TYPE
+		if(entry->d_type==DT_LNK || entry->d_type==DT_UNKNOWN)
+#endif
+		if(!isdir && is_lnk_lstat(full)>0)
+			isdir=!stat(full, &statp) && S_ISDIR(statp.st_mode);
+		if(!isdir)
+		{
+			count_old(plan, path, 0);
+			continue;
+		}
+		if(!node_find(plan, path, strlen(path)))
+		{
+			count_old(plan, path, 1);
+			continue;
+		}
+		if(walk_old(plan, datadir, path))
+			goto end;
+	}
+	ret=0;
+end:
+	if(dirp) closedir(dirp);
+	free_w(&dir);
+	free_w(&path);
+	free_w(&full);
+	return ret;
+}
+
+static int same(struct dirnode *n)
+{
+	return n && !n->dirty && n->want
+	  && n->want==n->have && n->want_sum==n->have_sum;
+}
+
+static int node_cmp(const void *a, const void *b)
+{
+	return strcmp((*(struct dirnode **)a)->path,
+		(*(struct dirnode **)b)->path);
+}
+
+// Symlinks in the previous backup point at the backup that has the real
+// directory, and so do the new ones.
+static const char *owner_of(struct dirrefs_plan *plan, const char *dir)
+{
+	const char *cp;
+	struct dirnode *n;
+	if((n=node_find(plan, dir, strlen(dir))) && n->owner)
+		return n->owner;
+	for(cp=dir; (cp=strchr(cp, '/')); cp++)
+		if((n=node_find(plan, dir, cp-dir)) && n->owner)
+			return n->owner;
+	return plan->oldbasename;
+}
+
+int dirrefs_plan_finish(struct dirrefs_plan *plan,
+	const char *oldbackup, const char *oldbasename)
+{
+	int ret=-1;
+	size_t i;
+	const char *cp;
+	char *datadir=NULL;
+	struct dirnode *n;
+	struct dirnode *tmp;
+	struct dirnode **refs;
+	struct reflist old;
+
+	memset(&old, 0, sizeof(old));
+	if(!(plan->oldbasename=strdup_w(oldbasename, __func__))
+	  || !(datadir=prepend_s(oldbackup, DATA_DIR))
+	  || reflist_load(&old, oldbackup))
+		goto end;
+	for(i=0; i<old.len; i++)
+	{
+		if(!(n=node_find(plan, old.refs[i].dir,
+			strlen(old.refs[i].dir))))
+				continue;
+		free_w(&n->owner);
+		if(!(n->owner=strdup_w(old.refs[i].owner, __func__)))
+			goto end;
+	}
+
+	if(walk_old(plan, datadir, ""))
+		goto end;
+
+	HASH_ITER(hh, plan->nodes, n, tmp)
+	{
+		if(!same(n))
+			continue;
+		if((cp=strrchr(n->path, '/'))
+		  && same(node_find(plan, n->path, cp-n->path)))
+			continue;
+		if(!(refs=(struct dirnode **)realloc_w(plan->refs,
+			(plan->nrefs+1)*sizeof(struct dirnode *), __func__)))
+				goto end;
+		plan->refs=refs;
+		plan->refs[plan->nrefs++]=n;
+	}
+	if(plan->nrefs)
+		qsort(plan->refs, plan->nrefs, sizeof(struct dirnode *),
+			node_cmp);
+	ret=0;
+end:
+	reflist_free_content(&old);
+	free_w(&datadir);
+	return ret;
+}
+
+static int make_ref(const char *datadir, const char *owner, const char *dir)
+{
+	int ret=-1;
+	char *path=NULL;
+	char *target=NULL;
+	char buf[4096];
+	ssize_t len;
+
+	if(!(path=prepend_s(datadir, dir))
+	  || !(target=ref_target(owner, dir)))
+		goto end;
+	if(mkpath(&path, datadir))
+	{
+		logp("could not create path for: %s\n", path);
+		goto end;
+	}
+	if(!symlink(target, path))
+	{
+		ret=0;
+		goto end;
+	}
+	// An interrupted phase4 might have got here before.
+	if(errno==EEXIST
+	  && (len=readlink(path, buf, sizeof(buf)-1))>0)
+	{
+		buf[len]='\0';
+		if(!strcmp(buf, target))
+			ret=0;
+	}
+end:
+	free_w(&path);
+	free_w(&target);
+	return ret;
+}
+
+int dirrefs_plan_link(struct dirrefs_plan *plan, const char *newbackup)
+{
+	int ret=-1;
+	size_t i;
+	uint64_t files=0;
+	uint64_t dirs=0;
+	char *datadir=NULL;
+	const char *owner;
+	struct reflist l;
+
+	memset(&l, 0, sizeof(l));
+	if(!(datadir=prepend_s(newbackup, DATA_DIR)))
+		goto end;
+	for(i=0; i<plan->nrefs; i++)
+	{
+		struct dirnode *n=plan->refs[i];
+		owner=owner_of(plan, n->path);
+		if(make_ref(datadir, owner, n->path))
+		{
+			// Something is already there, so the files get linked
+			// one by one.
+			continue;
+		}
+		if(reflist_add(&l, owner, n->path))
+			goto end;
+		n->ref=1;
+		dirs++;
+		files+=n->want;
+	}
+	if(reflist_save(&l, newbackup))
+		goto end;
+	if(dirs)
+		logp("Referred to %" PRIu64 " unchanged directories, holding %"
+			PRIu64 " files\n", dirs, files);
+	ret=0;
+end:
+	reflist_free_content(&l);
+	free_w(&datadir);
+	return ret;
+}
+
+int dirrefs_plan_covers(struct dirrefs_plan *plan, const char *datapth)
+{
+	const char *cp;
+	struct dirnode *n;
+	if(!plan->nrefs)
+		return 0;
+	for(cp=datapth; (cp=strchr(cp, '/')); cp++)
+		if((n=node_find(plan, datapth, cp-datapth)) && n->ref)
+			return 1;
+	return 0;
+}
+
+static int retarget(struct bu *n, const char *owner, const char *dir)
+{
+	int ret=-1;
+	char *path=NULL;
+	char *tmp=NULL;
+	char *target=NULL;
+
+	if(!(path=prepend_s(n->path, DATA_DIR))
+	  || astrcat(&path, "/", __func__)
+	  || astrcat(&path, dir, __func__)
+	  || !(tmp=strdup_w(path, __func__))
+	  || astrcat(&tmp, DIRREF_TMP, __func__)
+	  || !(target=ref_target(owner, dir)))
+		goto end;
+	unlink(tmp);
+	if(symlink(target, tmp))
+	{
+		logp("could not symlink %s: %s\n", tmp, strerror(errno));
+		goto end;
+	}
+	ret=do_rename(tmp, path);
+end:
+	free_w(&path);
+	free_w(&tmp);
+	free_w(&target);
+	return ret;
+}
+
+static int move_dir(struct bu *bu, struct bu *n, const char *dir)
+{
+	int ret=-1;
+	char *src=NULL;
+	char *dst=NULL;
+	char *tmp=NULL;
+
+	if(!(src=prepend_s(bu->path, DATA_DIR))
+	  || astrcat(&src, "/", __func__)
+	  || astrcat(&src, dir, __func__)
+	  || !(dst=prepend_s(n->path, DATA_DIR))
+	  || astrcat(&dst, "/", __func__)
+	  || astrcat(&dst, dir, __func__)
+	  || !(tmp=strdup_w(dst, __func__))
+	  || astrcat(&tmp, DIRREF_TMP, __func__))
+		goto end;
+
+	// If interrupted, the directory might already be here, or the
+	// symlink might already be out of the way.
+	if(is_dir_lstat(dst)<=0)
+	{
+		if(is_lnk_lstat(dst)>0 && do_rename(dst, tmp))
+			goto end;
+		if(do_rename(src, dst))
+			goto end;
+	}
+	unlink(tmp);
+	ret=0;
+end:
+	free_w(&src);
+	free_w(&dst);
+	free_w(&tmp);
+	return ret;
+}
+
+int dirrefs_hand_over(struct bu *bu)
+{
+	int ret=-1;
+	size_t i;
+	size_t j;
+	struct bu *n;
+	struct reflist mine;
+	struct reflist moved;
+	struct reflist l;
+
+	memset(&mine, 0, sizeof(mine));
+	memset(&moved, 0, sizeof(moved));
+	memset(&l, 0, sizeof(l));
+	if(reflist_load(&mine, bu->path))
+		goto end;
+
+	for(n=bu->next; n; n=n->next)
+	{
+		int changed=0;
+		size_t len;
+
+		reflist_free_content(&l);
+		if(reflist_load(&l, n->path))
+			goto end;
+		len=l.len;
+		for(i=0; i<len; i++)
+		{
+			struct dirref *r=&l.refs[i];
+			if(strcmp(r->owner, bu->basename))
+				continue;
+			changed=1;
+
+			// Already moved to an older backup than this one?
+			for(j=0; j<moved.len; j++)
+				if(under(r->dir, moved.refs[j].dir))
+					break;
+			if(j<moved.len)
+			{
+				if(retarget(n, moved.refs[j].owner, r->dir))
+					goto end;
+				free_w(&r->owner);
+				if(!(r->owner=strdup_w(moved.refs[j].owner,
+					__func__)))
+						goto end;
+				continue;
+			}
+
+			// This is the oldest backup that uses it, so it gets
+			// the real directory, along with any symlinks inside.
+			if(move_dir(bu, n, r->dir))
+				goto end;
+			r->gone=1;
+			for(j=0; j<mine.len; j++)
+			{
+				if(!under(mine.refs[j].dir, r->dir))
+					continue;
+				if(reflist_add(&l, mine.refs[j].owner,
+					mine.refs[j].dir))
+						goto end;
+				// The reflist might have moved.
+				r=&l.refs[i];
+			}
+			if(reflist_add(&moved, n->basename, r->dir))
+				goto end;
+			logp("moved %s from %s to %s\n",
+				r->dir, bu->basename, n->basename);
+		}
+		if(changed && reflist_save(&l, n->path))
+			goto end;
+	}
+	ret=0;
+end:
+	reflist_free_content(&mine);
+	reflist_free_content(&moved);
+	reflist_free_content(&l);
+	return ret;
+}
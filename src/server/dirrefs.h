@@ -0,0 +1,36 @@
+#ifndef _DIRREFS_H
+#define _DIRREFS_H
+
+#include "../bu.h"
+
+// Lists the directories in the data directory of a backup that are
+// symlinks to the same directory in an older backup, one
+// '<owner backup>\t<directory>' line each.
+#define DIRREFS		"dirrefs"
+
+struct dirrefs_plan;
+
+// Used by phase4 when both the previous and the new backup are hardlinked
+// archives. Every manifest entry with a data path is added first, saying
+// whether phase3 found it unchanged. Directories of the previous backup
+// that hold exactly the unchanged files of the new one, and nothing else,
+// then become symlinks in the new backup instead of being hard linked file
+// by file.
+extern struct dirrefs_plan *dirrefs_plan_alloc(void);
+extern void dirrefs_plan_free(struct dirrefs_plan **plan);
+extern int dirrefs_plan_add(struct dirrefs_plan *plan,
+	const char *datapth, int unchanged);
+extern int dirrefs_plan_finish(struct dirrefs_plan *plan,
+	const char *oldbackup, const char *oldbasename);
+extern int dirrefs_plan_link(struct dirrefs_plan *plan,
+	const char *newbackup);
+// Whether the data path is inside a directory that dirrefs_plan_link()
+// made a symlink.
+extern int dirrefs_plan_covers(struct dirrefs_plan *plan,
+	const char *datapth);
+
+// Before a backup is deleted, moves each directory that newer backups
+// refer to into the oldest of them, and points the others at it.
+extern int dirrefs_hand_over(struct bu *bu);
+
+#endif
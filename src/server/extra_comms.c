@@ -79,10 +79,11 @@ struct vers
 };
 
 static int send_features(struct asfd *asfd, struct conf **cconfs,
-	struct vers *vers)
+	struct vers *vers, int streams_max)
 {
 	int ret=-1;
 	char *feat=NULL;
+	char streams[32]="";
 	struct strlist *startdir=get_strlist(cconfs[OPT_STARTDIR]);
 	struct strlist *incglob=get_strlist(cconfs[OPT_INCGLOB]);
 
@@ -136,6 +137,19 @@ static int send_features(struct asfd *asfd, struct conf **cconfs,
 	if(append_to_feat(&feat, "seed:"))
 		goto end;
 
+	// File data can go in frames bigger than four hex digits allow.
+	if(append_to_feat(&feat, "large_frames:"))
+		goto end;
+
+	// Clients can have more than one file in flight in backup phase2.
+	if(streams_max>1)
+	{
+		snprintf(streams, sizeof(streams),
+			"phase2_streams=%d:", streams_max);
+		if(append_to_feat(&feat, streams))
+			goto end;
+	}
+
 	//printf("feat: %s\n", feat);
 
 	if(asfd->write_str(asfd, CMD_GEN, feat))
@@ -219,9 +233,11 @@ end:
 
 static int extra_comms_read(struct async *as,
 	struct vers *vers, int *srestore,
-	char **incexc, struct conf **globalcs, struct conf **cconfs)
+	char **incexc, struct conf **globalcs, struct conf **cconfs,
+	int streams_max)
 {
 	int ret=-1;
+	int large_frames=0;
 	struct asfd *asfd;
 	struct iobuf *rbuf;
 	asfd=as->asfd;
@@ -242,6 +258,9 @@ static int extra_comms_read(struct async *as,
 		{
 			if(asfd->write_str(asfd, CMD_GEN, "extra_comms_end ok"))
 				goto end;
+			// The client switches as soon as it reads the ok.
+			if(large_frames && asfd_set_large_frames(asfd))
+				goto end;
 			break;
 		}
 		else if(!strncmp_w(rbuf->buf, "autoupgrade:"))
@@ -406,6 +425,22 @@ static int extra_comms_read(struct async *as,
 			set_int(cconfs[OPT_REGEX_CASE_INSENSITIVE], 1);
 			set_int(globalcs[OPT_REGEX_CASE_INSENSITIVE], 1);
 		}
+		else if(!strncmp_w(rbuf->buf, "phase2_streams="))
+		{
+			int s;
+			s=atoi(rbuf->buf+strlen("phase2_streams="));
+			if(s<1 || s>streams_max)
+			{
+				logp("Client asked for %d phase2 streams, but the maximum is %d.\n", s, streams_max);
+				goto end;
+			}
+			set_int(cconfs[OPT_PHASE2_STREAMS], s);
+			set_int(globalcs[OPT_PHASE2_STREAMS], s);
+		}
+		else if(!strcmp(rbuf->buf, "large_frames"))
+		{
+			large_frames=1;
+		}
 		else
 		{
 			iobuf_log_unexpected(rbuf, __func__);
@@ -456,12 +491,20 @@ int extra_comms(struct async *as,
 {
 	struct vers vers;
 	struct asfd *asfd;
+	int streams_max;
 	asfd=as->asfd;
 	//char *restorepath=NULL;
 
 	if(vers_init(&vers, cconfs))
 		goto error;
 
+	// Only one phase2 stream unless the client asks for more.
+	streams_max=get_int(cconfs[OPT_PHASE2_STREAMS]);
+	if(streams_max>PHASE2_STREAMS_MAX)
+		streams_max=PHASE2_STREAMS_MAX;
+	set_int(confs[OPT_PHASE2_STREAMS], 1);
+	set_int(cconfs[OPT_PHASE2_STREAMS], 1);
+
 	if(vers.cli<vers.directory_tree)
 	{
 		set_int(confs[OPT_DIRECTORY_TREE], 0);
@@ -492,11 +535,12 @@ int extra_comms(struct async *as,
 	}
 	else
 	{
-		if(send_features(asfd, cconfs, &vers))
+		if(send_features(asfd, cconfs, &vers, streams_max))
 			goto error;
 	}
 
-	if(extra_comms_read(as, &vers, srestore, incexc, confs, cconfs))
+	if(extra_comms_read(as, &vers, srestore, incexc, confs, cconfs,
+		streams_max))
 		goto error;
 
 		
@@ -15,6 +15,8 @@ int fdirs_init(struct fdirs *fdirs,
 	 && (fdirs->datadirtmp=prepend_s(sdirs->finishing, "data.tmp"))
 	 && (fdirs->manifest=prepend_s(sdirs->finishing, "manifest.gz"))
 	 && (fdirs->deletionsfile=prepend_s(sdirs->finishing, "deletions"))
+	 && (fdirs->unchangedlist=prepend_s(sdirs->finishing,
+		UNCHANGED_LIST))
 	 && (fdirs->currentdup=prepend_s(sdirs->finishing, "currentdup"))
 	 && (fdirs->currentduptmp=prepend_s(sdirs->finishing, "currentdup.tmp"))
 	 && (fdirs->currentdupdata=prepend_s(fdirs->currentdup, "data"))
@@ -36,6 +38,7 @@ static void fdirs_free_content(struct fdirs *fdirs)
 	free_w(&fdirs->datadirtmp);
 	free_w(&fdirs->manifest);
 	free_w(&fdirs->deletionsfile);
+	free_w(&fdirs->unchangedlist);
 	free_w(&fdirs->currentdup);
 	free_w(&fdirs->currentduptmp);
 	free_w(&fdirs->currentdupdata);
@@ -7,6 +7,7 @@ struct fdirs // Finishing directories.
 {
 	char *manifest;
 	char *deletionsfile;
+	char *unchangedlist;
 	char *datadir;
 	char *datadirtmp;
 	char *currentdup;
@@ -0,0 +1,165 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../fsops.h"
+#include "../log.h"
+#include "../prepend.h"
+#include "ingest_dedup.h"
+
+#define MD5_HEX_LEN	32
+
+static uint64_t linked=0;
+static uint64_t saved_bytes=0;
+static uint64_t added=0;
+
+static const char *get_md5(const char *endfile)
+{
+	size_t i;
+	const char *cp;
+	if(!endfile || !(cp=strrchr(endfile, ':')))
+		return NULL;
+	cp++;
+	if(strlen(cp)!=MD5_HEX_LEN)
+		return NULL;
+	for(i=0; i<MD5_HEX_LEN; i++)
+		if(!isxdigit((unsigned char)cp[i]))
+			return NULL;
+	return cp;
+}
+
+static char *entry_path(const char *index, const char *md5, uint64_t size)
+{
+	char sub[MD5_HEX_LEN+32];
+	snprintf(sub, sizeof(sub), "%.2s/%s.%" PRIu64, md5, md5, size);
+	return prepend_s(index, sub);
+}
+
+// Replace path with a link to entry, so that path is never missing.
+static int link_to_entry(const char *entry, const char *path)
+{
+	int ret=-1;
+	char *tmppath=NULL;
+	if(astrcat(&tmppath, path, __func__)
+	  || astrcat(&tmppath, ".dedup", __func__))
+		return -1;
+	unlink(tmppath);
+	if(link(entry, tmppath))
+	{
+		logp("could not link %s to %s: %s\n",
+			tmppath, entry, strerror(errno));
+		goto end;
+	}
+	if(do_rename(tmppath, path))
+	{
+		unlink(tmppath);
+		goto end;
+	}
+	ret=0;
+end:
+	free_w(&tmppath);
+	return ret;
+}
+
+int ingest_dedup(const char *index, const char *path,
+	const char *endfile, int max_links, int add)
+{
+	int ret=0;
+	const char *md5;
+	char *entry=NULL;
+	struct stat statp;
+	struct stat estatp;
+
+	if(!index
+	  || !(md5=get_md5(endfile))
+	  || lstat(path, &statp)
+	  || !S_ISREG(statp.st_mode)
+	  || !statp.st_size)
+		return 0;
+	if(!(entry=entry_path(index, md5, (uint64_t)statp.st_size)))
+		return -1;
+
+	if(!lstat(entry, &estatp) && S_ISREG(estatp.st_mode))
+	{
+		if(estatp.st_dev==statp.st_dev
+		  && estatp.st_ino==statp.st_ino)
+			goto end;
+		// Different stored bytes can have the same md5sum, for
+		// example with different compression, so compare them.
+		if(estatp.st_nlink<(nlink_t)max_links
+		  && files_equal(entry, path, 0))
+		{
+			if(link_to_entry(entry, path))
+				goto end;
+			linked++;
+			saved_bytes+=(uint64_t)statp.st_size;
+			ret=1;
+			goto end;
+		}
+		if(!add)
+			goto end;
+		// New copies link to this one from now on.
+		unlink(entry);
+	}
+	else if(!add)
+		goto end;
+
+	if(build_path_w(entry))
+		goto end;
+	if(link(path, entry))
+	{
+		// Another client might have got there first.
+		if(errno!=EEXIST)
+			logp("could not link %s to %s: %s\n",
+				entry, path, strerror(errno));
+		goto end;
+	}
+	added++;
+end:
+	free_w(&entry);
+	return ret;
+}
+
+static void prune_dir(const char *dir)
+{
+	DIR *dirp=NULL;
+	char *path=NULL;
+	struct dirent *d;
+	struct stat statp;
+
+	if(!(dirp=opendir(dir)))
+		return;
+	while((d=readdir(dirp)))
+	{
+		if(!strcmp(d->d_name, ".")
+		  || !strcmp(d->d_name, ".."))
+			continue;
+		free_w(&path);
+		if(!(path=prepend_s(dir, d->d_name)))
+			break;
+		if(lstat(path, &statp))
+			continue;
+		if(S_ISDIR(statp.st_mode))
+			prune_dir(path);
+		// If a backup links to the entry at the same time, the entry
+		// goes but the backup keeps the data.
+		else if(S_ISREG(statp.st_mode) && statp.st_nlink==1)
+			unlink(path);
+	}
+	closedir(dirp);
+	free_w(&path);
+}
+
+void ingest_dedup_prune(const char *index)
+{
+	if(!index || is_dir_lstat(index)<=0)
+		return;
+	prune_dir(index);
+	recursive_delete_dirs_only_no_warnings(index);
+}
+
+void ingest_dedup_log_stats(void)
+{
+	if(!linked && !added) return;
+	logp("Ingest dedup: %" PRIu64 " files linked, saving %" PRIu64
+		" bytes, %" PRIu64 " added to the index\n",
+		linked, saved_bytes, added);
+}
@@ -0,0 +1,24 @@
+#ifndef _INGEST_DEDUP_H
+#define _INGEST_DEDUP_H
+
+#define INGEST_DEDUP_DIR	".ingest_dedup"
+
+// Index of stored data files, shared by the clients in a dedup_group that
+// use the same storage directory. It lives in
+// <directory>/.ingest_dedup/<dedup_group>, and each entry is a hard link to
+// a stored file, named after the md5sum of the original content and the
+// size of the stored file.
+
+// Looks up a newly received file. If the same file is already stored, path
+// is replaced with a hard link to it and 1 is returned. Otherwise, path is
+// added to the index if add is set, and 0 is returned. Problems are logged
+// and leave the file as it is.
+extern int ingest_dedup(const char *index, const char *path,
+	const char *endfile, int max_links, int add);
+
+// Removes the entries that no backup uses any more.
+extern void ingest_dedup_prune(const char *index);
+
+extern void ingest_dedup_log_stats(void);
+
+#endif
@@ -7,12 +7,31 @@
 #include "../fzp.h"
 #include "../log.h"
 #include "../prepend.h"
+#include "../uring.h"
 #include "child.h"
+#include "chunks.h"
 #include "link.h"
 
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+static int link_done(const char *oldpath, const char *newpath,
+	int err, void *arg)
+{
+	const char **dirs=(const char **)arg;
+	if(!err) return 0;
+	logp("could not hard link '%s/%s' to '%s/%s': %s\n",
+		dirs[1], newpath, dirs[0], oldpath, strerror(err));
+	return -1;
+}
+
 int recursive_hardlink(const char *src, const char *dst, struct conf **confs)
 {
 	int ret=-1;
+	int dstfd=-1;
+	const char *dirs[2]={ src, dst };
 	DIR *dirp=NULL;
 	char *tmp=NULL;
 	char *fullpatha=NULL;
@@ -33,6 +52,14 @@ int recursive_hardlink(const char *src, const char *dst, struct conf **confs)
 			src, __func__, strerror(errno));
 		goto end;
 	}
+	// The links are made relative to the two directories, so that the
+	// kernel does not walk both whole paths again for each file.
+	if((dstfd=open(dst, O_RDONLY|O_DIRECTORY))<0)
+	{
+		logp("could not open %s in %s: %s\n",
+			dst, __func__, strerror(errno));
+		goto end;
+	}
 
 	while(1)
 	{
@@ -70,7 +97,8 @@ int recursive_hardlink(const char *src, const char *dst, struct conf **confs)
 #endif
 		// Otherwise, we have to do an lstat() anyway, because we
 		// will need to check the number of hardlinks in do_link().
-		if(lstat(fullpatha, &statp))
+		if(fstatat(dirfd(dirp), entry->d_name, &statp,
+			AT_SYMLINK_NOFOLLOW))
 		{
 			logp("could not lstat %s\n", fullpatha);
 		}
@@ -83,8 +111,19 @@ int recursive_hardlink(const char *src, const char *dst, struct conf **confs)
 		{
 			//logp("hardlinking %s to %s\n", fullpathb, fullpatha);
 			if(timed_operation_status_only(CNTR_STATUS_SHUFFLING,
-				fullpathb, confs)
-			  || do_link(fullpatha, fullpathb, &statp, confs,
+				fullpathb, confs))
+					goto end;
+			// The links do not depend on each other, so they can
+			// all be in flight at once. Files with too many links
+			// already are copied by do_link().
+			if(statp.st_nlink<
+				(unsigned int)get_int(confs[OPT_MAX_HARDLINKS]))
+			{
+				if(uring_linkat(dirfd(dirp), entry->d_name,
+					dstfd, entry->d_name, link_done, dirs))
+						goto end;
+			}
+			else if(do_link(fullpatha, fullpathb, &statp, confs,
 				0 /* do not overwrite target */))
 					goto end;
 		}
@@ -92,7 +131,9 @@ int recursive_hardlink(const char *src, const char *dst, struct conf **confs)
 
 	ret=0;
 end:
+	if(uring_wait()) ret=-1;
 	if(dirp) closedir(dirp);
+	close_fd(&dstfd);
 	free_w(&fullpatha);
 	free_w(&fullpathb);
 	free_w(&tmp);
@@ -100,34 +141,128 @@ end:
 	return ret;
 }
 
-#define DUP_CHUNK	4096
-static int duplicate_file(const char *oldpath, const char *newpath)
+static struct link_stats stats;
+
+#define DUP_CHUNK	65536
+
+static int write_all(int fd, const char *buf, size_t count)
 {
-	int ret=-1;
-	size_t s=0;
-	size_t t=0;
-	struct fzp *op=NULL;
-	struct fzp *np=NULL;
-	char buf[DUP_CHUNK]="";
-	if(!(op=fzp_open(oldpath, "rb"))
-	  || !(np=fzp_open(newpath, "wb")))
-		goto end;
+	ssize_t w;
+	while(count)
+	{
+		if((w=write(fd, buf, count))<0)
+		{
+			if(errno==EINTR)
+				continue;
+			return -1;
+		}
+		buf+=w;
+		count-=w;
+	}
+	return 0;
+}
 
-	while((s=fzp_read(op, buf, DUP_CHUNK))>0)
+static int copy_by_reading(int ofd, int nfd)
+{
+	ssize_t s;
+	char buf[DUP_CHUNK];
+
+	while(1)
 	{
-		t=fzp_write(np, buf, s);
-		if(t!=s)
+		if((s=read(ofd, buf, DUP_CHUNK))<0)
 		{
-			logp("could not write all bytes: %lu!=%lu\n",
-				(unsigned long)s, (unsigned long)t);
-			goto end;
+			if(errno==EINTR)
+				continue;
+			logp("read error in %s: %s\n",
+				__func__, strerror(errno));
+			return -1;
+		}
+		if(!s)
+			break;
+		if(write_all(nfd, buf, s))
+		{
+			logp("write error in %s: %s\n",
+				__func__, strerror(errno));
+			return -1;
 		}
 	}
+	stats.copied++;
+	return 0;
+}
 
-	ret=0;
+#ifdef HAVE_COPY_FILE_RANGE
+// Returns 1 if the file system cannot do it, so the caller has to read and
+// write the data itself.
+static int copy_in_kernel(int ofd, int nfd, off_t size)
+{
+	ssize_t s;
+	off_t done=0;
+
+	while(done<size)
+	{
+		if((s=copy_file_range(ofd, NULL, nfd, NULL,
+			size-done, 0))<0)
+		{
+			if(!done && (errno==ENOSYS || errno==EXDEV
+			  || errno==EINVAL || errno==EOPNOTSUPP))
+				return 1;
+			logp("copy_file_range error in %s: %s\n",
+				__func__, strerror(errno));
+			return -1;
+		}
+		// Got shorter while being copied.
+		if(!s) break;
+		done+=s;
+	}
+	stats.range_copied++;
+	return 0;
+}
+#endif
+
+// Used when a file has too many hard links already. On file systems that
+// share extents between files, such as btrfs and XFS, the copy is a
+// reflink, which takes no time or space. Otherwise, the kernel copies the
+// data if it can, and failing that it is read and written here.
+static int duplicate_file(const char *oldpath, const char *newpath)
+{
+	int ret=-1;
+	int ofd=-1;
+	int nfd=-1;
+	struct stat statp;
+
+	if((ofd=open(oldpath, O_RDONLY))<0
+	  || fstat(ofd, &statp))
+	{
+		logp("could not open %s: %s\n", oldpath, strerror(errno));
+		goto end;
+	}
+	if((nfd=open(newpath, O_WRONLY|O_CREAT|O_TRUNC, 0666))<0)
+	{
+		logp("could not open %s: %s\n", newpath, strerror(errno));
+		goto end;
+	}
+
+#ifdef FICLONE
+	if(!ioctl(nfd, FICLONE, ofd))
+	{
+		stats.reflinked++;
+		ret=0;
+		goto end;
+	}
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+	if((ret=copy_in_kernel(ofd, nfd, statp.st_size))<=0)
+		goto end;
+#endif
+	ret=copy_by_reading(ofd, nfd);
 end:
-	fzp_close(&np);
-	fzp_close(&op);
+	close_fd(&ofd);
+	if(nfd>=0 && close(nfd))
+	{
+		logp("error closing %s in %s: %s\n",
+			newpath, __func__, strerror(errno));
+		ret=-1;
+	}
 	if(ret) logp("could not duplicate %s to %s\n", oldpath, newpath);
 	return ret;
 }
@@ -139,7 +274,10 @@ int do_link(const char *oldpath, const char *newpath, struct stat *statp,
 	if(confs
 	  && statp->st_nlink >= (unsigned int)get_int(confs[OPT_MAX_HARDLINKS]))
 	{
-		return duplicate_file(oldpath, newpath);
+		if(duplicate_file(oldpath, newpath)
+		  || chunks_recipe_copied(oldpath, newpath))
+			return -1;
+		return 0;
 	}
 	else if(link(oldpath, newpath))
 	{
@@ -158,3 +296,18 @@ int do_link(const char *oldpath, const char *newpath, struct stat *statp,
 	}
 	return 0;
 }
+
+void link_get_stats(struct link_stats *s)
+{
+	*s=stats;
+}
+
+void link_log_stats(void)
+{
+	if(!stats.reflinked && !stats.range_copied && !stats.copied)
+		return;
+	logp("Files duplicated because of max_hardlinks: %" PRIu64
+		" reflinked, %" PRIu64 " copied by the kernel, %" PRIu64
+		" copied\n", stats.reflinked, stats.range_copied,
+		stats.copied);
+}
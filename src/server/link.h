@@ -1,9 +1,19 @@
 #ifndef _LINK_H
 #define _LINK_H
 
+struct link_stats
+{
+	uint64_t reflinked;
+	uint64_t range_copied;
+	uint64_t copied;
+};
+
 extern int recursive_hardlink(const char *src, const char *dst,
 	struct conf **confs);
 extern int do_link(const char *oldpath, const char *newpath,
 	struct stat *statp, struct conf **confs, uint8_t overwrite);
 
+extern void link_get_stats(struct link_stats *stats);
+extern void link_log_stats(void);
+
 #endif
@@ -311,6 +311,8 @@ static int run_child(int *cfd, SSL_CTX *ctx, struct sockaddr_storage *addr,
 		goto end;
 	asfd->set_timeout(asfd, get_int(confs[OPT_NETWORK_TIMEOUT]));
 	asfd->ratelimit=get_float(confs[OPT_RATELIMIT]);
+	asfd->set_write_batch(asfd, get_int(confs[OPT_WRITE_BATCH_BYTES]),
+		get_int(confs[OPT_WRITE_BATCH_MS]));
 	asfd->peer_addr=peer_addr;
 
 	if(authorise_server(as->asfd, confs, cconfs)
@@ -0,0 +1,112 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../bu.h"
+#include "../log.h"
+#include "../prepend.h"
+#include "../sbuf.h"
+#include "manio.h"
+#include "prefetch.h"
+
+struct prefetch *prefetch_alloc(void)
+{
+	return (struct prefetch *)
+		calloc_w(1, sizeof(struct prefetch), __func__);
+}
+
+// Returns 0 if the path existed.
+static int hint_path(struct prefetch *prefetch, const char *path)
+{
+	int fd;
+	if((fd=open(path, O_RDONLY))<0)
+		return -1;
+#ifdef HAVE_POSIX_FADVISE
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+	close(fd);
+	prefetch->hinted++;
+	return 0;
+}
+
+// Follows the same search as restore_file() and process_data_dir_file().
+static int hint_datapth(struct prefetch *prefetch, const char *datapth)
+{
+	struct bu *b;
+	struct bu *bu=prefetch->bu;
+	char *path=NULL;
+
+	for(b=bu; b; b=b->next)
+	{
+		free_w(&path);
+		if(!(path=prepend_s(b->data, datapth)))
+			return -1;
+		if(!hint_path(prefetch, path))
+			break;
+	}
+	if(!b)
+		goto end;
+
+	// The reverse deltas that will be applied on the way back down.
+	for(b=b->prev; b && b->next!=bu; b=b->prev)
+	{
+		free_w(&path);
+		if(!(path=prepend_s(b->delta, datapth)))
+			return -1;
+		hint_path(prefetch, path);
+	}
+end:
+	free_w(&path);
+	return 0;
+}
+
+void prefetch_advance(struct prefetch *prefetch)
+{
+	struct sbuf *sb;
+
+	if(!prefetch || prefetch->finished)
+		return;
+	sb=prefetch->sb;
+
+	sbuf_free_content(sb);
+	switch(manio_read(prefetch->manio, sb))
+	{
+		case 0:
+			break;
+		case 1:
+			prefetch->finished=1;
+			return;
+		default:
+			// Not fatal, the restore will find out for itself.
+			logp("Stopping prefetch after manifest read error\n");
+			prefetch->finished=1;
+			return;
+	}
+
+	if(!sb->datapth.buf
+	  || !(sbuf_is_filedata(sb) || sbuf_is_vssdata(sb))
+	  || (prefetch->regex && !regex_check(prefetch->regex, sb->path.buf)))
+		return;
+	if(hint_datapth(prefetch, sb->datapth.buf))
+		prefetch->finished=1;
+}
+
+int prefetch_init(struct prefetch *prefetch,
+	const char *manifest, struct bu *bu, regex_t *regex, int ahead)
+{
+	prefetch->bu=bu;
+	prefetch->regex=regex;
+	if(!(prefetch->manio=manio_open(manifest, "rb"))
+	  || !(prefetch->sb=sbuf_alloc()))
+		return -1;
+	while(ahead-- > 0 && !prefetch->finished)
+		prefetch_advance(prefetch);
+	return 0;
+}
+
+void prefetch_free(struct prefetch **prefetch)
+{
+	if(!prefetch || !*prefetch)
+		return;
+	manio_close(&(*prefetch)->manio);
+	sbuf_free(&(*prefetch)->sb);
+	free_v((void **)prefetch);
+}
@@ -0,0 +1,29 @@
+#ifndef _PREFETCH_H
+#define _PREFETCH_H
+
+#include "../regexp.h"
+
+struct bu;
+struct manio;
+struct sbuf;
+
+// Reads the manifest ahead of a restore or verify, and tells the kernel
+// which storage files are going to be wanted soon. The disk can then be
+// reading them while the current file is being sent.
+struct prefetch
+{
+	struct manio *manio;
+	struct sbuf *sb;
+	struct bu *bu;
+	regex_t *regex;
+	int finished;
+	uint64_t hinted; // Number of storage files hinted.
+};
+
+extern struct prefetch *prefetch_alloc(void);
+extern int prefetch_init(struct prefetch *prefetch,
+	const char *manifest, struct bu *bu, regex_t *regex, int ahead);
+extern void prefetch_advance(struct prefetch *prefetch);
+extern void prefetch_free(struct prefetch **prefetch);
+
+#endif
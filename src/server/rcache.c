@@ -0,0 +1,271 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../bu.h"
+#include "../fsops.h"
+#include "../log.h"
+#include "../prepend.h"
+#include "rcache.h"
+
+#include <utime.h>
+
+struct rcent
+{
+	char *path;
+	time_t mtime;
+	uint64_t size;
+};
+
+static char *rcache_dir=NULL;
+static uint64_t rcache_max=0;
+static uint64_t rcache_size=0;
+static struct rcent *ents=NULL;
+static size_t ents_len=0;
+static size_t ents_alloc=0;
+// The existing contents are only scanned when something is first added.
+static int scanned=0;
+
+static uint64_t hits=0;
+static uint64_t misses=0;
+static uint64_t stored=0;
+static uint64_t evicted=0;
+
+static int ent_add(const char *path, struct stat *statp)
+{
+	if(ents_len==ents_alloc)
+	{
+		struct rcent *tmp;
+		size_t n=ents_alloc?ents_alloc*2:64;
+		if(!(tmp=(struct rcent *)realloc_w(ents,
+			n*sizeof(struct rcent), __func__)))
+				return -1;
+		ents=tmp;
+		ents_alloc=n;
+	}
+	if(!(ents[ents_len].path=strdup_w(path, __func__)))
+		return -1;
+	ents[ents_len].mtime=statp->st_mtime;
+	ents[ents_len].size=(uint64_t)statp->st_size;
+	rcache_size+=ents[ents_len].size;
+	ents_len++;
+	return 0;
+}
+
+static void ents_free(void)
+{
+	size_t i;
+	for(i=0; i<ents_len; i++)
+		free_w(&ents[i].path);
+	free_v((void **)&ents);
+	ents_len=0;
+	ents_alloc=0;
+	rcache_size=0;
+}
+
+static int scan_dir(const char *dir)
+{
+	int ret=-1;
+	DIR *dirp=NULL;
+	char *path=NULL;
+	struct dirent *d;
+	struct stat statp;
+
+	if(!(dirp=opendir(dir)))
+		return 0; // Nothing cached yet.
+	while((d=readdir(dirp)))
+	{
+		if(!strcmp(d->d_name, ".")
+		  || !strcmp(d->d_name, ".."))
+			continue;
+		free_w(&path);
+		if(!(path=prepend_s(dir, d->d_name)))
+			goto end;
+		if(lstat(path, &statp))
+			continue;
+		if(S_ISDIR(statp.st_mode))
+		{
+			if(scan_dir(path))
+				goto end;
+		}
+		else if(S_ISREG(statp.st_mode))
+		{
+			if(ent_add(path, &statp))
+				goto end;
+		}
+	}
+	ret=0;
+end:
+	closedir(dirp);
+	free_w(&path);
+	return ret;
+}
+
+static int ent_cmp(const void *a, const void *b)
+{
+	const struct rcent *x=(const struct rcent *)a;
+	const struct rcent *y=(const struct rcent *)b;
+	if(x->mtime<y->mtime) return -1;
+	if(x->mtime>y->mtime) return 1;
+	return 0;
+}
+
+// Remove the least recently used entries until the cache is back down to
+// 90% of its maximum size, so that eviction does not happen on every add.
+static void evict(void)
+{
+	size_t i;
+	size_t j;
+	struct stat statp;
+	uint64_t target=rcache_max/10*9;
+
+	// Hits update the mtime of the files, so refresh them first.
+	rcache_size=0;
+	for(i=0, j=0; i<ents_len; i++)
+	{
+		if(lstat(ents[i].path, &statp) || !S_ISREG(statp.st_mode))
+		{
+			free_w(&ents[i].path);
+			continue;
+		}
+		ents[i].mtime=statp.st_mtime;
+		ents[i].size=(uint64_t)statp.st_size;
+		rcache_size+=ents[i].size;
+		ents[j++]=ents[i];
+	}
+	ents_len=j;
+
+	qsort(ents, ents_len, sizeof(struct rcent), ent_cmp);
+
+	for(i=0; i<ents_len && rcache_size>target; i++)
+	{
+		if(unlink(ents[i].path) && errno!=ENOENT)
+			logp("unlink %s: %s\n", ents[i].path, strerror(errno));
+		rcache_size-=ents[i].size;
+		free_w(&ents[i].path);
+		evicted++;
+	}
+	if(!i) return;
+	memmove(ents, ents+i, (ents_len-i)*sizeof(struct rcent));
+	ents_len-=i;
+
+	recursive_delete_dirs_only_no_warnings(rcache_dir);
+}
+
+int rcache_init(const char *dir, uint64_t max_size)
+{
+	rcache_free();
+	if(!max_size) return 0;
+	if(!(rcache_dir=strdup_w(dir, __func__)))
+		return -1;
+	rcache_max=max_size;
+	return 0;
+}
+
+void rcache_free(void)
+{
+	ents_free();
+	free_w(&rcache_dir);
+	rcache_max=0;
+	scanned=0;
+	hits=0;
+	misses=0;
+	stored=0;
+	evicted=0;
+}
+
+static char *get_path(const char *datapth, struct bu *bu)
+{
+	char *path=NULL;
+	char *dir=NULL;
+	if(!(dir=prepend_s(rcache_dir, bu->basename)))
+		return NULL;
+	path=prepend_s(dir, datapth);
+	free_w(&dir);
+	return path;
+}
+
+struct bu *rcache_get(const char *datapth,
+	struct bu *bu, struct bu *stop, const char *dest)
+{
+	struct bu *b;
+	char *path=NULL;
+
+	// Nothing to rebuild if the data directory is in bu.
+	if(!rcache_dir || bu==stop) return NULL;
+
+	unlink(dest);
+	for(b=bu; b && b!=stop; b=b->next)
+	{
+		free_w(&path);
+		if(!(path=get_path(datapth, b)))
+			break;
+		if(link(path, dest))
+			continue;
+		// Mark it as recently used.
+		utime(path, NULL);
+		free_w(&path);
+		hits++;
+		return b;
+	}
+	free_w(&path);
+	misses++;
+	return NULL;
+}
+
+// Failing to add to the cache is not fatal to the restore.
+void rcache_put(const char *datapth, struct bu *bu, const char *src)
+{
+	char *path=NULL;
+	struct stat statp;
+
+	if(!rcache_dir) return;
+
+	if(!scanned)
+	{
+		if(scan_dir(rcache_dir))
+			goto end;
+		scanned=1;
+	}
+
+	if(lstat(src, &statp)
+	  || !S_ISREG(statp.st_mode)
+	  || (uint64_t)statp.st_size>rcache_max)
+		goto end;
+
+	if(!(path=get_path(datapth, bu))
+	  || build_path_w(path))
+		goto end;
+	if(link(src, path))
+	{
+		if(errno!=EEXIST)
+			logp("could not link %s to %s: %s\n",
+				src, path, strerror(errno));
+		goto end;
+	}
+	if(ent_add(path, &statp))
+		goto end;
+	stored++;
+
+	if(rcache_size>rcache_max)
+		evict();
+end:
+	free_w(&path);
+}
+
+void rcache_log_stats(void)
+{
+	uint64_t lookups=hits+misses;
+	if(!rcache_dir || !lookups) return;
+	logp("Restore cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64
+		"%% hit rate, %" PRIu64 " added, %" PRIu64 " evicted\n",
+		hits, misses, hits*100/lookups, stored, evicted);
+}
+
+void rcache_delete_backup(const char *dir, struct bu *bu)
+{
+	char *path=NULL;
+	if(!(path=prepend_s(dir, bu->basename)))
+		return;
+	if(is_dir_lstat(path)>0)
+		recursive_delete(path);
+	free_w(&path);
+}
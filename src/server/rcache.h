@@ -0,0 +1,25 @@
+#ifndef _RCACHE_H
+#define _RCACHE_H
+
+#define RCACHE_DIR	"restore_cache"
+
+struct bu;
+
+// On disk cache of files that have been rebuilt from reverse deltas during
+// a restore or verify. Entries are keyed by data path and backup, and are
+// stored under <client>/restore_cache/<backup>/<datapth>. When the total
+// size goes over the limit, the least recently used entries are removed.
+extern int rcache_init(const char *dir, uint64_t max_size);
+extern void rcache_free(void);
+
+// Look for the file in bu and the newer backups up to, but not including,
+// stop. On a hit, the cached file is hard linked to dest and the backup
+// that it came from is returned.
+extern struct bu *rcache_get(const char *datapth,
+	struct bu *bu, struct bu *stop, const char *dest);
+extern void rcache_put(const char *datapth, struct bu *bu, const char *src);
+extern void rcache_log_stats(void);
+
+extern void rcache_delete_backup(const char *dir, struct bu *bu);
+
+#endif
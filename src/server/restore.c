@@ -20,6 +20,8 @@
 #include "child.h"
 #include "compress.h"
 #include "manio.h"
+#include "prefetch.h"
+#include "rcache.h"
 #include "restore_sbuf.h"
 #include "rubble.h"
 #include "sdirs.h"
@@ -419,6 +421,8 @@ static int restore_stream(struct asfd *asfd, struct sdirs *sdirs,
 	struct iobuf interrupt;
 	struct fzp *rl_fzp=NULL;
 	struct iobuf *rl_iobuf=NULL;
+	struct prefetch *prefetch=NULL;
+	int ahead=get_int(cconfs[OPT_RESTORE_PREFETCH]);
 
 	iobuf_init(&interrupt);
 
@@ -429,6 +433,15 @@ static int restore_stream(struct asfd *asfd, struct sdirs *sdirs,
 	  || !(sb=sbuf_alloc()))
 		goto end;
 
+	// The restore list and srestore includes cannot be checked out of
+	// sequence, so do not prefetch when they are in use.
+	if(ahead && !rl_fzp && !srestore)
+	{
+		if(!(prefetch=prefetch_alloc())
+		  || prefetch_init(prefetch, manifest, bu, regex, ahead))
+			goto end;
+	}
+
 	while(1)
 	{
 		iobuf_free_content(rbuf);
@@ -462,6 +475,7 @@ static int restore_stream(struct asfd *asfd, struct sdirs *sdirs,
 			case 1: ret=0; goto end; // Finished OK.
 			default: goto end; // Error;
 		}
+		prefetch_advance(prefetch);
 
 		if(want_to_restore(asfd, srestore, rl_fzp, rl_iobuf,
 			sb, regex, act, cconfs))
@@ -487,6 +501,10 @@ static int restore_stream(struct asfd *asfd, struct sdirs *sdirs,
 		sbuf_free_content(sb);
 	}
 end:
+	if(prefetch)
+		logp("Prefetched %" PRIu64 " storage files\n",
+			prefetch->hinted);
+	prefetch_free(&prefetch);
 	iobuf_free(&rl_iobuf);
 	fzp_close(&rl_fzp);
 	sbuf_free(&sb);
@@ -507,6 +525,8 @@ static int actual_restore(struct asfd *asfd, struct bu *bu,
 	struct cntr *cntr=NULL;
 
 	if(linkhash_init()
+	  || rcache_init(sdirs->rcache, cconfs?
+		get_uint64_t(cconfs[OPT_RESTORE_CACHE_MAX_SIZE]):0)
 	  || !(slist=slist_alloc()))
 		goto end;
 
@@ -523,10 +543,13 @@ static int actual_restore(struct asfd *asfd, struct bu *bu,
 	cntr_print(cntr, act);
 	if(cntr_stats_to_file(cntr, bu->path, act))
 		goto end;
+	rcache_log_stats();
+	asfd_log_write_stats(asfd);
 	ret=0;
 end:
 	slist_free(&slist);
 	linkhash_free();
+	rcache_free();
 	return ret;
 }
 
@@ -16,7 +16,9 @@
 #include "../server/zlibio.h"
 #include "../sbuf.h"
 #include "../slist.h"
+#include "chunks.h"
 #include "dpth.h"
+#include "rcache.h"
 #include "sdirs.h"
 #include "restore_sbuf.h"
 
@@ -265,6 +267,7 @@ static int process_data_dir_file(struct asfd *asfd,
 	int patches=0;
 	char *dpath=NULL;
 	struct stat dstatp;
+	struct bu *hit=NULL;
 	const char *tmp=NULL;
 	const char *best=NULL;
 	static char *tmppath1=NULL;
@@ -278,6 +281,30 @@ static int process_data_dir_file(struct asfd *asfd,
 
 	best=path;
 	tmp=tmppath1;
+	if((hit=rcache_get(sb->datapth.buf, bu, b, tmp)))
+	{
+		// An earlier restore already rebuilt this file for a backup
+		// between here and the data directory. Carry on from there.
+		// The cached file is not gzipped.
+		best=tmp;
+		tmp=tmppath2;
+		patches++;
+		b=hit;
+	}
+	else if(sdirs && chunks_is_recipe(sdirs_get_chunks(sdirs), path)>0)
+	{
+		// The file is in the chunk store. Like a cached file, it comes
+		// back not gzipped.
+		if(chunks_rebuild(sdirs->chunks, path, tmp))
+		{
+			logw(asfd, cntr, "problem when rebuilding %s\n", path);
+			ret=0;
+			goto end;
+		}
+		best=tmp;
+		tmp=tmppath2;
+		patches++;
+	}
 	// Now go down the list, applying any deltas.
 	for(b=b->prev; b && b->next!=bu; b=b->prev)
 	{
@@ -312,6 +339,7 @@ static int process_data_dir_file(struct asfd *asfd,
 			ret=0;
 			goto end;
 		}
+		rcache_put(sb->datapth.buf, b, tmp);
 
 		best=tmp;
 		if(tmp==tmppath1) tmp=tmppath2;
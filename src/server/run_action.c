@@ -11,6 +11,7 @@
 #include "../log.h"
 #include "../regexp.h"
 #include "../run_script.h"
+#include "../uring.h"
 #include "main.h"
 #include "backup.h"
 #include "delete.h"
@@ -595,9 +596,12 @@ int run_action_server(struct async *as,
 	int ret=-1;
         struct sdirs *sdirs=NULL;
         if((sdirs=sdirs_alloc())
-          && !sdirs_init_from_confs(sdirs, cconfs))
+          && !sdirs_init_from_confs(sdirs, cconfs)
+	  && !uring_init(get_int(cconfs[OPT_IO_URING_DEPTH])))
 		ret=run_action_server_do(as,
 			sdirs, incexc, srestore, timer_ret, cconfs);
+	uring_log_stats();
+	uring_free();
         if(sdirs) lock_release(sdirs->lock_storage_for_write);
         sdirs_free(&sdirs);
 	return ret;
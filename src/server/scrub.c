@@ -0,0 +1,506 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../async.h"
+#include "../bu.h"
+#include "../cmd.h"
+#include "../conf.h"
+#include "../conffile.h"
+#include "../fsops.h"
+#include "../fzp.h"
+#include "../handy.h"
+#include "../hexmap.h"
+#include "../lock.h"
+#include "../log.h"
+#include "../md5.h"
+#include "../prepend.h"
+#include "../sbuf.h"
+#include "../times.h"
+#include "bu_get.h"
+#include "chunks.h"
+#include "manio.h"
+#include "sdirs.h"
+#include "scrub.h"
+
+#define STATS_PREFIX	"stats "
+
+struct scrub
+{
+	struct sdirs *sdirs;
+	struct bu *bu;
+	struct md5 *md5;
+	struct fzp *report;
+	// Bytes a second for this process, or 0 for no limit.
+	uint64_t rate;
+	uint64_t read;
+	struct timeval start;
+	struct scrub_stats stats;
+};
+
+static uint64_t usecs_since(struct timeval *start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (uint64_t)(now.tv_sec-start->tv_sec)*1000000
+		+now.tv_usec-start->tv_usec;
+}
+
+// Sleeps for as long as the reading is ahead of the rate limit.
+static void throttle(struct scrub *s, size_t len)
+{
+	uint64_t due;
+	uint64_t elapsed;
+	s->read+=len;
+	if(!s->rate) return;
+	due=s->read*1000000/s->rate;
+	elapsed=usecs_since(&s->start);
+	if(due>elapsed)
+		usleep((useconds_t)(due-elapsed));
+}
+
+static int add_to_md5(void *arg, const uint8_t *buf, size_t len)
+{
+	struct scrub *s=(struct scrub *)arg;
+	if(!md5_update(s->md5, buf, len))
+	{
+		logp("md5_update() failed\n");
+		return -1;
+	}
+	throttle(s, len);
+	return 0;
+}
+
+static int read_only(void *arg, const uint8_t *buf, size_t len)
+{
+	throttle((struct scrub *)arg, len);
+	return 0;
+}
+
+// Returns 0 if the whole file could be read, or -1 if not.
+static int stream_file(struct scrub *s, const char *path, int gz,
+	int (*fn)(void *arg, const uint8_t *buf, size_t len))
+{
+	int got;
+	int ret=-1;
+	struct fzp *fzp=NULL;
+	uint8_t buf[ZCHUNK];
+
+	if(gz) fzp=fzp_gzopen(path, "rb");
+	else fzp=fzp_open(path, "rb");
+	if(!fzp)
+		return -1;
+	while((got=fzp_read(fzp, buf, sizeof(buf)))>0)
+		if(fn(s, buf, (size_t)got))
+			goto end;
+	if(got<0 || !fzp_eof(fzp) || fzp_error(fzp))
+		goto end;
+	ret=0;
+end:
+	fzp_close(&fzp);
+	return ret;
+}
+
+static int report(struct scrub *s, const char *what, struct sbuf *sb)
+{
+	logp("%s: %s (%s)\n", what,
+		iobuf_to_printable(&sb->path),
+		iobuf_to_printable(&sb->datapth));
+	if(!strcmp(what, "missing")) s->stats.missing++;
+	else s->stats.corrupt++;
+	if(fzp_printf(s->report, "%s %s\n", what, sb->datapth.buf)<0)
+		return -1;
+	return 0;
+}
+
+static int check_data(struct scrub *s, struct sbuf *sb, const char *path)
+{
+	int r;
+	const char *sum=NULL;
+	uint64_t before=s->read;
+	uint8_t checksum[MD5_DIGEST_LENGTH];
+
+	if(sb->endfile.buf
+	  && (sum=strrchr(sb->endfile.buf, ':')))
+		sum++;
+	if(!md5_init(s->md5))
+	{
+		logp("md5_init() failed\n");
+		return -1;
+	}
+	// The md5sum is of what the client sent, so encrypted files are
+	// read as they are stored, and the rest are decompressed on the way.
+	if(chunks_is_recipe(sdirs_get_chunks(s->sdirs), path)>0)
+		r=chunks_read(s->sdirs->chunks, path, add_to_md5, s);
+	else
+		r=stream_file(s, path,
+			!sbuf_is_encrypted(sb)
+			  && dpth_is_compressed(sb->compression, path),
+			add_to_md5);
+	if(r)
+		return report(s, "unreadable", sb);
+	if(!sum)
+	{
+		s->stats.partial++;
+		return 0;
+	}
+	if(!md5_final(s->md5, checksum))
+	{
+		logp("md5_final() failed\n");
+		return -1;
+	}
+	if(strcmp(bytes_to_md5str(checksum), sum))
+		return report(s, "corrupt", sb);
+	s->stats.files++;
+	s->stats.bytes+=s->read-before;
+	return 0;
+}
+
+// The file is only in the data directory of a newer backup, and is got back
+// by applying the reverse deltas between there and this backup. Rebuilding
+// it would need temporary files, so just make sure that each delta that a
+// restore would use can be read. The newer data gets checked when that
+// backup is scrubbed.
+static int check_deltas(struct scrub *s, struct sbuf *sb, struct bu *b)
+{
+	int ret=0;
+	char *dpath=NULL;
+
+	for(b=b->prev; b && b->next!=s->bu; b=b->prev)
+	{
+		free_w(&dpath);
+		if(!(dpath=prepend_s(b->delta, sb->datapth.buf)))
+			return -1;
+		if(is_reg_lstat(dpath)<=0)
+			continue;
+		if(stream_file(s, dpath, 1, read_only))
+		{
+			ret=report(s, "unreadable", sb);
+			goto end;
+		}
+	}
+	s->stats.partial++;
+end:
+	free_w(&dpath);
+	return ret;
+}
+
+static int scrub_entry(struct scrub *s, struct sbuf *sb)
+{
+	int ret=-1;
+	struct bu *b;
+	char *path=NULL;
+
+	// Go up the list until the file is found in a data directory, in
+	// the same way as a restore.
+	for(b=s->bu; b; b=b->next)
+	{
+		free_w(&path);
+		if(!(path=prepend_s(b->data, sb->datapth.buf)))
+			goto end;
+		if(is_reg_lstat(path)>0)
+			break;
+	}
+	if(!b)
+		ret=report(s, "missing", sb);
+	else if(b==s->bu)
+		ret=check_data(s, sb, path);
+	else
+		ret=check_deltas(s, sb, b);
+end:
+	free_w(&path);
+	return ret;
+}
+
+// Scrubs every workers'th file in the manifest, starting at the given one.
+static int scrub_part(struct scrub *s, const char *manifest,
+	int worker, int workers)
+{
+	int ret=-1;
+	uint64_t i=0;
+	struct sbuf *sb=NULL;
+	struct manio *manio=NULL;
+
+	gettimeofday(&s->start, NULL);
+	if(!(manio=manio_open(manifest, "rb"))
+	  || !(sb=sbuf_alloc())
+	  || !(s->md5=md5_alloc(__func__)))
+		goto end;
+
+	while(1)
+	{
+		switch(manio_read(manio, sb))
+		{
+			case 0: break;
+			case 1: ret=0; goto end;
+			default: goto end;
+		}
+		if((sbuf_is_filedata(sb) || sbuf_is_vssdata(sb))
+		  && sb->datapth.buf
+		  && i++%workers==(uint64_t)worker
+		  && scrub_entry(s, sb))
+			goto end;
+		sbuf_free_content(sb);
+	}
+end:
+	md5_free(&s->md5);
+	sbuf_free(&sb);
+	manio_close(&manio);
+	return ret;
+}
+
+static void stats_add(struct scrub_stats *dst, struct scrub_stats *src)
+{
+	dst->files+=src->files;
+	dst->bytes+=src->bytes;
+	dst->partial+=src->partial;
+	dst->corrupt+=src->corrupt;
+	dst->missing+=src->missing;
+}
+
+static char *part_path(const char *report, int worker)
+{
+	char suffix[32];
+	char *path=NULL;
+	snprintf(suffix, sizeof(suffix), ".%d", worker);
+	if(astrcat(&path, report, __func__)
+	  || astrcat(&path, suffix, __func__))
+	{
+		free_w(&path);
+		return NULL;
+	}
+	return path;
+}
+
+// This runs in the child. The counts go at the end of its part of the
+// report, for the parent to pick up.
+static int run_worker(struct scrub *s, const char *manifest,
+	const char *part, int worker, int workers)
+{
+	int ret=-1;
+	if(!(s->report=fzp_open(part, "wb")))
+		return -1;
+	if(!scrub_part(s, manifest, worker, workers)
+	  && fzp_printf(s->report, STATS_PREFIX "%" PRIu64 " %" PRIu64
+		" %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+		s->stats.files, s->stats.bytes, s->stats.partial,
+		s->stats.corrupt, s->stats.missing)>0)
+			ret=0;
+	if(fzp_close(&s->report))
+		ret=-1;
+	return ret;
+}
+
+static int merge_part(struct fzp *out, const char *part,
+	struct scrub_stats *stats)
+{
+	int ret=-1;
+	int got_stats=0;
+	char buf[4096];
+	struct fzp *fzp=NULL;
+	struct scrub_stats st;
+
+	if(!(fzp=fzp_open(part, "rb")))
+		return -1;
+	while(fzp_gets(fzp, buf, sizeof(buf)))
+	{
+		if(strncmp(buf, STATS_PREFIX, strlen(STATS_PREFIX)))
+		{
+			if(fzp_printf(out, "%s", buf)<0)
+				goto end;
+			continue;
+		}
+		if(sscanf(buf+strlen(STATS_PREFIX), "%" SCNu64 " %" SCNu64
+			" %" SCNu64 " %" SCNu64 " %" SCNu64,
+			&st.files, &st.bytes, &st.partial,
+			&st.corrupt, &st.missing)!=5)
+				goto end;
+		stats_add(stats, &st);
+		got_stats=1;
+	}
+	if(got_stats) ret=0;
+end:
+	fzp_close(&fzp);
+	unlink(part);
+	return ret;
+}
+
+static int scrub_in_workers(struct scrub *s, const char *manifest,
+	const char *report, struct fzp *out, int workers)
+{
+	int i;
+	int ret=0;
+	int status;
+	pid_t *pids=NULL;
+	char *part=NULL;
+
+	if(!(pids=(pid_t *)calloc_w(workers, sizeof(pid_t), __func__)))
+		return -1;
+	if(s->rate)
+		s->rate=s->rate/workers?s->rate/workers:1;
+	for(i=0; i<workers; i++)
+	{
+		free_w(&part);
+		if(!(part=part_path(report, i)))
+		{
+			ret=-1;
+			break;
+		}
+		switch((pids[i]=fork()))
+		{
+			case -1:
+				logp("fork failed in %s: %s\n",
+					__func__, strerror(errno));
+				ret=-1;
+				break;
+			case 0:
+				// Child. Do not run any exit handlers.
+				_exit(run_worker(s, manifest, part,
+					i, workers)?1:0);
+			default:
+				continue;
+		}
+		break;
+	}
+	// Wait for all that were started, even if there was a problem.
+	for(i=0; i<workers && pids[i]>0; i++)
+	{
+		if(waitpid(pids[i], &status, 0)<0
+		  || !WIFEXITED(status)
+		  || WEXITSTATUS(status))
+		{
+			logp("scrub worker %d failed\n", i);
+			ret=-1;
+		}
+		free_w(&part);
+		if(!(part=part_path(report, i))
+		  || merge_part(out, part, &s->stats))
+			ret=-1;
+	}
+	free_w(&part);
+	free_v((void **)&pids);
+	return ret;
+}
+
+int scrub_backup(struct sdirs *sdirs, struct bu *bu,
+	int workers, uint64_t max_rate, struct scrub_stats *stats)
+{
+	int ret=-1;
+	char *manifest=NULL;
+	char *report=NULL;
+	struct scrub s;
+
+	memset(&s, 0, sizeof(s));
+	s.sdirs=sdirs;
+	s.bu=bu;
+	s.rate=max_rate;
+	if(workers<1) workers=1;
+
+	if(!(manifest=prepend_s(bu->path, "manifest.gz"))
+	  || !(report=prepend_s(bu->path, SCRUB_REPORT))
+	  || !(s.report=fzp_open(report, "wb")))
+		goto end;
+
+	if(workers==1)
+		ret=scrub_part(&s, manifest, 0, 1);
+	else
+		ret=scrub_in_workers(&s, manifest, report, s.report, workers);
+	if(fzp_close(&s.report))
+		ret=-1;
+end:
+	fzp_close(&s.report);
+	memcpy(stats, &s.stats, sizeof(*stats));
+	free_w(&manifest);
+	free_w(&report);
+	return ret;
+}
+
+static int scrub_backups(struct sdirs *sdirs, struct conf **cconfs,
+	const char *backup)
+{
+	int ret=0;
+	int found=0;
+	struct bu *bu=NULL;
+	struct bu *bu_list=NULL;
+	unsigned long bno=0;
+	struct scrub_stats stats;
+	int workers=get_int(cconfs[OPT_SCRUB_WORKERS]);
+	uint64_t max_rate=get_uint64_t(cconfs[OPT_SCRUB_MAX_RATE]);
+
+	if(backup && *backup && *backup!='a')
+		bno=strtoul(backup, NULL, 10);
+	if(bu_get_list(sdirs, &bu_list))
+		return -1;
+	for(bu=bu_list; bu; bu=bu->next)
+	{
+		time_t start;
+		if(bno && bu->bno!=bno)
+			continue;
+		found=1;
+		start=time(NULL);
+		logp("Scrubbing backup %" PRIu64 " %s\n",
+			bu->bno, bu->timestamp);
+		if(scrub_backup(sdirs, bu, workers, max_rate, &stats))
+		{
+			ret=-1;
+			break;
+		}
+		logp("%" PRIu64 " files checked, %" PRIu64 " bytes read, %"
+			PRIu64 " partly checked, %" PRIu64 " corrupt, %"
+			PRIu64 " missing, %s\n",
+			stats.files, stats.bytes, stats.partial,
+			stats.corrupt, stats.missing,
+			time_taken(time(NULL)-start));
+		if(stats.corrupt || stats.missing)
+		{
+			logp("Problems are listed in %s/%s\n",
+				bu->path, SCRUB_REPORT);
+			ret=1;
+		}
+	}
+	if(!found)
+	{
+		logp("backup not found\n");
+		ret=-1;
+	}
+	bu_list_free(&bu_list);
+	return ret;
+}
+
+int run_scrub(struct conf **globalcs, const char *cname, const char *backup)
+{
+	int ret=-1;
+	struct sdirs *sdirs=NULL;
+	struct conf **cconfs=NULL;
+
+	if(!cname || !*cname)
+	{
+		logp("Scrub needs a client name, given with '-C'.\n");
+		return -1;
+	}
+	if(!(cconfs=confs_alloc())
+	  || confs_init(cconfs)
+	  || set_string(cconfs[OPT_CNAME], cname)
+	  || conf_load_clientconfdir(globalcs, cconfs)
+	  || !(sdirs=sdirs_alloc())
+	  || sdirs_init_from_confs(sdirs, cconfs))
+		goto end;
+
+	// Keep backups and deletes out of the way.
+	if(mkpath(&sdirs->lock_storage_for_write->path, sdirs->lockdir))
+		goto end;
+	lock_get(sdirs->lock_storage_for_write);
+	if(sdirs->lock_storage_for_write->status!=GET_LOCK_GOT)
+	{
+		logp("Could not get %s for %s. Another process is probably "
+			"running.\n", sdirs->lock_storage_for_write->path,
+			cname);
+		goto end;
+	}
+
+	ret=scrub_backups(sdirs, cconfs, backup);
+end:
+	if(sdirs)
+		lock_release(sdirs->lock_storage_for_write);
+	sdirs_free(&sdirs);
+	confs_free(&cconfs);
+	return ret;
+}
@@ -0,0 +1,34 @@
+#ifndef _SCRUB_H
+#define _SCRUB_H
+
+#define SCRUB_REPORT	"scrub_report"
+
+struct scrub_stats
+{
+	// Files whose md5sum was checked against the manifest.
+	uint64_t files;
+	uint64_t bytes;
+	// Files that only exist as reverse deltas from a newer backup, or
+	// that have no md5sum. Only the readability of what is stored for
+	// them is checked.
+	uint64_t partial;
+	uint64_t corrupt;
+	uint64_t missing;
+};
+
+// Checks the stored data of every file in the manifest of a backup against
+// the md5sums that the client sent, without a client connection or any
+// temporary files. The work is split between the given number of processes,
+// which between them read no more than max_rate bytes a second, if set.
+// Problems are listed in <backup>/scrub_report, one datapth per line.
+// Returns 0 if the scrub ran, whether or not it found problems, or -1 on
+// error.
+extern int scrub_backup(struct sdirs *sdirs, struct bu *bu,
+	int workers, uint64_t max_rate, struct scrub_stats *stats);
+
+// Scrubs the backups of a client from the command line. Returns 0 if
+// everything was fine, 1 if problems were found, or -1 on error.
+extern int run_scrub(struct conf **globalcs,
+	const char *cname, const char *backup);
+
+#endif
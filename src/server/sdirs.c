@@ -6,6 +6,9 @@
 #include "../lock.h"
 #include "../log.h"
 #include "../prepend.h"
+#include "chunks.h"
+#include "ingest_dedup.h"
+#include "rcache.h"
 #include "timestamp.h"
 
 #define RELINK_DIR	"relink"
@@ -55,6 +58,20 @@ int sdirs_get_real_manifest(struct sdirs *sdirs)
 		sdirs->rworking, "manifest.gz");
 }
 
+// Only looked for once, because recipes can only be in backups that were
+// made after the store was created. If it is created later on, the files
+// that this process reads are still not recipes.
+const char *sdirs_get_chunks(struct sdirs *sdirs)
+{
+	if(!sdirs->chunks_looked_for)
+	{
+		// On error, look at each file anyway, so that it gets noticed.
+		sdirs->chunks_exist=chunks_store_exists(sdirs->chunks)!=0;
+		sdirs->chunks_looked_for=1;
+	}
+	return sdirs->chunks_exist?sdirs->chunks:NULL;
+}
+
 int sdirs_get_real_working_from_symlink(struct sdirs *sdirs)
 {
 	char real[256]="";
@@ -130,9 +147,13 @@ static int do_common_dirs(struct sdirs *sdirs, const char *manual_delete)
 	  || !(sdirs->phase1data=prepend_s(sdirs->working, "phase1.gz"))
 	  || !(sdirs->changed=prepend_s(sdirs->working, "changed"))
 	  || !(sdirs->unchanged=prepend_s(sdirs->working, "unchanged"))
+	  || !(sdirs->unchangedlist=prepend_s(sdirs->working,
+		UNCHANGED_LIST))
 	  || !(sdirs->counters_d=prepend_s(sdirs->working, "counters_d"))
 	  || !(sdirs->counters_n=prepend_s(sdirs->working, "counters_n"))
-	  || !(sdirs->restore_list=prepend_s(sdirs->client, "restore_list")))
+	  || !(sdirs->restore_list=prepend_s(sdirs->client, "restore_list"))
+	  || !(sdirs->rcache=prepend_s(sdirs->client, RCACHE_DIR))
+	  || !(sdirs->chunks=prepend_s(sdirs->client, CHUNKS_DIR)))
 		return -1;
 	if(manual_delete)
 	{
@@ -166,6 +187,19 @@ static int do_dirs(struct sdirs *sdirs, const char *cname,
 	return 0;
 }
 
+static int do_ingest_dedup_dir(struct sdirs *sdirs, const char *dedup_group)
+{
+	int ret=0;
+	char *tmp=NULL;
+	if(!dedup_group)
+		return 0;
+	if(!(tmp=prepend_s(sdirs->base, INGEST_DEDUP_DIR))
+	  || !(sdirs->ingest_dedup=prepend_s(tmp, dedup_group)))
+		ret=-1;
+	free_w(&tmp);
+	return ret;
+}
+
 int sdirs_init_from_confs_plus_cname(
 	struct sdirs *sdirs,
 	struct conf **confs,
@@ -205,7 +239,8 @@ int sdirs_init(struct sdirs *sdirs,
 	if(!(sdirs->base=strdup_w(directory, __func__)))
 		goto error;
 
-	if(do_dirs(sdirs, cname, manual_delete))
+	if(do_dirs(sdirs, cname, manual_delete)
+	  || do_ingest_dedup_dir(sdirs, dedup_group))
 		goto error;
 
 	if(do_lock_dirs(sdirs, cname, conf_lockdir)) goto error;
@@ -242,6 +277,7 @@ void sdirs_free_content(struct sdirs *sdirs)
 	free_w(&sdirs->timestamp);
 	free_w(&sdirs->changed);
 	free_w(&sdirs->unchanged);
+	free_w(&sdirs->unchangedlist);
 	free_w(&sdirs->counters_d);
 	free_w(&sdirs->counters_n);
 	free_w(&sdirs->manifest);
@@ -250,6 +286,9 @@ void sdirs_free_content(struct sdirs *sdirs)
 	free_w(&sdirs->phase1data);
 
 	free_w(&sdirs->restore_list);
+	free_w(&sdirs->rcache);
+	free_w(&sdirs->chunks);
+	free_w(&sdirs->ingest_dedup);
 
 	free_w(&sdirs->lockdir);
 	lock_free(&sdirs->lock_storage_for_write);
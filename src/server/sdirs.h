@@ -3,6 +3,7 @@
 
 #define TREE_DIR	"t"
 #define DATA_DIR	"data"
+#define UNCHANGED_LIST	"unchanged.list"
 
 #include "../conf.h"
 
@@ -34,6 +35,7 @@ struct sdirs
 	char *timestamp;
 	char *changed;
 	char *unchanged;
+	char *unchangedlist; // Data paths that phase4 can just link.
 	char *counters_d; // file data entries
 	char *counters_n; // non file data entries
 	char *manifest; // Path to manifest (via working).
@@ -42,6 +44,11 @@ struct sdirs
 	char *phase1data;
 
 	char *restore_list; // For restore file lists from the client.
+	char *rcache; // For files rebuilt from reverse deltas.
+	char *chunks; // For the chunk store.
+	int chunks_looked_for;
+	int chunks_exist;
+	char *ingest_dedup; // Index shared by the dedup_group.
 
 	char *lockdir;
 	// For backup/delete, lock all storage directories for other
@@ -75,4 +82,7 @@ extern int sdirs_create_real_working(struct sdirs *sdirs, uint64_t bno,
 	const char *timestamp_format);
 extern int sdirs_get_real_working_from_symlink(struct sdirs *sdirs);
 
+// Returns the chunk store, or NULL if there is not one.
+extern const char *sdirs_get_chunks(struct sdirs *sdirs);
+
 #endif
@@ -0,0 +1,106 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../conf.h"
+#include "../fsops.h"
+#include "../log.h"
+#include "../prepend.h"
+#include "sigcache.h"
+
+#include <librsync.h>
+
+// Signatures made with different hashes cannot be mixed up. Older
+// versions of librsync only do md4.
+static const char *rshash_name(struct conf **cconfs)
+{
+#ifndef RS_DEFAULT_STRONG_LEN
+	if(get_e_rshash(cconfs[OPT_RSHASH])==RSHASH_BLAKE2)
+		return rshash_to_str(RSHASH_BLAKE2);
+#else
+	(void)cconfs;
+#endif
+	return rshash_to_str(RSHASH_MD4);
+}
+
+static char *get_dir(const char *backupdir, struct conf **cconfs)
+{
+	char *dir;
+	char *path;
+	if(!(dir=prepend_s(backupdir, SIGS_DIR)))
+		return NULL;
+	path=prepend_s(dir, rshash_name(cconfs));
+	free_w(&dir);
+	return path;
+}
+
+char *sigcache_path(const char *backupdir, struct conf **cconfs,
+	const char *datapth)
+{
+	char *dir;
+	char *path;
+	if(!(dir=get_dir(backupdir, cconfs)))
+		return NULL;
+	path=prepend_s(dir, datapth);
+	free_w(&dir);
+	return path;
+}
+
+struct sigcache *sigcache_alloc(void)
+{
+	return (struct sigcache *)
+		calloc_w(1, sizeof(struct sigcache), __func__);
+}
+
+int sigcache_init(struct sigcache *sc, const char *oldbackupdir,
+	const char *newbackupdir, struct conf **cconfs)
+{
+	if(!(sc->olddir=get_dir(oldbackupdir, cconfs))
+	  || !(sc->newdir=get_dir(newbackupdir, cconfs)))
+		return -1;
+	return 0;
+}
+
+void sigcache_free(struct sigcache **sc)
+{
+	if(!sc || !*sc) return;
+	free_w(&(*sc)->olddir);
+	free_w(&(*sc)->newdir);
+	free_v((void **)sc);
+}
+
+// Returns the path for a new signature, with its directory created.
+char *sigcache_new_path(struct sigcache *sc, const char *datapth)
+{
+	char *path;
+	if(!(path=prepend_s(sc->newdir, datapth)))
+		return NULL;
+	if(build_path_w(path))
+		free_w(&path);
+	return path;
+}
+
+// An unchanged file is moving into the new backup. Its signature is still
+// good, so take that along too.
+void sigcache_move(struct sigcache *sc, const char *datapth)
+{
+	char *oldpath=NULL;
+	char *newpath=NULL;
+	struct stat statp;
+
+	if(!(oldpath=prepend_s(sc->olddir, datapth))
+	  || lstat(oldpath, &statp)
+	  || !S_ISREG(statp.st_mode)
+	  || !(newpath=sigcache_new_path(sc, datapth)))
+		goto end;
+	do_rename(oldpath, newpath);
+end:
+	free_w(&oldpath);
+	free_w(&newpath);
+}
+
+// Only the signatures in the current backup ever get used, so whatever is
+// left in the previous backup can go.
+void sigcache_tidy(struct sigcache *sc)
+{
+	if(is_dir_lstat(sc->olddir)>0)
+		recursive_delete(sc->olddir);
+}
@@ -0,0 +1,30 @@
+#ifndef _SIGCACHE_H
+#define _SIGCACHE_H
+
+#define SIGS_DIR	"sigs"
+
+struct conf;
+
+// librsync signatures of stored files, kept next to the data at
+// <backup>/sigs/<rshash>/<datapth>. They get made in phase4 when a changed
+// file is patched, follow unchanged files into the next backup, and are
+// sent to the client in phase2 instead of reading the whole file again.
+struct sigcache
+{
+	char *olddir; // In the previous backup.
+	char *newdir; // In the backup being finished.
+};
+
+extern char *sigcache_path(const char *backupdir, struct conf **cconfs,
+	const char *datapth);
+
+extern struct sigcache *sigcache_alloc(void);
+extern int sigcache_init(struct sigcache *sc, const char *oldbackupdir,
+	const char *newbackupdir, struct conf **cconfs);
+extern void sigcache_free(struct sigcache **sc);
+
+extern char *sigcache_new_path(struct sigcache *sc, const char *datapth);
+extern void sigcache_move(struct sigcache *sc, const char *datapth);
+extern void sigcache_tidy(struct sigcache *sc);
+
+#endif
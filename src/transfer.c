@@ -86,6 +86,41 @@ static int do_inflate(struct asfd *asfd,
 	return 0;
 }
 
+// Frames can be bigger than the decryption buffer, so they are decrypted
+// a piece at a time, leaving room for the cipher to hand back a block
+// more than it was given.
+static int decrypt_and_inflate(struct asfd *asfd, EVP_CIPHER_CTX *enc_ctx,
+	z_stream *zstrm, struct BFILE *bfd, uint8_t *out,
+	uint8_t *doutbuf, size_t doutbuflen,
+	uint8_t *inbuf, size_t inlen,
+	char **metadata, const char *encpassword, int enccompressed,
+	uint64_t *sent)
+{
+	int doutlen=0;
+	size_t piece;
+	size_t maxpiece=doutbuflen-EVP_MAX_BLOCK_LENGTH;
+
+	while(inlen)
+	{
+		piece=inlen<maxpiece?inlen:maxpiece;
+		if(!EVP_CipherUpdate(enc_ctx,
+			doutbuf, &doutlen, inbuf, (int)piece))
+		{
+			logp("Decryption error\n");
+			return -1;
+		}
+		inbuf+=piece;
+		inlen-=piece;
+		if(!doutlen)
+			continue;
+		if(do_inflate(asfd, zstrm, bfd, out,
+			doutbuf, (size_t)doutlen, metadata,
+			encpassword, enccompressed, sent))
+				return -1;
+	}
+	return 0;
+}
+
 #ifdef HAVE_WIN32
 
 struct winbuf
@@ -202,9 +237,14 @@ int transfer_gzfile_inl(struct asfd *asfd,
 		return -1;
 	}
 
+	// The data is used straight away, so there is no need for a copy
+	// of each piece of it.
+	asfd->rbuf_views=1;
+	asfd->rbuf_view_cmd=CMD_APPEND;
+
 	while(!quit)
 	{
-		iobuf_free_content(rbuf);
+		asfd_free_rbuf(asfd);
 		if(asfd->read(asfd))
 		{
 			if(enc_ctx)
@@ -214,6 +254,7 @@ int transfer_gzfile_inl(struct asfd *asfd,
 				enc_ctx=NULL;
 			}
 			inflateEnd(&zstrm);
+			asfd->rbuf_views=0;
 			return -1;
 		}
 		(*rcvd)+=rbuf->len;
@@ -228,41 +269,28 @@ int transfer_gzfile_inl(struct asfd *asfd,
 					  "append with no file or metadata");
 					quit++; ret=-1;
 				}
-				else
+				else if(enc_ctx)
 				{
-					size_t lentouse;
-					uint8_t *buftouse=NULL;
 					// If doing decryption, it needs
 					// to be done before uncompressing.
-					if(enc_ctx)
-					{
-					  // updating our checksum needs to
-					  // be done first
-					  if(!EVP_CipherUpdate(enc_ctx,
-						doutbuf, &doutlen,
-						(uint8_t *)rbuf->buf,
-						rbuf->len))
-					  {
-						logp("Decryption error\n");
-						quit++; ret=-1;
-					  	break;
-					  }
-					  if(!doutlen) break;
-					  lentouse=(size_t)doutlen;
-					  buftouse=doutbuf;
-					}
-					else
+					if(decrypt_and_inflate(asfd, enc_ctx,
+						&zstrm, bfd, out,
+						doutbuf, sizeof(doutbuf),
+						(uint8_t *)rbuf->buf, rbuf->len,
+						metadata, encpassword,
+						enccompressed, sent))
 					{
-					  lentouse=rbuf->len;
-					  buftouse=(uint8_t *)rbuf->buf;
+						ret=-1; quit++;
 					}
+				}
+				else
+				{
 					//logp("want to write: %d\n", zstrm.avail_in);
 
 					if(do_inflate(asfd, &zstrm, bfd, out,
-						buftouse, lentouse, metadata,
-						encpassword,
-						enccompressed,
-						sent))
+						(uint8_t *)rbuf->buf, rbuf->len,
+						metadata, encpassword,
+						enccompressed, sent))
 					{
 						ret=-1; quit++;
 						break;
@@ -311,7 +339,8 @@ int transfer_gzfile_inl(struct asfd *asfd,
 		enc_ctx=NULL;
 	}
 
-	iobuf_free_content(rbuf);
+	asfd_free_rbuf(asfd);
+	asfd->rbuf_views=0;
 	if(ret) logp("transfer file returning: %d\n", ret);
 	return ret;
 }
@@ -0,0 +1,456 @@
+#include "burp.h"
+#include "alloc.h"
+#include "log.h"
+#include "uring.h"
+
+enum uring_op_type
+{
+	URING_UNLINK=0,
+	URING_LINK,
+	URING_RENAME,
+	URING_OP_MAX
+};
+
+static const char *op_names[URING_OP_MAX]={
+	"unlink",
+	"link",
+	"rename"
+};
+
+static uint64_t queued=0;
+static uint64_t immediate=0;
+static uint64_t submits=0;
+
+static int finished(enum uring_op_type type, const char *a, const char *b,
+	int err, uring_cb cb, void *arg)
+{
+	if(cb) return cb(a, b, err, arg);
+	if(!err) return 0;
+	logp("Could not %s %s%s%s: %s\n", op_names[type],
+		a, b?" to ":"", b?b:"", strerror(err));
+	return -1;
+}
+
+static int run_now(enum uring_op_type type,
+	int adirfd, const char *a, int bdirfd, const char *b,
+	uring_cb cb, void *arg)
+{
+	int r=0;
+	immediate++;
+	switch(type)
+	{
+		case URING_UNLINK: r=unlinkat(adirfd, a, 0); break;
+		case URING_LINK: r=linkat(adirfd, a, bdirfd, b, 0); break;
+		case URING_RENAME: r=renameat(adirfd, a, bdirfd, b); break;
+		default: errno=EINVAL; r=-1; break;
+	}
+	return finished(type, a, b, r?errno:0, cb, arg);
+}
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+struct uring_op
+{
+	enum uring_op_type type;
+	char *a;
+	char *b;
+	uring_cb cb;
+	void *arg;
+};
+
+struct uring
+{
+	int fd;
+	pid_t pid;
+	unsigned depth;
+
+	void *sq_ring;
+	size_t sq_ring_len;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+
+	void *cq_ring;
+	size_t cq_ring_len;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct uring_op *ops;
+	unsigned *free_ops;
+	unsigned nfree;
+	unsigned unsubmitted;
+	unsigned inflight;
+	int ret;
+
+	uint8_t supported[URING_OP_MAX];
+};
+
+static struct uring *ring=NULL;
+
+static const uint8_t opcodes[URING_OP_MAX]={
+	IORING_OP_UNLINKAT,
+	IORING_OP_LINKAT,
+	IORING_OP_RENAMEAT
+};
+
+static void ring_unmap(struct uring *r)
+{
+	if(r->sqes && r->sqes!=MAP_FAILED)
+		munmap(r->sqes, r->sqes_len);
+	if(r->cq_ring && r->cq_ring!=MAP_FAILED && r->cq_ring!=r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_len);
+	if(r->sq_ring && r->sq_ring!=MAP_FAILED)
+		munmap(r->sq_ring, r->sq_ring_len);
+	if(r->fd>=0)
+		close(r->fd);
+	free_v((void **)&r->ops);
+	free_v((void **)&r->free_ops);
+	free_v((void **)&r);
+}
+
+static void ring_probe(struct uring *r)
+{
+	int i;
+	size_t len;
+	struct io_uring_probe *probe;
+
+	len=sizeof(struct io_uring_probe)
+		+IORING_OP_LAST*sizeof(struct io_uring_probe_op);
+	if(!(probe=(struct io_uring_probe *)calloc_w(1, len, __func__)))
+		return;
+	if(!syscall(__NR_io_uring_register, r->fd,
+		IORING_REGISTER_PROBE, probe, IORING_OP_LAST))
+	{
+		for(i=0; i<URING_OP_MAX; i++)
+			r->supported[i]=opcodes[i]<=probe->last_op
+			  && (probe->ops[opcodes[i]].flags
+				& IO_URING_OP_SUPPORTED);
+	}
+	free_v((void **)&probe);
+}
+
+static struct uring *ring_setup(unsigned depth)
+{
+	unsigned i;
+	struct uring *r;
+	struct io_uring_params p;
+
+	if(!(r=(struct uring *)calloc_w(1, sizeof(struct uring), __func__)))
+		return NULL;
+	memset(&p, 0, sizeof(p));
+	if((r->fd=syscall(__NR_io_uring_setup, depth, &p))<0)
+	{
+		logp("io_uring not available, not using it: %s\n",
+			strerror(errno));
+		goto error;
+	}
+
+	r->sq_ring_len=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+	r->cq_ring_len=p.cq_off.cqes
+		+p.cq_entries*sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(r->cq_ring_len>r->sq_ring_len)
+			r->sq_ring_len=r->cq_ring_len;
+		r->cq_ring_len=r->sq_ring_len;
+	}
+	r->sq_ring=mmap(NULL, r->sq_ring_len, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if(r->sq_ring==MAP_FAILED)
+		goto error_mmap;
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_ring=r->sq_ring;
+	else
+	{
+		r->cq_ring=mmap(NULL, r->cq_ring_len, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if(r->cq_ring==MAP_FAILED)
+			goto error_mmap;
+	}
+	r->sqes_len=p.sq_entries*sizeof(struct io_uring_sqe);
+	r->sqes=(struct io_uring_sqe *)mmap(NULL, r->sqes_len,
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+		r->fd, IORING_OFF_SQES);
+	if(r->sqes==MAP_FAILED)
+		goto error_mmap;
+
+	r->sq_tail=(unsigned *)((char *)r->sq_ring+p.sq_off.tail);
+	r->sq_mask=*(unsigned *)((char *)r->sq_ring+p.sq_off.ring_mask);
+	r->sq_array=(unsigned *)((char *)r->sq_ring+p.sq_off.array);
+	r->cq_head=(unsigned *)((char *)r->cq_ring+p.cq_off.head);
+	r->cq_tail=(unsigned *)((char *)r->cq_ring+p.cq_off.tail);
+	r->cq_mask=*(unsigned *)((char *)r->cq_ring+p.cq_off.ring_mask);
+	r->cqes=(struct io_uring_cqe *)((char *)r->cq_ring+p.cq_off.cqes);
+
+	// The kernel rounds the depth up to a power of two. There are never
+	// more operations in flight than submission queue entries, so the
+	// completion queue, which is twice the size, cannot overflow.
+	r->depth=p.sq_entries;
+	if(!(r->ops=(struct uring_op *)calloc_w(r->depth,
+		sizeof(struct uring_op), __func__))
+	  || !(r->free_ops=(unsigned *)calloc_w(r->depth,
+		sizeof(unsigned), __func__)))
+			goto error;
+	for(i=0; i<r->depth; i++)
+		r->free_ops[i]=i;
+	r->nfree=r->depth;
+	r->pid=getpid();
+
+	ring_probe(r);
+	return r;
+error_mmap:
+	logp("io_uring mmap failed, not using it: %s\n", strerror(errno));
+error:
+	ring_unmap(r);
+	return NULL;
+}
+
+static int ring_enter(struct uring *r, unsigned min_complete)
+{
+	int n;
+	while(1)
+	{
+		n=syscall(__NR_io_uring_enter, r->fd, r->unsubmitted,
+			min_complete,
+			min_complete?IORING_ENTER_GETEVENTS:0, NULL, 0);
+		if(n>=0) break;
+		if(errno==EINTR) continue;
+		logp("io_uring_enter failed: %s\n", strerror(errno));
+		return -1;
+	}
+	submits++;
+	r->unsubmitted-=n;
+	return 0;
+}
+
+// Submits anything not yet submitted, waits for at least min_complete
+// operations to finish and calls their callbacks.
+static int ring_reap(struct uring *r, unsigned min_complete)
+{
+	unsigned head;
+	struct io_uring_cqe *cqe;
+	struct uring_op op;
+	unsigned slot;
+	int err;
+
+	if(ring_enter(r, min_complete))
+		return -1;
+	// A callback can queue more operations, which can reap in turn, so
+	// the head is read again for each entry.
+	while((head=*r->cq_head)!=__atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+	{
+		cqe=&r->cqes[head & r->cq_mask];
+		slot=(unsigned)cqe->user_data;
+		err=cqe->res<0?-cqe->res:0;
+		__atomic_store_n(r->cq_head, head+1, __ATOMIC_RELEASE);
+
+		op=r->ops[slot];
+		memset(&r->ops[slot], 0, sizeof(struct uring_op));
+		r->free_ops[r->nfree++]=slot;
+		r->inflight--;
+
+		if(finished(op.type, op.a, op.b, err, op.cb, op.arg)<0)
+			r->ret=-1;
+		free_w(&op.a);
+		free_w(&op.b);
+	}
+	return 0;
+}
+
+static int ring_queue(struct uring *r, enum uring_op_type type,
+	int adirfd, const char *a, int bdirfd, const char *b,
+	uring_cb cb, void *arg)
+{
+	unsigned slot;
+	unsigned tail;
+	unsigned idx;
+	struct uring_op *op;
+	struct io_uring_sqe *sqe;
+
+	// Callbacks can queue operations of their own, so there might still be
+	// no free slot after reaping.
+	while(!r->nfree)
+		if(ring_reap(r, 1))
+			goto error;
+
+	slot=r->free_ops[--r->nfree];
+	op=&r->ops[slot];
+	if(!(op->a=strdup_w(a, __func__))
+	  || (b && !(op->b=strdup_w(b, __func__))))
+	{
+		free_w(&op->a);
+		r->free_ops[r->nfree++]=slot;
+		errno=ENOMEM;
+		goto error;
+	}
+	op->type=type;
+	op->cb=cb;
+	op->arg=arg;
+
+	tail=*r->sq_tail;
+	idx=tail & r->sq_mask;
+	sqe=&r->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode=opcodes[type];
+	sqe->fd=adirfd;
+	sqe->addr=(uint64_t)(uintptr_t)op->a;
+	switch(type)
+	{
+		case URING_UNLINK:
+			sqe->unlink_flags=0;
+			break;
+		case URING_LINK:
+			sqe->len=(uint32_t)bdirfd;
+			sqe->addr2=(uint64_t)(uintptr_t)op->b;
+			sqe->hardlink_flags=0;
+			break;
+		case URING_RENAME:
+			sqe->len=(uint32_t)bdirfd;
+			sqe->addr2=(uint64_t)(uintptr_t)op->b;
+			sqe->rename_flags=0;
+			break;
+		default:
+			break;
+	}
+	sqe->user_data=slot;
+	r->sq_array[idx]=idx;
+	__atomic_store_n(r->sq_tail, tail+1, __ATOMIC_RELEASE);
+
+	r->unsubmitted++;
+	r->inflight++;
+	queued++;
+
+	// Hand them to the kernel in batches, so that the first ones are
+	// being worked on while the rest are queued.
+	// If this fails, the next reap tries again.
+	if(r->unsubmitted>=r->depth/2)
+		ring_enter(r, 0);
+	return 0;
+error:
+	// The caller still gets its callback, so that whatever it passed in
+	// arg can be dealt with in one place.
+	finished(type, a, b, errno?errno:EIO, cb, arg);
+	return -1;
+}
+
+static int ring_usable(enum uring_op_type type)
+{
+	return ring && ring->pid==getpid() && ring->supported[type];
+}
+
+int uring_init(unsigned depth)
+{
+	uring_free();
+	if(!depth) return 0;
+	ring=ring_setup(depth);
+	return 0;
+}
+
+void uring_free(void)
+{
+	if(!ring) return;
+	if(ring->pid==getpid())
+		uring_wait();
+	ring_unmap(ring);
+	ring=NULL;
+}
+
+int uring_wait(void)
+{
+	int ret;
+	if(!ring || ring->pid!=getpid()) return 0;
+	while(ring->inflight)
+	{
+		if(ring_reap(ring, ring->inflight))
+		{
+			ring->ret=-1;
+			break;
+		}
+	}
+	ret=ring->ret;
+	ring->ret=0;
+	return ret;
+}
+
+static int do_op(enum uring_op_type type,
+	int adirfd, const char *a, int bdirfd, const char *b,
+	uring_cb cb, void *arg)
+{
+	if(ring_usable(type))
+		return ring_queue(ring, type, adirfd, a, bdirfd, b, cb, arg);
+	return run_now(type, adirfd, a, bdirfd, b, cb, arg);
+}
+
+#else
+
+int uring_init(unsigned depth)
+{
+	if(depth)
+		logp("io_uring not supported on this system, not using it\n");
+	return 0;
+}
+
+void uring_free(void)
+{
+}
+
+int uring_wait(void)
+{
+	return 0;
+}
+
+static int do_op(enum uring_op_type type,
+	int adirfd, const char *a, int bdirfd, const char *b,
+	uring_cb cb, void *arg)
+{
+	return run_now(type, adirfd, a, bdirfd, b, cb, arg);
+}
+
+#endif
+
+int uring_unlink(const char *path, uring_cb cb, void *arg)
+{
+	return do_op(URING_UNLINK, AT_FDCWD, path, AT_FDCWD, NULL, cb, arg);
+}
+
+int uring_unlinkat(int dirfd, const char *path, uring_cb cb, void *arg)
+{
+	return do_op(URING_UNLINK, dirfd, path, AT_FDCWD, NULL, cb, arg);
+}
+
+int uring_link(const char *oldpath, const char *newpath,
+	uring_cb cb, void *arg)
+{
+	return do_op(URING_LINK, AT_FDCWD, oldpath, AT_FDCWD, newpath,
+		cb, arg);
+}
+
+int uring_linkat(int olddirfd, const char *oldpath,
+	int newdirfd, const char *newpath, uring_cb cb, void *arg)
+{
+	return do_op(URING_LINK, olddirfd, oldpath, newdirfd, newpath,
+		cb, arg);
+}
+
+int uring_rename(const char *oldpath, const char *newpath,
+	uring_cb cb, void *arg)
+{
+	return do_op(URING_RENAME, AT_FDCWD, oldpath, AT_FDCWD, newpath,
+		cb, arg);
+}
+
+void uring_log_stats(void)
+{
+	if(!queued) return;
+	logp("io_uring: %" PRIu64 " operations in %" PRIu64
+		" submissions, %" PRIu64 " run directly\n",
+		queued, submits, immediate);
+}
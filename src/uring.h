@@ -0,0 +1,43 @@
+#ifndef _URING_H
+#define _URING_H
+
+// Queue for file system operations that do not depend on each other, such
+// as the unlinks when a directory tree is deleted. On Linux with io_uring,
+// up to 'depth' of them are in flight at once. Otherwise, or before
+// uring_init(), or in a forked child of the process that called it, each
+// operation runs straight away, and its callback is called before the
+// queueing function returns.
+
+// Called when an operation has finished, with 0 or an errno. Paths are only
+// valid during the call. Returning -1 counts as a failure. With no
+// callback, a failure is logged.
+typedef int (*uring_cb)(const char *path, const char *newpath,
+	int err, void *arg);
+
+// A depth of 0 leaves io_uring off. Not being able to set it up is not an
+// error, the operations just run one at a time.
+extern int uring_init(unsigned depth);
+extern void uring_free(void);
+
+// These return -1 if an operation that ran straight away failed, or if the
+// operation could not be queued. Either way, the callback has been called.
+extern int uring_unlink(const char *path, uring_cb cb, void *arg);
+extern int uring_link(const char *oldpath, const char *newpath,
+	uring_cb cb, void *arg);
+// Relative to directory file descriptors, to save walking the same leading
+// directories for every path. The descriptors must stay open until the
+// operation has finished.
+extern int uring_unlinkat(int dirfd, const char *path,
+	uring_cb cb, void *arg);
+extern int uring_linkat(int olddirfd, const char *oldpath,
+	int newdirfd, const char *newpath, uring_cb cb, void *arg);
+extern int uring_rename(const char *oldpath, const char *newpath,
+	uring_cb cb, void *arg);
+
+// Waits for everything that has been queued. Returns -1 if any of it failed
+// since the last wait.
+extern int uring_wait(void);
+
+extern void uring_log_stats(void);
+
+#endif
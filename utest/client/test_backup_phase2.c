@@ -269,8 +269,54 @@ static void setup_asfds_with_slist_changed_files(struct asfd *asfd,
 	asfd_assert_write(asfd, &w, 0, CMD_GEN, "okbackupphase2end");
 }
 
-static void run_test(int expected_ret,
-	int slist_entries,
+// The server asks for the files on alternate streams.
+static void setup_asfds_with_slist_new_files_streams(struct asfd *asfd,
+	struct slist *slist)
+{
+	int i=0;
+	int r=0; int w=0;
+	struct sbuf *s;
+	const char *stream[2]={"0", "1"};
+
+	asfd_assert_write(asfd, &w, 0, CMD_GEN, "backupphase2");
+	asfd_mock_read(asfd, &r, 0, CMD_GEN, "ok");
+
+	for(s=slist->head; s; s=s->next)
+	{
+		if(!sbuf_is_filedata(s)
+		  && !sbuf_is_vssdata(s))
+			continue;
+		build_file(s->path.buf, NULL);
+		fail_unless(!lstat(s->path.buf, &s->statp));
+		s->winattr=0;
+		s->compression=0;
+		attribs_encode(s);
+		asfd_mock_read(asfd, &r, 0, CMD_STREAM, stream[i%2]);
+		asfd_mock_read_iobuf(asfd, &r, 0, &s->attr);
+		asfd_mock_read_iobuf(asfd, &r, 0, &s->path);
+		asfd_assert_write(asfd, &w, 0, CMD_STREAM, stream[i%2]);
+		asfd_assert_write_iobuf(asfd, &w, 0, &s->attr);
+		asfd_assert_write_iobuf(asfd, &w, 0, &s->path);
+		asfd_assert_write(asfd, &w, 0, CMD_END_FILE,
+			"0:d41d8cd98f00b204e9800998ecf8427e");
+		i++;
+	}
+
+	asfd_mock_read(asfd, &r, 0, CMD_GEN, "backupphase2end");
+	asfd_assert_write(asfd, &w, 0, CMD_GEN, "okbackupphase2end");
+}
+
+static void setup_asfds_bad_stream(struct asfd *asfd,
+	struct slist *slist)
+{
+	int r=0; int w=0;
+	asfd_assert_write(asfd, &w, 0, CMD_GEN, "backupphase2");
+	asfd_mock_read(asfd, &r, 0, CMD_GEN, "ok");
+	asfd_mock_read(asfd, &r, 0, CMD_STREAM, "2");
+}
+
+static void run_test_streams(int expected_ret,
+	int slist_entries, int streams,
 	void setup_asfds_callback(struct asfd *asfd, struct slist *slist))
 {
 	struct asfd *asfd;
@@ -285,10 +331,12 @@ static void run_test(int expected_ret,
 
 	as=setup_async();
 	confs=setup_conf();
+	set_int(confs[OPT_PHASE2_STREAMS], streams);
 	asfd=asfd_mock_setup(&reads, &writes);
 	as->asfd_add(as, asfd);
 	asfd->as=as;
 	as->read_write=async_rw_simple;
+	as->read_quick=async_rw_simple;
 	as->write=async_write_simple;
 
 	if(slist_entries)
@@ -306,6 +354,13 @@ static void run_test(int expected_ret,
 	fail_unless(!recursive_delete(BASE));
 }
 
+static void run_test(int expected_ret,
+	int slist_entries,
+	void setup_asfds_callback(struct asfd *asfd, struct slist *slist))
+{
+	run_test_streams(expected_ret, slist_entries, 1, setup_asfds_callback);
+}
+
 START_TEST(test_phase2_with_slist_new_files)
 {
 	run_test(0, 10, setup_asfds_with_slist_new_files);
@@ -318,6 +373,18 @@ START_TEST(test_phase2_with_slist_changed_files)
 }
 END_TEST
 
+START_TEST(test_phase2_with_slist_new_files_streams)
+{
+	run_test_streams(0, 10, 2, setup_asfds_with_slist_new_files_streams);
+}
+END_TEST
+
+START_TEST(test_phase2_bad_stream)
+{
+	run_test_streams(-1, 0, 2, setup_asfds_bad_stream);
+}
+END_TEST
+
 Suite *suite_client_backup_phase2(void)
 {
 	Suite *s;
@@ -333,6 +400,8 @@ Suite *suite_client_backup_phase2(void)
 	tcase_add_test(tc_core, test_phase2_empty_backup_ok_with_warning);
 	tcase_add_test(tc_core, test_phase2_with_slist_new_files);
 	tcase_add_test(tc_core, test_phase2_with_slist_changed_files);
+	tcase_add_test(tc_core, test_phase2_with_slist_new_files_streams);
+	tcase_add_test(tc_core, test_phase2_bad_stream);
 
 	suite_add_tcase(s, tc_core);
 
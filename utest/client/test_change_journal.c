@@ -0,0 +1,498 @@
+#include "../test.h"
+#include "../builders/build_file.h"
+#include "../../src/alloc.h"
+#include "../../src/conffile.h"
+#include "../../src/fsops.h"
+#include "../../src/prepend.h"
+#include "../../src/client/change_journal.h"
+#include "../../src/client/find.h"
+#include "../../src/client/find_logic.h"
+#include "../../src/client/scan_cache.h"
+
+#include <signal.h>
+#include <sys/wait.h>
+
+#define BASE		"utest_change_journal"
+
+static char fullpath[PATH_MAX];
+static char tree[8192];
+static char jdir[8192];
+static struct strlist *got=NULL;
+
+static void setup(void)
+{
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!mkdir(BASE, 0777));
+	fail_unless(realpath(BASE, fullpath)!=NULL);
+	snprintf(tree, sizeof(tree), "%s/tree", fullpath);
+	snprintf(jdir, sizeof(jdir), "%s/journal", fullpath);
+	fail_unless(!mkdir(tree, 0777));
+	fail_unless(!mkdir(jdir, 0777));
+}
+
+static void tear_down(void)
+{
+	fail_unless(!recursive_delete(BASE));
+	free_logic_cache();
+	alloc_check();
+}
+
+static char *tree_path(const char *path)
+{
+	static char buf[8192];
+	snprintf(buf, sizeof(buf), "%s/%s", tree, path);
+	return buf;
+}
+
+static void write_file(const char *path, const char *mode, size_t s)
+{
+	FILE *fp;
+	fail_unless((fp=fopen(tree_path(path), mode))!=NULL);
+	while(s-->0)
+		fail_unless(fprintf(fp, "0")==1);
+	fail_unless(!fclose(fp));
+}
+
+static void make_dir(const char *path)
+{
+	fail_unless(!mkdir(tree_path(path), 0777));
+}
+
+static void journal_append(const char *line)
+{
+	FILE *fp;
+	char path[8192];
+	snprintf(path, sizeof(path), "%s/%s", jdir, CHANGE_JOURNAL_FILE);
+	fail_unless((fp=fopen(path, "ab"))!=NULL);
+	fail_unless(fprintf(fp, "%s\n", line)>0);
+	fail_unless(!fclose(fp));
+}
+
+static void journal_append_id(char kind, const char *path)
+{
+	char line[128];
+	struct stat statp;
+	fail_unless(!lstat(tree_path(path), &statp));
+	snprintf(line, sizeof(line), "%c %llu %llu", kind,
+		(unsigned long long)statp.st_dev,
+		(unsigned long long)statp.st_ino);
+	journal_append(line);
+}
+
+static void journal_start(void)
+{
+	char line[64];
+	struct stat statp;
+	char path[8192];
+	snprintf(path, sizeof(path), "%s/%s", jdir, CHANGE_JOURNAL_FILE);
+	unlink(path);
+	fail_unless(!lstat(tree, &statp));
+	snprintf(line, sizeof(line), "F %llu",
+		(unsigned long long)statp.st_dev);
+	journal_append(line);
+}
+
+// Does nothing but acknowledge the tokens of the scans. The tests write
+// the lines that the events would have given.
+static pid_t start_fake_watcher(void)
+{
+	pid_t pid;
+	pid_t parent=getpid();
+	fail_unless((pid=fork())>=0);
+	if(!pid)
+	{
+		char marker[8192];
+		char acked[64]="";
+		char buf[64];
+		char line[128];
+		FILE *fp;
+		snprintf(marker, sizeof(marker), "%s/%s",
+			jdir, CHANGE_JOURNAL_MARKER);
+		// Go away if a failed test did not stop it.
+		while(getppid()==parent)
+		{
+			if((fp=fopen(marker, "rb")))
+			{
+				if(fgets(buf, sizeof(buf), fp)
+				  && strcmp(buf, acked))
+				{
+					snprintf(acked, sizeof(acked),
+						"%s", buf);
+					buf[strcspn(buf, "\n")]='\0';
+					snprintf(line, sizeof(line),
+						"A %s", buf);
+					journal_append(line);
+				}
+				fclose(fp);
+			}
+			usleep(10000);
+		}
+		_exit(0);
+	}
+	return pid;
+}
+
+static void stop_watcher(pid_t pid)
+{
+	kill(pid, SIGKILL);
+	fail_unless(waitpid(pid, NULL, 0)==pid);
+}
+
+static struct conf **load_conf(int with_journal)
+{
+	char *buf=NULL;
+	char extra[20000];
+	struct conf **confs;
+	const char *conffile=BASE "/burp.conf";
+
+	fail_unless((confs=confs_alloc())!=NULL);
+	fail_unless(!confs_init(confs));
+	snprintf(extra, sizeof(extra), "include=%s\nexclude=%s/x\n",
+		tree, tree);
+	fail_unless(!astrcat(&buf, MIN_CLIENT_CONF, __func__));
+	fail_unless(!astrcat(&buf, extra, __func__));
+	if(with_journal)
+	{
+		snprintf(extra, sizeof(extra), "change_journal=%s\n", jdir);
+		fail_unless(!astrcat(&buf, extra, __func__));
+	}
+	build_file(conffile, buf);
+	fail_unless(!conf_load_global_only(conffile, confs));
+	free_w(&buf);
+	return confs;
+}
+
+static int collect(__attribute__ ((unused)) struct asfd *asfd,
+	struct FF_PKT *ff, __attribute__ ((unused)) struct conf **confs)
+{
+	char buf[8192];
+	snprintf(buf, sizeof(buf), "%s|%d|%lld|%llu|%lld|%lld|%lu|%s",
+		ff->fname, ff->type,
+		(long long)ff->statp.st_size,
+		(unsigned long long)ff->statp.st_ino,
+		(long long)ff->statp.st_mtime,
+		(long long)ff->statp.st_ctime,
+		(unsigned long)ff->statp.st_nlink,
+		(ff->type==FT_LNK_S || ff->type==FT_LNK_H)?ff->link:"");
+	fail_unless(!strlist_add(&got, buf, 0));
+	return 0;
+}
+
+static struct strlist *scan(struct conf **confs)
+{
+	struct strlist *l;
+	struct FF_PKT *ff;
+	got=NULL;
+	fail_unless((ff=find_files_init(collect))!=NULL);
+	fail_unless(!find_files_journal_begin(confs));
+	for(l=get_strlist(confs[OPT_STARTDIR]); l; l=l->next)
+		if(l->flag)
+			fail_unless(!find_files_begin(NULL, ff, confs, l->path));
+	fail_unless(!find_files_journal_end());
+	find_files_free(&ff);
+	return got;
+}
+
+// Scans with the journal, and without, and checks that they are the same.
+static void check_scan(struct conf **confs, struct conf **plain)
+{
+	struct strlist *a;
+	struct strlist *b;
+	struct strlist *x;
+	struct strlist *y;
+	a=scan(confs);
+	b=scan(plain);
+	for(x=a, y=b; x && y; x=x->next, y=y->next)
+		ck_assert_str_eq(x->path, y->path);
+	fail_unless(!x && !y);
+	strlists_free(&a);
+	strlists_free(&b);
+}
+
+// Returns the size that the scan gave the path.
+static long long scanned_size(struct strlist *list, const char *path)
+{
+	size_t len;
+	struct strlist *l;
+	const char *p=tree_path(path);
+	len=strlen(p);
+	for(l=list; l; l=l->next)
+		if(!strncmp(l->path, p, len) && l->path[len]=='|')
+			return strtoll(strchr(l->path+len+1, '|')+1, NULL, 10);
+	return -1;
+}
+
+static void build_tree(void)
+{
+	make_dir("a");
+	write_file("a/f1", "wb", 1);
+	write_file("a/f2", "wb", 2);
+	make_dir("b");
+	write_file("b/g1", "wb", 3);
+	make_dir("b/sub");
+	write_file("b/sub/h1", "wb", 4);
+	fail_unless(!symlink("g1", tree_path("b/lnk")));
+	make_dir("x");
+	write_file("x/excluded", "wb", 5);
+}
+
+static struct stat stat_of(const char *path)
+{
+	struct stat statp;
+	fail_unless(!lstat(tree_path(path), &statp));
+	return statp;
+}
+
+START_TEST(test_change_journal_sync)
+{
+	struct stat a;
+	struct stat b;
+	char *token1=NULL;
+	struct change_journal *cj;
+	pid_t pid;
+
+	setup();
+	build_tree();
+	journal_start();
+	a=stat_of("a");
+	b=stat_of("b");
+	fail_unless((cj=change_journal_alloc())!=NULL);
+
+	// Nothing acknowledges it.
+	fail_unless(!change_journal_sync(cj, jdir, NULL, 1));
+	fail_unless(!cj->token);
+	fail_unless(!cj->usable);
+
+	pid=start_fake_watcher();
+
+	// Nothing to start from.
+	fail_unless(!change_journal_sync(cj, jdir, NULL, 5));
+	fail_unless(cj->token!=NULL);
+	fail_unless(!cj->usable);
+	fail_unless(change_journal_fs_is_watched(cj, a.st_dev));
+	fail_unless((token1=strdup_w(cj->token, __func__))!=NULL);
+
+	journal_append_id('D', "a");
+	journal_append_id('I', "b/g1");
+	fail_unless(!change_journal_sync(cj, jdir, token1, 5));
+	fail_unless(cj->usable);
+	fail_unless(change_journal_dir_is_dirty(cj, &a));
+	fail_unless(!change_journal_dir_is_dirty(cj, &b));
+	b=stat_of("b/g1");
+	fail_unless(change_journal_inode_is_dirty(cj, &b));
+	free_w(&token1);
+	fail_unless((token1=strdup_w(cj->token, __func__))!=NULL);
+
+	// Only what came after the previous token.
+	fail_unless(!change_journal_sync(cj, jdir, token1, 5));
+	fail_unless(cj->usable);
+	fail_unless(!change_journal_dir_is_dirty(cj, &a));
+	free_w(&token1);
+	fail_unless((token1=strdup_w(cj->token, __func__))!=NULL);
+
+	// Events were lost.
+	journal_append("O");
+	fail_unless(!change_journal_sync(cj, jdir, token1, 5));
+	fail_unless(cj->token!=NULL);
+	fail_unless(!cj->usable);
+
+	// The previous token is not there.
+	fail_unless(!change_journal_sync(cj, jdir, "12.34", 5));
+	fail_unless(!cj->usable);
+
+	stop_watcher(pid);
+	free_w(&token1);
+	change_journal_free(&cj);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_change_journal_scan)
+{
+	pid_t pid;
+	struct strlist *list;
+	struct conf **confs;
+	struct conf **plain;
+
+	setup();
+	build_tree();
+	journal_start();
+	confs=load_conf(1);
+	plain=load_conf(0);
+	pid=start_fake_watcher();
+
+	// Nothing to start from, so everything is read.
+	check_scan(confs, plain);
+
+	// Nothing changed.
+	check_scan(confs, plain);
+
+	// A file changes in a directory that the journal has a line for,
+	// and in one that it does not. The second one must come from the
+	// cache, or the directory was read after all.
+	write_file("a/f1", "ab", 10);
+	write_file("b/g1", "ab", 10);
+	journal_append_id('D', "a");
+	list=scan(confs);
+	fail_unless(scanned_size(list, "a/f1")==11);
+	fail_unless(scanned_size(list, "b/g1")==3);
+	fail_unless(scanned_size(list, "b/sub/h1")==4);
+	fail_unless(scanned_size(list, "x/excluded")==-1);
+	strlists_free(&list);
+
+	// A line for the file itself is enough too.
+	journal_append_id('I', "b/g1");
+	check_scan(confs, plain);
+
+	// New entries, and a new directory that the cache knows nothing
+	// about.
+	write_file("b/sub/h2", "wb", 6);
+	make_dir("b/sub/d");
+	write_file("b/sub/d/i1", "wb", 7);
+	journal_append_id('D', "b/sub");
+	check_scan(confs, plain);
+
+	// Deleting.
+	fail_unless(!unlink(tree_path("a/f2")));
+	journal_append_id('D', "a");
+	check_scan(confs, plain);
+
+	// A lost event means that everything gets read.
+	write_file("b/sub/h1", "ab", 1);
+	journal_append("O");
+	check_scan(confs, plain);
+
+	// So does a new journal.
+	write_file("b/sub/h1", "ab", 1);
+	journal_start();
+	check_scan(confs, plain);
+
+	// And so do different includes or excludes.
+	write_file("b/sub/h1", "ab", 1);
+	fail_unless(!add_to_strlist(confs[OPT_EXCEXT], "nothing", 0));
+	check_scan(confs, plain);
+
+	stop_watcher(pid);
+	confs_free(&confs);
+	confs_free(&plain);
+	tear_down();
+}
+END_TEST
+
+#ifdef HAVE_FANOTIFY_DFID_NAME
+#include <sys/fanotify.h>
+#include <sys/prctl.h>
+
+static int have_fanotify(void)
+{
+	int fd;
+	if((fd=fanotify_init(FAN_CLASS_NOTIF|FAN_REPORT_DFID_NAME
+		|FAN_REPORT_FID, O_RDONLY))<0)
+			return 0;
+	close(fd);
+	return 1;
+}
+
+static void move_or_link(const char *from, const char *to, int do_link)
+{
+	char src[8192];
+	snprintf(src, sizeof(src), "%s", tree_path(from));
+	if(do_link)
+		fail_unless(!link(src, tree_path(to)));
+	else
+		fail_unless(!rename(src, tree_path(to)));
+}
+
+static pid_t start_watcher(struct conf **confs)
+{
+	int i;
+	pid_t pid;
+	char path[8192];
+	struct stat statp;
+
+	snprintf(path, sizeof(path), "%s/%s", jdir, CHANGE_JOURNAL_FILE);
+	fail_unless((pid=fork())>=0);
+	if(!pid)
+	{
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		_exit(change_journal_watch(confs)?1:0);
+	}
+	for(i=0; i<500 && lstat(path, &statp); i++)
+		usleep(10000);
+	fail_unless(i<500);
+	return pid;
+}
+
+// The same as above, but with the real thing making the journal.
+START_TEST(test_change_journal_watch)
+{
+	pid_t pid;
+	struct conf **confs;
+	struct conf **plain;
+
+	if(!have_fanotify())
+	{
+		printf("Skipping %s: fanotify is not available\n", __func__);
+		return;
+	}
+
+	setup();
+	build_tree();
+	confs=load_conf(1);
+	plain=load_conf(0);
+	pid=start_watcher(confs);
+
+	check_scan(confs, plain);
+	check_scan(confs, plain);
+
+	write_file("a/f1", "ab", 10);
+	write_file("b/g1", "ab", 10);
+	check_scan(confs, plain);
+
+	write_file("b/sub/h2", "wb", 6);
+	make_dir("b/sub/d");
+	write_file("b/sub/d/i1", "wb", 7);
+	fail_unless(!unlink(tree_path("a/f2")));
+	fail_unless(!chmod(tree_path("b/g1"), 0600));
+	check_scan(confs, plain);
+
+	move_or_link("b/sub/d", "a/d", 0);
+	move_or_link("a/f1", "b/f1", 0);
+	check_scan(confs, plain);
+
+	// A second name for a file, in another directory. Changing it through
+	// either name must be seen in both.
+	move_or_link("b/sub/h1", "a/hl", 1);
+	check_scan(confs, plain);
+	write_file("a/hl", "ab", 3);
+	check_scan(confs, plain);
+	fail_unless(!unlink(tree_path("a/hl")));
+	check_scan(confs, plain);
+
+	stop_watcher(pid);
+	confs_free(&confs);
+	confs_free(&plain);
+	tear_down();
+}
+END_TEST
+#endif
+
+Suite *suite_client_change_journal(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("client_change_journal");
+
+	tc_core=tcase_create("Core");
+	tcase_set_timeout(tc_core, 120);
+
+	tcase_add_test(tc_core, test_change_journal_sync);
+	tcase_add_test(tc_core, test_change_journal_scan);
+#ifdef HAVE_FANOTIFY_DFID_NAME
+	tcase_add_test(tc_core, test_change_journal_watch);
+#endif
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
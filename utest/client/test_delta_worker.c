@@ -0,0 +1,145 @@
+#include "../test.h"
+#include "../../src/alloc.h"
+#include "../../src/asfd.h"
+#include "../../src/async.h"
+#include "../../src/cmd.h"
+#include "../../src/handy_extra.h"
+#include "../../src/iobuf.h"
+#include "../../src/client/delta_worker.h"
+
+// The worker end of the pipe is driven by the test, standing in for the
+// child process, and the server end is another pipe.
+struct pipes
+{
+	struct async *as;
+	struct async *worker_as;
+	struct async *peer_as;
+	struct asfd *worker;
+	struct asfd *server;
+	struct asfd *peer;
+	struct delta_worker *dw;
+};
+
+static struct async *setup_async(void)
+{
+	struct async *as;
+	fail_unless((as=async_alloc())!=NULL);
+	fail_unless(!as->init(as, 0));
+	return as;
+}
+
+static void setup(struct pipes *p)
+{
+	int wfds[2];
+	int sfds[2];
+	memset(p, 0, sizeof(*p));
+	fail_unless(!pipe(wfds));
+	fail_unless(!pipe(sfds));
+	p->as=setup_async();
+	p->worker_as=setup_async();
+	p->peer_as=setup_async();
+	fail_unless((p->dw=delta_worker_alloc())!=NULL);
+	fail_unless((p->dw->asfd=setup_asfd(p->as,
+		"delta worker", &wfds[0], ""))!=NULL);
+	fail_unless((p->worker=setup_asfd(p->worker_as,
+		"worker", &wfds[1], ""))!=NULL);
+	fail_unless((p->server=setup_asfd(p->as,
+		"server", &sfds[1], ""))!=NULL);
+	p->server->attempt_reads=0;
+	fail_unless((p->peer=setup_asfd(p->peer_as,
+		"peer", &sfds[0], ""))!=NULL);
+}
+
+static void tear_down(struct pipes *p)
+{
+	delta_worker_free(&p->dw);
+	fail_unless(p->dw==NULL);
+	async_asfd_free_all(&p->as);
+	async_asfd_free_all(&p->worker_as);
+	async_asfd_free_all(&p->peer_as);
+	alloc_check();
+}
+
+static void flush(struct asfd *asfd)
+{
+	while(asfd->writebuflen)
+		fail_unless(!asfd->as->write(asfd->as));
+}
+
+static void expect_read(struct asfd *asfd, enum cmd cmd, const char *buf)
+{
+	fail_unless(!asfd->read(asfd));
+	fail_unless(asfd->rbuf->cmd==cmd);
+	fail_unless(!strcmp(asfd->rbuf->buf, buf));
+	iobuf_free_content(asfd->rbuf);
+}
+
+START_TEST(test_delta_worker_send)
+{
+	int r=0;
+	struct pipes p;
+	setup(&p);
+
+	fail_unless(!p.worker->write_str(p.worker, CMD_APPEND, "abc"));
+	fail_unless(!p.worker->write_str(p.worker, CMD_APPEND, "def"));
+	fail_unless(!write_endfile(p.worker, 6, NULL));
+	flush(p.worker);
+	fail_unless(!delta_worker_ready(p.dw));
+
+	while(!r)
+	{
+		fail_unless(!p.as->read_write(p.as));
+		fail_unless((r=delta_worker_send(p.dw, p.server))>=0);
+	}
+	fail_unless(r==1);
+	fail_unless(p.dw->done);
+	fail_unless(p.dw->bytes==6);
+	fail_unless(!delta_worker_failed(p.dw));
+
+	// Everything goes to the server in the order that it was generated.
+	flush(p.server);
+	expect_read(p.peer, CMD_APPEND, "abc");
+	expect_read(p.peer, CMD_APPEND, "def");
+	expect_read(p.peer, CMD_END_FILE, "6:");
+
+	tear_down(&p);
+}
+END_TEST
+
+START_TEST(test_delta_worker_failed)
+{
+	struct pipes p;
+	setup(&p);
+
+	fail_unless(!p.worker->write_str(p.worker, CMD_APPEND, "abc"));
+	flush(p.worker);
+	// The worker goes away without sending the end of file.
+	async_asfd_free_all(&p.worker_as);
+
+	while(!p.as->read_write(p.as))
+		fail_unless(!delta_worker_send(p.dw, p.server));
+	fail_unless(delta_worker_failed(p.dw));
+	fail_unless(!p.dw->done);
+
+	flush(p.server);
+	expect_read(p.peer, CMD_APPEND, "abc");
+
+	tear_down(&p);
+}
+END_TEST
+
+Suite *suite_client_delta_worker(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("client_delta_worker");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_delta_worker_send);
+	tcase_add_test(tc_core, test_delta_worker_failed);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -383,6 +383,24 @@ static void setup_rshash(struct asfd *asfd, struct conf **confs)
 	setup_extra_comms_end(asfd, &r, &w);
 }
 
+static struct asfd *large_frames_asfd;
+
+static void check_large_frames(struct conf **confs,
+	enum action action, const char *incexc)
+{
+	fail_unless(large_frames_asfd->large_frames==1);
+	fail_unless(asfd_frame_len(large_frames_asfd)==ASYNC_LARGE_BUF_LEN);
+}
+
+static void setup_large_frames(struct asfd *asfd, struct conf **confs)
+{
+	int r=0; int w=0;
+	large_frames_asfd=asfd;
+	setup_extra_comms_begin(asfd, &r, &w, "large_frames");
+	asfd_assert_write(asfd, &w, 0, CMD_GEN, "large_frames");
+	setup_extra_comms_end(asfd, &r, &w);
+}
+
 START_TEST(test_client_extra_comms)
 {
 	run_test(-1, ACTION_BACKUP, setup_write_error, NULL);
@@ -407,6 +425,7 @@ START_TEST(test_client_extra_comms)
 	run_test(0,  ACTION_BACKUP, setup_uname, NULL);
 	run_test(0,  ACTION_BACKUP, setup_msg, check_msg);
 	run_test(0,  ACTION_BACKUP, setup_rshash, check_rshash);
+	run_test(0,  ACTION_BACKUP, setup_large_frames, check_large_frames);
 }
 END_TEST
 
@@ -0,0 +1,204 @@
+#include "../test.h"
+#include "../../src/alloc.h"
+#include "../../src/conf.h"
+#include "../../src/strlist.h"
+#include "../../src/client/find.h"
+#include "../../src/client/find_logic.h"
+
+static struct conf **setup(void)
+{
+	struct conf **confs;
+	alloc_check_init();
+	fail_unless((confs=confs_alloc())!=NULL);
+	fail_unless(!confs_init(confs));
+	return confs;
+}
+
+static void tear_down(struct conf ***confs)
+{
+	free_logic_cache();
+	confs_free(confs);
+	alloc_check();
+}
+
+static struct FF_PKT *set_ff(struct FF_PKT *ff, const char *fname,
+	uint64_t size)
+{
+	memset(ff, 0, sizeof(*ff));
+	ff->fname=(char *)fname;
+	ff->statp.st_mode=S_IFREG|0644;
+	ff->statp.st_size=size;
+	return ff;
+}
+
+static int excluded(struct conf **confs, const char *fname, uint64_t size)
+{
+	struct FF_PKT ff;
+	return is_logic_excluded(confs, set_ff(&ff, fname, size));
+}
+
+static int included(struct conf **confs, const char *fname, uint64_t size)
+{
+	struct FF_PKT ff;
+	return is_logic_included(confs, set_ff(&ff, fname, size));
+}
+
+struct logic_data
+{
+	const char *expr;
+	const char *fname;
+	uint64_t size;
+	int exc;
+	int inc;
+};
+
+static struct logic_data l[] = {
+	{ "file_ext=txt or file_ext=c", "/a/b.txt", 1, 1, 1 },
+	{ "file_ext=txt or file_ext=c", "/a/b.TXT", 1, 1, 1 },
+	{ "file_ext=txt or file_ext=c", "/a/b.gz", 1, 0, 0 },
+	{ "file_ext='tar.gz' or file_ext=c", "/a/b.tar.gz", 1, 1, 1 },
+	{ "file_size>=5 and file_ext=ost", "/a/b.ost", 5, 1, 1 },
+	{ "file_size>=5 and file_ext=ost", "/a/b.ost", 4, 0, 0 },
+	{ "file_size>5K and file_size<1M", "/a/b", 5*1024+1, 1, 1 },
+	{ "file_size>5K and file_size<1M", "/a/b", 5*1024, 0, 0 },
+	{ "(file_size>=3 and file_size<=5) or (file_size=8 and path_match=b$)",
+		"/a/b", 8, 1, 1 },
+	{ "(file_size>=3 and file_size<=5) or (file_size=8 and path_match=b$)",
+		"/a/c", 8, 0, 0 },
+	{ "(file_size>=3 and file_size<=5) or (file_size=8 and path_match=b$)",
+		"/a/c", 4, 1, 1 },
+	{ "file_match='^c(a|b)' and file_size>0", "/x/cb", 1, 1, 1 },
+	{ "file_match='^c(a|b)' and file_size>0", "/cb/x", 1, 0, 0 },
+	{ "not file_ext=txt", "/a/b.txt", 1, 0, 0 },
+	{ "not file_ext=txt", "/a/b.gz", 1, 1, 1 },
+	{ "not not file_ext=txt and file_size<2", "/a/b.txt", 1, 1, 1 },
+	{ "file_ext=gz or not (file_size>2)", "/a/b.txt", 1, 1, 1 },
+	{ "file_ext=gz or ( not file_size>2 )", "/a/b.txt", 5, 0, 0 },
+	{ "file_ext=gz or ((file_size>2))", "/a/b.txt", 5, 1, 1 },
+	// These cannot be evaluated, so get the default.
+	{ "file_ext=txt", "/a/b.txt", 1, 0, 1 },
+	{ "(file_size>=30 or file_size<2", "/a/b", 1, 0, 1 },
+	{ "this expression isnt valid", "/a/b", 1, 0, 0 },
+	{ "file_size>1 xor file_size>2", "/a/b", 5, 0, 1 },
+	{ ") file_size>1 (", "/a/b", 5, 0, 1 },
+	{ "( )", "/a/b", 5, 0, 1 },
+};
+
+START_TEST(test_find_logic)
+{
+	size_t i;
+	struct conf **confs;
+	for(i=0; i<sizeof(l)/sizeof(*l); i++)
+	{
+		confs=setup();
+		fail_unless(!add_to_strlist(confs[OPT_EXCLOGIC], l[i].expr, 0));
+		fail_unless(!add_to_strlist(confs[OPT_INCLOGIC], l[i].expr, 0));
+		// The second time uses what was compiled the first time.
+		fail_unless(excluded(confs, l[i].fname, l[i].size)==l[i].exc);
+		fail_unless(excluded(confs, l[i].fname, l[i].size)==l[i].exc);
+		fail_unless(included(confs, l[i].fname, l[i].size)==l[i].inc);
+		fail_unless(included(confs, l[i].fname, l[i].size)==l[i].inc);
+		tear_down(&confs);
+	}
+}
+END_TEST
+
+START_TEST(test_find_logic_no_rules)
+{
+	struct FF_PKT ff;
+	struct conf **confs=setup();
+	fail_unless(!excluded(confs, "/a/b", 1));
+	fail_unless(included(confs, "/a/b", 1));
+	fail_unless(!add_to_strlist(confs[OPT_EXCLOGIC], "file_size>0", 0));
+	fail_unless(!add_to_strlist(confs[OPT_INCLOGIC], "file_size>0", 0));
+	// Directories are not looked at.
+	set_ff(&ff, "/a", 1);
+	ff.statp.st_mode=S_IFDIR|0755;
+	fail_unless(!is_logic_excluded(confs, &ff));
+	fail_unless(!is_logic_included(confs, &ff));
+	tear_down(&confs);
+}
+END_TEST
+
+static const char *exprs[]={
+	"file_size>=5M and (file_ext=pst or file_ext=ost)",
+	"path_match='^/home/[^/]+/\\.cache/' or file_ext=tmp",
+	"not file_size<1K and file_match='^core\\.[0-9]+$'",
+	NULL
+};
+
+static const char *dirs[]={ "/home/user", "/home/user/.cache", "/var/log" };
+static const char *names[]={ "mail.pst", "a.tmp", "core.1234", "notes.txt" };
+
+START_TEST(test_find_logic_no_alloc)
+{
+	int i;
+	uint64_t allocs;
+	struct conf **confs=setup();
+	for(i=0; exprs[i]; i++)
+		fail_unless(!add_to_strlist(confs[OPT_EXCLOGIC], exprs[i], 0));
+	excluded(confs, "/home/user/mail.pst", 1);
+	allocs=alloc_count;
+	for(i=0; i<1000; i++)
+		excluded(confs, "/home/user/.cache/x.txt", i);
+	fail_unless(alloc_count==allocs);
+	tear_down(&confs);
+}
+END_TEST
+
+#define BENCH_PATHS	1000000
+
+// Prints how many files a second the rules can be evaluated for.
+START_TEST(test_find_logic_benchmark)
+{
+	int i;
+	int hits=0;
+	clock_t start;
+	clock_t took;
+	char path[256];
+	struct conf **confs=setup();
+
+	for(i=0; exprs[i]; i++)
+		fail_unless(!add_to_strlist(confs[OPT_EXCLOGIC], exprs[i], 0));
+
+	start=clock();
+	for(i=0; i<BENCH_PATHS; i++)
+	{
+		snprintf(path, sizeof(path), "%s/%d/%s",
+			dirs[i%3], i%1000, names[i%4]);
+		hits+=excluded(confs, path, (uint64_t)(i%7)*1024*1024);
+	}
+	took=clock()-start;
+	fail_unless(hits>0);
+	printf("exclude_logic with %d rules for %d paths: %.0f paths/s\n",
+		3, BENCH_PATHS,
+		took?BENCH_PATHS/((double)took/CLOCKS_PER_SEC):0);
+	tear_down(&confs);
+}
+END_TEST
+
+Suite *suite_client_find_logic(void)
+{
+	Suite *s;
+	TCase *tc_core;
+	TCase *tc_bench;
+
+	s=suite_create("client_find_logic");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_find_logic);
+	tcase_add_test(tc_core, test_find_logic_no_rules);
+	tcase_add_test(tc_core, test_find_logic_no_alloc);
+	suite_add_tcase(s, tc_core);
+
+	if(BENCHMARKS_WANTED)
+	{
+		tc_bench=tcase_create("Benchmark");
+		tcase_set_timeout(tc_bench, 600);
+		tcase_add_test(tc_bench, test_find_logic_benchmark);
+		suite_add_tcase(s, tc_bench);
+	}
+
+	return s;
+}
@@ -0,0 +1,440 @@
+#include "../test.h"
+#include "../prng.h"
+#include "../../src/alloc.h"
+#include "../../src/conf.h"
+#include "../../src/pathcmp.h"
+#include "../../src/regexp.h"
+#include "../../src/strlist.h"
+#include "../../src/client/find_match.h"
+
+static struct conf **setup(void)
+{
+	struct conf **confs;
+	fail_unless((confs=confs_alloc())!=NULL);
+	fail_unless(!confs_init(confs));
+	return confs;
+}
+
+static void tear_down(struct conf ***confs)
+{
+	confs_free(confs);
+	alloc_check();
+}
+
+// What the configuration file code does after loading the lists.
+static void finalise_ext(struct strlist *list)
+{
+	long max=0;
+	struct strlist *l;
+	for(l=list; l; l=l->next)
+		if((long)strlen(l->path)>max) max=strlen(l->path);
+	if(list) list->flag=max+1;
+}
+
+static void finalise(struct conf **confs)
+{
+	finalise_ext(get_strlist(confs[OPT_INCEXT]));
+	finalise_ext(get_strlist(confs[OPT_EXCEXT]));
+	fail_unless(!strlist_compile_regexes(get_strlist(confs[OPT_INCREG])));
+	fail_unless(!strlist_compile_regexes(get_strlist(confs[OPT_EXCREG])));
+}
+
+static struct find_match *compile(struct conf **confs)
+{
+	struct find_match *fm;
+	finalise(confs);
+	fail_unless((fm=find_match_alloc())!=NULL);
+	fail_unless(!find_match_init(fm, confs));
+	return fm;
+}
+
+// The way that the lists were walked before they were compiled, to
+// check the answers against.
+static int ref_ext(struct strlist *list, const char *fname)
+{
+	long i=0;
+	struct strlist *l;
+	const char *cp=NULL;
+	if(!list) return 0;
+	for(cp=fname+strlen(fname)-1; i<list->flag && cp>=fname; cp--, i++)
+	{
+		if(*cp!='.') continue;
+		for(l=list; l; l=l->next)
+			if(!strcasecmp(l->path, cp+1))
+				return 1;
+		return 0;
+	}
+	return 0;
+}
+
+static int ref_regex(struct strlist *list, const char *fname)
+{
+	for(; list; list=list->next)
+		if(regex_check(list->re, fname))
+			return 1;
+	return 0;
+}
+
+static int ref_incext(struct conf **confs, const char *fname)
+{
+	struct strlist *incext=get_strlist(confs[OPT_INCEXT]);
+	if(!incext) return 1;
+	return ref_ext(incext, fname);
+}
+
+static int ref_no_incext(struct conf **confs, const char *fname)
+{
+	int longest=0;
+	int matching=0;
+	struct strlist *l=NULL;
+	struct strlist *best=NULL;
+	struct strlist *increg=get_strlist(confs[OPT_INCREG]);
+
+	if(ref_ext(get_strlist(confs[OPT_EXCEXT]), fname)
+	  || ref_regex(get_strlist(confs[OPT_EXCREG]), fname)
+	  || (increg && !ref_regex(increg, fname)))
+		return 0;
+	for(l=get_strlist(confs[OPT_INCEXCDIR]); l; l=l->next)
+	{
+		matching=is_subdir(l->path, fname);
+		if(matching>=longest)
+		{
+			longest=matching;
+			best=l;
+		}
+	}
+	if(!best) return 0;
+	return best->flag;
+}
+
+static void assert_same(struct find_match *fm, struct conf **confs,
+	const char *fname)
+{
+	int a=find_match_no_incext(fm, fname);
+	int b=ref_no_incext(confs, fname);
+	if(a!=b)
+		fail_unless(0, "%s: got %d, expected %d", fname, a, b);
+	fail_unless(find_match_incext(fm, fname)==ref_incext(confs, fname));
+}
+
+START_TEST(test_find_match_no_incext)
+{
+	struct conf **confs;
+	struct find_match *fm;
+	confs=setup();
+	add_to_strlist(confs[OPT_INCEXCDIR], "/", 1);
+	add_to_strlist(confs[OPT_INCEXCDIR], "/blah", 0);
+	add_to_strlist(confs[OPT_INCEXCDIR], "/tmp", 0);
+	add_to_strlist(confs[OPT_INCEXCDIR], "/tmp/some/sub/dir", 1);
+	fm=compile(confs);
+
+	fail_unless(find_match_no_incext(fm, "/blah2"));
+	fail_unless(find_match_no_incext(fm, "/blah2/blah3"));
+	fail_unless(find_match_no_incext(fm, "/tmp/some/sub/dir/1"));
+	fail_unless(!find_match_no_incext(fm, "/tmp"));
+	fail_unless(!find_match_no_incext(fm, "/tmp/blah"));
+	fail_unless(!find_match_no_incext(fm, "/tmp/some/sub"));
+
+	find_match_free(&fm);
+	fail_unless(fm==NULL);
+	tear_down(&confs);
+}
+END_TEST
+
+static const char *dir_paths[]={
+	"", "/", "//", "/a", "/a/", "/a/b", "/a/b/", "/a/bc", "/ab",
+	"/a/b/c", "/a//b", "a", "a/b", "/x/y/z", "/a/b/c/d/e", NULL
+};
+
+static void check_dir_paths(struct conf **confs)
+{
+	int i;
+	struct find_match *fm=compile(confs);
+	for(i=0; dir_paths[i]; i++)
+		assert_same(fm, confs, dir_paths[i]);
+	find_match_free(&fm);
+}
+
+START_TEST(test_find_match_dirs)
+{
+	struct conf **confs;
+
+	// Nothing to go on.
+	confs=setup();
+	check_dir_paths(confs);
+	tear_down(&confs);
+
+	// A path under none of them gets whatever the last one is.
+	confs=setup();
+	add_to_strlist(confs[OPT_INCEXCDIR], "/x", 0);
+	add_to_strlist(confs[OPT_INCEXCDIR], "/y", 1);
+	check_dir_paths(confs);
+	tear_down(&confs);
+
+	// '/a/' and '/a/b' are as deep as each other for '/a/b', so the
+	// later one wins, whichever way round they are.
+	confs=setup();
+	add_to_strlist(confs[OPT_INCEXCDIR], "/a/", 1);
+	add_to_strlist(confs[OPT_INCEXCDIR], "/a/b", 0);
+	check_dir_paths(confs);
+	tear_down(&confs);
+	confs=setup();
+	add_to_strlist(confs[OPT_INCEXCDIR], "/a/b", 0);
+	add_to_strlist(confs[OPT_INCEXCDIR], "/a/", 1);
+	check_dir_paths(confs);
+	tear_down(&confs);
+
+	// The same path twice.
+	confs=setup();
+	add_to_strlist(confs[OPT_INCEXCDIR], "/a", 1);
+	add_to_strlist(confs[OPT_INCEXCDIR], "/a/b/c", 1);
+	add_to_strlist(confs[OPT_INCEXCDIR], "/a", 0);
+	check_dir_paths(confs);
+	tear_down(&confs);
+
+	confs=setup();
+	add_to_strlist(confs[OPT_INCEXCDIR], "", 1);
+	add_to_strlist(confs[OPT_INCEXCDIR], "/", 0);
+	add_to_strlist(confs[OPT_INCEXCDIR], "a", 1);
+	add_to_strlist(confs[OPT_INCEXCDIR], "/a//b", 1);
+	check_dir_paths(confs);
+	tear_down(&confs);
+}
+END_TEST
+
+static const char *ext_paths[]={
+	"", ".", "/a/b.txt", "/a/b.TXT", "/a/b.Txt", "/a/b.txtx", "/a/b.tx",
+	"/a/b", "/a.txt/b", "/a/b.tar.gz", "/a/b.gz.tar", "/a/.txt",
+	"/a/b.", "/a/b.verylongextension", NULL
+};
+
+START_TEST(test_find_match_ext)
+{
+	int i;
+	struct conf **confs;
+	struct find_match *fm;
+
+	confs=setup();
+	add_to_strlist(confs[OPT_INCEXCDIR], "/", 1);
+	add_to_strlist(confs[OPT_INCEXT], "TXT", 0);
+	add_to_strlist(confs[OPT_INCEXT], "txt", 0);
+	add_to_strlist(confs[OPT_INCEXT], "tar", 0);
+	add_to_strlist(confs[OPT_EXCEXT], "gz", 0);
+	add_to_strlist(confs[OPT_EXCEXT], "", 0);
+	fm=compile(confs);
+	for(i=0; ext_paths[i]; i++)
+		assert_same(fm, confs, ext_paths[i]);
+	fail_unless(find_match_incext(fm, "/a/b.tXt"));
+	fail_unless(!find_match_incext(fm, "/a/b.gz"));
+	fail_unless(!find_match_no_incext(fm, "/a/b.GZ"));
+	fail_unless(find_match_no_incext(fm, "/a/b.tar"));
+	find_match_free(&fm);
+	tear_down(&confs);
+}
+END_TEST
+
+static const char *regex_paths[]={
+	"/a/b.txt", "/a/b.log", "/tmp/abab", "/tmp/abba", "/tmp/a)b",
+	"/tmp/ab)", "/home/user/x", "/home/user", "/HOME/user/x", NULL
+};
+
+static void check_regexes(const char *inc[], const char *exc[])
+{
+	int i;
+	struct conf **confs;
+	struct find_match *fm;
+
+	confs=setup();
+	add_to_strlist(confs[OPT_INCEXCDIR], "/", 1);
+	for(i=0; inc && inc[i]; i++)
+		add_to_strlist(confs[OPT_INCREG], inc[i], 0);
+	for(i=0; exc && exc[i]; i++)
+		add_to_strlist(confs[OPT_EXCREG], exc[i], 0);
+	fm=compile(confs);
+	for(i=0; regex_paths[i]; i++)
+		assert_same(fm, confs, regex_paths[i]);
+	find_match_free(&fm);
+	tear_down(&confs);
+}
+
+START_TEST(test_find_match_regex)
+{
+	const char *plain[]={ "\\.txt$", "^/home/[^/]+/", NULL };
+	const char *brackets[]={ "[[:digit:]()]", "/tmp/[)]", "^/tmp/a[]]", NULL };
+	// These cannot go together, so are checked one at a time.
+	const char *backref[]={ "\\.txt$", "(ab)\\1", NULL };
+	const char *unbalanced[]={ "a)b", "\\.log$", NULL };
+	const char *broken[]={ "(ab", "\\.log$", NULL };
+
+	check_regexes(plain, NULL);
+	check_regexes(NULL, plain);
+	check_regexes(plain, brackets);
+	check_regexes(backref, NULL);
+	check_regexes(NULL, backref);
+	check_regexes(unbalanced, NULL);
+	check_regexes(NULL, unbalanced);
+	check_regexes(broken, NULL);
+	check_regexes(NULL, broken);
+}
+END_TEST
+
+#define RULES		2000
+#define PATHS		2000
+
+static const char *words[]={
+	"home", "user", "data", "tmp", "var", "log", "cache", "src", "a", "b"
+};
+static const char *exts[]={
+	"txt", "log", "tmp", "o", "c", "h", "jpg", "bak", "iso", "gz"
+};
+
+static char *random_path(char *buf, size_t len)
+{
+	int i;
+	int depth=1+prng_next()%6;
+	*buf='\0';
+	for(i=0; i<depth; i++)
+	{
+		char tmp[32];
+		snprintf(tmp, sizeof(tmp), "/%s%u",
+			words[prng_next()%10], prng_next()%(i<2?4:50));
+		strncat(buf, tmp, len-strlen(buf)-1);
+	}
+	if(prng_next()%2)
+	{
+		strncat(buf, ".", len-strlen(buf)-1);
+		strncat(buf, exts[prng_next()%10], len-strlen(buf)-1);
+	}
+	return buf;
+}
+
+// Lots of rules, like an exclusion list that somebody else maintains.
+static void build_rules(struct conf **confs, int rules)
+{
+	int i;
+	char buf[256];
+	char re[300];
+	add_to_strlist(confs[OPT_INCEXCDIR], "/", 1);
+	for(i=0; i<rules; i++)
+	{
+		switch(i%4)
+		{
+			case 0:
+			case 1:
+				add_to_strlist(confs[OPT_INCEXCDIR],
+					random_path(buf, sizeof(buf)), i%2);
+				break;
+			case 2:
+				snprintf(buf, sizeof(buf), "%s%d",
+					exts[prng_next()%10], i);
+				add_to_strlist(confs[OPT_EXCEXT], buf, 0);
+				break;
+			case 3:
+				snprintf(re, sizeof(re), "^%s/.*\\.%s$",
+					random_path(buf, sizeof(buf)),
+					exts[prng_next()%10]);
+				add_to_strlist(confs[OPT_EXCREG], re, 0);
+				break;
+		}
+	}
+}
+
+START_TEST(test_find_match_random)
+{
+	int i;
+	char buf[256];
+	struct conf **confs;
+	struct find_match *fm;
+
+	prng_init(0);
+	confs=setup();
+	build_rules(confs, 200);
+	fm=compile(confs);
+	for(i=0; i<5000; i++)
+		assert_same(fm, confs, random_path(buf, sizeof(buf)));
+	find_match_free(&fm);
+	tear_down(&confs);
+}
+END_TEST
+
+static double secs(clock_t c)
+{
+	return (double)c/CLOCKS_PER_SEC;
+}
+
+// Prints how many paths a second can be decided on, with lots of rules.
+START_TEST(test_find_match_benchmark)
+{
+	int i;
+	int a=0;
+	int b=0;
+	char **paths;
+	clock_t start;
+	clock_t compiled;
+	clock_t walked;
+	struct conf **confs;
+	struct find_match *fm;
+	char buf[256];
+
+	prng_init(1);
+	confs=setup();
+	build_rules(confs, RULES);
+	fm=compile(confs);
+	fail_unless((paths=(char **)calloc_w(PATHS, sizeof(char *),
+		__func__))!=NULL);
+	for(i=0; i<PATHS; i++)
+		fail_unless((paths[i]=strdup_w(random_path(buf, sizeof(buf)),
+			__func__))!=NULL);
+
+	start=clock();
+	for(i=0; i<PATHS; i++)
+		a+=find_match_no_incext(fm, paths[i]);
+	compiled=clock()-start;
+	start=clock();
+	for(i=0; i<PATHS; i++)
+		b+=ref_no_incext(confs, paths[i]);
+	walked=clock()-start;
+	fail_unless(a==b);
+
+	printf("include/exclude with %d rules: "
+		"compiled %.0f paths/s, walking the lists %.0f paths/s\n",
+		RULES,
+		compiled?PATHS/secs(compiled):0,
+		walked?PATHS/secs(walked):0);
+
+	for(i=0; i<PATHS; i++)
+		free_w(&paths[i]);
+	free_v((void **)&paths);
+	find_match_free(&fm);
+	tear_down(&confs);
+}
+END_TEST
+
+Suite *suite_client_find_match(void)
+{
+	Suite *s;
+	TCase *tc_core;
+	TCase *tc_bench;
+
+	s=suite_create("client_find_match");
+
+	tc_core=tcase_create("Core");
+	tcase_set_timeout(tc_core, 60);
+
+	tcase_add_test(tc_core, test_find_match_no_incext);
+	tcase_add_test(tc_core, test_find_match_dirs);
+	tcase_add_test(tc_core, test_find_match_ext);
+	tcase_add_test(tc_core, test_find_match_regex);
+	tcase_add_test(tc_core, test_find_match_random);
+	suite_add_tcase(s, tc_core);
+
+	if(BENCHMARKS_WANTED)
+	{
+		tc_bench=tcase_create("Benchmark");
+		tcase_set_timeout(tc_bench, 600);
+		tcase_add_test(tc_bench, test_find_match_benchmark);
+		suite_add_tcase(s, tc_bench);
+	}
+
+	return s;
+}
@@ -0,0 +1,209 @@
+#include "../test.h"
+#include "../../src/alloc.h"
+#include "../../src/asfd.h"
+#include "../../src/async.h"
+#include "../../src/attribs.h"
+#include "../../src/base64.h"
+#include "../../src/bfile.h"
+#include "../../src/cmd.h"
+#include "../../src/fsops.h"
+#include "../../src/iobuf.h"
+#include "../../src/sbuf.h"
+#include "../../src/client/restore_finish.h"
+
+#include <sys/socket.h>
+
+#define BASE		"utest_client_restore_finish"
+#define DIR		BASE "/dir"
+#define MTIME		1234567890
+
+static struct sbuf *setup_sbuf(mode_t mode)
+{
+	struct sbuf *sb;
+	fail_unless((sb=sbuf_alloc())!=NULL);
+	sb->path.cmd=CMD_FILE;
+	sb->statp.st_mode=S_IFREG|mode;
+	sb->statp.st_uid=getuid();
+	sb->statp.st_gid=getgid();
+	sb->statp.st_atime=MTIME;
+	sb->statp.st_mtime=MTIME;
+	fail_unless(!attribs_encode(sb));
+	return sb;
+}
+
+static struct restore_finish *setup(int workers, int do_fsync,
+	struct asfd *asfd)
+{
+	struct restore_finish *rf;
+	base64_init();
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!mkdir(BASE, 0777));
+	fail_unless(!mkdir(DIR, 0777));
+	fail_unless((rf=restore_finish_alloc())!=NULL);
+	fail_unless(!restore_finish_init(rf, asfd, NULL, workers, do_fsync));
+	fail_unless(restore_finish_workers(rf)==workers);
+	return rf;
+}
+
+static void tear_down(struct restore_finish **rf)
+{
+	restore_finish_free(rf);
+	fail_unless(*rf==NULL);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static char *file_path(int i)
+{
+	static char path[256];
+	snprintf(path, sizeof(path), DIR "/file%d", i);
+	return path;
+}
+
+static void restore_file(struct restore_finish *rf, struct BFILE *bfd,
+	struct sbuf *sb, const char *path)
+{
+	fail_unless(!bfd->open(bfd, NULL, path,
+		O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR));
+	fail_unless(bfd->write(bfd, (void *)"data", 4)==4);
+	fail_unless(!restore_finish_file(rf, bfd, sb, path));
+	fail_unless(bfd->mode==BF_CLOSED);
+}
+
+static void assert_finished(const char *path, mode_t mode)
+{
+	struct stat statp;
+	fail_unless(!lstat(path, &statp));
+	fail_unless((statp.st_mode&07777)==mode);
+	fail_unless(statp.st_mtime==MTIME);
+}
+
+static void do_test_restore_finish(int workers, int do_fsync)
+{
+	int i;
+	struct sbuf *sb;
+	struct BFILE *bfd;
+	struct restore_finish *rf;
+
+	rf=setup(workers, do_fsync, NULL);
+	sb=setup_sbuf(0640);
+	fail_unless((bfd=bfile_alloc())!=NULL);
+	bfile_init(bfd, 0, 0, NULL);
+	bfd->set_attribs_on_close=1;
+
+	for(i=0; i<50; i++)
+		restore_file(rf, bfd, sb, file_path(i));
+	fail_unless(bfd->set_attribs_on_close==1);
+
+	// Everything in the directory is finished before its own
+	// attributes are set.
+	fail_unless(!restore_finish_wait(rf, DIR));
+	for(i=0; i<50; i++)
+		assert_finished(file_path(i), 0640);
+	fail_unless(!chmod(DIR, 0555));
+
+	fail_unless(!restore_finish_end(rf));
+	fail_unless(!chmod(DIR, 0777));
+	bfile_free(&bfd);
+	sbuf_free(&sb);
+	tear_down(&rf);
+}
+
+START_TEST(test_restore_finish_in_process)
+{
+	do_test_restore_finish(0, 0);
+	do_test_restore_finish(0, 1);
+}
+END_TEST
+
+START_TEST(test_restore_finish_workers)
+{
+	do_test_restore_finish(1, 0);
+	do_test_restore_finish(3, 1);
+}
+END_TEST
+
+START_TEST(test_restore_finish_wait_prefix)
+{
+	struct sbuf *sb;
+	struct BFILE *bfd;
+	struct restore_finish *rf;
+
+	rf=setup(2, 0, NULL);
+	sb=setup_sbuf(0600);
+	fail_unless((bfd=bfile_alloc())!=NULL);
+	bfile_init(bfd, 0, 0, NULL);
+
+	restore_file(rf, bfd, sb, DIR "/a");
+	restore_file(rf, bfd, sb, BASE "/dirx");
+	// Nothing is under 'dir/a', and 'dirx' is not under 'dir'.
+	fail_unless(!restore_finish_wait(rf, DIR "/a/b"));
+	fail_unless(!restore_finish_wait(rf, DIR));
+	assert_finished(DIR "/a", 0600);
+	fail_unless(!restore_finish_end(rf));
+	assert_finished(BASE "/dirx", 0600);
+
+	bfile_free(&bfd);
+	sbuf_free(&sb);
+	tear_down(&rf);
+}
+END_TEST
+
+START_TEST(test_restore_finish_warning)
+{
+	int fds[2];
+	struct sbuf *sb;
+	struct BFILE *bfd;
+	struct async *as;
+	struct asfd *asfd;
+	struct asfd *peer;
+	struct restore_finish *rf;
+
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+	fail_unless((as=async_alloc())!=NULL);
+	fail_unless(!as->init(as, 0));
+	fail_unless((asfd=setup_asfd(as, "server", &fds[0], ""))!=NULL);
+	fail_unless((peer=setup_asfd(as, "peer", &fds[1], ""))!=NULL);
+
+	rf=setup(1, 0, asfd);
+	sb=setup_sbuf(0600);
+	fail_unless((bfd=bfile_alloc())!=NULL);
+	bfile_init(bfd, 0, 0, NULL);
+
+	restore_file(rf, bfd, sb, DIR "/a");
+	// Too short to be metadata.
+	fail_unless(!restore_finish_meta(rf, sb, DIR "/a", "abc", 3));
+	fail_unless(!restore_finish_end(rf));
+	assert_finished(DIR "/a", 0600);
+
+	while(asfd->writebuflen)
+		fail_unless(!as->write(as));
+	fail_unless(!peer->read(peer));
+	fail_unless(peer->rbuf->cmd==CMD_WARNING);
+	fail_unless(strstr(peer->rbuf->buf, "too short")!=NULL);
+	iobuf_free_content(peer->rbuf);
+
+	bfile_free(&bfd);
+	sbuf_free(&sb);
+	async_asfd_free_all(&as);
+	tear_down(&rf);
+}
+END_TEST
+
+Suite *suite_client_restore_finish(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("client_restore_finish");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_restore_finish_in_process);
+	tcase_add_test(tc_core, test_restore_finish_workers);
+	tcase_add_test(tc_core, test_restore_finish_wait_prefix);
+	tcase_add_test(tc_core, test_restore_finish_warning);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -55,8 +55,12 @@ int main(int argc, char *argv[], char *envp[])
 
 #ifndef HAVE_WIN32
 	// These do not compile for Windows.
+	srunner_add_suite(sr, suite_client_change_journal());
 	srunner_add_suite(sr, suite_client_delete());
+	srunner_add_suite(sr, suite_client_delta_worker());
 	srunner_add_suite(sr, suite_client_find());
+	srunner_add_suite(sr, suite_client_find_logic());
+	srunner_add_suite(sr, suite_client_find_match());
 #ifdef HAVE_NCURSES
 	if(!valgrind)
 	{
@@ -67,6 +71,7 @@ int main(int argc, char *argv[], char *envp[])
 #endif
 	srunner_add_suite(sr, suite_client_monitor_json_input());
 	srunner_add_suite(sr, suite_lock());
+	srunner_add_suite(sr, suite_uring());
 
 	// These compile for Windows, but do not run correctly and the whole
 	// utest process crashes out.
@@ -74,9 +79,11 @@ int main(int argc, char *argv[], char *envp[])
 	srunner_add_suite(sr, suite_client_backup_phase2());
 	srunner_add_suite(sr, suite_client_monitor());
 	srunner_add_suite(sr, suite_client_restore());
+	srunner_add_suite(sr, suite_client_restore_finish());
 
 	// These compile for Windows, but have an error.
 	srunner_add_suite(sr, suite_attribs());
+	srunner_add_suite(sr, suite_bfile());
 	srunner_add_suite(sr, suite_conffile());
 
 	// These are server side only, so do not want to run them on Windows.
@@ -89,10 +96,15 @@ int main(int argc, char *argv[], char *envp[])
 	srunner_add_suite(sr, suite_server_bedup());
 	srunner_add_suite(sr, suite_server_blocklen());
 	srunner_add_suite(sr, suite_server_bu_get());
+	srunner_add_suite(sr, suite_server_chunks());
 	srunner_add_suite(sr, suite_server_delete());
+	srunner_add_suite(sr, suite_server_delta_chain());
+	srunner_add_suite(sr, suite_server_dirrefs());
 	srunner_add_suite(sr, suite_server_dpth());
 	srunner_add_suite(sr, suite_server_extra_comms());
 	srunner_add_suite(sr, suite_server_fdirs());
+	srunner_add_suite(sr, suite_server_ingest_dedup());
+	srunner_add_suite(sr, suite_server_link());
 	srunner_add_suite(sr, suite_server_list());
 	srunner_add_suite(sr, suite_server_manio());
 	srunner_add_suite(sr, suite_server_monitor_browse());
@@ -100,11 +112,15 @@ int main(int argc, char *argv[], char *envp[])
 	srunner_add_suite(sr, suite_server_monitor_cstat());
 	srunner_add_suite(sr, suite_server_monitor_json_output());
 	srunner_add_suite(sr, suite_server_monitor_status_server());
+	srunner_add_suite(sr, suite_server_prefetch());
+	srunner_add_suite(sr, suite_server_rcache());
 	srunner_add_suite(sr, suite_server_restore());
 	srunner_add_suite(sr, suite_server_restore_sbuf());
 	srunner_add_suite(sr, suite_server_resume());
 	srunner_add_suite(sr, suite_server_run_action());
+	srunner_add_suite(sr, suite_server_scrub());
 	srunner_add_suite(sr, suite_server_sdirs());
+	srunner_add_suite(sr, suite_server_sigcache());
 	srunner_add_suite(sr, suite_server_timer());
 #endif
 
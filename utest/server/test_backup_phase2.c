@@ -11,6 +11,7 @@
 #include "../../src/fsops.h"
 #include "../../src/iobuf.h"
 #include "../../src/server/backup_phase2.h"
+#include "../../src/server/manio.h"
 #include "../../src/server/sdirs.h"
 #include "../../src/slist.h"
 #include "../builders/build_asfd_mock.h"
@@ -237,9 +238,73 @@ static void setup_asfds_happy_path_new_files(struct asfd *asfd,
 	asfd_mock_read(asfd, &r, 0, CMD_GEN, "okbackupphase2end");
 }
 
-static void run_test(int expected_ret,
-        int manio_entries,
-        void setup_asfds_callback(struct asfd *asfd, struct slist *slist))
+// Every file is requested on its own stream before the client answers, and
+// the client sends them back in reverse order.
+static void setup_asfds_happy_path_new_files_streams(struct asfd *asfd,
+	struct slist *slist)
+{
+	int i=0;
+	int r=0, w=0;
+	struct sbuf *s;
+	char stream[16];
+	struct sbuf *files[PHASE2_STREAMS_MAX];
+
+	for(s=slist->head; s; s=s->next)
+	{
+		if(!sbuf_is_filedata(s))
+			continue;
+		fail_unless(i<PHASE2_STREAMS_MAX);
+		snprintf(stream, sizeof(stream), "%d", i);
+		asfd_assert_write(asfd, &w, 0, CMD_STREAM, stream);
+		asfd_assert_write_iobuf(asfd, &w, 0, &s->attr);
+		asfd_assert_write_iobuf(asfd, &w, 0, &s->path);
+		files[i++]=s;
+	}
+	asfd_assert_write(asfd, &w, 0, CMD_GEN, "backupphase2end");
+	asfd_mock_read_no_op(asfd, &r, 200);
+	while(i--)
+	{
+		s=files[i];
+		snprintf(stream, sizeof(stream), "%d", i);
+		asfd_mock_read(asfd, &r, 0, CMD_STREAM, stream);
+		asfd_mock_read_iobuf(asfd, &r, 0, &s->attr);
+		asfd_mock_read_iobuf(asfd, &r, 0, &s->path);
+		asfd_mock_read(asfd, &r, 0, CMD_APPEND, "some data");
+		asfd_mock_read(asfd, &r, 0, CMD_END_FILE,
+			"9:d41d8cd98f00b204e9800998ecf8427e");
+	}
+	asfd_mock_read(asfd, &r, 0, CMD_GEN, "okbackupphase2end");
+}
+
+// The changed manifest needs to be in phase1 order, whatever order the
+// client finished the files in.
+static void check_changed_order(struct sdirs *sdirs, struct slist *slist)
+{
+	int count=0;
+	struct sbuf *s;
+	struct sbuf *sb;
+	struct manio *manio;
+	fail_unless((sb=sbuf_alloc())!=NULL);
+	fail_unless((manio=manio_open_phase2(sdirs->changed,
+		MANIO_MODE_READ))!=NULL);
+	for(s=slist->head; s; s=s->next)
+	{
+		if(!sbuf_is_filedata(s))
+			continue;
+		fail_unless(!manio_read(manio, sb));
+		fail_unless(!strcmp(sb->path.buf, s->path.buf));
+		sbuf_free_content(sb);
+		count++;
+	}
+	fail_unless(count>1);
+	fail_unless(manio_read(manio, sb)==1);
+	fail_unless(!manio_close(&manio));
+	sbuf_free(&sb);
+}
+
+static void run_test_streams(int expected_ret,
+	int manio_entries, int streams,
+	void setup_asfds_callback(struct asfd *asfd, struct slist *slist))
 {
 	struct asfd *asfd;
 	struct async *as;
@@ -249,9 +314,11 @@ static void run_test(int expected_ret,
 	prng_init(0);
 	base64_init();
 	setup(&as, &sdirs, &confs);
+	set_int(confs[OPT_PHASE2_STREAMS], streams);
 	asfd=asfd_mock_setup(&reads, &writes);
 	as->asfd_add(as, asfd);
 	as->read_write=async_rw_simple;
+	as->read_quick=async_rw_simple;
 	asfd->as=as;
 
 	build_storage_dirs(sdirs, sd1, ARR_LEN(sd1));
@@ -275,6 +342,8 @@ static void run_test(int expected_ret,
 	{
 		// FIX THIS: Should check for the presence and correctness of
 		// changed and unchanged manios.
+		if(streams>1)
+			check_changed_order(sdirs, slist);
 	}
 	asfd_free(&asfd);
 	asfd_mock_teardown(&reads, &writes);
@@ -282,6 +351,13 @@ static void run_test(int expected_ret,
 	tear_down(&as, &sdirs, &confs);
 }
 
+static void run_test(int expected_ret,
+        int manio_entries,
+        void setup_asfds_callback(struct asfd *asfd, struct slist *slist))
+{
+	run_test_streams(expected_ret, manio_entries, 1, setup_asfds_callback);
+}
+
 START_TEST(test_phase2_happy_path_nothing_from_client)
 {
 	run_test(0, 10, setup_asfds_happy_path_nothing_from_client);
@@ -300,6 +376,13 @@ START_TEST(test_phase2_happy_path_new_files)
 }
 END_TEST
 
+START_TEST(test_phase2_happy_path_new_files_streams)
+{
+	run_test_streams(0, 20, PHASE2_STREAMS_MAX,
+		setup_asfds_happy_path_new_files_streams);
+}
+END_TEST
+
 static struct sd sd2[] = {
 	{ "0000001 1970-01-01 00:00:00", 1, 1, BU_CURRENT },
 	{ "0000002 1970-01-01 00:00:00", 2, 2, BU_WORKING },
@@ -430,6 +513,7 @@ Suite *suite_server_backup_phase2(void)
 	tcase_add_test(tc_core, test_phase2_happy_path_nothing_from_client);
 	tcase_add_test(tc_core, test_phase2_happy_path_interrupts_from_client);
 	tcase_add_test(tc_core, test_phase2_happy_path_new_files);
+	tcase_add_test(tc_core, test_phase2_happy_path_new_files_streams);
 
 	tcase_add_test(tc_core, test_phase2_happy_path_no_files);
 	tcase_add_test(tc_core, test_phase2_happy_path_changed_files);
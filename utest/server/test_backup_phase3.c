@@ -122,10 +122,22 @@ static void check_manifest(
 	assert_files_compressed_equal(expected, path);
 }
 
+static void check_unchanged_list(const char *path, const char *expected)
+{
+	size_t len=strlen(expected);
+	char buf[256]="";
+	struct fzp *fzp;
+	fail_unless((fzp=fzp_gzopen(path, "rb"))!=NULL);
+	fail_unless(fzp_read(fzp, buf, sizeof(buf))==(int)len);
+	fail_unless(!strcmp(buf, expected));
+	fzp_close(&fzp);
+}
+
 static void build_and_check_phase3(
 	struct mdata *a, size_t alen,
 	struct mdata *b, size_t blen,
-	struct mdata *x, size_t xlen)
+	struct mdata *x, size_t xlen,
+	const char *unchanged_list)
 {
 	char buf[4096];
 	char changed[512];
@@ -153,6 +165,7 @@ static void build_and_check_phase3(
 	fail_unless(!backup_phase3_server_all(sdirs, confs));
 
 	check_manifest(final, x, xlen);
+	check_unchanged_list(sdirs->unchangedlist, unchanged_list);
 
 	tear_down(&sdirs, &confs);
 }
@@ -162,12 +175,14 @@ START_TEST(test_backup_phase3)
 	build_and_check_phase3(
 		a1, ARR_LEN(a1),
 		b1, ARR_LEN(b1),
-		x1, ARR_LEN(x1)
+		x1, ARR_LEN(x1),
+		"1\n4\n"
 	);
 	build_and_check_phase3(
 		b1, ARR_LEN(b1),
 		a1, ARR_LEN(a1),
-		x1, ARR_LEN(x1)
+		x1, ARR_LEN(x1),
+		"2\n3\n"
 	);
 }
 END_TEST
@@ -9,11 +9,14 @@
 #include "../../src/fsops.h"
 #include "../../src/iobuf.h"
 #include "../../src/log.h"
+#include "../../src/prepend.h"
 #include "../../src/server/backup_phase4.h"
+#include "../../src/server/dirrefs.h"
 #include "../../src/server/fdirs.h"
 #include "../../src/server/link.h"
 #include "../../src/server/sdirs.h"
 #include "../../src/slist.h"
+#include "../../src/uring.h"
 #include "../builders/build_file.h"
 
 #define BASE	"utest_server_backup_phase4"
@@ -209,6 +212,192 @@ START_TEST(test_atomic_data_jiggle)
 }
 END_TEST
 
+static struct sd sd2[] = {
+	{ "0000001 1970-01-01 00:00:00", 1, 1, BU_CURRENT },
+	{ "0000002 1970-01-02 00:00:00", 2, 2, BU_FINISHING },
+};
+
+static struct sd sd2_hardlinked[] = {
+	{ "0000001 1970-01-01 00:00:00", 1, 1, BU_CURRENT|BU_HARDLINKED },
+	{ "0000002 1970-01-02 00:00:00", 2, 2, BU_FINISHING },
+};
+
+static char *currentdata_path(struct sdirs *sdirs, struct sbuf *s)
+{
+	static char path[256]="";
+	snprintf(path, sizeof(path), "%s/%s%s",
+		sdirs->currentdata, TREE_DIR, s->path.buf);
+	return path;
+}
+
+static nlink_t links(const char *path)
+{
+	struct stat statp;
+	fail_unless(!lstat(path, &statp));
+	return statp.st_nlink;
+}
+
+// Every other file is unchanged, with its data in the previous backup and
+// listed by phase3. The rest are new. Files 'done' and 'stale' have already
+// been linked by an interrupted jiggle, and 'stale' has also already been
+// unlinked from where it was.
+static void run_test_unchanged(struct sd *sd, size_t sdlen,
+	int max_hardlinks, nlink_t expected_links, unsigned uring_depth)
+{
+	int i=0;
+	struct sbuf *s;
+	struct fzp *fzp;
+	struct conf **confs;
+	struct sdirs *sdirs;
+	struct fdirs *fdirs;
+	struct slist *slist;
+	struct sbuf *done=NULL;
+	struct sbuf *stale=NULL;
+
+	setup(&sdirs, &fdirs, &confs);
+	fail_unless(!set_int(confs[OPT_MAX_HARDLINKS], max_hardlinks));
+	fail_unless(!uring_init(uring_depth));
+	build_storage_dirs(sdirs, sd, sdlen);
+	slist=build_manifest(fdirs->manifest, 100, /*phase*/ 3);
+
+	fail_unless((fzp=fzp_gzopen(fdirs->unchangedlist, "wb"))!=NULL);
+	for(s=slist->head; s; s=s->next)
+	{
+		if(!sbuf_is_filedata(s))
+			continue;
+		if(i++%2)
+		{
+			build_file(datadirtmp_path(fdirs, s),
+				datadirtmp_path(fdirs, s));
+			continue;
+		}
+		build_file(currentdata_path(sdirs, s),
+			datadirtmp_path(fdirs, s));
+		fail_unless(fzp_printf(fzp, "%s\n", s->datapth.buf)>0);
+		if(!done) done=s;
+		else if(!stale) stale=s;
+	}
+	fail_unless(!fzp_close(&fzp));
+	fail_unless(done && stale);
+	fail_unless(!build_path_w(datadir_path(fdirs, done)));
+	fail_unless(!link(currentdata_path(sdirs, done),
+		datadir_path(fdirs, done)));
+	fail_unless(!build_path_w(datadir_path(fdirs, stale)));
+	fail_unless(!link(currentdata_path(sdirs, stale),
+		datadir_path(fdirs, stale)));
+	fail_unless(!unlink(currentdata_path(sdirs, stale)));
+
+	fail_unless(!backup_phase4_server_all(sdirs, confs));
+	log_fzp_set(NULL, confs);
+
+	assert_datadir(slist, fdirs);
+	fail_unless(is_reg_lstat(fdirs->unchangedlist)<=0);
+	i=0;
+	for(s=slist->head; s; s=s->next)
+	{
+		if(!sbuf_is_filedata(s) || i++%2 || s==done || s==stale)
+			continue;
+		fail_unless(links(datadir_path(fdirs, s))==expected_links);
+	}
+
+	uring_free();
+	slist_free(&slist);
+	tear_down(&sdirs, &fdirs, &confs);
+}
+
+START_TEST(test_atomic_data_jiggle_unchanged)
+{
+	// The old links go when the previous backup becomes a reverse delta
+	// backup.
+	run_test_unchanged(sd2, ARR_LEN(sd2), 10000, 1, 0);
+	run_test_unchanged(sd2_hardlinked, ARR_LEN(sd2_hardlinked),
+		10000, 2, 0);
+	// Too many links already, so they get copied.
+	run_test_unchanged(sd2_hardlinked, ARR_LEN(sd2_hardlinked), 1, 1, 0);
+}
+END_TEST
+
+START_TEST(test_atomic_data_jiggle_unchanged_uring)
+{
+	run_test_unchanged(sd2, ARR_LEN(sd2), 10000, 1, 8);
+	run_test_unchanged(sd2_hardlinked, ARR_LEN(sd2_hardlinked),
+		10000, 2, 8);
+	run_test_unchanged(sd2_hardlinked, ARR_LEN(sd2_hardlinked), 1, 1, 8);
+}
+END_TEST
+
+// Everything is unchanged, apart from one file at the end, so the
+// directories without it can be referred to as a whole.
+START_TEST(test_atomic_data_jiggle_dir_refs)
+{
+	struct sbuf *s;
+	struct fzp *fzp;
+	struct conf **confs;
+	struct sdirs *sdirs;
+	struct fdirs *fdirs;
+	struct slist *slist;
+	struct sbuf *changed=NULL;
+	char *path=NULL;
+	char *refs=NULL;
+	char *cp;
+	char buf[4096]="";
+	struct stat statp;
+
+	setup(&sdirs, &fdirs, &confs);
+	fail_unless(!set_int(confs[OPT_HARDLINKED_ARCHIVE], 1));
+	fail_unless(!set_int(confs[OPT_HARDLINKED_DIR_REFS], 1));
+	build_storage_dirs(sdirs, sd2_hardlinked, ARR_LEN(sd2_hardlinked));
+	slist=build_manifest(fdirs->manifest, 100, /*phase*/ 3);
+	for(s=slist->head; s; s=s->next)
+		if(sbuf_is_filedata(s))
+			changed=s;
+	fail_unless(changed!=NULL);
+
+	fail_unless((fzp=fzp_gzopen(fdirs->unchangedlist, "wb"))!=NULL);
+	for(s=slist->head; s; s=s->next)
+	{
+		if(!sbuf_is_filedata(s))
+			continue;
+		if(s==changed)
+		{
+			build_file(datadirtmp_path(fdirs, s),
+				datadirtmp_path(fdirs, s));
+			continue;
+		}
+		build_file(currentdata_path(sdirs, s),
+			datadirtmp_path(fdirs, s));
+		fail_unless(fzp_printf(fzp, "%s\n", s->datapth.buf)>0);
+	}
+	fail_unless(!fzp_close(&fzp));
+
+	fail_unless(!backup_phase4_server_all(sdirs, confs));
+	log_fzp_set(NULL, confs);
+
+	assert_datadir(slist, fdirs);
+	fail_unless(is_reg_lstat(fdirs->unchangedlist)<=0);
+	// The changed file is a real file in a real directory.
+	fail_unless(is_reg_lstat(datadir_path(fdirs, changed))>0);
+	fail_unless(links(datadir_path(fdirs, changed))==1);
+
+	fail_unless((refs=prepend_s(sdirs->finishing, DIRREFS))!=NULL);
+	fail_unless((fzp=fzp_open(refs, "rb"))!=NULL);
+	fail_unless(fzp_gets(fzp, buf, sizeof(buf))!=NULL);
+	fzp_close(&fzp);
+	fail_unless((cp=strchr(buf, '\n'))!=NULL);
+	*cp='\0';
+	fail_unless((cp=strchr(buf, '\t'))!=NULL);
+	fail_unless(!strncmp(buf, sd2_hardlinked[0].timestamp, cp-buf));
+	fail_unless((path=prepend_s(fdirs->datadir, cp+1))!=NULL);
+	fail_unless(is_lnk_lstat(path)>0);
+	fail_unless(!stat(path, &statp) && S_ISDIR(statp.st_mode));
+
+	free_w(&path);
+	free_w(&refs);
+	slist_free(&slist);
+	tear_down(&sdirs, &fdirs, &confs);
+}
+END_TEST
+
 Suite *suite_server_backup_phase4(void)
 {
 	Suite *s;
@@ -220,6 +409,9 @@ Suite *suite_server_backup_phase4(void)
 	tcase_set_timeout(tc_core, 60);
 
 	tcase_add_test(tc_core, test_atomic_data_jiggle);
+	tcase_add_test(tc_core, test_atomic_data_jiggle_unchanged);
+	tcase_add_test(tc_core, test_atomic_data_jiggle_unchanged_uring);
+	tcase_add_test(tc_core, test_atomic_data_jiggle_dir_refs);
 
 	suite_add_tcase(s, tc_core);
 
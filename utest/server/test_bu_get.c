@@ -1,5 +1,6 @@
 #include "../test.h"
 #include "../builders/build.h"
+#include "../builders/build_file.h"
 #include "../../src/alloc.h"
 #include "../../src/bu.h"
 #include "../../src/conf.h"
@@ -386,6 +387,99 @@ START_TEST(test_bu_get_deleteme)
 }
 END_TEST
 
+static void age_path(const char *path)
+{
+	struct utimbuf times;
+	times.actime=time(NULL)-60;
+	times.modtime=times.actime;
+	fail_unless(!utime(path, &times));
+}
+
+// Make the mtimes old enough for the backup catalog to trust them.
+static void age_storage_dirs(struct sdirs *sdirs, struct sd *s, int len)
+{
+	int i;
+	char backup[128]="";
+	for(i=0; i<len; i++)
+	{
+		snprintf(backup, sizeof(backup),
+			"%s/%s", sdirs->client, s[i].timestamp);
+		age_path(backup);
+	}
+	age_path(sdirs->client);
+}
+
+static int catalog_exists(struct sdirs *sdirs)
+{
+	struct stat statp;
+	char path[256]="";
+	snprintf(path, sizeof(path), "%s/.bu_catalog/catalog", sdirs->client);
+	return !lstat(path, &statp);
+}
+
+static struct sd ct1[] = {
+	{ "0000005 1970-01-01 00:00:00", 5, 1,
+		BU_MANIFEST|BU_LOG_BACKUP|BU_DELETABLE },
+	{ "0000006 1970-01-02 00:00:00", 6, 2,
+		BU_MANIFEST|BU_LOG_BACKUP|BU_LOG_RESTORE },
+	{ "0000007 1970-01-03 00:00:00", 7, 3,
+		BU_MANIFEST|BU_LOG_BACKUP|BU_LOG_VERIFY|BU_LOG_RESTORE },
+	{ "0000008 1970-01-04 00:00:00", 8, 4,
+		BU_MANIFEST|BU_LOG_BACKUP|BU_LOG_RESTORE },
+	{ "0000009 1970-01-05 00:00:00", 9, 5,
+		BU_MANIFEST|BU_LOG_BACKUP|BU_LOG_VERIFY|BU_CURRENT },
+};
+
+static struct sd ct2[] = {
+	{ "0000006 1970-01-02 00:00:00", 6, 1,
+		BU_MANIFEST|BU_LOG_BACKUP|BU_LOG_RESTORE|BU_DELETABLE },
+	{ "0000007 1970-01-03 00:00:00", 7, 2,
+		BU_MANIFEST|BU_LOG_BACKUP|BU_LOG_VERIFY|BU_LOG_RESTORE },
+	{ "0000008 1970-01-04 00:00:00", 8, 3,
+		BU_MANIFEST|BU_LOG_BACKUP|BU_LOG_RESTORE },
+	{ "0000009 1970-01-05 00:00:00", 9, 4,
+		BU_MANIFEST|BU_LOG_BACKUP|BU_LOG_VERIFY|BU_CURRENT },
+};
+
+START_TEST(test_bu_get_catalog)
+{
+	char path[256]="";
+	struct sdirs *sdirs=setup();
+	do_sdirs_init(sdirs);
+	build_storage_dirs(sdirs, sd12, ARR_LEN(sd12));
+
+	// Freshly modified directories are not trusted, so nothing gets
+	// remembered.
+	assert_bu_list_with_working(sdirs, sd12, ARR_LEN(sd12));
+	fail_unless(!catalog_exists(sdirs));
+
+	// The first listing creates the catalog directory, the second
+	// writes the catalog, and the third reads it.
+	age_storage_dirs(sdirs, sd12, ARR_LEN(sd12));
+	assert_bu_list_with_working(sdirs, sd12, ARR_LEN(sd12));
+	age_path(sdirs->client);
+	assert_bu_list_with_working(sdirs, sd12, ARR_LEN(sd12));
+	fail_unless(catalog_exists(sdirs));
+	assert_bu_list_with_working(sdirs, sd12, ARR_LEN(sd12));
+	assert_bu_list(sdirs, sd11, ARR_LEN(sd11));
+
+	// A log added to a finished backup gets noticed.
+	snprintf(path, sizeof(path), "%s/%s/restorelog",
+		sdirs->client, sd12[3].timestamp);
+	build_file(path, NULL);
+	assert_bu_list_with_working(sdirs, ct1, ARR_LEN(ct1));
+	assert_bu_list(sdirs, sd11, ARR_LEN(sd11));
+
+	// Removing a backup makes the catalog stale.
+	snprintf(path, sizeof(path), "%s/%s",
+		sdirs->client, sd12[0].timestamp);
+	fail_unless(!rename(path, sdirs->deleteme));
+	assert_bu_list_with_working(sdirs, ct2, ARR_LEN(ct2));
+
+	tear_down(&sdirs);
+}
+END_TEST
+
 Suite *suite_server_bu_get(void)
 {
 	Suite *s;
@@ -401,6 +495,7 @@ Suite *suite_server_bu_get(void)
 	tcase_add_test(tc_core, test_bu_get_with_running);
 	tcase_add_test(tc_core, test_bu_get_current);
 	tcase_add_test(tc_core, test_bu_get_deleteme);
+	tcase_add_test(tc_core, test_bu_get_catalog);
 	suite_add_tcase(s, tc_core);
 
 	return s;
@@ -0,0 +1,359 @@
+#include "../test.h"
+#include "../prng.h"
+#include "../../src/alloc.h"
+#include "../../src/fsops.h"
+#include "../../src/fzp.h"
+#include "../../src/prepend.h"
+#include "../../src/server/chunks.h"
+
+#include <time.h>
+
+#define BASE		"utest_server_chunks"
+#define STORE		BASE "/" CHUNKS_DIR
+#define FILE1		BASE "/data/file1"
+#define FILE2		BASE "/data/file2"
+#define FILE3		BASE "/data/file3"
+#define FILE4		BASE "/data/file4"
+#define DEST		BASE "/dest"
+
+#define BENCH_FILES	8
+#define BENCH_SIZE	(4*1024*1024)
+
+static void setup(void)
+{
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!build_path_w(FILE1));
+}
+
+static void tear_down(void)
+{
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static uint8_t *random_buf(size_t len, uint32_t seed)
+{
+	size_t i;
+	uint8_t *buf;
+	fail_unless((buf=(uint8_t *)malloc_w(len, __func__))!=NULL);
+	prng_init(seed);
+	for(i=0; i<len; i++)
+		buf[i]=(uint8_t)prng_next();
+	return buf;
+}
+
+static void write_buf(const char *path, const uint8_t *buf, size_t len,
+	int compression)
+{
+	struct fzp *fzp;
+	if(compression)
+		fail_unless((fzp=fzp_gzopen(path, "wb9"))!=NULL);
+	else
+		fail_unless((fzp=fzp_open(path, "wb"))!=NULL);
+	fail_unless(fzp_write(fzp, buf, len)==len);
+	fail_unless(!fzp_close(&fzp));
+}
+
+static void copy_file(const char *src, const char *dst)
+{
+	int got;
+	char buf[4096];
+	struct fzp *in;
+	struct fzp *out;
+	fail_unless((in=fzp_open(src, "rb"))!=NULL);
+	fail_unless((out=fzp_open(dst, "wb"))!=NULL);
+	while((got=fzp_read(in, buf, sizeof(buf)))>0)
+		fail_unless(fzp_write(out, buf, got)==(size_t)got);
+	fail_unless(!fzp_close(&in));
+	fail_unless(!fzp_close(&out));
+}
+
+static void check_content(const char *path, const uint8_t *buf, size_t len)
+{
+	struct stat statp;
+	uint8_t *got;
+	struct fzp *fzp;
+	fail_unless(!lstat(path, &statp));
+	fail_unless((size_t)statp.st_size==len);
+	fail_unless((got=(uint8_t *)malloc_w(len, __func__))!=NULL);
+	fail_unless((fzp=fzp_open(path, "rb"))!=NULL);
+	fail_unless(fzp_read(fzp, got, len)==(int)len);
+	fail_unless(!fzp_close(&fzp));
+	fail_unless(!memcmp(got, buf, len));
+	free_v((void **)&got);
+}
+
+static int count_cuts(const uint8_t *buf, size_t len, size_t *cuts, int max)
+{
+	int n=0;
+	size_t off=0;
+	while(off<len && n<max)
+	{
+		size_t c=chunks_cut(buf+off, len-off);
+		if(off+c<len)
+		{
+			fail_unless(c>=CHUNK_MIN);
+			fail_unless(c<=CHUNK_MAX);
+		}
+		off+=c;
+		cuts[n++]=off;
+	}
+	return n;
+}
+
+START_TEST(test_chunks_cut)
+{
+	int i;
+	int j;
+	int n1;
+	int n2;
+	int same=0;
+	size_t len=2*1024*1024;
+	size_t cuts1[256];
+	size_t cuts2[256];
+	uint8_t *buf=random_buf(len+100, 1);
+
+	fail_unless(chunks_cut(buf, 10)==10);
+	fail_unless(chunks_cut(buf, CHUNK_MIN)==CHUNK_MIN);
+
+	// Inserting some bytes at the front only moves the first cut, the
+	// rest stay with the content.
+	n1=count_cuts(buf+100, len, cuts1, 256);
+	n2=count_cuts(buf, len+100, cuts2, 256);
+	fail_unless(n1>len/CHUNK_MAX);
+	fail_unless(n1<len/CHUNK_MIN);
+	for(i=0; i<n1; i++)
+		for(j=0; j<n2; j++)
+			if(cuts2[j]==cuts1[i]+100)
+				same++;
+	fail_unless(same>=n1-1);
+
+	free_v((void **)&buf);
+	alloc_check();
+}
+END_TEST
+
+static void remove_first_chunk(const char *recipe)
+{
+	char line[256];
+	char sub[256];
+	char *path;
+	struct fzp *fzp;
+	fail_unless((fzp=fzp_open(recipe, "rb"))!=NULL);
+	fail_unless(fzp_gets(fzp, line, sizeof(line))!=NULL);
+	fail_unless(fzp_gets(fzp, line, sizeof(line))!=NULL);
+	fail_unless(!fzp_close(&fzp));
+	*strchr(line, ' ')='\0';
+	snprintf(sub, sizeof(sub), "%.2s/%.2s/%s", line, line+2, line);
+	fail_unless((path=prepend_s(STORE, sub))!=NULL);
+	fail_unless(!unlink(path));
+	free_w(&path);
+}
+
+static void do_store_rebuild(int compression)
+{
+	size_t len=1024*1024+123;
+	uint8_t *buf=random_buf(len, 2);
+	setup();
+
+	// Nothing is a recipe until there is a store.
+	write_buf(FILE1, buf, len, compression);
+	fail_unless(!chunks_store_exists(STORE));
+	fail_unless(!chunks_is_recipe(STORE, FILE1));
+	fail_unless(!chunks_is_recipe(NULL, FILE1));
+	fail_unless(!chunks_store(STORE, FILE1, compression));
+	fail_unless(chunks_store_exists(STORE)==1);
+	fail_unless(chunks_is_recipe(STORE, FILE1)==1);
+	fail_unless(!chunks_is_recipe(NULL, FILE1));
+	fail_unless(!chunks_rebuild(STORE, FILE1, DEST));
+	check_content(DEST, buf, len);
+
+	// Small files are left alone.
+	write_buf(FILE2, buf, CHUNK_MAX/2, compression);
+	fail_unless(!chunks_store(STORE, FILE2, compression));
+	fail_unless(!chunks_is_recipe(STORE, FILE2));
+
+	// A missing chunk is an error.
+	remove_first_chunk(FILE1);
+	fail_unless(chunks_rebuild(STORE, FILE1, DEST)==-1);
+
+	free_v((void **)&buf);
+	tear_down();
+}
+
+START_TEST(test_chunks_store_rebuild)
+{
+	do_store_rebuild(0);
+	do_store_rebuild(9);
+}
+END_TEST
+
+static int count_chunks(const char *dir)
+{
+	int n=0;
+	DIR *dirp;
+	char *path;
+	struct dirent *d;
+	struct stat statp;
+	fail_unless((dirp=opendir(dir))!=NULL);
+	while((d=readdir(dirp)))
+	{
+		if(*d->d_name=='.'
+		  || !strcmp(d->d_name, "recipes"))
+			continue;
+		fail_unless((path=prepend_s(dir, d->d_name))!=NULL);
+		fail_unless(!lstat(path, &statp));
+		if(S_ISDIR(statp.st_mode))
+			n+=count_chunks(path);
+		else if(strlen(d->d_name)==64)
+			n++;
+		free_w(&path);
+	}
+	closedir(dirp);
+	return n;
+}
+
+START_TEST(test_chunks_gc)
+{
+	int n1;
+	int n2;
+	size_t len=1024*1024;
+	uint8_t *buf1=random_buf(len, 3);
+	uint8_t *buf2=random_buf(len, 4);
+	setup();
+
+	write_buf(FILE1, buf1, len, 0);
+	fail_unless(!chunks_store(STORE, FILE1, 0));
+	n1=count_chunks(STORE);
+	write_buf(FILE2, buf2, len, 0);
+	fail_unless(!chunks_store(STORE, FILE2, 0));
+	n2=count_chunks(STORE);
+	fail_unless(n2>n1);
+
+	// Nothing goes while both are referred to.
+	fail_unless(!chunks_gc(STORE));
+	fail_unless(count_chunks(STORE)==n2);
+
+	fail_unless(!unlink(FILE2));
+	fail_unless(!chunks_gc(STORE));
+	fail_unless(count_chunks(STORE)==n1);
+	fail_unless(!chunks_rebuild(STORE, FILE1, DEST));
+	check_content(DEST, buf1, len);
+
+	// Moved, hard linked, or copied, the references stay.
+	fail_unless(!rename(FILE1, FILE3));
+	fail_unless(!link(FILE3, FILE4));
+	fail_unless(!unlink(FILE3));
+	fail_unless(!chunks_gc(STORE));
+	fail_unless(count_chunks(STORE)==n1);
+	copy_file(FILE4, FILE1);
+	fail_unless(!chunks_recipe_copied(FILE4, FILE1));
+	fail_unless(!unlink(FILE4));
+	fail_unless(!chunks_gc(STORE));
+	fail_unless(count_chunks(STORE)==n1);
+	fail_unless(!chunks_rebuild(STORE, FILE1, DEST));
+	check_content(DEST, buf1, len);
+
+	// Copies of other files are left alone.
+	copy_file(DEST, FILE2);
+	fail_unless(!chunks_recipe_copied(DEST, FILE2));
+	fail_unless(!unlink(FILE2));
+
+	fail_unless(!unlink(FILE1));
+	fail_unless(!chunks_gc(STORE));
+	fail_unless(!count_chunks(STORE));
+
+	// No store, nothing to do.
+	fail_unless(!recursive_delete(STORE));
+	fail_unless(!chunks_gc(STORE));
+
+	free_v((void **)&buf1);
+	free_v((void **)&buf2);
+	tear_down();
+}
+END_TEST
+
+static int msecs(clock_t c)
+{
+	return (int)(c*1000/CLOCKS_PER_SEC);
+}
+
+// Each file is stored, then stored again with some bytes inserted and some
+// removed, like a disk image or a database dump that has changed a little.
+// Prints how much of the second lot was new, and how fast it all went.
+START_TEST(test_chunks_benchmark)
+{
+	int i;
+	clock_t start;
+	clock_t taken;
+	uint64_t total;
+	uint64_t stored;
+	struct chunks_stats before;
+	struct chunks_stats after;
+	setup();
+
+	chunks_get_stats(&before);
+	start=clock();
+	for(i=0; i<BENCH_FILES; i++)
+	{
+		uint8_t *buf=random_buf(BENCH_SIZE, 100+i);
+		write_buf(FILE1, buf, BENCH_SIZE, 0);
+		fail_unless(!chunks_store(STORE, FILE1, 0));
+		fail_unless(!rename(FILE1, BASE "/data/old"));
+
+		memmove(buf+BENCH_SIZE/3+64, buf+BENCH_SIZE/3, BENCH_SIZE/3);
+		memset(buf+BENCH_SIZE/3, i, 64);
+		memmove(buf+BENCH_SIZE/2, buf+BENCH_SIZE/2+4096,
+			BENCH_SIZE/2-4096);
+		write_buf(FILE1, buf, BENCH_SIZE-4096, 0);
+		fail_unless(!chunks_store(STORE, FILE1, 0));
+		fail_unless(!chunks_rebuild(STORE, FILE1, DEST));
+		check_content(DEST, buf, BENCH_SIZE-4096);
+		free_v((void **)&buf);
+	}
+	taken=clock()-start;
+	chunks_get_stats(&after);
+
+	total=after.bytes-before.bytes;
+	stored=after.new_bytes-before.new_bytes;
+	printf("chunk store for %d files of %d bytes and changed copies: "
+		"%" PRIu64 " bytes in, %" PRIu64 " stored, "
+		"dedup ratio %d.%02d, %d.%03ds, %d MB/s\n",
+		BENCH_FILES, BENCH_SIZE, total, stored,
+		(int)(total/stored), (int)(total*100/stored%100),
+		msecs(taken)/1000, msecs(taken)%1000,
+		(int)(total*1000/1048576/(msecs(taken)?msecs(taken):1)));
+
+	// Ideally, a bit under 2.
+	fail_unless(total*100/stored>=180);
+
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_chunks(void)
+{
+	Suite *s;
+	TCase *tc_core;
+	TCase *tc_bench;
+
+	s=suite_create("server_chunks");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_chunks_cut);
+	tcase_add_test(tc_core, test_chunks_store_rebuild);
+	tcase_add_test(tc_core, test_chunks_gc);
+
+	suite_add_tcase(s, tc_core);
+
+	if(BENCHMARKS_WANTED)
+	{
+		tc_bench=tcase_create("Benchmark");
+		tcase_set_timeout(tc_bench, 600);
+		tcase_add_test(tc_bench, test_chunks_benchmark);
+		suite_add_tcase(s, tc_bench);
+	}
+
+	return s;
+}
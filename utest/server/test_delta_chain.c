@@ -0,0 +1,149 @@
+#include "../test.h"
+#include "../builders/build.h"
+#include "../builders/build_file.h"
+#include "../../src/alloc.h"
+#include "../../src/bu.h"
+#include "../../src/fsops.h"
+#include "../../src/prepend.h"
+#include "../../src/server/bu_get.h"
+#include "../../src/server/delta_chain.h"
+#include "../../src/server/sdirs.h"
+
+#define BASE		"utest_server_delta_chain"
+#define DATAPTH		"t/0000/0000/0001"
+
+static struct sd sd1234[] = {
+	{ "0000001 1970-01-01 00:00:00", 1, 1, BU_DELETABLE },
+	{ "0000002 1970-01-02 00:00:00", 2, 2, 0 },
+	{ "0000003 1970-01-03 00:00:00", 3, 3, 0 },
+	{ "0000004 1970-01-04 00:00:00", 4, 4, BU_CURRENT }
+};
+
+static struct sdirs *setup(void)
+{
+	struct sdirs *sdirs;
+	fail_unless(!recursive_delete(BASE));
+	fail_unless((sdirs=sdirs_alloc())!=NULL);
+	fail_unless(!sdirs_init(sdirs,
+		BASE, // directory
+		"utestclient", // cname
+		NULL, // client_lockdir
+		"a_group", // dedup_group
+		NULL // manual_delete
+	));
+	build_storage_dirs(sdirs, sd1234, ARR_LEN(sd1234));
+	return sdirs;
+}
+
+static void tear_down(struct sdirs **sdirs)
+{
+	sdirs_free(sdirs);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static void build_in(const char *dir, const char *content)
+{
+	char *path;
+	fail_unless((path=prepend_s(dir, DATAPTH))!=NULL);
+	fail_unless(!build_path_w(path));
+	build_file(path, content);
+	free_w(&path);
+}
+
+// Backup 1 has the oldest full copy. Backups 2 and 3 have reverse deltas.
+static struct delta_chain *setup_chain(struct sdirs *sdirs,
+	int max_length, int max_percent)
+{
+	struct bu *b;
+	struct delta_chain *dc;
+	fail_unless((dc=delta_chain_alloc())!=NULL);
+	fail_unless(!delta_chain_init(dc, sdirs, max_length, max_percent));
+	fail_unless(dc->older!=NULL);
+	fail_unless(dc->older->bno==3);
+	for(b=dc->older; b; b=b->prev)
+	{
+		if(b->bno==1) build_in(b->data, "0123456789");
+		else build_in(b->delta, "01");
+	}
+	return dc;
+}
+
+START_TEST(test_delta_chain_length)
+{
+	struct delta_chain *dc;
+	struct sdirs *sdirs=setup();
+
+	dc=setup_chain(sdirs, 0, 0);
+	fail_unless(!delta_chain_too_long(dc, DATAPTH));
+	fail_unless(dc->length==2);
+	fail_unless(dc->bytes==4);
+	delta_chain_add(dc, 0);
+	fail_unless(dc->lengths[2]==1);
+	fail_unless(!delta_chain_too_long(dc, "t/other"));
+	fail_unless(dc->length==0);
+	delta_chain_add(dc, 0);
+	fail_unless(dc->lengths[0]==1);
+	delta_chain_log(dc);
+	delta_chain_free(&dc);
+	fail_unless(dc==NULL);
+
+	dc=setup_chain(sdirs, 3, 0);
+	fail_unless(!delta_chain_too_long(dc, DATAPTH));
+	delta_chain_free(&dc);
+
+	dc=setup_chain(sdirs, 2, 0);
+	fail_unless(delta_chain_too_long(dc, DATAPTH)==1);
+	delta_chain_add(dc, 1);
+	fail_unless(dc->full_copies==1);
+	delta_chain_free(&dc);
+
+	tear_down(&sdirs);
+}
+END_TEST
+
+START_TEST(test_delta_chain_bytes)
+{
+	char *oldpath;
+	struct delta_chain *dc;
+	struct sdirs *sdirs=setup();
+
+	build_in(sdirs->client, "0123456789");
+	build_in(sdirs->currentdata, "01");
+	fail_unless((oldpath=prepend_s(sdirs->client, DATAPTH))!=NULL);
+
+	// The chain has 2+2+2 bytes of deltas, and the full copy has 10.
+	dc=setup_chain(sdirs, 0, 60);
+	fail_unless(!delta_chain_too_long(dc, DATAPTH));
+	fail_unless(!delta_chain_too_big(dc,
+		sdirs->currentdata, DATAPTH, oldpath));
+	delta_chain_free(&dc);
+
+	dc=setup_chain(sdirs, 0, 59);
+	fail_unless(!delta_chain_too_long(dc, DATAPTH));
+	fail_unless(delta_chain_too_big(dc,
+		sdirs->currentdata, DATAPTH, oldpath)==1);
+	fail_unless(!delta_chain_too_big(dc,
+		sdirs->currentdata, "t/other", oldpath));
+	delta_chain_free(&dc);
+
+	free_w(&oldpath);
+	tear_down(&sdirs);
+}
+END_TEST
+
+Suite *suite_server_delta_chain(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_delta_chain");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_delta_chain_length);
+	tcase_add_test(tc_core, test_delta_chain_bytes);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
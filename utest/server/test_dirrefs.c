@@ -0,0 +1,383 @@
+#include "../test.h"
+#include "../builders/build.h"
+#include "../builders/build_file.h"
+#include "../../src/alloc.h"
+#include "../../src/bu.h"
+#include "../../src/fsops.h"
+#include "../../src/fzp.h"
+#include "../../src/prepend.h"
+#include "../../src/server/bu_get.h"
+#include "../../src/server/dirrefs.h"
+#include "../../src/server/sdirs.h"
+
+#define BASE		"utest_server_dirrefs"
+
+#define B1		"0000001 1970-01-01 00:00:00"
+#define B2		"0000002 1970-01-02 00:00:00"
+#define B3		"0000003 1970-01-03 00:00:00"
+
+static struct sd sd123[] = {
+	{ B1, 1, 1, BU_HARDLINKED },
+	{ B2, 2, 2, BU_HARDLINKED },
+	{ B3, 3, 3, BU_HARDLINKED|BU_CURRENT }
+};
+
+struct entry
+{
+	const char *datapth;
+	int unchanged;
+};
+
+// Directory 'a' is the same, 'b' has a new file, 'c' has lost a file, and
+// all of 'd' is the same, so 'd/e' is not needed as well.
+static const char *old_files[] = {
+	"t/a/x", "t/a/y", "t/b/z", "t/c/w", "t/c/old", "t/d/e/f", "t/d/g"
+};
+
+static struct entry new_files[] = {
+	{ "t/a/x", 1 },
+	{ "t/a/y", 1 },
+	{ "t/b/new", 0 },
+	{ "t/b/z", 1 },
+	{ "t/c/w", 1 },
+	{ "t/d/e/f", 1 },
+	{ "t/d/g", 1 }
+};
+
+static struct sdirs *setup(void)
+{
+	struct sdirs *sdirs;
+	fail_unless(!recursive_delete(BASE));
+	fail_unless((sdirs=sdirs_alloc())!=NULL);
+	fail_unless(!sdirs_init(sdirs,
+		BASE, // directory
+		"utestclient", // cname
+		NULL, // client_lockdir
+		"a_group", // dedup_group
+		NULL // manual_delete
+	));
+	build_storage_dirs(sdirs, sd123, ARR_LEN(sd123));
+	return sdirs;
+}
+
+static void tear_down(struct sdirs **sdirs)
+{
+	sdirs_free(sdirs);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static char *data_path(struct sdirs *sdirs, const char *backup,
+	const char *datapth)
+{
+	static char path[256]="";
+	snprintf(path, sizeof(path), "%s/%s/" DATA_DIR "/%s",
+		sdirs->client, backup, datapth);
+	return path;
+}
+
+static char *backup_path(struct sdirs *sdirs, const char *backup)
+{
+	static char path[256]="";
+	snprintf(path, sizeof(path), "%s/%s", sdirs->client, backup);
+	return path;
+}
+
+static void build_data(struct sdirs *sdirs, const char *backup,
+	const char *datapth)
+{
+	char *path=data_path(sdirs, backup, datapth);
+	fail_unless(!build_path_w(path));
+	build_file(path, datapth);
+}
+
+static void assert_data(struct sdirs *sdirs, const char *backup,
+	const char *datapth)
+{
+	size_t len=strlen(datapth);
+	char buf[256]="";
+	struct fzp *fzp;
+	fail_unless((fzp=fzp_open(data_path(sdirs, backup, datapth),
+		"rb"))!=NULL);
+	fail_unless(fzp_read(fzp, buf, sizeof(buf))==len);
+	fail_unless(!strcmp(buf, datapth));
+	fzp_close(&fzp);
+}
+
+static void assert_ref(struct sdirs *sdirs, const char *backup,
+	const char *dir, const char *target)
+{
+	ssize_t len;
+	char buf[256]="";
+	fail_unless((len=readlink(data_path(sdirs, backup, dir),
+		buf, sizeof(buf)-1))>0);
+	buf[len]='\0';
+	fail_unless(!strcmp(buf, target));
+}
+
+static void assert_refs_file(struct sdirs *sdirs, const char *backup,
+	const char *content)
+{
+	char path[256]="";
+	char buf[256]="";
+	struct fzp *fzp;
+	snprintf(path, sizeof(path), "%s/" DIRREFS,
+		backup_path(sdirs, backup));
+	if(!content)
+	{
+		fail_unless(is_reg_lstat(path)<=0);
+		return;
+	}
+	fail_unless((fzp=fzp_open(path, "rb"))!=NULL);
+	fail_unless(fzp_read(fzp, buf, sizeof(buf))==strlen(content));
+	fail_unless(!strcmp(buf, content));
+	fzp_close(&fzp);
+}
+
+// Does what phase4 would do for the new backup, with the new files written
+// and the unchanged ones linked, unless they are in a referred directory.
+static struct dirrefs_plan *plan_backup(struct sdirs *sdirs,
+	const char *oldbackup, const char *newbackup,
+	struct entry *entries, size_t len)
+{
+	size_t i;
+	char *oldpath;
+	struct dirrefs_plan *plan;
+
+	fail_unless((plan=dirrefs_plan_alloc())!=NULL);
+	for(i=0; i<len; i++)
+		fail_unless(!dirrefs_plan_add(plan, entries[i].datapth,
+			entries[i].unchanged));
+	fail_unless(!dirrefs_plan_finish(plan,
+		backup_path(sdirs, oldbackup), oldbackup));
+	fail_unless(!dirrefs_plan_link(plan, backup_path(sdirs, newbackup)));
+	for(i=0; i<len; i++)
+	{
+		if(dirrefs_plan_covers(plan, entries[i].datapth))
+			continue;
+		if(!entries[i].unchanged)
+		{
+			build_data(sdirs, newbackup, entries[i].datapth);
+			continue;
+		}
+		fail_unless((oldpath=strdup_w(data_path(sdirs, oldbackup,
+			entries[i].datapth), __func__))!=NULL);
+		fail_unless(!build_path_w(data_path(sdirs, newbackup,
+			entries[i].datapth)));
+		fail_unless(!link(oldpath, data_path(sdirs, newbackup,
+			entries[i].datapth)));
+		free_w(&oldpath);
+	}
+	return plan;
+}
+
+static void build_b1(struct sdirs *sdirs)
+{
+	size_t i;
+	for(i=0; i<ARR_LEN(old_files); i++)
+		build_data(sdirs, B1, old_files[i]);
+}
+
+static void assert_backup(struct sdirs *sdirs, const char *backup)
+{
+	size_t i;
+	for(i=0; i<ARR_LEN(new_files); i++)
+		assert_data(sdirs, backup, new_files[i].datapth);
+}
+
+START_TEST(test_dirrefs_plan)
+{
+	struct dirrefs_plan *plan;
+	struct sdirs *sdirs=setup();
+
+	build_b1(sdirs);
+	plan=plan_backup(sdirs, B1, B2, new_files, ARR_LEN(new_files));
+
+	fail_unless(dirrefs_plan_covers(plan, "t/a/x"));
+	fail_unless(dirrefs_plan_covers(plan, "t/d/e/f"));
+	fail_unless(!dirrefs_plan_covers(plan, "t/b/z"));
+	fail_unless(!dirrefs_plan_covers(plan, "t/c/w"));
+	fail_unless(!dirrefs_plan_covers(plan, "t/ab"));
+	fail_unless(is_lnk_lstat(data_path(sdirs, B2, "t/a"))>0);
+	fail_unless(is_lnk_lstat(data_path(sdirs, B2, "t/d"))>0);
+	fail_unless(is_dir_lstat(data_path(sdirs, B2, "t/b"))>0);
+	fail_unless(is_dir_lstat(data_path(sdirs, B2, "t/c"))>0);
+	assert_ref(sdirs, B2, "t/a", "../../../" B1 "/data/t/a");
+	assert_refs_file(sdirs, B2, B1 "\tt/a\n" B1 "\tt/d\n");
+	assert_backup(sdirs, B2);
+
+	dirrefs_plan_free(&plan);
+	fail_unless(plan==NULL);
+	tear_down(&sdirs);
+}
+END_TEST
+
+START_TEST(test_dirrefs_plan_nothing_old)
+{
+	struct dirrefs_plan *plan;
+	struct sdirs *sdirs=setup();
+
+	fail_unless(!build_path_w(data_path(sdirs, B1, "t")));
+	fail_unless((plan=dirrefs_plan_alloc())!=NULL);
+	fail_unless(!dirrefs_plan_add(plan, "t/a/x", 1));
+	fail_unless(!dirrefs_plan_finish(plan, backup_path(sdirs, B1), B1));
+	fail_unless(!dirrefs_plan_link(plan, backup_path(sdirs, B2)));
+	fail_unless(!dirrefs_plan_covers(plan, "t/a/x"));
+	assert_refs_file(sdirs, B2, NULL);
+	dirrefs_plan_free(&plan);
+	tear_down(&sdirs);
+}
+END_TEST
+
+// A second run, after being interrupted, finds its symlinks already there.
+START_TEST(test_dirrefs_plan_again)
+{
+	struct dirrefs_plan *plan;
+	struct sdirs *sdirs=setup();
+
+	build_b1(sdirs);
+	plan=plan_backup(sdirs, B1, B2, new_files, 2);
+	dirrefs_plan_free(&plan);
+	fail_unless((plan=dirrefs_plan_alloc())!=NULL);
+	fail_unless(!dirrefs_plan_add(plan, "t/a/x", 1));
+	fail_unless(!dirrefs_plan_add(plan, "t/a/y", 1));
+	fail_unless(!dirrefs_plan_finish(plan, backup_path(sdirs, B1), B1));
+	fail_unless(!dirrefs_plan_link(plan, backup_path(sdirs, B2)));
+	fail_unless(dirrefs_plan_covers(plan, "t/a/x"));
+	assert_refs_file(sdirs, B2, B1 "\tt/a\n");
+	dirrefs_plan_free(&plan);
+	tear_down(&sdirs);
+}
+END_TEST
+
+static struct entry b3_files[] = {
+	{ "t/a/x", 1 },
+	{ "t/a/y", 1 },
+	{ "t/b/new", 1 },
+	{ "t/b/z", 0 },
+	{ "t/c/w", 1 },
+	{ "t/d/e/f", 1 },
+	{ "t/d/g", 1 }
+};
+
+// Backup 3 refers to 'a' and 'd' in backup 1 through backup 2, and to 'c'
+// in backup 2.
+static struct bu *setup_three(struct sdirs *sdirs)
+{
+	struct bu *bu_list=NULL;
+	struct dirrefs_plan *plan;
+
+	build_b1(sdirs);
+	plan=plan_backup(sdirs, B1, B2, new_files, ARR_LEN(new_files));
+	dirrefs_plan_free(&plan);
+	plan=plan_backup(sdirs, B2, B3, b3_files, ARR_LEN(b3_files));
+	dirrefs_plan_free(&plan);
+	assert_ref(sdirs, B3, "t/a", "../../../" B1 "/data/t/a");
+	assert_ref(sdirs, B3, "t/c", "../../../" B2 "/data/t/c");
+	assert_refs_file(sdirs, B3,
+		B1 "\tt/a\n" B2 "\tt/c\n" B1 "\tt/d\n");
+	assert_backup(sdirs, B3);
+
+	fail_unless(!bu_get_list(sdirs, &bu_list));
+	fail_unless(bu_list && bu_list->next && bu_list->next->next);
+	return bu_list;
+}
+
+START_TEST(test_dirrefs_hand_over)
+{
+	struct bu *bu_list;
+	struct sdirs *sdirs=setup();
+
+	bu_list=setup_three(sdirs);
+
+	// Delete backup 1.
+	fail_unless(!dirrefs_hand_over(bu_list));
+	fail_unless(!recursive_delete(bu_list->path));
+	fail_unless(is_dir_lstat(data_path(sdirs, B2, "t/a"))>0);
+	fail_unless(is_dir_lstat(data_path(sdirs, B2, "t/d"))>0);
+	assert_refs_file(sdirs, B2, NULL);
+	assert_ref(sdirs, B3, "t/a", "../../../" B2 "/data/t/a");
+	assert_refs_file(sdirs, B3,
+		B2 "\tt/a\n" B2 "\tt/c\n" B2 "\tt/d\n");
+	assert_backup(sdirs, B2);
+	assert_backup(sdirs, B3);
+
+	// Then backup 2.
+	fail_unless(!dirrefs_hand_over(bu_list->next));
+	fail_unless(!recursive_delete(bu_list->next->path));
+	fail_unless(is_dir_lstat(data_path(sdirs, B3, "t/a"))>0);
+	fail_unless(is_dir_lstat(data_path(sdirs, B3, "t/c"))>0);
+	assert_refs_file(sdirs, B3, NULL);
+	assert_backup(sdirs, B3);
+
+	bu_list_free(&bu_list);
+	tear_down(&sdirs);
+}
+END_TEST
+
+START_TEST(test_dirrefs_hand_over_middle)
+{
+	struct bu *bu_list;
+	struct sdirs *sdirs=setup();
+
+	bu_list=setup_three(sdirs);
+
+	// Backup 2 owns nothing that backup 3 can lose.
+	fail_unless(!dirrefs_hand_over(bu_list->next));
+	fail_unless(!recursive_delete(bu_list->next->path));
+	assert_refs_file(sdirs, B3, B1 "\tt/a\n" B1 "\tt/d\n");
+	assert_backup(sdirs, B3);
+
+	bu_list_free(&bu_list);
+	tear_down(&sdirs);
+}
+END_TEST
+
+// Interrupted after moving the directory, before saving the refs.
+START_TEST(test_dirrefs_hand_over_again)
+{
+	struct bu *bu_list;
+	struct sdirs *sdirs=setup();
+	char *src;
+	char *dst;
+
+	bu_list=setup_three(sdirs);
+	fail_unless((src=strdup_w(data_path(sdirs, B1, "t/a"),
+		__func__))!=NULL);
+	fail_unless((dst=strdup_w(data_path(sdirs, B2, "t/a"),
+		__func__))!=NULL);
+	fail_unless(!unlink(dst));
+	fail_unless(!rename(src, dst));
+
+	fail_unless(!dirrefs_hand_over(bu_list));
+	fail_unless(!recursive_delete(bu_list->path));
+	assert_refs_file(sdirs, B2, NULL);
+	assert_backup(sdirs, B2);
+	assert_backup(sdirs, B3);
+
+	free_w(&src);
+	free_w(&dst);
+	bu_list_free(&bu_list);
+	tear_down(&sdirs);
+}
+END_TEST
+
+Suite *suite_server_dirrefs(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_dirrefs");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_dirrefs_plan);
+	tcase_add_test(tc_core, test_dirrefs_plan_nothing_old);
+	tcase_add_test(tc_core, test_dirrefs_plan_again);
+	tcase_add_test(tc_core, test_dirrefs_hand_over);
+	tcase_add_test(tc_core, test_dirrefs_hand_over_middle);
+	tcase_add_test(tc_core, test_dirrefs_hand_over_again);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -153,7 +153,7 @@ static const char *get_features(int srestore, const char *version)
 	if(version && !strcmp(version, "1.4.40"))
 		old_version=1;
 
-	snprintf(features, sizeof(features), "extra_comms_begin ok:autoupgrade:incexc:orig_client:uname:failover:vss_restore:regex_icase:%s%smsg:forceproto=1:%sseed:", srestore?"srestore:":"", old_version?"":"counters_json:", rshash);
+	snprintf(features, sizeof(features), "extra_comms_begin ok:autoupgrade:incexc:orig_client:uname:failover:vss_restore:regex_icase:%s%smsg:forceproto=1:%sseed:large_frames:", srestore?"srestore:":"", old_version?"":"counters_json:", rshash);
 	return features;
 }
 
@@ -297,6 +297,22 @@ static void checks_uname_is_windows(struct conf **confs, struct conf **cconfs,
 	fail_unless(get_int(cconfs[OPT_CLIENT_IS_WINDOWS])==1);
 }
 
+static struct asfd *large_frames_asfd;
+
+static void setup_large_frames(struct asfd *asfd,
+	struct conf **confs, struct conf **cconfs)
+{
+	large_frames_asfd=asfd;
+	setup_simple(asfd, confs, cconfs, "large_frames", /*srestore*/0);
+}
+
+static void checks_large_frames(struct conf **confs, struct conf **cconfs,
+	const char *incexc, int srestore)
+{
+	fail_unless(large_frames_asfd->large_frames==1);
+	fail_unless(asfd_frame_len(large_frames_asfd)==ASYNC_LARGE_BUF_LEN);
+}
+
 static void setup_unexpected_feature(struct asfd *asfd,
 	struct conf **confs, struct conf **cconfs)
 {
@@ -526,6 +542,7 @@ START_TEST(test_server_extra_comms)
 	run_test(0, setup_msg, checks_msg);
 	run_test(0, setup_uname, checks_uname);
 	run_test(0, setup_uname_is_windows, checks_uname_is_windows);
+	run_test(0, setup_large_frames, checks_large_frames);
 	run_test(-1, setup_unexpected_feature, NULL);
 	run_test(0, setup_srestore_not_ok, checks_srestore_not_ok);
 
@@ -0,0 +1,152 @@
+#include "../test.h"
+#include "../builders/build_file.h"
+#include "../../src/alloc.h"
+#include "../../src/fsops.h"
+#include "../../src/server/ingest_dedup.h"
+
+#define BASE		"utest_server_ingest_dedup"
+#define INDEX		BASE "/.ingest_dedup/a_group"
+#define FILE1		BASE "/client1/data/file"
+#define FILE2		BASE "/client2/data/file"
+#define FILE3		BASE "/client3/data/file"
+#define MD5		"0123456789abcdef0123456789abcdef"
+#define ENDFILE		"10:" MD5
+#define ENTRY		INDEX "/01/" MD5 ".10"
+
+static void setup(void)
+{
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!build_path_w(FILE1));
+	fail_unless(!build_path_w(FILE2));
+	fail_unless(!build_path_w(FILE3));
+}
+
+static void tear_down(void)
+{
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static nlink_t links(const char *path)
+{
+	struct stat statp;
+	fail_unless(!lstat(path, &statp));
+	return statp.st_nlink;
+}
+
+static int same_file(const char *a, const char *b)
+{
+	struct stat astatp;
+	struct stat bstatp;
+	fail_unless(!lstat(a, &astatp));
+	fail_unless(!lstat(b, &bstatp));
+	return astatp.st_ino==bstatp.st_ino;
+}
+
+START_TEST(test_ingest_dedup)
+{
+	setup();
+
+	build_file(FILE1, "0123456789");
+	build_file(FILE2, "0123456789");
+	fail_unless(!ingest_dedup(INDEX, FILE1, ENDFILE, 10, 1));
+	fail_unless(links(FILE1)==2);
+	fail_unless(same_file(FILE1, ENTRY));
+
+	// Already in the index.
+	fail_unless(!ingest_dedup(INDEX, FILE1, ENDFILE, 10, 1));
+	fail_unless(links(FILE1)==2);
+
+	fail_unless(ingest_dedup(INDEX, FILE2, ENDFILE, 10, 1)==1);
+	fail_unless(same_file(FILE1, FILE2));
+	fail_unless(links(FILE1)==3);
+
+	// Same key, different content.
+	build_file(FILE3, "9876543210");
+	fail_unless(!ingest_dedup(INDEX, FILE3, ENDFILE, 10, 0));
+	fail_unless(!same_file(FILE3, ENTRY));
+	fail_unless(!ingest_dedup(INDEX, FILE3, ENDFILE, 10, 1));
+	fail_unless(same_file(FILE3, ENTRY));
+	fail_unless(links(FILE1)==2);
+
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_ingest_dedup_max_links)
+{
+	setup();
+
+	build_file(FILE1, "0123456789");
+	build_file(FILE2, "0123456789");
+	build_file(FILE3, "0123456789");
+	fail_unless(!ingest_dedup(INDEX, FILE1, ENDFILE, 2, 1));
+	fail_unless(!ingest_dedup(INDEX, FILE2, ENDFILE, 2, 1));
+	fail_unless(same_file(FILE2, ENTRY));
+	fail_unless(ingest_dedup(INDEX, FILE3, ENDFILE, 3, 1)==1);
+	fail_unless(same_file(FILE2, FILE3));
+	fail_unless(!same_file(FILE1, FILE3));
+
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_ingest_dedup_bad_endfile)
+{
+	setup();
+
+	build_file(FILE1, "0123456789");
+	fail_unless(!ingest_dedup(INDEX, FILE1, "10", 10, 1));
+	fail_unless(!ingest_dedup(INDEX, FILE1, "10:xyz", 10, 1));
+	fail_unless(!ingest_dedup(INDEX, FILE1, NULL, 10, 1));
+	fail_unless(!ingest_dedup(NULL, FILE1, ENDFILE, 10, 1));
+	fail_unless(links(FILE1)==1);
+	fail_unless(is_dir_lstat(INDEX)<=0);
+
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_ingest_dedup_prune)
+{
+	setup();
+
+	build_file(FILE1, "0123456789");
+	build_file(FILE2, "0123456789");
+	fail_unless(!ingest_dedup(INDEX, FILE1, ENDFILE, 10, 1));
+	fail_unless(ingest_dedup(INDEX, FILE2, ENDFILE, 10, 1)==1);
+
+	fail_unless(!unlink(FILE1));
+	ingest_dedup_prune(INDEX);
+	fail_unless(is_reg_lstat(ENTRY)>0);
+
+	fail_unless(!unlink(FILE2));
+	ingest_dedup_prune(INDEX);
+	fail_unless(is_reg_lstat(ENTRY)<=0);
+	fail_unless(is_dir_lstat(INDEX)<=0);
+
+	// Nothing there.
+	ingest_dedup_prune(INDEX);
+	ingest_dedup_prune(NULL);
+
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_ingest_dedup(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_ingest_dedup");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_ingest_dedup);
+	tcase_add_test(tc_core, test_ingest_dedup_max_links);
+	tcase_add_test(tc_core, test_ingest_dedup_bad_endfile);
+	tcase_add_test(tc_core, test_ingest_dedup_prune);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
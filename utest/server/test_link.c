@@ -0,0 +1,151 @@
+#include "../test.h"
+#include "../builders/build_file.h"
+#include "../../src/alloc.h"
+#include "../../src/conf.h"
+#include "../../src/fsops.h"
+#include "../../src/server/link.h"
+
+#define BASE		"utest_server_link"
+#define OLDPATH		BASE "/old"
+#define NEWPATH		BASE "/new"
+
+static struct conf **setup(int max_hardlinks)
+{
+	struct conf **confs;
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!build_path_w(OLDPATH));
+	fail_unless((confs=confs_alloc())!=NULL);
+	fail_unless(!confs_init(confs));
+	fail_unless(!set_int(confs[OPT_MAX_HARDLINKS], max_hardlinks));
+	return confs;
+}
+
+static void tear_down(struct conf ***confs)
+{
+	confs_free(confs);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static void build_old(size_t len)
+{
+	size_t i;
+	char *buf;
+	FILE *fp;
+	fail_unless((buf=(char *)malloc_w(len+1, __func__))!=NULL);
+	for(i=0; i<len; i++)
+		buf[i]='a'+i%26;
+	fail_unless((fp=fopen(OLDPATH, "wb"))!=NULL);
+	fail_unless(fwrite(buf, 1, len, fp)==len);
+	fail_unless(!fclose(fp));
+	free_w(&buf);
+}
+
+static void assert_same(void)
+{
+	int a;
+	int b;
+	FILE *ofp;
+	FILE *nfp;
+	fail_unless((ofp=fopen(OLDPATH, "rb"))!=NULL);
+	fail_unless((nfp=fopen(NEWPATH, "rb"))!=NULL);
+	do
+	{
+		a=fgetc(ofp);
+		b=fgetc(nfp);
+		fail_unless(a==b);
+	} while(a!=EOF);
+	fclose(ofp);
+	fclose(nfp);
+}
+
+static nlink_t links(const char *path)
+{
+	struct stat statp;
+	fail_unless(!lstat(path, &statp));
+	return statp.st_nlink;
+}
+
+static uint64_t duplicated(void)
+{
+	struct link_stats stats;
+	link_get_stats(&stats);
+	return stats.reflinked+stats.range_copied+stats.copied;
+}
+
+START_TEST(test_do_link)
+{
+	struct stat statp;
+	uint64_t before=duplicated();
+	struct conf **confs=setup(10000);
+
+	build_old(10);
+	fail_unless(!lstat(OLDPATH, &statp));
+	fail_unless(!do_link(OLDPATH, NEWPATH, &statp, confs, 0));
+	fail_unless(links(NEWPATH)==2);
+	fail_unless(do_link(OLDPATH, NEWPATH, &statp, confs, 0)==-1);
+	fail_unless(!do_link(OLDPATH, NEWPATH, &statp, confs, 1));
+	fail_unless(duplicated()==before);
+	tear_down(&confs);
+}
+END_TEST
+
+static void do_test_duplicate(size_t len)
+{
+	struct stat statp;
+	uint64_t before=duplicated();
+	struct conf **confs=setup(1);
+
+	build_old(len);
+	fail_unless(!lstat(OLDPATH, &statp));
+	fail_unless(!do_link(OLDPATH, NEWPATH, &statp, confs, 0));
+	fail_unless(links(OLDPATH)==1);
+	fail_unless(links(NEWPATH)==1);
+	assert_same();
+	fail_unless(duplicated()==before+1);
+
+	// Whatever was there gets replaced.
+	build_file(NEWPATH, "something else entirely");
+	fail_unless(!do_link(OLDPATH, NEWPATH, &statp, confs, 0));
+	assert_same();
+	link_log_stats();
+	tear_down(&confs);
+}
+
+START_TEST(test_do_link_duplicate)
+{
+	do_test_duplicate(0);
+	do_test_duplicate(10);
+	do_test_duplicate(1024*1024+7);
+}
+END_TEST
+
+START_TEST(test_do_link_duplicate_missing)
+{
+	struct stat statp;
+	struct conf **confs=setup(1);
+
+	build_old(10);
+	fail_unless(!lstat(OLDPATH, &statp));
+	fail_unless(!unlink(OLDPATH));
+	fail_unless(do_link(OLDPATH, NEWPATH, &statp, confs, 0)==-1);
+	tear_down(&confs);
+}
+END_TEST
+
+Suite *suite_server_link(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_link");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_do_link);
+	tcase_add_test(tc_core, test_do_link_duplicate);
+	tcase_add_test(tc_core, test_do_link_duplicate_missing);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
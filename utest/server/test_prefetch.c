@@ -0,0 +1,122 @@
+#include "../test.h"
+#include "../builders/build.h"
+#include "../builders/build_file.h"
+#include "../prng.h"
+#include "../../src/alloc.h"
+#include "../../src/bu.h"
+#include "../../src/fsops.h"
+#include "../../src/prepend.h"
+#include "../../src/sbuf.h"
+#include "../../src/slist.h"
+#include "../../src/server/bu_get.h"
+#include "../../src/server/prefetch.h"
+#include "../../src/server/sdirs.h"
+
+#define BASE	"utest_server_prefetch"
+
+static struct sd sd1[] = {
+	{ "0000001 1970-01-01 00:00:00", 1, 1, BU_CURRENT },
+};
+
+static struct sdirs *setup(void)
+{
+	struct sdirs *sdirs;
+	prng_init(0);
+	fail_unless(!recursive_delete(BASE));
+	fail_unless((sdirs=sdirs_alloc())!=NULL);
+	fail_unless(!sdirs_init(sdirs,
+		BASE, // directory
+		"utestclient", // cname
+		NULL, // client_lockdir
+		"a_group", // dedup_group
+		NULL // manual_delete
+	));
+	return sdirs;
+}
+
+static void tear_down(struct sdirs **sdirs)
+{
+	sdirs_free(sdirs);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+// Returns the number of data files created in the first 'ahead' entries.
+static uint64_t build_data_files(struct sdirs *sdirs, struct slist *slist,
+	int ahead, uint64_t *total)
+{
+	int i=0;
+	uint64_t count=0;
+	struct sbuf *s;
+	char path[256];
+	*total=0;
+	for(s=slist->head; s; s=s->next, i++)
+	{
+		if(!sbuf_is_filedata(s))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s%s",
+			sdirs->currentdata, TREE_DIR, s->path.buf);
+		build_file(path, "data");
+		(*total)++;
+		if(i<ahead)
+			count++;
+	}
+	return count;
+}
+
+static void run_test(int entries, int ahead)
+{
+	int i;
+	uint64_t total;
+	uint64_t expected;
+	struct bu *bu_list=NULL;
+	struct slist *slist=NULL;
+	struct prefetch *prefetch=NULL;
+	struct sdirs *sdirs=setup();
+
+	build_storage_dirs(sdirs, sd1, ARR_LEN(sd1));
+	slist=build_manifest(sdirs->cmanifest, entries, 0 /*phase*/);
+	expected=build_data_files(sdirs, slist, ahead, &total);
+	fail_unless(!bu_get_list(sdirs, &bu_list));
+
+	fail_unless((prefetch=prefetch_alloc())!=NULL);
+	fail_unless(!prefetch_init(prefetch, sdirs->cmanifest,
+		bu_list, NULL /*regex*/, ahead));
+	fail_unless(prefetch->hinted==expected);
+
+	// Advancing past the end is harmless.
+	for(i=0; i<entries+2; i++)
+		prefetch_advance(prefetch);
+	fail_unless(prefetch->finished==1);
+	fail_unless(prefetch->hinted==total);
+
+	prefetch_free(&prefetch);
+	fail_unless(prefetch==NULL);
+	prefetch_advance(prefetch);
+	bu_list_free(&bu_list);
+	slist_free(&slist);
+	tear_down(&sdirs);
+}
+
+START_TEST(test_prefetch)
+{
+	run_test(20, 0);
+	run_test(20, 5);
+	run_test(20, 50);
+}
+END_TEST
+
+Suite *suite_server_prefetch(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_prefetch");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_prefetch);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -0,0 +1,180 @@
+#include "../test.h"
+#include "../builders/build.h"
+#include "../builders/build_file.h"
+#include "../../src/alloc.h"
+#include "../../src/bu.h"
+#include "../../src/fsops.h"
+#include "../../src/prepend.h"
+#include "../../src/server/bu_get.h"
+#include "../../src/server/rcache.h"
+#include "../../src/server/sdirs.h"
+
+#include <utime.h>
+
+#define BASE		"utest_server_rcache"
+#define DATAPTH		"t/0000/0000/0001"
+#define SRC		BASE "/src"
+#define DEST		BASE "/dest"
+#define CONTENT		"0123456789012345678901234567890123456789"
+
+static struct sd sd123[] = {
+	{ "0000001 1970-01-01 00:00:00", 1, 1, BU_DELETABLE },
+	{ "0000002 1970-01-02 00:00:00", 2, 2, 0 },
+	{ "0000003 1970-01-03 00:00:00", 3, 3, BU_CURRENT }
+};
+
+static struct sdirs *setup(struct bu **bu_list)
+{
+	struct sdirs *sdirs;
+	fail_unless(!recursive_delete(BASE));
+	fail_unless((sdirs=sdirs_alloc())!=NULL);
+	fail_unless(!sdirs_init(sdirs,
+		BASE, // directory
+		"utestclient", // cname
+		NULL, // client_lockdir
+		"a_group", // dedup_group
+		NULL // manual_delete
+	));
+	build_storage_dirs(sdirs, sd123, ARR_LEN(sd123));
+	fail_unless(!bu_get_list(sdirs, bu_list));
+	return sdirs;
+}
+
+static void tear_down(struct sdirs **sdirs, struct bu **bu_list)
+{
+	rcache_free();
+	bu_list_free(bu_list);
+	sdirs_free(sdirs);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static void put_aged(const char *datapth, struct bu *bu, time_t age)
+{
+	struct utimbuf ut;
+	unlink(SRC);
+	build_file(SRC, CONTENT);
+	ut.actime=ut.modtime=time(NULL)-age;
+	fail_unless(!utime(SRC, &ut));
+	rcache_put(datapth, bu, SRC);
+	unlink(SRC);
+}
+
+static int cached(struct sdirs *sdirs, const char *datapth, struct bu *bu)
+{
+	int ret;
+	char *dir;
+	char *path;
+	fail_unless((dir=prepend_s(sdirs->rcache, bu->basename))!=NULL);
+	fail_unless((path=prepend_s(dir, datapth))!=NULL);
+	ret=is_reg_lstat(path)>0;
+	free_w(&dir);
+	free_w(&path);
+	return ret;
+}
+
+START_TEST(test_rcache_off)
+{
+	struct bu *bu_list=NULL;
+	struct sdirs *sdirs=setup(&bu_list);
+	fail_unless(!rcache_init(sdirs->rcache, 0));
+	put_aged(DATAPTH, bu_list->next, 0);
+	fail_unless(!cached(sdirs, DATAPTH, bu_list->next));
+	fail_unless(rcache_get(DATAPTH, bu_list, NULL, DEST)==NULL);
+	tear_down(&sdirs, &bu_list);
+}
+END_TEST
+
+START_TEST(test_rcache_get)
+{
+	struct bu *bu_list=NULL;
+	struct bu *b1;
+	struct bu *b2;
+	struct bu *b3;
+	struct sdirs *sdirs=setup(&bu_list);
+	b1=bu_list;
+	b2=b1->next;
+	b3=b2->next;
+	fail_unless(!rcache_init(sdirs->rcache, 1024));
+
+	fail_unless(rcache_get(DATAPTH, b1, b3, DEST)==NULL);
+	put_aged(DATAPTH, b2, 0);
+	fail_unless(cached(sdirs, DATAPTH, b2));
+
+	// Found from an older backup, but not past the stop backup.
+	fail_unless(rcache_get(DATAPTH, b1, b3, DEST)==b2);
+	fail_unless(is_reg_lstat(DEST)>0);
+	fail_unless(rcache_get(DATAPTH, b2, b3, DEST)==b2);
+	fail_unless(rcache_get(DATAPTH, b1, b2, DEST)==NULL);
+	fail_unless(rcache_get(DATAPTH, b3, b3, DEST)==NULL);
+	fail_unless(rcache_get("t/other", b1, b3, DEST)==NULL);
+	unlink(DEST);
+
+	// Deleting the backup deletes its cache entries.
+	rcache_delete_backup(sdirs->rcache, b2);
+	fail_unless(!cached(sdirs, DATAPTH, b2));
+	fail_unless(rcache_get(DATAPTH, b1, b3, DEST)==NULL);
+
+	tear_down(&sdirs, &bu_list);
+}
+END_TEST
+
+START_TEST(test_rcache_evict)
+{
+	struct bu *bu_list=NULL;
+	struct bu *b1;
+	struct bu *b2;
+	struct sdirs *sdirs=setup(&bu_list);
+	b1=bu_list;
+	b2=b1->next;
+
+	// Room for two entries.
+	fail_unless(!rcache_init(sdirs->rcache, 2*strlen(CONTENT)+10));
+	put_aged("t/a", b1, 300);
+	put_aged("t/b", b1, 200);
+	put_aged("t/c", b2, 100);
+	put_aged("t/d", b2, 10);
+
+	// The least recently used entries got removed.
+	fail_unless(!cached(sdirs, "t/a", b1));
+	fail_unless(!cached(sdirs, "t/b", b1));
+	fail_unless(cached(sdirs, "t/c", b2));
+	fail_unless(cached(sdirs, "t/d", b2));
+	rcache_free();
+
+	// A hit makes an entry recently used. A new run finds the existing
+	// entries on disk.
+	fail_unless(!rcache_init(sdirs->rcache, 2*strlen(CONTENT)+10));
+	fail_unless(rcache_get("t/c", b2, NULL, DEST)==b2);
+	unlink(DEST);
+	put_aged("t/e", b1, 0);
+	fail_unless(cached(sdirs, "t/c", b2));
+	fail_unless(!cached(sdirs, "t/d", b2));
+	fail_unless(cached(sdirs, "t/e", b1));
+
+	// Too big for the cache.
+	rcache_free();
+	fail_unless(!rcache_init(sdirs->rcache, 10));
+	put_aged("t/f", b1, 0);
+	fail_unless(!cached(sdirs, "t/f", b1));
+
+	tear_down(&sdirs, &bu_list);
+}
+END_TEST
+
+Suite *suite_server_rcache(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_rcache");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_rcache_off);
+	tcase_add_test(tc_core, test_rcache_get);
+	tcase_add_test(tc_core, test_rcache_evict);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
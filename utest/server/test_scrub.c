@@ -0,0 +1,338 @@
+#include "../test.h"
+#include "../prng.h"
+#include "../builders/build.h"
+#include "../builders/build_file.h"
+#include "../../src/alloc.h"
+#include "../../src/attribs.h"
+#include "../../src/base64.h"
+#include "../../src/bu.h"
+#include "../../src/fsops.h"
+#include "../../src/fzp.h"
+#include "../../src/hexmap.h"
+#include "../../src/md5.h"
+#include "../../src/prepend.h"
+#include "../../src/sbuf.h"
+#include "../../src/server/bu_get.h"
+#include "../../src/server/chunks.h"
+#include "../../src/server/manio.h"
+#include "../../src/server/scrub.h"
+#include "../../src/server/sdirs.h"
+
+#define BASE		"utest_server_scrub"
+#define DATAPTH1	"t/0000/0000/0001"
+#define DATAPTH2	"t/0000/0000/0002"
+#define DATAPTH3	"t/0000/0000/0003"
+#define DATAPTH4	"t/0000/0000/0004"
+#define DATAPTH5	"t/0000/0000/0005"
+#define DATAPTH6	"t/0000/0000/0006"
+#define DATAPTH7	"t/0000/0000/0007"
+#define ONE		"file one"
+#define TWO		"file two"
+#define THREE		"file three"
+#define MD5_ONE		"e6bbb3095edb03733dfa4e6dd9962cfb"
+#define MD5_TWO		"f03e17819231fd2ea06d3013ee1e3b2c"
+#define MD5_THREE	"f1aad22b17992651f9fbf60c5ebd9920"
+#define MD5_FOUR	"8cc9e752c5cb72c701657b5ae2e19a86"
+
+static struct sd sd123[] = {
+	{ "0000001 1970-01-01 00:00:00", 1, 1, BU_DELETABLE },
+	{ "0000002 1970-01-02 00:00:00", 2, 2, 0 },
+	{ "0000003 1970-01-03 00:00:00", 3, 3, BU_CURRENT }
+};
+
+static struct sdirs *setup(struct bu **bu_list)
+{
+	struct sdirs *sdirs;
+	base64_init();
+	fail_unless(!recursive_delete(BASE));
+	fail_unless((sdirs=sdirs_alloc())!=NULL);
+	fail_unless(!sdirs_init(sdirs,
+		BASE, // directory
+		"utestclient", // cname
+		NULL, // client_lockdir
+		"a_group", // dedup_group
+		NULL // manual_delete
+	));
+	build_storage_dirs(sdirs, sd123, ARR_LEN(sd123));
+	fail_unless(!bu_get_list(sdirs, bu_list));
+	return sdirs;
+}
+
+static void tear_down(struct sdirs **sdirs, struct bu **bu_list)
+{
+	bu_list_free(bu_list);
+	sdirs_free(sdirs);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static struct bu *get_bu(struct bu *bu_list, uint64_t bno)
+{
+	struct bu *bu;
+	for(bu=bu_list; bu; bu=bu->next)
+		if(bu->bno==bno)
+			return bu;
+	fail_unless(0);
+	return NULL;
+}
+
+static char *get_path(const char *dir, const char *datapth)
+{
+	char *path;
+	fail_unless((path=prepend_s(dir, datapth))!=NULL);
+	fail_unless(!build_path_w(path));
+	return path;
+}
+
+static void write_data(const char *dir, const char *datapth,
+	const void *buf, size_t len, int compression)
+{
+	char *path=get_path(dir, datapth);
+	struct fzp *fzp;
+	if(compression)
+		fail_unless((fzp=fzp_gzopen(path, "wb9"))!=NULL);
+	else
+		fail_unless((fzp=fzp_open(path, "wb"))!=NULL);
+	fail_unless(fzp_write(fzp, buf, len)==len);
+	fail_unless(!fzp_close(&fzp));
+	free_w(&path);
+}
+
+static void truncate_data(const char *dir, const char *datapth)
+{
+	char *path=get_path(dir, datapth);
+	fail_unless(!truncate(path, 20));
+	free_w(&path);
+}
+
+static void add_entry(struct manio *manio, enum cmd cmd,
+	const char *path, const char *datapth, const char *endfile,
+	int compression)
+{
+	struct sbuf *sb;
+	fail_unless((sb=sbuf_alloc())!=NULL);
+	sb->compression=compression;
+	attribs_encode(sb);
+	fail_unless((path=strdup_w(path, __func__))!=NULL);
+	iobuf_from_str(&sb->path, cmd, (char *)path);
+	if(datapth)
+	{
+		fail_unless((datapth=strdup_w(datapth, __func__))!=NULL);
+		iobuf_from_str(&sb->datapth, CMD_DATAPTH, (char *)datapth);
+	}
+	if(endfile)
+	{
+		fail_unless((endfile=strdup_w(endfile, __func__))!=NULL);
+		iobuf_from_str(&sb->endfile, CMD_END_FILE, (char *)endfile);
+	}
+	fail_unless(!manio_write_sbuf(manio, sb));
+	sbuf_free(&sb);
+}
+
+static struct manio *open_manifest(struct bu *bu)
+{
+	char *manifest;
+	struct manio *manio;
+	fail_unless((manifest=prepend_s(bu->path, "manifest.gz"))!=NULL);
+	fail_unless((manio=manio_open(manifest, "wb"))!=NULL);
+	free_w(&manifest);
+	return manio;
+}
+
+// A good file of each kind, one that has gone bad, one that has gone
+// missing, and one that has no md5sum.
+static void build_backup(struct bu *bu)
+{
+	struct manio *manio=open_manifest(bu);
+
+	add_entry(manio, CMD_FILE, "/a", DATAPTH1, "8:" MD5_ONE, 9);
+	write_data(bu->data, DATAPTH1, ONE, strlen(ONE), 1);
+	add_entry(manio, CMD_FILE, "/b", DATAPTH2, "8:" MD5_TWO, 0);
+	write_data(bu->data, DATAPTH2, TWO, strlen(TWO), 0);
+	// Encrypted data is checked as it is stored.
+	add_entry(manio, CMD_ENC_FILE, "/c", DATAPTH3, "10:" MD5_THREE, 9);
+	write_data(bu->data, DATAPTH3, THREE, strlen(THREE), 0);
+	add_entry(manio, CMD_FILE, "/d", DATAPTH4, "9:" MD5_FOUR, 9);
+	write_data(bu->data, DATAPTH4, THREE, strlen(THREE), 1);
+	add_entry(manio, CMD_FILE, "/e", DATAPTH5, "8:" MD5_ONE, 9);
+	add_entry(manio, CMD_FILE, "/f", DATAPTH6, "8", 9);
+	write_data(bu->data, DATAPTH6, ONE, strlen(ONE), 1);
+	add_entry(manio, CMD_DIRECTORY, "/g", NULL, NULL, 0);
+
+	fail_unless(!manio_close(&manio));
+}
+
+static int report_has(struct bu *bu, const char *line)
+{
+	int found=0;
+	char buf[256];
+	char *path;
+	struct fzp *fzp;
+	fail_unless((path=prepend_s(bu->path, SCRUB_REPORT))!=NULL);
+	fail_unless((fzp=fzp_open(path, "rb"))!=NULL);
+	while(fzp_gets(fzp, buf, sizeof(buf)))
+		if(!strcmp(buf, line))
+			found++;
+	fail_unless(!fzp_close(&fzp));
+	free_w(&path);
+	return found;
+}
+
+static void do_test_scrub(int workers)
+{
+	struct bu *bu;
+	struct bu *bu_list=NULL;
+	struct scrub_stats stats;
+	struct sdirs *sdirs=setup(&bu_list);
+
+	bu=get_bu(bu_list, 3);
+	build_backup(bu);
+	fail_unless(!scrub_backup(sdirs, bu, workers, 0, &stats));
+	fail_unless(stats.files==3);
+	fail_unless(stats.bytes==strlen(ONE)+strlen(TWO)+strlen(THREE));
+	fail_unless(stats.partial==1);
+	fail_unless(stats.corrupt==1);
+	fail_unless(stats.missing==1);
+	fail_unless(report_has(bu, "corrupt " DATAPTH4 "\n")==1);
+	fail_unless(report_has(bu, "missing " DATAPTH5 "\n")==1);
+	fail_unless(report_has(bu, "corrupt " DATAPTH1 "\n")==0);
+
+	tear_down(&sdirs, &bu_list);
+}
+
+START_TEST(test_scrub)
+{
+	do_test_scrub(1);
+}
+END_TEST
+
+START_TEST(test_scrub_workers)
+{
+	do_test_scrub(3);
+	do_test_scrub(20);
+}
+END_TEST
+
+START_TEST(test_scrub_deltas)
+{
+	struct bu *bu;
+	struct bu *bu_list=NULL;
+	struct manio *manio;
+	struct scrub_stats stats;
+	struct sdirs *sdirs=setup(&bu_list);
+
+	// The files are only in the newest backup, so the older ones have
+	// reverse deltas.
+	bu=get_bu(bu_list, 3);
+	write_data(bu->data, DATAPTH1, ONE, strlen(ONE), 1);
+	write_data(bu->data, DATAPTH2, TWO, strlen(TWO), 1);
+	bu=get_bu(bu_list, 2);
+	write_data(bu->delta, DATAPTH1, TWO, strlen(TWO), 1);
+	write_data(bu->delta, DATAPTH2, ONE, strlen(ONE), 1);
+	bu=get_bu(bu_list, 1);
+	write_data(bu->delta, DATAPTH1, TWO, strlen(TWO), 1);
+	write_data(bu->delta, DATAPTH2, ONE, strlen(ONE), 1);
+	truncate_data(bu->delta, DATAPTH2);
+
+	manio=open_manifest(bu);
+	add_entry(manio, CMD_FILE, "/a", DATAPTH1, "8:" MD5_TWO, 9);
+	add_entry(manio, CMD_FILE, "/b", DATAPTH2, "8:" MD5_ONE, 9);
+	fail_unless(!manio_close(&manio));
+
+	fail_unless(!scrub_backup(sdirs, bu, 1, 0, &stats));
+	fail_unless(stats.files==0);
+	fail_unless(stats.partial==1);
+	fail_unless(stats.corrupt==1);
+	fail_unless(stats.missing==0);
+	fail_unless(report_has(bu, "unreadable " DATAPTH2 "\n")==1);
+
+	tear_down(&sdirs, &bu_list);
+}
+END_TEST
+
+START_TEST(test_scrub_chunks)
+{
+	size_t i;
+	size_t len=CHUNK_MAX*3;
+	char *path;
+	char endfile[64];
+	uint8_t *buf;
+	uint8_t checksum[MD5_DIGEST_LENGTH];
+	struct bu *bu;
+	struct md5 *md5;
+	struct bu *bu_list=NULL;
+	struct manio *manio;
+	struct scrub_stats stats;
+	struct sdirs *sdirs=setup(&bu_list);
+
+	fail_unless((buf=(uint8_t *)malloc_w(len, __func__))!=NULL);
+	prng_init(1);
+	for(i=0; i<len; i++)
+		buf[i]=(uint8_t)prng_next();
+	fail_unless((md5=md5_alloc(__func__))!=NULL);
+	fail_unless(md5_init(md5));
+	fail_unless(md5_update(md5, buf, len));
+	fail_unless(md5_final(md5, checksum));
+	md5_free(&md5);
+	snprintf(endfile, sizeof(endfile), "%zu:%s",
+		len, bytes_to_md5str(checksum));
+
+	bu=get_bu(bu_list, 3);
+	write_data(bu->data, DATAPTH7, buf, len, 1);
+	path=get_path(bu->data, DATAPTH7);
+	fail_unless(!chunks_store(sdirs->chunks, path, 9));
+	fail_unless(chunks_is_recipe(sdirs->chunks, path)==1);
+	manio=open_manifest(bu);
+	add_entry(manio, CMD_FILE, "/a", DATAPTH7, endfile, 9);
+	fail_unless(!manio_close(&manio));
+
+	fail_unless(!scrub_backup(sdirs, bu, 1, 0, &stats));
+	fail_unless(stats.files==1);
+	fail_unless(stats.bytes==len);
+	fail_unless(stats.corrupt==0);
+
+	free_w(&path);
+	free_v((void **)&buf);
+	tear_down(&sdirs, &bu_list);
+}
+END_TEST
+
+START_TEST(test_scrub_max_rate)
+{
+	time_t start;
+	struct bu *bu;
+	struct bu *bu_list=NULL;
+	struct scrub_stats stats;
+	struct sdirs *sdirs=setup(&bu_list);
+
+	bu=get_bu(bu_list, 3);
+	build_backup(bu);
+	// About 40 bytes at 20 bytes a second.
+	start=time(NULL);
+	fail_unless(!scrub_backup(sdirs, bu, 1, 20, &stats));
+	fail_unless(time(NULL)-start>=1);
+	fail_unless(stats.files==3);
+
+	tear_down(&sdirs, &bu_list);
+}
+END_TEST
+
+Suite *suite_server_scrub(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_scrub");
+
+	tc_core=tcase_create("Core");
+	tcase_set_timeout(tc_core, 60);
+
+	tcase_add_test(tc_core, test_scrub);
+	tcase_add_test(tc_core, test_scrub_workers);
+	tcase_add_test(tc_core, test_scrub_deltas);
+	tcase_add_test(tc_core, test_scrub_chunks);
+	tcase_add_test(tc_core, test_scrub_max_rate);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
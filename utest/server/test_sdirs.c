@@ -1,4 +1,5 @@
 #include "../test.h"
+#include "../builders/build_file.h"
 #include "../../src/alloc.h"
 #include "../../src/conf.h"
 #include "../../src/conffile.h"
@@ -102,6 +103,9 @@ static void all_tests(struct sdirs *sdirs)
 	ck_assert_str_eq(sdirs->current, CLIENT "/current");
 	ck_assert_str_eq(sdirs->currenttmp, CLIENT "/current.tmp");
 	ck_assert_str_eq(sdirs->deleteme, CLIENT "/deleteme");
+	ck_assert_str_eq(sdirs->rcache, CLIENT "/restore_cache");
+	ck_assert_str_eq(sdirs->chunks, CLIENT "/chunks");
+	ck_assert_str_eq(sdirs->ingest_dedup, BASE "/.ingest_dedup/a_group");
 	ck_assert_str_eq(sdirs->timestamp, WORKING "/timestamp");
 	ck_assert_str_eq(sdirs->changed, WORKING "/changed");
 	ck_assert_str_eq(sdirs->unchanged, WORKING "/unchanged");
@@ -150,6 +154,27 @@ START_TEST(test_lockdirs)
 }
 END_TEST
 
+START_TEST(test_sdirs_get_chunks)
+{
+	struct sdirs *sdirs;
+	struct sdirs *sdirs2;
+	sdirs=setup();
+	do_sdirs_init(sdirs, NULL /* client_lockdir */);
+	fail_unless(sdirs_get_chunks(sdirs)==NULL);
+
+	// Not looked for again.
+	build_file(CLIENT "/chunks/id", "0123456789abcdef0123456789abcdef");
+	fail_unless(sdirs_get_chunks(sdirs)==NULL);
+
+	fail_unless((sdirs2=sdirs_alloc())!=NULL);
+	do_sdirs_init(sdirs2, NULL /* client_lockdir */);
+	ck_assert_str_eq(sdirs_get_chunks(sdirs2), CLIENT "/chunks");
+	sdirs_free(&sdirs2);
+
+	tear_down(&sdirs);
+}
+END_TEST
+
 Suite *suite_server_sdirs(void)
 {
 	Suite *s;
@@ -161,6 +186,7 @@ Suite *suite_server_sdirs(void)
 
 	tcase_add_test(tc_core, test_sdirs);
 	tcase_add_test(tc_core, test_lockdirs);
+	tcase_add_test(tc_core, test_sdirs_get_chunks);
 	suite_add_tcase(s, tc_core);
 
 	return s;
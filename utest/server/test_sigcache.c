@@ -0,0 +1,114 @@
+#include "../test.h"
+#include "../builders/build_file.h"
+#include "../../src/alloc.h"
+#include "../../src/conf.h"
+#include "../../src/fsops.h"
+#include "../../src/prepend.h"
+#include "../../src/server/sigcache.h"
+
+#define BASE		"utest_server_sigcache"
+#define OLDDIR		BASE "/old"
+#define NEWDIR		BASE "/new"
+#define DATAPTH		"t/0000/0000/0001"
+
+static struct conf **setup(struct sigcache **sc)
+{
+	struct conf **cconfs;
+	fail_unless(!recursive_delete(BASE));
+	fail_unless((cconfs=confs_alloc())!=NULL);
+	fail_unless(!confs_init(cconfs));
+	fail_unless((*sc=sigcache_alloc())!=NULL);
+	fail_unless(!sigcache_init(*sc, OLDDIR, NEWDIR, cconfs));
+	return cconfs;
+}
+
+static void tear_down(struct conf ***cconfs, struct sigcache **sc)
+{
+	sigcache_free(sc);
+	fail_unless(*sc==NULL);
+	confs_free(cconfs);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static int has_sig(const char *backupdir, struct conf **cconfs,
+	const char *datapth)
+{
+	int ret;
+	char *path;
+	fail_unless((path=sigcache_path(backupdir, cconfs, datapth))!=NULL);
+	ret=is_reg_lstat(path)>0;
+	free_w(&path);
+	return ret;
+}
+
+static void build_old_sig(struct conf **cconfs, const char *datapth)
+{
+	char *path;
+	fail_unless((path=sigcache_path(OLDDIR, cconfs, datapth))!=NULL);
+	fail_unless(!build_path_w(path));
+	build_file(path, "sig");
+	free_w(&path);
+}
+
+START_TEST(test_sigcache_path)
+{
+	char *path;
+	struct sigcache *sc=NULL;
+	struct conf **cconfs=setup(&sc);
+
+	fail_unless((path=sigcache_path(OLDDIR, cconfs, DATAPTH))!=NULL);
+	fail_unless(!strncmp(path, OLDDIR "/" SIGS_DIR "/",
+		strlen(OLDDIR "/" SIGS_DIR "/")));
+	fail_unless(!strcmp(path+strlen(path)-strlen(DATAPTH), DATAPTH));
+	free_w(&path);
+
+	// The directories get created for new signatures.
+	fail_unless((path=sigcache_new_path(sc, DATAPTH))!=NULL);
+	build_file(path, "sig");
+	free_w(&path);
+	fail_unless(has_sig(NEWDIR, cconfs, DATAPTH));
+
+	tear_down(&cconfs, &sc);
+}
+END_TEST
+
+START_TEST(test_sigcache_move)
+{
+	struct sigcache *sc=NULL;
+	struct conf **cconfs=setup(&sc);
+
+	build_old_sig(cconfs, DATAPTH);
+	build_old_sig(cconfs, "t/deleted");
+	sigcache_move(sc, DATAPTH);
+	fail_unless(!has_sig(OLDDIR, cconfs, DATAPTH));
+	fail_unless(has_sig(NEWDIR, cconfs, DATAPTH));
+
+	// Nothing to move.
+	sigcache_move(sc, "t/other");
+	fail_unless(!has_sig(NEWDIR, cconfs, "t/other"));
+
+	// Whatever is left over in the old backup goes.
+	sigcache_tidy(sc);
+	fail_unless(!has_sig(OLDDIR, cconfs, "t/deleted"));
+	fail_unless(has_sig(NEWDIR, cconfs, DATAPTH));
+
+	tear_down(&cconfs, &sc);
+}
+END_TEST
+
+Suite *suite_server_sigcache(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_sigcache");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_sigcache_path);
+	tcase_add_test(tc_core, test_sigcache_move);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
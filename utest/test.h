@@ -8,6 +8,11 @@
 #define ARR_LEN(array) (sizeof((array))/sizeof((array)[0]))
 #define FOREACH(array) for(unsigned int i=0; i<ARR_LEN(array); i++)
 
+// The benchmarks take a long time, especially under valgrind, and print
+// their timings, so they are only run when asked for like this:
+// BURP_UTEST_BENCHMARK=1 make check
+#define BENCHMARKS_WANTED	(getenv("BURP_UTEST_BENCHMARK")!=NULL)
+
 #define MIN_SERVER_CONF_NO_LISTEN		\
 	"mode=server\n"				\
 	"lockfile=/lockfile/path\n"		\
@@ -63,19 +68,25 @@ extern void assert_xattr(const char *expected,
 Suite *suite_alloc(void);
 Suite *suite_asfd(void);
 Suite *suite_attribs(void);
+Suite *suite_bfile(void);
 Suite *suite_base64(void);
 Suite *suite_client_acl(void);
 Suite *suite_client_auth(void);
 Suite *suite_client_backup_phase2(void);
+Suite *suite_client_change_journal(void);
 Suite *suite_client_delete(void);
+Suite *suite_client_delta_worker(void);
 Suite *suite_client_extra_comms(void);
 Suite *suite_client_extrameta(void);
 Suite *suite_client_find(void);
+Suite *suite_client_find_logic(void);
+Suite *suite_client_find_match(void);
 Suite *suite_client_monitor(void);
 Suite *suite_client_monitor_json_input(void);
 Suite *suite_client_monitor_lline(void);
 Suite *suite_client_monitor_status_client_ncurses(void);
 Suite *suite_client_restore(void);
+Suite *suite_client_restore_finish(void);
 Suite *suite_client_xattr(void);
 Suite *suite_cmd(void);
 Suite *suite_cntr(void);
@@ -97,10 +108,15 @@ Suite *suite_server_backup_phase3(void);
 Suite *suite_server_backup_phase4(void);
 Suite *suite_server_blocklen(void);
 Suite *suite_server_bu_get(void);
+Suite *suite_server_chunks(void);
 Suite *suite_server_delete(void);
+Suite *suite_server_delta_chain(void);
+Suite *suite_server_dirrefs(void);
 Suite *suite_server_dpth(void);
 Suite *suite_server_extra_comms(void);
 Suite *suite_server_fdirs(void);
+Suite *suite_server_ingest_dedup(void);
+Suite *suite_server_link(void);
 Suite *suite_server_list(void);
 Suite *suite_server_manio(void);
 Suite *suite_server_monitor_browse(void);
@@ -108,13 +124,18 @@ Suite *suite_server_monitor_cache(void);
 Suite *suite_server_monitor_cstat(void);
 Suite *suite_server_monitor_json_output(void);
 Suite *suite_server_monitor_status_server(void);
+Suite *suite_server_prefetch(void);
+Suite *suite_server_rcache(void);
 Suite *suite_server_resume(void);
 Suite *suite_server_restore(void);
 Suite *suite_server_restore_sbuf(void);
 Suite *suite_server_run_action(void);
+Suite *suite_server_scrub(void);
 Suite *suite_server_sdirs(void);
+Suite *suite_server_sigcache(void);
 Suite *suite_server_timer(void);
 Suite *suite_slist(void);
 Suite *suite_times(void);
+Suite *suite_uring(void);
 
 #endif
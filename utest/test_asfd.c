@@ -2,8 +2,13 @@
 #include "../src/alloc.h"
 #include "../src/asfd.h"
 #include "../src/async.h"
+#include "../src/iobuf.h"
 #include "../src/ssl.h"
 
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
 static struct async *setup(void)
 {
 	struct async *as;
@@ -181,10 +186,608 @@ START_TEST(test_setup_asfd_twice)
 }
 END_TEST
 
+START_TEST(test_iobuf_parse_lead)
+{
+	size_t len;
+	enum cmd cmd;
+	fail_unless(!iobuf_parse_lead("a0000", &cmd, &len));
+	fail_unless(cmd==CMD_APPEND && len==0);
+	fail_unless(!iobuf_parse_lead("f1A2b", &cmd, &len));
+	fail_unless(cmd==CMD_FILE && len==0x1A2B);
+	fail_unless(!iobuf_parse_lead("xFFFF", &cmd, &len));
+	fail_unless(len==0xFFFF);
+	fail_unless(iobuf_parse_lead("a000g", &cmd, &len)==-1);
+	fail_unless(iobuf_parse_lead("a 123", &cmd, &len)==-1);
+	fail_unless(iobuf_parse_lead("a12", &cmd, &len)==-1);
+	fail_unless(iobuf_parse_lead("\0" "0000", &cmd, &len)==-1);
+}
+END_TEST
+
+static size_t add_frame(char *buf, enum cmd cmd, const char *data, size_t len)
+{
+	snprintf(buf, 6, "%c%04X", cmd, (unsigned int)len);
+	memcpy(buf+5, data, len);
+	return len+5;
+}
+
+static struct asfd *setup_pipe(struct async *as, int *wfd)
+{
+	int fds[2];
+	struct asfd *asfd;
+	fail_unless(!pipe(fds));
+	fail_unless((asfd=setup_asfd(as, "pipe", &fds[0], ""))!=NULL);
+	*wfd=fds[1];
+	return asfd;
+}
+
+static void do_test_asfd_parse(enum cmd view_cmd)
+{
+	int i;
+	int wfd;
+	size_t len=0;
+	size_t sent=0;
+	char data[100];
+	char stream[4096];
+	struct async *as;
+	struct asfd *asfd;
+	as=setup();
+	asfd=setup_pipe(as, &wfd);
+	asfd->rbuf_views=view_cmd?1:0;
+	asfd->rbuf_view_cmd=view_cmd;
+
+	for(i=0; i<(int)sizeof(data); i++)
+		data[i]='a'+i%26;
+	for(i=0; i<20; i++)
+		len+=add_frame(stream+len, i%3?CMD_APPEND:CMD_DATAPTH,
+			data, i*5);
+
+	// A few bytes at a time, so that leads and data are split between
+	// reads.
+	for(i=0; i<20; )
+	{
+		fail_unless(!asfd->parse_readbuf(asfd));
+		if(!asfd->rbuf->buf)
+		{
+			size_t n=len-sent<7?len-sent:7;
+			fail_unless(n>0);
+			fail_unless(write(wfd, stream+sent, n)==(ssize_t)n);
+			sent+=n;
+			fail_unless(!asfd->do_read(asfd));
+			continue;
+		}
+		fail_unless(asfd->rbuf->cmd==(i%3?CMD_APPEND:CMD_DATAPTH));
+		fail_unless(asfd->rbuf->len==(size_t)i*5);
+		fail_unless(!memcmp(asfd->rbuf->buf, data, i*5));
+		fail_unless(asfd->rbuf->buf[i*5]=='\0');
+		fail_unless(asfd->rbuf_view_saved
+			==(view_cmd && asfd->rbuf->cmd==view_cmd));
+		asfd_free_rbuf(asfd);
+		fail_unless(!asfd->rbuf->buf);
+		i++;
+	}
+	fail_unless(sent==len);
+	fail_unless(!asfd->readbuflen);
+
+	// A lead that is not hex.
+	fail_unless(write(wfd, "a00z0", 5)==5);
+	fail_unless(!asfd->do_read(asfd));
+	fail_unless(asfd->parse_readbuf(asfd)==-1);
+
+	close(wfd);
+	tear_down(&as);
+}
+
+START_TEST(test_asfd_parse_readbuf)
+{
+	do_test_asfd_parse((enum cmd)0);
+}
+END_TEST
+
+START_TEST(test_asfd_parse_readbuf_views)
+{
+	do_test_asfd_parse(CMD_APPEND);
+}
+END_TEST
+
+// The parser as it was, which copied each frame, then moved everything
+// after it down to the start of the read buffer.
+struct old_parser
+{
+	char *readbuf;
+	size_t readbuflen;
+	size_t bufmaxsize;
+};
+
+static int old_parse(struct old_parser *p, struct iobuf *rbuf)
+{
+	unsigned int s=0;
+	char command;
+	if(p->readbuflen<5) return 0;
+	if((sscanf(p->readbuf, "%c%04X", &command, &s))!=2)
+		return -1;
+	if(p->readbuflen<s+5)
+		return 0;
+	rbuf->cmd=(enum cmd)command;
+	if(!(rbuf->buf=(char *)malloc_w(s+1, __func__)))
+		return -1;
+	memcpy(rbuf->buf, p->readbuf+5, s);
+	rbuf->buf[s]='\0';
+	memmove(p->readbuf, p->readbuf+s+5, p->readbuflen-s-5);
+	p->readbuflen-=s+5;
+	rbuf->len=s;
+	return 0;
+}
+
+// The benchmarks want to wait in read() and write() rather than spin.
+static void make_blocking(int fd)
+{
+	int flags;
+	fail_unless((flags=fcntl(fd, F_GETFL, 0))>=0);
+	fail_unless(!fcntl(fd, F_SETFL, flags & ~O_NONBLOCK));
+}
+
+#define BENCH_BYTES	(64*1024*1024)
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec-start->tv_sec)
+		+(now.tv_usec-start->tv_usec)/1000000.0;
+}
+
+// Writes frames of the given size down the pipe, in a child process.
+static pid_t start_writer(int wfd, int rfd, size_t frame, size_t frames)
+{
+	pid_t pid;
+	size_t i;
+	size_t len=0;
+	char *buf;
+	fail_unless((pid=fork())>=0);
+	if(pid)
+	{
+		close(wfd);
+		return pid;
+	}
+	close(rfd);
+	buf=(char *)calloc(1, 65536);
+	memset(buf+5, 'x', frame);
+	for(i=0; i<frames; i++)
+	{
+		len+=add_frame(buf+len, CMD_APPEND, buf+len+5, frame);
+		if(len+frame+5<=65536 && i<frames-1)
+			continue;
+		if(write(wfd, buf, len)!=(ssize_t)len)
+			_exit(1);
+		len=0;
+		memset(buf+5, 'x', frame);
+	}
+	_exit(0);
+}
+
+static void finish_writer(pid_t pid)
+{
+	int status;
+	fail_unless(waitpid(pid, &status, 0)==pid);
+	fail_unless(WIFEXITED(status) && !WEXITSTATUS(status));
+}
+
+static double bench_old(size_t frame)
+{
+	int fds[2];
+	pid_t pid;
+	ssize_t r;
+	size_t got=0;
+	size_t frames=BENCH_BYTES/frame;
+	struct timeval start;
+	struct iobuf rbuf;
+	struct old_parser p;
+
+	iobuf_init(&rbuf);
+	p.bufmaxsize=(ASYNC_BUF_LEN*2)+32;
+	p.readbuflen=0;
+	fail_unless((p.readbuf=(char *)calloc_w(1, p.bufmaxsize,
+		__func__))!=NULL);
+	fail_unless(!pipe(fds));
+	pid=start_writer(fds[1], fds[0], frame, frames);
+	gettimeofday(&start, NULL);
+	while(got<frames)
+	{
+		fail_unless(!old_parse(&p, &rbuf));
+		if(rbuf.buf)
+		{
+			got++;
+			iobuf_free_content(&rbuf);
+			continue;
+		}
+		fail_unless((r=read(fds[0], p.readbuf+p.readbuflen,
+			p.bufmaxsize-p.readbuflen))>0);
+		p.readbuflen+=r;
+	}
+	finish_writer(pid);
+	close(fds[0]);
+	free_w(&p.readbuf);
+	return elapsed(&start);
+}
+
+static double bench_new(size_t frame, enum cmd view_cmd)
+{
+	int wfd;
+	pid_t pid;
+	size_t got=0;
+	size_t frames=BENCH_BYTES/frame;
+	struct timeval start;
+	struct async *as;
+	struct asfd *asfd;
+
+	as=setup();
+	asfd=setup_pipe(as, &wfd);
+	make_blocking(asfd->fd);
+	asfd->rbuf_views=view_cmd?1:0;
+	asfd->rbuf_view_cmd=view_cmd;
+	pid=start_writer(wfd, asfd->fd, frame, frames);
+	gettimeofday(&start, NULL);
+	while(got<frames)
+	{
+		fail_unless(!asfd->parse_readbuf(asfd));
+		if(asfd->rbuf->buf)
+		{
+			got++;
+			asfd_free_rbuf(asfd);
+			continue;
+		}
+		fail_unless(!asfd->do_read(asfd));
+	}
+	finish_writer(pid);
+	tear_down(&as);
+	return elapsed(&start);
+}
+
+// Not a pass or fail test, but shows what the parser costs for small
+// frames, such as paths and attributes, and for full sized data frames.
+START_TEST(test_asfd_parse_readbuf_benchmark)
+{
+	size_t i;
+	size_t sizes[]={ 64, 1024, ASYNC_BUF_LEN };
+	for(i=0; i<sizeof(sizes)/sizeof(*sizes); i++)
+	{
+		double old_time=bench_old(sizes[i]);
+		double new_time=bench_new(sizes[i], (enum cmd)0);
+		double view_time=bench_new(sizes[i], CMD_APPEND);
+		printf("%d MB in %lu byte frames: old parser %.3fs, "
+			"copies %.3fs, views %.3fs\n",
+			BENCH_BYTES/(1024*1024), (unsigned long)sizes[i],
+			old_time, new_time, view_time);
+	}
+}
+END_TEST
+
+// Appends a frame, writing out whatever is in the way until it fits.
+static void write_frame(struct asfd *asfd, enum cmd cmd,
+	char *buf, size_t len)
+{
+	struct iobuf wbuf;
+	iobuf_set(&wbuf, cmd, buf, len);
+	while(1)
+	{
+		switch(asfd->append_all_to_write_buffer(asfd, &wbuf))
+		{
+			case APPEND_OK:
+				return;
+			case APPEND_BLOCKED:
+				fail_unless(!asfd->do_write(asfd));
+				break;
+			default:
+				fail_unless(0);
+		}
+	}
+}
+
+static void flush_frames(struct asfd *asfd)
+{
+	while(asfd->writebuflen)
+		fail_unless(!asfd->do_write(asfd));
+}
+
+// If given a writer in the same process, it is kept going too, so that
+// neither end waits on the other.
+static void read_frame(struct asfd *asfd, struct asfd *wasfd)
+{
+	while(1)
+	{
+		fail_unless(!asfd->parse_readbuf(asfd));
+		if(asfd->rbuf->buf)
+			return;
+		if(wasfd && wasfd->writebuflen)
+			fail_unless(!wasfd->do_write(wasfd));
+		fail_unless(!asfd->do_read(asfd));
+	}
+}
+
+static void setup_socketpair(struct async *as,
+	struct asfd **a, struct asfd **b)
+{
+	int fds[2];
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+	fail_unless((*a=setup_asfd(as, "a", &fds[0], ""))!=NULL);
+	fail_unless((*b=setup_asfd(as, "b", &fds[1], ""))!=NULL);
+}
+
+START_TEST(test_asfd_large_frames)
+{
+	size_t i;
+	size_t len=ASYNC_LARGE_BUF_LEN;
+	char *data;
+	struct async *as;
+	struct asfd *wasfd;
+	struct asfd *rasfd;
+	as=setup();
+	setup_socketpair(as, &wasfd, &rasfd);
+	fail_unless((data=(char *)malloc_w(len, __func__))!=NULL);
+	for(i=0; i<len; i++)
+		data[i]=i%251;
+
+	fail_unless(asfd_frame_len(wasfd)==ASYNC_BUF_LEN);
+
+	// Something left over from before the switch still gets through.
+	write_frame(wasfd, CMD_GEN, (char *)"before", 6);
+	fail_unless(!asfd_set_large_frames(wasfd));
+	fail_unless(!asfd_set_large_frames(wasfd));
+	fail_unless(asfd_frame_len(wasfd)==ASYNC_LARGE_BUF_LEN);
+	write_frame(wasfd, CMD_APPEND, data, len);
+	write_frame(wasfd, CMD_APPEND, data, 0);
+	write_frame(wasfd, CMD_GEN, (char *)"after", 5);
+
+	read_frame(rasfd, wasfd);
+	fail_unless(rasfd->rbuf->cmd==CMD_GEN);
+	fail_unless(!strcmp(rasfd->rbuf->buf, "before"));
+	asfd_free_rbuf(rasfd);
+	fail_unless(!asfd_set_large_frames(rasfd));
+
+	read_frame(rasfd, wasfd);
+	fail_unless(rasfd->rbuf->cmd==CMD_APPEND);
+	fail_unless(rasfd->rbuf->len==len);
+	fail_unless(!memcmp(rasfd->rbuf->buf, data, len));
+	asfd_free_rbuf(rasfd);
+	read_frame(rasfd, wasfd);
+	fail_unless(rasfd->rbuf->cmd==CMD_APPEND);
+	fail_unless(!rasfd->rbuf->len);
+	asfd_free_rbuf(rasfd);
+	read_frame(rasfd, wasfd);
+	fail_unless(rasfd->rbuf->cmd==CMD_GEN);
+	fail_unless(!strcmp(rasfd->rbuf->buf, "after"));
+	asfd_free_rbuf(rasfd);
+
+	free_w(&data);
+	tear_down(&as);
+}
+END_TEST
+
+START_TEST(test_asfd_large_frames_not_agreed)
+{
+	char data[10]="0123456789";
+	struct async *as;
+	struct asfd *wasfd;
+	struct asfd *rasfd;
+	as=setup();
+	setup_socketpair(as, &wasfd, &rasfd);
+	fail_unless(!asfd_set_large_frames(wasfd));
+	write_frame(wasfd, CMD_APPEND, data, sizeof(data));
+	flush_frames(wasfd);
+	fail_unless(!rasfd->do_read(rasfd));
+	fail_unless(rasfd->parse_readbuf(rasfd)==-1);
+	tear_down(&as);
+}
+END_TEST
+
+// A frame with no command used to match a view command that had been
+// turned off, so rbuf pointed into readbuf and was then freed.
+static void do_test_asfd_read_no_command(int large)
+{
+	const char *frame=large?"\x80\0\0\0\3abc":"\0" "0003abc";
+	struct async *as;
+	struct asfd *wasfd;
+	struct asfd *rasfd;
+	as=setup();
+	as->setsec=0;
+	as->setusec=0;
+	setup_socketpair(as, &wasfd, &rasfd);
+	if(large)
+	{
+		fail_unless(!asfd_set_large_frames(wasfd));
+		fail_unless(!asfd_set_large_frames(rasfd));
+	}
+	rasfd->rbuf_views=0;
+	rasfd->rbuf_view_cmd=(enum cmd)0;
+	fail_unless(write(wasfd->fd, frame, 8)==8);
+	fail_unless(rasfd->read(rasfd)==-1);
+	fail_unless(!rasfd->rbuf_view_saved);
+	asfd_free_rbuf(rasfd);
+	iobuf_free_content(rasfd->rbuf);
+	tear_down(&as);
+}
+
+START_TEST(test_asfd_read_no_command)
+{
+	do_test_asfd_read_no_command(0);
+	do_test_asfd_read_no_command(1);
+}
+END_TEST
+
+static void write_small_frames(struct asfd *asfd, int count)
+{
+	int i;
+	for(i=0; i<count; i++)
+		write_frame(asfd, CMD_GEN, (char *)"0123456789", 10);
+}
+
+static struct async *setup_write_batch(struct asfd **wasfd,
+	struct asfd **rasfd, int bytes, int max_ms)
+{
+	struct async *as;
+	as=setup();
+	// Do not wait around in select().
+	as->setsec=0;
+	as->setusec=0;
+	setup_socketpair(as, wasfd, rasfd);
+	(*wasfd)->set_write_batch(*wasfd, bytes, max_ms);
+	return as;
+}
+
+START_TEST(test_asfd_write_batch_off)
+{
+	struct async *as;
+	struct asfd *wasfd;
+	struct asfd *rasfd;
+	as=setup_write_batch(&wasfd, &rasfd, 0, 1000);
+	write_small_frames(wasfd, 3);
+	fail_unless(!as->read_write(as));
+	fail_unless(!wasfd->writebuflen);
+	fail_unless(wasfd->frames==3);
+	fail_unless(wasfd->writes==1);
+	tear_down(&as);
+}
+END_TEST
+
+START_TEST(test_asfd_write_batch_bytes)
+{
+	struct async *as;
+	struct asfd *wasfd;
+	struct asfd *rasfd;
+	as=setup_write_batch(&wasfd, &rasfd, 100, 60*1000);
+	write_small_frames(wasfd, 3);
+	fail_unless(!as->read_write(as));
+	fail_unless(wasfd->writebuflen==45);
+	fail_unless(!wasfd->writes);
+	write_small_frames(wasfd, 4);
+	fail_unless(!as->read_write(as));
+	fail_unless(!wasfd->writebuflen);
+	fail_unless(wasfd->frames==7);
+	fail_unless(wasfd->writes==1);
+
+	// Plain writes, with no reading, do not wait.
+	write_small_frames(wasfd, 1);
+	fail_unless(!as->write(as));
+	fail_unless(!wasfd->writebuflen);
+	fail_unless(wasfd->writes==2);
+	tear_down(&as);
+}
+END_TEST
+
+START_TEST(test_asfd_write_batch_ms)
+{
+	struct async *as;
+	struct asfd *wasfd;
+	struct asfd *rasfd;
+	as=setup_write_batch(&wasfd, &rasfd, 1000, 10);
+	write_small_frames(wasfd, 2);
+	fail_unless(!as->read_write(as));
+	fail_unless(wasfd->writebuflen==30);
+	usleep(20000);
+	fail_unless(!as->read_write(as));
+	fail_unless(!wasfd->writebuflen);
+	fail_unless(wasfd->writes==1);
+	tear_down(&as);
+}
+END_TEST
+
+START_TEST(test_asfd_write_batch_flush)
+{
+	struct async *as;
+	struct asfd *wasfd;
+	struct asfd *rasfd;
+	as=setup_write_batch(&wasfd, &rasfd, 1000, 60*1000);
+	write_small_frames(wasfd, 2);
+	fail_unless(!as->read_write(as));
+	fail_unless(wasfd->writebuflen==30);
+	fail_unless(!asfd_flush_asio(wasfd));
+	fail_unless(!wasfd->writebuflen);
+	fail_unless(!wasfd->write_batch_flush);
+	asfd_log_write_stats(wasfd);
+
+	// The peer will not answer until it has what was written.
+	write_small_frames(wasfd, 1);
+	fail_unless(!as->read_write(as));
+	fail_unless(wasfd->writebuflen==15);
+	write_small_frames(rasfd, 1);
+	flush_frames(rasfd);
+	fail_unless(!wasfd->read(wasfd));
+	fail_unless(!wasfd->writebuflen);
+	fail_unless(wasfd->writes==2);
+	iobuf_free_content(wasfd->rbuf);
+	read_frame(rasfd, NULL);
+	fail_unless(rasfd->rbuf->len==10);
+	iobuf_free_content(rasfd->rbuf);
+	tear_down(&as);
+}
+END_TEST
+
+#define THROUGHPUT_BYTES	(256*1024*1024)
+
+static double throughput(int large_frames)
+{
+	pid_t pid;
+	size_t got=0;
+	size_t frame;
+	struct timeval start;
+	struct async *as;
+	struct asfd *wasfd;
+	struct asfd *rasfd;
+
+	as=setup();
+	setup_socketpair(as, &wasfd, &rasfd);
+	if(large_frames)
+	{
+		fail_unless(!asfd_set_large_frames(wasfd));
+		fail_unless(!asfd_set_large_frames(rasfd));
+	}
+	make_blocking(wasfd->fd);
+	make_blocking(rasfd->fd);
+	frame=asfd_frame_len(wasfd);
+	gettimeofday(&start, NULL);
+	fail_unless((pid=fork())>=0);
+	if(!pid)
+	{
+		char *buf=(char *)calloc(1, frame);
+		for(got=0; got<THROUGHPUT_BYTES; got+=frame)
+			write_frame(wasfd, CMD_APPEND, buf, frame);
+		write_frame(wasfd, CMD_END_FILE, (char *)"end", 3);
+		flush_frames(wasfd);
+		_exit(0);
+	}
+	while(1)
+	{
+		read_frame(rasfd, NULL);
+		if(rasfd->rbuf->cmd==CMD_END_FILE)
+			break;
+		got+=rasfd->rbuf->len;
+		asfd_free_rbuf(rasfd);
+	}
+	asfd_free_rbuf(rasfd);
+	finish_writer(pid);
+	fail_unless(got>=THROUGHPUT_BYTES);
+	tear_down(&as);
+	return (THROUGHPUT_BYTES/(1024.0*1024.0))/elapsed(&start);
+}
+
+// Not a pass or fail test, but shows what the frame size costs when
+// moving file data over a local socket.
+START_TEST(test_asfd_large_frames_benchmark)
+{
+	double legacy=throughput(0);
+	double large=throughput(1);
+	printf("%d MB over a socketpair: %.0f MB/s in %d byte frames, "
+		"%.0f MB/s in %d byte frames\n",
+		THROUGHPUT_BYTES/(1024*1024),
+		legacy, ASYNC_BUF_LEN, large, ASYNC_LARGE_BUF_LEN);
+}
+END_TEST
+
 Suite *suite_asfd(void)
 {
 	Suite *s;
 	TCase *tc_core;
+	TCase *tc_bench;
 
 	s=suite_create("asfd");
 
@@ -200,8 +803,27 @@ Suite *suite_asfd(void)
 	tcase_add_test(tc_core, test_setup_asfd_stdout);
 	tcase_add_test(tc_core, test_setup_asfd_twice);
 	tcase_add_test(tc_core, test_setup_asfd_ncurses_stdin);
+	tcase_add_test(tc_core, test_iobuf_parse_lead);
+	tcase_add_test(tc_core, test_asfd_parse_readbuf);
+	tcase_add_test(tc_core, test_asfd_parse_readbuf_views);
+	tcase_add_test(tc_core, test_asfd_large_frames);
+	tcase_add_test(tc_core, test_asfd_large_frames_not_agreed);
+	tcase_add_test(tc_core, test_asfd_read_no_command);
+	tcase_add_test(tc_core, test_asfd_write_batch_off);
+	tcase_add_test(tc_core, test_asfd_write_batch_bytes);
+	tcase_add_test(tc_core, test_asfd_write_batch_ms);
+	tcase_add_test(tc_core, test_asfd_write_batch_flush);
 	suite_add_tcase(s, tc_core);
 
+	if(BENCHMARKS_WANTED)
+	{
+		tc_bench=tcase_create("Benchmark");
+		tcase_set_timeout(tc_bench, 600);
+		tcase_add_test(tc_bench, test_asfd_parse_readbuf_benchmark);
+		tcase_add_test(tc_bench, test_asfd_large_frames_benchmark);
+		suite_add_tcase(s, tc_bench);
+	}
+
 	return s;
 }
 
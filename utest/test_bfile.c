@@ -0,0 +1,254 @@
+#include "test.h"
+#include "../src/alloc.h"
+#include "../src/bfile.h"
+#include "../src/fsops.h"
+
+#define BASE		"utest_bfile"
+#define PATH		BASE "/file"
+
+static struct BFILE *setup(uint64_t size, uint64_t blocks,
+	int sparse, int preallocate, size_t buffer)
+{
+	struct BFILE *bfd;
+	struct bfile_restore br;
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!mkdir(BASE, 0777));
+	fail_unless((bfd=bfile_alloc())!=NULL);
+	bfile_init(bfd, 0, 0, NULL);
+	fail_unless(!bfd->open(bfd, NULL, PATH,
+		O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR));
+	bfd->statp.st_size=size;
+	bfd->statp.st_blocks=blocks;
+	br.sparse=sparse;
+	br.preallocate=preallocate;
+	br.buffer=buffer;
+	fail_unless(!bfd->set_restore(bfd, &br));
+	return bfd;
+}
+
+static void tear_down(struct BFILE **bfd)
+{
+	bfile_free(bfd);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+// Data, then zeros, then more data, then zeros to the end.
+static char *make_content(size_t len)
+{
+	size_t i;
+	char *buf;
+	fail_unless((buf=(char *)calloc_w(1, len, __func__))!=NULL);
+	for(i=0; i<len; i++)
+	{
+		if(i<len/4 || (i>=len/2 && i<len/2+100))
+			buf[i]='a'+i%26;
+	}
+	return buf;
+}
+
+static void write_content(struct BFILE *bfd, char *buf, size_t len,
+	size_t chunk)
+{
+	size_t off;
+	for(off=0; off<len; off+=chunk)
+	{
+		size_t w=len-off<chunk?len-off:chunk;
+		fail_unless(bfd->write(bfd, buf+off, w)==(ssize_t)w);
+	}
+	fail_unless(!bfd->close(bfd, NULL));
+}
+
+static struct stat check_content(char *buf, size_t len)
+{
+	size_t got;
+	char *rbuf;
+	FILE *fp;
+	struct stat statp;
+	fail_unless(!lstat(PATH, &statp));
+	fail_unless((size_t)statp.st_size==len);
+	fail_unless((rbuf=(char *)malloc_w(len+1, __func__))!=NULL);
+	fail_unless((fp=fopen(PATH, "rb"))!=NULL);
+	got=fread(rbuf, 1, len+1, fp);
+	fail_unless(got==len);
+	fail_unless(!memcmp(rbuf, buf, len));
+	fclose(fp);
+	free_w(&rbuf);
+	return statp;
+}
+
+static void do_test_restore_writes(size_t len, uint64_t blocks,
+	int sparse, int preallocate, size_t buffer, size_t chunk)
+{
+	char *buf;
+	struct BFILE *bfd;
+	bfd=setup(len, blocks, sparse, preallocate, buffer);
+	buf=make_content(len);
+	write_content(bfd, buf, len, chunk);
+	check_content(buf, len);
+	free_v((void **)&buf);
+	tear_down(&bfd);
+}
+
+START_TEST(test_bfile_restore_writes)
+{
+	size_t len=1024*1024+7;
+	uint64_t full=len/512+1;
+	size_t chunks[]={ 1000, 4096, 16000, 300000 };
+	size_t i;
+
+	// A byte at a time, to go over every block boundary.
+	do_test_restore_writes(10000, 0, 1, 0, 0, 1);
+	do_test_restore_writes(10000, 0, 1, 0, 4096, 1);
+
+	for(i=0; i<sizeof(chunks)/sizeof(*chunks); i++)
+	{
+		do_test_restore_writes(len, full, 0, 0, 0, chunks[i]);
+		do_test_restore_writes(len, full, 0, 1, 0, chunks[i]);
+		do_test_restore_writes(len, full, 0, 0, 65536, chunks[i]);
+		do_test_restore_writes(len, 0, 1, 0, 0, chunks[i]);
+		do_test_restore_writes(len, 0, 1, 0, 65536, chunks[i]);
+		do_test_restore_writes(len, 8, 1, 1, 65536, chunks[i]);
+	}
+}
+END_TEST
+
+START_TEST(test_bfile_restore_sparse)
+{
+	char *buf;
+	size_t len=1024*1024;
+	struct stat statp;
+	struct BFILE *bfd;
+
+	bfd=setup(len, 8, 1, 0, 0);
+	buf=make_content(len);
+	write_content(bfd, buf, len, 16000);
+	statp=check_content(buf, len);
+	// Only the data should take up space, and the zeros at the end
+	// still count towards the size. Not every filesystem does holes.
+	if(statp.st_blocks)
+		fail_unless((uint64_t)statp.st_blocks*512<len/2);
+	free_v((void **)&buf);
+	tear_down(&bfd);
+
+	// The same file, but it was not sparse when it was backed up.
+	bfd=setup(len, len/512, 1, 0, 0);
+	buf=make_content(len);
+	write_content(bfd, buf, len, 16000);
+	statp=check_content(buf, len);
+	fail_unless((uint64_t)statp.st_blocks*512>=len);
+	free_v((void **)&buf);
+	tear_down(&bfd);
+}
+END_TEST
+
+START_TEST(test_bfile_restore_preallocate)
+{
+	char buf[]="0123456789";
+	struct BFILE *bfd;
+
+	// The preallocation does not change the size of the file.
+	bfd=setup(1024*1024, 2048, 0, 1, 0);
+	write_content(bfd, buf, 10, 10);
+	check_content(buf, 10);
+	tear_down(&bfd);
+}
+END_TEST
+
+#define HOLEY_LEN	(3*1024*1024+5)
+#define HOLEY_DATA	(1024*1024)
+
+// Some data at the start, some in the middle, and a hole at the end.
+static char *build_holey_file(int *sparse)
+{
+	int fd;
+	char *buf;
+	struct stat statp;
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!mkdir(BASE, 0777));
+	fail_unless((buf=(char *)calloc_w(1, HOLEY_LEN, __func__))!=NULL);
+	memset(buf, 'a', 3);
+	memset(buf+HOLEY_DATA+1, 'b', 5000);
+	fail_unless((fd=open(PATH, O_WRONLY|O_CREAT|O_TRUNC, 0600))>=0);
+	fail_unless(pwrite(fd, buf, 3, 0)==3);
+	fail_unless(pwrite(fd, buf+HOLEY_DATA+1, 5000, HOLEY_DATA+1)==5000);
+	fail_unless(!ftruncate(fd, HOLEY_LEN));
+	fail_unless(!fstat(fd, &statp));
+	fail_unless(!close(fd));
+	*sparse=(uint64_t)statp.st_blocks*512<HOLEY_LEN;
+	return buf;
+}
+
+static void read_holey_file(const char *expected, size_t chunk, int sparse)
+{
+	char *buf;
+	ssize_t r;
+	size_t got=0;
+	struct BFILE *bfd;
+	fail_unless((bfd=bfile_alloc())!=NULL);
+	bfile_init(bfd, 0, 0, NULL);
+	fail_unless(!bfd->open(bfd, NULL, PATH, O_RDONLY, 0));
+	fail_unless(bfd->holes==sparse);
+	fail_unless((buf=(char *)malloc_w(HOLEY_LEN+chunk, __func__))!=NULL);
+	while((r=bfd->read(bfd, buf+got, chunk))>0)
+		got+=r;
+	fail_unless(!r);
+	fail_unless(got==HOLEY_LEN);
+	fail_unless(!memcmp(buf, expected, HOLEY_LEN));
+	fail_unless(!bfd->close(bfd, NULL));
+	free_w(&buf);
+	bfile_free(&bfd);
+}
+
+START_TEST(test_bfile_read_holes)
+{
+	int sparse;
+	char *expected;
+	size_t chunks[]={ 7, 1000, 4096, 16000, 2*1024*1024 };
+	size_t i;
+
+	// Not every filesystem does holes.
+	expected=build_holey_file(&sparse);
+	for(i=0; i<sizeof(chunks)/sizeof(*chunks); i++)
+		read_holey_file(expected, chunks[i], sparse);
+	free_v((void **)&expected);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_bfile_read_no_holes)
+{
+	char buf[]="0123456789";
+	struct BFILE *bfd;
+
+	bfd=setup(10, 8, 0, 0, 0);
+	write_content(bfd, buf, 10, 10);
+	bfile_init(bfd, 0, 0, NULL);
+	fail_unless(!bfd->open(bfd, NULL, PATH, O_RDONLY, 0));
+	fail_unless(!bfd->holes);
+	fail_unless(bfd->read(bfd, buf, sizeof(buf))==10);
+	fail_unless(!strncmp(buf, "0123456789", 10));
+	fail_unless(!bfd->close(bfd, NULL));
+	tear_down(&bfd);
+}
+END_TEST
+
+Suite *suite_bfile(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("bfile");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_bfile_restore_writes);
+	tcase_add_test(tc_core, test_bfile_restore_sparse);
+	tcase_add_test(tc_core, test_bfile_restore_preallocate);
+	tcase_add_test(tc_core, test_bfile_read_holes);
+	tcase_add_test(tc_core, test_bfile_read_no_holes);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -29,6 +29,7 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_CA_CRL:
 		case OPT_PEER_VERSION:
 		case OPT_CLIENT_LOCKDIR:
+		case OPT_CHANGE_JOURNAL:
 		case OPT_MONITOR_LOGFILE:
 		case OPT_CNAME:
 		case OPT_PASSWORD:
@@ -80,7 +81,14 @@ static void check_default(struct conf **c, enum conf_opt o)
 			fail_unless(get_float(c[o])==0);
 			break;
 		case OPT_CLIENT_IS_WINDOWS:
+		case OPT_WRITE_BATCH_BYTES:
 		case OPT_RANDOMISE:
+		case OPT_DELTA_WORKERS:
+		case OPT_RESTORE_FINISHERS:
+		case OPT_RESTORE_FSYNC:
+		case OPT_RESTORE_SPARSE:
+		case OPT_RESTORE_PREALLOCATE:
+		case OPT_RESTORE_WRITE_BUFFER:
 		case OPT_B_SCRIPT_POST_RUN_ON_FAIL:
 		case OPT_R_SCRIPT_POST_RUN_ON_FAIL:
 		case OPT_SEND_CLIENT_CNTR:
@@ -94,6 +102,8 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_S_SCRIPT_POST_NOTIFY:
 		case OPT_S_SCRIPT_NOTIFY:
 		case OPT_HARDLINKED_ARCHIVE:
+		case OPT_SYNTHETIC_FULL_CHAIN_LENGTH:
+		case OPT_SYNTHETIC_FULL_CHAIN_PERCENT:
 		case OPT_N_SUCCESS_WARNINGS_ONLY:
 		case OPT_N_SUCCESS_CHANGES_ONLY:
 		case OPT_CROSS_ALL_FILESYSTEMS:
@@ -123,6 +133,12 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_TIMER_REPEAT_INTERVAL:
 		case OPT_REGEX_CASE_INSENSITIVE:
 		case OPT_FORCE_UPDATE_ENCRYPTION:
+		case OPT_RESTORE_PREFETCH:
+		case OPT_LIBRSYNC_SIGNATURE_CACHE:
+		case OPT_CHUNK_STORE:
+		case OPT_INGEST_DEDUP:
+		case OPT_IO_URING_DEPTH:
+		case OPT_HARDLINKED_DIR_REFS:
 			fail_unless(get_int(c[o])==0);
 			break;
 		case OPT_VSS_RESTORE:
@@ -153,11 +169,16 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_ACL:
 		case OPT_XATTR:
 		case OPT_N_FAILURE_BACKUP_FAILOVERS_LEFT:
+		case OPT_PHASE2_STREAMS:
+		case OPT_SCRUB_WORKERS:
 			fail_unless(get_int(c[o])==1);
 			break;
 		case OPT_NETWORK_TIMEOUT:
 			fail_unless(get_int(c[o])==60*60*2);
 			break;
+		case OPT_WRITE_BATCH_MS:
+			fail_unless(get_int(c[o])==5);
+			break;
 		case OPT_SSL_COMPRESSION:
 			fail_unless(get_int(c[o])==5);
 			break;
@@ -223,6 +244,8 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_MIN_FILE_SIZE:
 		case OPT_MAX_FILE_SIZE:
 		case OPT_LIBRSYNC_MAX_SIZE:
+		case OPT_RESTORE_CACHE_MAX_SIZE:
+		case OPT_SCRUB_MAX_RATE:
 			fail_unless(get_uint64_t(c[o])==0);
 			break;
 		case OPT_RBLK_MEMORY_MAX:
@@ -53,6 +53,7 @@ static void read_checks(
 		fail_unless(fzp_eof(fzp));
 	else
 		fail_unless(!fzp_eof(fzp));
+	fail_unless(!fzp_error(fzp));
 	fail_unless(!fzp_close(&fzp));
 	fail_unless(fzp==NULL);
 
@@ -162,6 +163,23 @@ START_TEST(test_fzp_gzread)
 }
 END_TEST
 
+// A gzipped file that has been cut short reads up to where it stops, then
+// looks like it has ended.
+START_TEST(test_fzp_gzread_short)
+{
+	char buf[32]="";
+	struct fzp *fzp;
+	setup_for_read(fzp_gzopen, content);
+	fail_unless(!truncate(file, 20));
+	fail_unless((fzp=fzp_gzopen(file, "rb"))!=NULL);
+	fail_unless(fzp_read(fzp, buf, sizeof(buf))<(int)strlen(content));
+	fail_unless(fzp_eof(fzp));
+	fail_unless(fzp_error(fzp));
+	fail_unless(!fzp_close(&fzp));
+	tear_down();
+}
+END_TEST
+
 START_TEST(test_fzp_seek)
 {
 	do_seek_tests(fzp_open);
@@ -195,6 +213,7 @@ START_TEST(test_fzp_null_pointer)
 	fail_unless(!fzp_read(NULL, NULL, 1));
 	fail_unless(!fzp_write(NULL, NULL, 1));
 	fail_unless(fzp_eof(NULL)==-1);
+	fail_unless(fzp_error(NULL)==-1);
 	fail_unless(fzp_flush(NULL)==EOF);
 	fail_unless(fzp_seek(NULL, 1, SEEK_SET)==-1);
 	fail_unless(fzp_tell(NULL)==-1);
@@ -222,6 +241,7 @@ Suite *suite_fzp(void)
 
 	tcase_add_test(tc_core, test_fzp_read);
 	tcase_add_test(tc_core, test_fzp_gzread);
+	tcase_add_test(tc_core, test_fzp_gzread_short);
 	tcase_add_test(tc_core, test_fzp_seek);
 	tcase_add_test(tc_core, test_fzp_gzseek);
 #ifndef HAVE_WIN32
@@ -1,6 +1,7 @@
 #include <check.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "../src/alloc.h"
 #include "../src/hexmap.h"
 #include "../src/md5.h"
@@ -28,17 +29,114 @@ START_TEST(test_md5)
 }
 END_TEST
 
+// The same context gets used for one file after another.
+START_TEST(test_md5_reuse)
+{
+	int i;
+	uint8_t checksum[MD5_DIGEST_LENGTH];
+	struct md5 *md5;
+
+	alloc_counters_reset();
+	fail_unless((md5=md5_alloc(__func__))!=NULL);
+	for(i=0; i<3; i++)
+	{
+		fail_unless(md5_init(md5));
+		fail_unless(md5_update(md5, "bl", 2));
+		fail_unless(md5_update(md5, "ah", 2));
+		fail_unless(md5_final(md5, checksum));
+		ck_assert_str_eq(
+			"6f1ed002ab5595859014ebf0951522d9",
+			bytes_to_md5str(checksum)
+		);
+		// What is kept between files can be let go of at any point.
+		if(i==1)
+			md5_cleanup();
+	}
+	md5_free(&md5);
+	md5_cleanup();
+	alloc_check();
+}
+END_TEST
+
+#define BENCH_BYTES	(64*1024*1024)
+#define BENCH_FILES	100000
+
+static double secs(clock_t c)
+{
+	return (double)c/CLOCKS_PER_SEC;
+}
+
+// Prints how fast one core can checksum, with the buffer sizes that the
+// file transfers use, and what it costs per file for lots of small ones.
+START_TEST(test_md5_benchmark)
+{
+	int i;
+	size_t b;
+	size_t n;
+	clock_t start;
+	clock_t took;
+	uint8_t *buf;
+	uint8_t checksum[MD5_DIGEST_LENGTH];
+	struct md5 *md5;
+	size_t sizes[]={ 4096, 32768, 1024*1024 };
+
+	alloc_counters_reset();
+	fail_unless((buf=(uint8_t *)malloc_w(sizes[2], __func__))!=NULL);
+	for(b=0; b<sizes[2]; b++)
+		buf[b]=(uint8_t)(b*31+b/7);
+	fail_unless((md5=md5_alloc(__func__))!=NULL);
+
+	for(i=0; i<(int)(sizeof(sizes)/sizeof(*sizes)); i++)
+	{
+		start=clock();
+		fail_unless(md5_init(md5));
+		for(n=0; n<BENCH_BYTES; n+=sizes[i])
+			fail_unless(md5_update(md5, buf, sizes[i]));
+		fail_unless(md5_final(md5, checksum));
+		took=clock()-start;
+		printf("md5 of %d MB in %lu byte buffers: %.0f MB/s\n",
+			BENCH_BYTES/(1024*1024), (unsigned long)sizes[i],
+			took?BENCH_BYTES/(1024*1024)/secs(took):0);
+	}
+
+	start=clock();
+	for(i=0; i<BENCH_FILES; i++)
+	{
+		fail_unless(md5_init(md5));
+		fail_unless(md5_update(md5, buf, 100));
+		fail_unless(md5_final(md5, checksum));
+	}
+	took=clock()-start;
+	printf("md5 of %d files of 100 bytes: %.2f us per file\n",
+		BENCH_FILES, secs(took)*1000000/BENCH_FILES);
+
+	md5_free(&md5);
+	free_v((void **)&buf);
+	alloc_check();
+}
+END_TEST
+
 Suite *suite_md5(void)
 {
 	Suite *s;
 	TCase *tc_core;
+	TCase *tc_bench;
 
 	s=suite_create("md5");
 
 	tc_core=tcase_create("Core");
 
 	tcase_add_test(tc_core, test_md5);
+	tcase_add_test(tc_core, test_md5_reuse);
 	suite_add_tcase(s, tc_core);
 
+	if(BENCHMARKS_WANTED)
+	{
+		tc_bench=tcase_create("Benchmark");
+		tcase_set_timeout(tc_bench, 600);
+		tcase_add_test(tc_bench, test_md5_benchmark);
+		suite_add_tcase(s, tc_bench);
+	}
+
 	return s;
 }
@@ -1,7 +1,13 @@
 #include "test.h"
+#include "prng.h"
 #include "../src/alloc.h"
+#include "../src/fsops.h"
+#include "../src/fzp.h"
+#include "../src/prepend.h"
 #include "../src/rs_buf.h"
 
+#include <time.h>
+
 static rs_filebuf_t *setup(rs_buffers_t *rsbuf, int data_len)
 {
 	rs_filebuf_t *fb;
@@ -183,10 +189,164 @@ START_TEST(test_rs_outfilebuf_drain_error4)
 }
 END_TEST
 
+#define BENCH_DIR	"utest_rs_buf"
+#define BENCH_FILES	4
+#define BENCH_SIZE	(4*1024*1024)
+#define BENCH_BLOCK_LEN	2048
+
+// Writes pseudo random content, the same for the same seed. Modified files
+// have a byte changed in each sixteenth.
+static void build_bench_file(const char *path, uint32_t seed, int modified,
+	size_t size)
+{
+	size_t i;
+	uint32_t r;
+	struct fzp *fzp;
+	static uint8_t buf[BENCH_SIZE];
+	prng_init(seed);
+	for(i=0; i<size; i+=sizeof(r))
+	{
+		r=prng_next();
+		memcpy(buf+i, &r, sizeof(r));
+	}
+	if(modified)
+		for(i=0; i<size; i+=size/16)
+			buf[i]^=0xff;
+	fail_unless((fzp=fzp_open(path, "wb"))!=NULL);
+	fail_unless(fzp_write(fzp, buf, size)==size);
+	fail_unless(!fzp_close(&fzp));
+}
+
+static void make_delta(rs_signature_t *sumset, const char *src,
+	const char *del)
+{
+	struct fzp *srcfzp;
+	struct fzp *delfzp;
+	fail_unless(rs_build_hash_table(sumset)==RS_DONE);
+	fail_unless((srcfzp=fzp_open(src, "rb"))!=NULL);
+	fail_unless((delfzp=fzp_open(del, "wb"))!=NULL);
+	fail_unless(rs_delta_gzfile(sumset, srcfzp, delfzp)==RS_DONE);
+	fail_unless(!fzp_close(&srcfzp));
+	fail_unless(!fzp_close(&delfzp));
+	rs_free_sumset(sumset);
+}
+
+// The way that phase4 used to do it.
+static void delta_via_sig_file(const char *dst, const char *src,
+	const char *sig, const char *del, struct conf **confs)
+{
+	struct fzp *dstfzp;
+	struct fzp *sigfzp;
+	rs_signature_t *sumset=NULL;
+	fail_unless((dstfzp=fzp_open(dst, "rb"))!=NULL);
+	fail_unless((sigfzp=fzp_open(sig, "wb"))!=NULL);
+	fail_unless(rs_sig_gzfile(dstfzp, sigfzp, BENCH_BLOCK_LEN,
+		PROTO1_RS_STRONG_LEN, confs)==RS_DONE);
+	fail_unless(!fzp_close(&dstfzp));
+	fail_unless(!fzp_close(&sigfzp));
+	fail_unless((sigfzp=fzp_open(sig, "rb"))!=NULL);
+	fail_unless(rs_loadsig_fzp(sigfzp, &sumset)==RS_DONE);
+	fail_unless(!fzp_close(&sigfzp));
+	unlink(sig);
+	make_delta(sumset, src, del);
+}
+
+static void delta_in_memory(const char *dst, const char *src,
+	const char *del, struct conf **confs)
+{
+	struct fzp *dstfzp;
+	rs_signature_t *sumset=NULL;
+	fail_unless((dstfzp=fzp_open(dst, "rb"))!=NULL);
+	fail_unless(rs_sig_gzfile_load(dstfzp, NULL, &sumset, BENCH_BLOCK_LEN,
+		PROTO1_RS_STRONG_LEN, confs)==RS_DONE);
+	fail_unless(!fzp_close(&dstfzp));
+	make_delta(sumset, src, del);
+}
+
+static char *bench_path(const char *name, int i)
+{
+	char *path;
+	char tmp[32];
+	snprintf(tmp, sizeof(tmp), "%s.%d", name, i);
+	fail_unless((path=prepend_s(BENCH_DIR, tmp))!=NULL);
+	return path;
+}
+
+static int msecs(clock_t c)
+{
+	return (int)(c*1000/CLOCKS_PER_SEC);
+}
+
+// Checks that both ways produce the same reverse delta, and returns how
+// long each took.
+static void compare_deltas(int files, size_t size,
+	clock_t *via_file, clock_t *in_memory)
+{
+	int i;
+	clock_t start;
+	struct conf **confs;
+	alloc_check_init();
+	fail_unless((confs=confs_alloc())!=NULL);
+	fail_unless(!confs_init(confs));
+	fail_unless(!recursive_delete(BENCH_DIR));
+	fail_unless(!mkdir(BENCH_DIR, 0777));
+
+	for(i=0; i<files; i++)
+	{
+		char *old=bench_path("old", i);
+		char *new=bench_path("new", i);
+		char *sig=bench_path("sig", i);
+		char *del1=bench_path("del1", i);
+		char *del2=bench_path("del2", i);
+		build_bench_file(old, i, 0, size);
+		build_bench_file(new, i, 1, size);
+
+		start=clock();
+		delta_via_sig_file(new, old, sig, del1, confs);
+		*via_file+=clock()-start;
+		start=clock();
+		delta_in_memory(new, old, del2, confs);
+		*in_memory+=clock()-start;
+
+		fail_unless(files_equal(del1, del2, 0));
+		free_w(&old);
+		free_w(&new);
+		free_w(&sig);
+		free_w(&del1);
+		free_w(&del2);
+	}
+
+	fail_unless(!recursive_delete(BENCH_DIR));
+	confs_free(&confs);
+	alloc_check();
+}
+
+START_TEST(test_rs_sig_gzfile_load)
+{
+	clock_t via_file=0;
+	clock_t in_memory=0;
+	compare_deltas(1, 256*1024, &via_file, &in_memory);
+}
+END_TEST
+
+START_TEST(test_rs_sig_gzfile_load_benchmark)
+{
+	clock_t via_file=0;
+	clock_t in_memory=0;
+	compare_deltas(BENCH_FILES, BENCH_SIZE, &via_file, &in_memory);
+	printf("reverse deltas for %d files of %d bytes: "
+		"signature file %d.%03ds, in memory %d.%03ds\n",
+		BENCH_FILES, BENCH_SIZE,
+		msecs(via_file)/1000, msecs(via_file)%1000,
+		msecs(in_memory)/1000, msecs(in_memory)%1000);
+}
+END_TEST
+
 Suite *suite_rs_buf(void)
 {
 	Suite *s;
 	TCase *tc_core;
+	TCase *tc_bench;
 
 	s=suite_create("rs_buf");
 
@@ -208,7 +368,17 @@ Suite *suite_rs_buf(void)
 	tcase_add_test(tc_core, test_rs_outfilebuf_drain_error3);
 	tcase_add_test(tc_core, test_rs_outfilebuf_drain_error4);
 
+	tcase_add_test(tc_core, test_rs_sig_gzfile_load);
+
 	suite_add_tcase(s, tc_core);
 
+	if(BENCHMARKS_WANTED)
+	{
+		tc_bench=tcase_create("Benchmark");
+		tcase_set_timeout(tc_bench, 600);
+		tcase_add_test(tc_bench, test_rs_sig_gzfile_load_benchmark);
+		suite_add_tcase(s, tc_bench);
+	}
+
 	return s;
 }
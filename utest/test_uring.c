@@ -0,0 +1,330 @@
+#include "test.h"
+#include "builders/build_file.h"
+#include "../src/alloc.h"
+#include "../src/conf.h"
+#include "../src/fsops.h"
+#include "../src/prepend.h"
+#include "../src/uring.h"
+#include "../src/server/link.h"
+
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define BASE		"utest_uring"
+#define SHM_BASE	"/dev/shm/utest_uring"
+#define BENCH_FILES	5000
+// Where the files of a backup end up being, in a storage directory.
+#define BENCH_DIR	"/burp/client/0000001 2026-10-19 14:00:00" \
+			"/data/t/home/user/projects/burp/src"
+
+static void setup(void)
+{
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!build_path_w(BASE "/src/dummy"));
+}
+
+static void tear_down(void)
+{
+	uring_free();
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static nlink_t links(const char *path)
+{
+	struct stat statp;
+	fail_unless(!lstat(path, &statp));
+	return statp.st_nlink;
+}
+
+static int done;
+static int failed;
+
+static int count_cb(const char *path, const char *newpath,
+	int err, void *arg)
+{
+	done++;
+	if(err)
+	{
+		failed++;
+		fail_unless(err==*(int *)arg);
+	}
+	return 0;
+}
+
+static int fail_cb(const char *path, const char *newpath,
+	int err, void *arg)
+{
+	return err?-1:0;
+}
+
+static void build_files(const char *dir, int n)
+{
+	int i;
+	char path[256];
+	for(i=0; i<n; i++)
+	{
+		snprintf(path, sizeof(path), "%s/%d/%d", dir, i%10, i);
+		if(!(i/10))
+			fail_unless(!build_path_w(path));
+		build_file(path, "0123456789");
+	}
+}
+
+static void do_test_uring_ops(unsigned depth)
+{
+	int i;
+	int eexist=EEXIST;
+	int enoent=ENOENT;
+	char src[64];
+	char dst[64];
+
+	setup();
+	fail_unless(!uring_init(depth));
+
+	done=0;
+	failed=0;
+	for(i=0; i<100; i++)
+	{
+		snprintf(src, sizeof(src), BASE "/src/%d", i);
+		build_file(src, "0123456789");
+	}
+	for(i=0; i<100; i++)
+	{
+		snprintf(src, sizeof(src), BASE "/src/%d", i);
+		snprintf(dst, sizeof(dst), BASE "/src/%d.link", i);
+		fail_unless(!uring_link(src, dst, count_cb, &eexist));
+	}
+	fail_unless(!uring_wait());
+	fail_unless(done==100);
+	fail_unless(!failed);
+	fail_unless(links(BASE "/src/0")==2);
+
+	// Already there.
+	fail_unless(!uring_link(BASE "/src/0", BASE "/src/1.link",
+		count_cb, &eexist));
+	fail_unless(!uring_wait());
+	fail_unless(done==101);
+	fail_unless(failed==1);
+
+	fail_unless(!uring_rename(BASE "/src/0.link", BASE "/src/renamed",
+		count_cb, &enoent));
+	for(i=0; i<100; i++)
+	{
+		snprintf(src, sizeof(src), BASE "/src/%d", i);
+		fail_unless(!uring_unlink(src, count_cb, &enoent));
+	}
+	fail_unless(!uring_unlink(BASE "/src/not_there",
+		count_cb, &enoent));
+	fail_unless(!uring_wait());
+	fail_unless(done==203);
+	fail_unless(failed==2);
+	fail_unless(is_reg_lstat(BASE "/src/renamed")>0);
+	fail_unless(links(BASE "/src/renamed")==1);
+	fail_unless(is_reg_lstat(BASE "/src/0")<=0);
+
+	// Failures are passed back.
+	if(depth)
+	{
+		fail_unless(!uring_unlink(BASE "/src/not_there",
+			fail_cb, NULL));
+		fail_unless(uring_wait()==-1);
+	}
+	else
+		fail_unless(uring_unlink(BASE "/src/not_there",
+			fail_cb, NULL)==-1);
+	fail_unless(!uring_wait());
+
+	tear_down();
+}
+
+START_TEST(test_uring_ops_direct)
+{
+	do_test_uring_ops(0);
+}
+END_TEST
+
+START_TEST(test_uring_ops)
+{
+	do_test_uring_ops(8);
+}
+END_TEST
+
+START_TEST(test_uring_ops_depth_1)
+{
+	do_test_uring_ops(1);
+}
+END_TEST
+
+START_TEST(test_uring_fork)
+{
+	pid_t pid;
+	int status;
+
+	setup();
+	fail_unless(!uring_init(8));
+	build_file(BASE "/src/a", "0123456789");
+	switch((pid=fork()))
+	{
+		case -1:
+			fail_unless(0);
+			break;
+		case 0:
+			// The ring belongs to the parent, so this has to have
+			// happened by the time it returns.
+			if(uring_unlink(BASE "/src/a", NULL, NULL)
+			  || is_reg_lstat(BASE "/src/a")>0)
+				_exit(1);
+			_exit(0);
+	}
+	fail_unless(waitpid(pid, &status, 0)==pid);
+	fail_unless(WIFEXITED(status) && !WEXITSTATUS(status));
+	fail_unless(!uring_wait());
+	tear_down();
+}
+END_TEST
+
+static struct conf **setup_confs(void)
+{
+	struct conf **confs;
+	fail_unless((confs=confs_alloc())!=NULL);
+	fail_unless(!confs_init(confs));
+	fail_unless(!set_int(confs[OPT_MAX_HARDLINKS], 10000));
+	return confs;
+}
+
+static void do_test_uring_recursive(unsigned depth)
+{
+	struct conf **confs;
+
+	setup();
+	confs=setup_confs();
+	fail_unless(!uring_init(depth));
+	build_files(BASE "/src", 100);
+	fail_unless(!recursive_hardlink(BASE "/src", BASE "/dst", confs));
+	fail_unless(links(BASE "/src/9/99")==2);
+	fail_unless(links(BASE "/dst/9/99")==2);
+
+	fail_unless(!recursive_delete(BASE "/dst"));
+	fail_unless(is_dir_lstat(BASE "/dst")<=0);
+	fail_unless(links(BASE "/src/9/99")==1);
+
+	// Already there.
+	fail_unless(!recursive_hardlink(BASE "/src", BASE "/dst", confs));
+	fail_unless(recursive_hardlink(BASE "/src", BASE "/dst", confs)==-1);
+
+	confs_free(&confs);
+	tear_down();
+}
+
+START_TEST(test_uring_recursive_direct)
+{
+	do_test_uring_recursive(0);
+}
+END_TEST
+
+START_TEST(test_uring_recursive)
+{
+	do_test_uring_recursive(64);
+}
+END_TEST
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec-start->tv_sec)
+		+(now.tv_usec-start->tv_usec)/1000000.0;
+}
+
+static void bench(const char *where, const char *base, unsigned depth,
+	struct conf **confs)
+{
+	char *src;
+	char *dst;
+	struct timeval start;
+	double link_time;
+	double delete_time;
+
+	fail_unless((src=prepend_s(base, "src"))!=NULL);
+	fail_unless((dst=prepend_s(base, "dst"))!=NULL);
+	fail_unless(!uring_init(depth));
+
+	gettimeofday(&start, NULL);
+	fail_unless(!recursive_hardlink(src, dst, confs));
+	link_time=elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	fail_unless(!recursive_delete(dst));
+	delete_time=elapsed(&start);
+
+	uring_free();
+	printf("%s, io_uring_depth=%u: %d links in %.3fs, "
+		"%d unlinks in %.3fs\n", where, depth,
+		BENCH_FILES, link_time, BENCH_FILES, delete_time);
+	free_w(&src);
+	free_w(&dst);
+}
+
+static void do_bench(const char *where, const char *base)
+{
+	char *src;
+	struct conf **confs;
+
+	confs=setup_confs();
+	fail_unless(!recursive_delete(base));
+	fail_unless((src=prepend_s(base, "src"))!=NULL);
+	build_files(src, BENCH_FILES);
+	bench(where, base, 0, confs);
+	bench(where, base, 64, confs);
+	bench(where, base, 0, confs);
+	bench(where, base, 64, confs);
+	fail_unless(!recursive_delete(base));
+	free_w(&src);
+	confs_free(&confs);
+}
+
+// Not a pass or fail test, but shows how long shuffling and deleting
+// take, with and without the queueing, on a tmpfs and on whatever disk the
+// tests are running on.
+START_TEST(test_uring_benchmark)
+{
+	setup();
+	if(is_dir_lstat("/dev/shm")>0)
+	{
+		do_bench("tmpfs", SHM_BASE BENCH_DIR);
+		fail_unless(!recursive_delete(SHM_BASE));
+	}
+	do_bench("local disk", BASE "/bench" BENCH_DIR);
+	tear_down();
+}
+END_TEST
+
+Suite *suite_uring(void)
+{
+	Suite *s;
+	TCase *tc_core;
+	TCase *tc_bench;
+
+	s=suite_create("uring");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_uring_ops_direct);
+	tcase_add_test(tc_core, test_uring_ops);
+	tcase_add_test(tc_core, test_uring_ops_depth_1);
+	tcase_add_test(tc_core, test_uring_fork);
+	tcase_add_test(tc_core, test_uring_recursive_direct);
+	tcase_add_test(tc_core, test_uring_recursive);
+	suite_add_tcase(s, tc_core);
+
+	if(BENCHMARKS_WANTED)
+	{
+		tc_bench=tcase_create("Benchmark");
+		tcase_set_timeout(tc_bench, 600);
+		tcase_add_test(tc_bench, test_uring_benchmark);
+		suite_add_tcase(s, tc_bench);
+	}
+
+	return s;
+}